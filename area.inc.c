@@ -21,8 +21,611 @@
  * handlers are currently experiments, their arguments may change.
  */
 #define LUI_AREA "lui_area"
-#define lui_pushArea(L) lui_pushObject(L, LUI_AREA, 1)
-#define lui_checkArea(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_AREA))
+#define lui_pushArea(L) ((lui_areaObject*)lui_pushObjectSized(L, LUI_AREA, 1, sizeof(lui_areaObject)))
+#define lui_checkArea(L, pos) ((lui_areaObject*)luaL_checkudata(L, pos, LUI_AREA))
+
+typedef struct lui_scene lui_scene;
+typedef struct lui_tileSet lui_tileSet;
+
+/* at most this many separate rectangles are kept per area for redrawing */
+#define LUI_AREA_MAXINVAL 8
+
+typedef struct lui_areaObject {
+	void *object;
+	int scrolling;
+	lui_scene *scene;
+	lui_hitIndex *hitindex;
+	int cached;
+	double dirty[4];		/* part of the cache to redraw, x0, y0, x1, y1 */
+	lui_displayList *tilelist;
+	int tilesize;
+	double inval[LUI_AREA_MAXINVAL][4];	/* x0, y0, x1, y1 */
+	int numinval;
+	struct lui_areaObject *nextinval;
+	int invalqueued;
+#ifdef LUI_GTK
+	cairo_surface_t *cache;
+	int cachew, cacheh;
+	lui_tileSet *tiles;
+#endif
+} lui_areaObject;
+
+#ifdef LUI_GTK
+/* libui has no way to get at the cairo context behind a uiDrawContext.
+ * lui_gtkDrawContext mirrors struct uiDrawContext from unix/draw.h of libui
+ * alpha4.1, and only lui_areaCairo() and lui_areaSubContext() may rely on
+ * it. The cairo context is taken from the draw signal of the area widget,
+ * and the mirror is only trusted if it holds the same one, so that a
+ * changed layout makes areas draw directly instead of corrupting memory.
+ */
+typedef struct {
+	cairo_t *cr;
+	GtkStyleContext *style;
+} lui_gtkDrawContext;
+
+/* the cairo context of the area being drawn */
+static cairo_t *lui_areaDrawing = NULL;
+
+static gboolean lui_area_drawBegin(GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+	lui_areaDrawing = cr;
+	return FALSE;
+}
+
+static gboolean lui_area_drawEnd(GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+	lui_areaDrawing = NULL;
+	return FALSE;
+}
+
+/* catch the draw signal of the widget libui draws an area on. libui draws
+ * in the class handler, so lui_area_drawBegin() runs before it. */
+static void lui_area_watchDraw(uiArea *area)
+{
+	/* a scrolling area is a scrolled window with the drawing widget in it,
+	 * maybe in a viewport */
+	GtkWidget *w = GTK_WIDGET(uiControlHandle(uiControl(area)));
+	while (GTK_IS_BIN(w) && gtk_bin_get_child(GTK_BIN(w))) {
+		w = gtk_bin_get_child(GTK_BIN(w));
+	}
+	g_signal_connect(w, "draw", G_CALLBACK(lui_area_drawBegin), NULL);
+	g_signal_connect_after(w, "draw", G_CALLBACK(lui_area_drawEnd), NULL);
+}
+
+/* the cairo context c draws to, or NULL if it is not known */
+static cairo_t *lui_areaCairo(uiDrawContext *c)
+{
+	cairo_t *cr = lui_areaDrawing;
+	return cr && ((lui_gtkDrawContext*) c)->cr == cr ? cr : NULL;
+}
+
+/* make dc a copy of the context c, which lui_areaCairo() knows, drawing to
+ * cr instead. dc is known to lui_areaCairo() until the returned previous
+ * context is restored with lui_areaEndSubContext(). */
+static cairo_t *lui_areaSubContext(lui_gtkDrawContext *dc, uiDrawContext *c, cairo_t *cr)
+{
+	*dc = *(lui_gtkDrawContext*) c;
+	dc->cr = cr;
+	cairo_t *prev = lui_areaDrawing;
+	lui_areaDrawing = cr;
+	return prev;
+}
+
+static void lui_areaEndSubContext(cairo_t *prev)
+{
+	lui_areaDrawing = prev;
+}
+#endif
+
+/* implemented in scene.inc.c */
+static void lui_scene_draw(lui_scene *scene, lui_drawContextObject *ctx);
+static void lui_area_setScene(lua_State *L, lui_areaObject *area, int pos);
+
+/* cached areas larger than this many pixels are drawn directly */
+#define LUI_AREA_MAXCACHE (16 * 1024 * 1024)
+
+/* mark a part of the cache of an area as in need of redrawing */
+static void lui_areaDirty(lui_areaObject *area, double x, double y, double w, double h)
+{
+	double *d = area->dirty;
+	if (d[0] >= d[2] || d[1] >= d[3]) {
+		d[0] = x;
+		d[1] = y;
+		d[2] = x + w;
+		d[3] = y + h;
+		return;
+	}
+	if (x < d[0]) d[0] = x;
+	if (y < d[1]) d[1] = y;
+	if (x + w > d[2]) d[2] = x + w;
+	if (y + h > d[3]) d[3] = y + h;
+}
+
+static void lui_areaDirtyAll(lui_areaObject *area)
+{
+	area->dirty[0] = area->dirty[1] = -HUGE_VAL;
+	area->dirty[2] = area->dirty[3] = HUGE_VAL;
+}
+
+static void lui_areaFreeCache(lui_areaObject *area)
+{
+#ifdef LUI_GTK
+	if (area->cache) {
+		cairo_surface_destroy(area->cache);
+		area->cache = NULL;
+	}
+#endif
+	lui_areaDirtyAll(area);
+}
+
+/* lui_areaQueueRedrawAll
+ *
+ * queue a redraw of the entire area, including its cached content.
+ */
+static void lui_areaQueueRedrawAll(lui_areaObject *area)
+{
+	lui_areaDirtyAll(area);
+	if (area->object) {
+		uiAreaQueueRedrawAll(uiArea(area->object));
+	}
+}
+
+/* lui_areaQueueRedrawRect
+ *
+ * queue a redraw of a part of an area. libui can only redraw whole areas,
+ * so where the platform allows it, the native widget is invalidated
+ * directly. Scrolling areas are always redrawn completely.
+ */
+static void lui_areaQueueRedrawRect(lui_areaObject *area, double x, double y, double w, double h)
+{
+	if (!area->object || w <= 0 || h <= 0) {
+		return;
+	}
+	lui_areaDirty(area, x, y, w, h);
+#if defined(LUI_GTK) || defined(_WIN32)
+	/* stay well within the range of int */
+	double x0 = floor(x), y0 = floor(y), x1 = ceil(x + w), y1 = ceil(y + h);
+	if (!area->scrolling && x0 > -1e6 && y0 > -1e6 && x1 < 1e6 && y1 < 1e6) {
+#ifdef LUI_GTK
+		gtk_widget_queue_draw_area(GTK_WIDGET(uiControlHandle(uiControl(area->object))), x0, y0, x1 - x0, y1 - y0);
+#else
+		RECT r = { x0, y0, x1, y1 };
+		InvalidateRect((HWND) uiControlHandle(uiControl(area->object)), &r, FALSE);
+#endif
+		return;
+	}
+#endif
+	uiAreaQueueRedrawAll(uiArea(area->object));
+}
+
+/* areas with invalidated rectangles, that are redrawn together */
+static lui_areaObject *lui_invalidAreas = NULL;
+static int lui_invalidFlushQueued = 0;
+
+static void lui_areaFlushInvalid(void *data)
+{
+	lui_invalidFlushQueued = 0;
+	while (lui_invalidAreas) {
+		lui_areaObject *area = lui_invalidAreas;
+		lui_invalidAreas = area->nextinval;
+		area->nextinval = NULL;
+		area->invalqueued = 0;
+		for (int i = 0; i < area->numinval; ++i) {
+			double *r = area->inval[i];
+			lui_areaQueueRedrawRect(area, r[0], r[1], r[2] - r[0], r[3] - r[1]);
+		}
+		area->numinval = 0;
+	}
+}
+
+static void lui_areaUnqueueInvalid(lui_areaObject *area)
+{
+	if (area->invalqueued) {
+		lui_areaObject **a = &lui_invalidAreas;
+		while (*a != area) {
+			a = &(*a)->nextinval;
+		}
+		*a = area->nextinval;
+		area->nextinval = NULL;
+		area->invalqueued = 0;
+	}
+	area->numinval = 0;
+}
+
+static void lui_areaUnionRect(double *r, const double *o)
+{
+	if (o[0] < r[0]) r[0] = o[0];
+	if (o[1] < r[1]) r[1] = o[1];
+	if (o[2] > r[2]) r[2] = o[2];
+	if (o[3] > r[3]) r[3] = o[3];
+}
+
+/* lui_areaAddInvalid
+ *
+ * add a rectangle to the region of an area to redraw. Overlapping and
+ * touching rectangles are merged, and if there are too many rectangles,
+ * the new one is merged with the one that grows the least by it. The
+ * region is handed to the native widget once the current event has been
+ * handled.
+ */
+static void lui_areaAddInvalid(lui_areaObject *area, double x, double y, double w, double h)
+{
+	if (!area->object || !(w > 0 && h > 0)) {
+		return;
+	}
+	double r[4] = { x, y, x + w, y + h };
+	for (;;) {
+		int i = 0;
+		while (i < area->numinval) {
+			double *o = area->inval[i];
+			if (o[0] <= r[2] && r[0] <= o[2] && o[1] <= r[3] && r[1] <= o[3]) {
+				lui_areaUnionRect(r, o);
+				memcpy(o, area->inval[--area->numinval], sizeof(r));
+				i = 0;
+			} else {
+				++i;
+			}
+		}
+		if (area->numinval < LUI_AREA_MAXINVAL) {
+			break;
+		}
+		int best = 0;
+		double bestgrowth = HUGE_VAL;
+		for (i = 0; i < area->numinval; ++i) {
+			double u[4], *o = area->inval[i];
+			memcpy(u, r, sizeof(u));
+			lui_areaUnionRect(u, o);
+			double growth = (u[2] - u[0]) * (u[3] - u[1]) - (r[2] - r[0]) * (r[3] - r[1]) - (o[2] - o[0]) * (o[3] - o[1]);
+			if (growth < bestgrowth) {
+				bestgrowth = growth;
+				best = i;
+			}
+		}
+		lui_areaUnionRect(r, area->inval[best]);
+		memcpy(area->inval[best], area->inval[--area->numinval], sizeof(r));
+	}
+	memcpy(area->inval[area->numinval++], r, sizeof(r));
+	if (!area->invalqueued) {
+		area->invalqueued = 1;
+		area->nextinval = lui_invalidAreas;
+		lui_invalidAreas = area;
+	}
+	if (!lui_invalidFlushQueued) {
+		lui_invalidFlushQueued = 1;
+		uiQueueMain(lui_areaFlushInvalid, NULL);
+	}
+}
+
+/* tiled rendering  ********************************************************/
+
+#ifdef LUI_GTK
+
+/* tile grids with more tiles than this are not used */
+#define LUI_AREA_MAXTILES (1024 * 1024)
+
+/* a copy of a display list that worker threads can render from while the
+ * original is changed. ref keeps the paths used alive. */
+typedef struct {
+	lui_displayList *dl;
+	int refcount;
+	int ref;
+} lui_tileSnapshot;
+
+typedef struct {
+	cairo_surface_t *surface;
+	unsigned gen;			/* generation the surface was rendered for */
+	unsigned pendinggen;	/* generation a job is queued for, or 0 */
+} lui_tile;
+
+struct lui_tileSet {
+	lua_State *L;
+	lui_areaObject *area;	/* NULL after the area is gone */
+	lui_displayList *dl;
+	unsigned version;
+	unsigned gen;
+	lui_tileSnapshot *snap;
+	int size, cols, rows;
+	lui_tile *tiles;
+	int pending;
+};
+
+typedef struct {
+	lui_poolJob job;
+	lui_tileSet *set;
+	lui_tileSnapshot *snap;
+	unsigned gen;
+	int tx, ty, size;
+	double scale;
+	cairo_surface_t *surface;
+} lui_tileJob;
+
+static lui_pool *lui_tilePool = NULL;
+
+static void lui_tiles_releaseSnapshot(lua_State *L, lui_tileSnapshot *snap)
+{
+	if (snap && --snap->refcount == 0) {
+		luaL_unref(L, LUA_REGISTRYINDEX, snap->ref);
+		lui_displaylist_free(snap->dl);
+		free(snap);
+	}
+}
+
+/* copy the display list at stack position pos, leaving out text, as text
+ * layouts can not be used from more than one thread. Paths are drawn from
+ * the pieces lui recorded for them, so the copy fails if one of them could
+ * not be recorded completely. */
+static lui_tileSnapshot *lui_tiles_snapshot(lua_State *L, int pos, lui_displayList *src)
+{
+	lui_tileSnapshot *snap = calloc(1, sizeof(lui_tileSnapshot));
+	lui_displayList *dl = calloc(1, sizeof(lui_displayList));
+	if (!snap || !dl) {
+		free(snap);
+		free(dl);
+		return NULL;
+	}
+	snap->dl = dl;
+	snap->refcount = 1;
+	snap->ref = LUA_NOREF;
+	int ok = 1;
+	if (src->numcmds) {
+		ok = ok && (dl->cmds = malloc(src->numcmds * sizeof(lui_dlCommand)));
+		for (int i = 0; ok && i < src->numcmds; ++i) {
+			if (src->cmds[i].path && src->cmds[i].path->incomplete) {
+				ok = 0;
+			} else if (src->cmds[i].op != LUI_DL_TEXT) {
+				dl->cmds[dl->numcmds++] = src->cmds[i];
+			}
+		}
+	}
+	if (ok && src->numbrushes) {
+		ok = (dl->brushes = malloc(src->numbrushes * sizeof(uiDrawBrush))) != NULL;
+		for (int i = 0; ok && i < src->numbrushes; ++i) {
+			ok = lui_drawbrush_copy(&dl->brushes[i], &src->brushes[i]);
+			dl->numbrushes += ok;
+		}
+	}
+	if (ok && src->numparams) {
+		ok = (dl->params = malloc(src->numparams * sizeof(uiDrawStrokeParams))) != NULL;
+		for (int i = 0; ok && i < src->numparams; ++i) {
+			ok = lui_drawstrokeparams_copy(&dl->params[i], &src->params[i]);
+			dl->numparams += ok;
+		}
+	}
+	if (ok && src->nummatrices) {
+		ok = (dl->matrices = malloc(src->nummatrices * sizeof(uiDrawMatrix))) != NULL;
+		if (ok) {
+			memcpy(dl->matrices, src->matrices, src->nummatrices * sizeof(uiDrawMatrix));
+			dl->nummatrices = src->nummatrices;
+		}
+	}
+	if (!ok) {
+		lui_displaylist_free(dl);
+		free(snap);
+		return NULL;
+	}
+	/* the list references its paths from its uservalue. clear() replaces
+	 * that table, so holding on to it keeps the paths of this copy. */
+	lua_getuservalue(L, pos);
+	snap->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	return snap;
+}
+
+static void lui_tiles_freeTiles(lui_tileSet *set)
+{
+	for (int i = 0; i < set->cols * set->rows; ++i) {
+		if (set->tiles[i].surface) {
+			cairo_surface_destroy(set->tiles[i].surface);
+		}
+	}
+	free(set->tiles);
+	set->tiles = NULL;
+	set->cols = set->rows = 0;
+}
+
+static void lui_tiles_freeSet(lui_tileSet *set)
+{
+	lui_tiles_freeTiles(set);
+	lui_tiles_releaseSnapshot(set->L, set->snap);
+	free(set);
+}
+
+/* detach a tile set from its area. It is freed when the last of its jobs
+ * is done. */
+static void lui_tiles_detach(lui_areaObject *area)
+{
+	lui_tileSet *set = area->tiles;
+	if (!set) {
+		return;
+	}
+	area->tiles = NULL;
+	set->area = NULL;
+	if (set->pending == 0) {
+		lui_tiles_freeSet(set);
+	} else {
+		lui_tiles_freeTiles(set);
+	}
+}
+
+/* make the tile grid cover cols x rows tiles, keeping what is there */
+static int lui_tiles_resize(lui_tileSet *set, int cols, int rows)
+{
+	if (cols == set->cols && rows == set->rows) {
+		return 1;
+	}
+	lui_tile *tiles = calloc((size_t) cols * rows, sizeof(lui_tile));
+	if (!tiles) {
+		return 0;
+	}
+	for (int ty = 0; ty < set->rows; ++ty) {
+		for (int tx = 0; tx < set->cols; ++tx) {
+			lui_tile *t = &set->tiles[ty * set->cols + tx];
+			if (tx < cols && ty < rows) {
+				tiles[ty * cols + tx] = *t;
+			} else if (t->surface) {
+				cairo_surface_destroy(t->surface);
+			}
+		}
+	}
+	free(set->tiles);
+	set->tiles = tiles;
+	set->cols = cols;
+	set->rows = rows;
+	return 1;
+}
+
+static void lui_tiles_run(lui_poolJob *pjob, void *threaddata)
+{
+	lui_tileJob *job = (lui_tileJob*) pjob;
+	double x = job->tx * job->size, y = job->ty * job->size;
+	int px = ceil(job->size * job->scale);
+	cairo_surface_t *s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, px, px);
+	if (cairo_surface_status(s) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(s);
+		return;
+	}
+	cairo_surface_set_device_scale(s, job->scale, job->scale);
+	cairo_t *cr = cairo_create(s);
+	cairo_translate(cr, -x, -y);
+	lui_drawContextObject ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	/* the context only tracks transformations, nothing is drawn through it */
+	lui_drawcontext_begin(&ctx, NULL, x, y, job->size, job->size);
+	lui_displaylist_playCairo(cr, &ctx, job->snap->dl);
+	free(ctx.stack);
+	cairo_destroy(cr);
+	cairo_surface_flush(s);
+	job->surface = s;
+}
+
+static void lui_tiles_done(lui_poolJob *pjob)
+{
+	lui_tileJob *job = (lui_tileJob*) pjob;
+	lui_tileSet *set = job->set;
+	set->pending -= 1;
+	if (set->area && job->tx < set->cols && job->ty < set->rows) {
+		lui_tile *t = &set->tiles[job->ty * set->cols + job->tx];
+		if (t->pendinggen == job->gen) {
+			t->pendinggen = 0;
+		}
+		if (job->surface && job->gen == set->gen) {
+			if (t->surface) {
+				cairo_surface_destroy(t->surface);
+			}
+			t->surface = job->surface;
+			t->gen = job->gen;
+			job->surface = NULL;
+			lui_areaQueueRedrawRect(set->area, job->tx * job->size, job->ty * job->size, job->size, job->size);
+		}
+	}
+	if (job->surface) {
+		cairo_surface_destroy(job->surface);
+	}
+	lui_tiles_releaseSnapshot(set->L, job->snap);
+	if (!set->area && set->pending == 0) {
+		lui_tiles_freeSet(set);
+	}
+	free(job);
+}
+
+/* lui_tiles_draw
+ *
+ * draw the tiles of an area that intersect the clip rectangle, and queue
+ * jobs for those that are missing or out of date. Until a tile is
+ * rendered, its previous content, if any, is drawn. obj is the stack
+ * position of the area. Returns 0 if the area can not be tiled, in which
+ * case the display list must be drawn directly.
+ */
+static int lui_tiles_draw(lua_State *L, int obj, lui_areaObject *area, cairo_t *cr, double x, double y, double w, double h, double areaw, double areah)
+{
+	int size = area->tilesize;
+	double cols = ceil(areaw / size), rows = ceil(areah / size);
+	if (cols < 1 || rows < 1 || cols * rows > LUI_AREA_MAXTILES) {
+		return 0;
+	}
+	if (!lui_tilePool) {
+		lui_tilePool = lui_poolNew(0, NULL, NULL);
+		if (!lui_tilePool) {
+			return 0;
+		}
+	}
+	if (lui_tilePool->numthreads == 0) {
+		return 0;
+	}
+	lui_tileSet *set = area->tiles;
+	if (set && set->size != size) {
+		lui_tiles_detach(area);
+		set = NULL;
+	}
+	if (!set) {
+		set = calloc(1, sizeof(lui_tileSet));
+		if (!set) {
+			return 0;
+		}
+		set->L = L;
+		set->area = area;
+		set->size = size;
+		area->tiles = set;
+	}
+	if (!lui_tiles_resize(set, cols, rows)) {
+		return 0;
+	}
+	if (!set->snap || set->dl != area->tilelist || set->version != area->tilelist->version) {
+		lui_aux_getUservalue(L, obj, "tiles");
+		lui_tileSnapshot *snap = lui_tiles_snapshot(L, lua_gettop(L), area->tilelist);
+		lua_pop(L, 1);
+		if (!snap) {
+			return 0;
+		}
+		lui_tiles_releaseSnapshot(L, set->snap);
+		set->snap = snap;
+		set->dl = area->tilelist;
+		set->version = area->tilelist->version;
+		set->gen += 1;
+	}
+
+	double scale = 1, sy;
+	cairo_surface_get_device_scale(cairo_get_target(cr), &scale, &sy);
+	int tx0 = floor(x / size), ty0 = floor(y / size);
+	int tx1 = ceil((x + w) / size), ty1 = ceil((y + h) / size);
+	if (tx0 < 0) tx0 = 0;
+	if (ty0 < 0) ty0 = 0;
+	if (tx1 > set->cols) tx1 = set->cols;
+	if (ty1 > set->rows) ty1 = set->rows;
+	for (int ty = ty0; ty < ty1; ++ty) {
+		for (int tx = tx0; tx < tx1; ++tx) {
+			lui_tile *t = &set->tiles[ty * set->cols + tx];
+			if (t->gen != set->gen && t->pendinggen != set->gen) {
+				lui_tileJob *job = calloc(1, sizeof(lui_tileJob));
+				if (job) {
+					job->job.run = lui_tiles_run;
+					job->job.done = lui_tiles_done;
+					job->set = set;
+					job->snap = set->snap;
+					job->gen = set->gen;
+					job->tx = tx;
+					job->ty = ty;
+					job->size = size;
+					job->scale = scale;
+					set->snap->refcount += 1;
+					set->pending += 1;
+					t->pendinggen = set->gen;
+					/* the tiles exposed last are the most relevant */
+					lui_poolSubmit(lui_tilePool, &job->job, 1);
+				}
+			}
+			if (t->surface) {
+				cairo_save(cr);
+				cairo_set_source_surface(cr, t->surface, tx * size, ty * size);
+				cairo_rectangle(cr, tx * size, ty * size, size, size);
+				cairo_fill(cr);
+				cairo_restore(cr);
+			}
+		}
+	}
+	return 1;
+}
+
+#endif
 
 /*** Property
  * Object: area
@@ -31,7 +634,19 @@
  * called when the area needs redrawing. area is the area this handler is
  * called for. context is a draw.context object for this area. x, y, w, h are
  * the position and size of the rectangle within the area to redraw. areaw,
- * areah are the full width and height of the area.
+ * areah are the full width and height of the area. The context object is
+ * the same for each call, but it may only be used while ondraw runs. If
+ * drawparams is set, the handler is called as
+ * <code>ondraw(area, context, params)</code> instead.
+ *** Property
+ * Object: area
+ * Name: drawparams
+ * if set to true, or to a table, ondraw is passed a table with the fields
+ * x, y, w, h, areaw, areah, with the same meaning as the respective ondraw
+ * arguments, instead of the individual values. The same table is updated
+ * and passed for every call, so drawing does not create any garbage. When
+ * read, returns this table, or nil. Set to nil or false to go back to the
+ * default.
  *** Property
  * Object: area
  * Name: onmouse
@@ -43,7 +658,9 @@
  * is 0 for the "move" event. x, y is the position within the area, where the
  * event occurred. count is a counter for mouse clicks. It can be used to
  * determine whether a click is a double click. modifiers are the modifier
- * keys. areaw, areah are the full width and height of the area.
+ * keys. areaw, areah are the full width and height of the area. If the
+ * hitindex property is set, the id of the topmost rectangle in it at x, y,
+ * or nil, is passed as an additional argument id after areah.
  *** Property
  * Object: area
  * Name: onkey
@@ -54,6 +671,42 @@
  * currently active modifiers, the names of which can be found in
  * lui.enum.keymod. So, in order to determine of a modifier is active, you
  * check for it using for example <code>modifier | lui.enum.keymod.shift</code>.
+ *** Property
+ * Object: area
+ * Name: scene
+ * a draw.scene to display in the area. The nodes of the scene are drawn
+ * before ondraw is called, and changes to them only cause the parts of the
+ * area they cover to be redrawn. A scene can only be displayed by one area
+ * at a time. Set to nil to remove the scene.
+ *** Property
+ * Object: area
+ * Name: hitindex
+ * a hitindex to look up mouse positions in for the onmouse handler. A
+ * hitindex may be shared by several areas. Set to nil to remove it.
+ *** Property
+ * Object: area
+ * Name: cached
+ * if set to true, what the area draws is kept in an offscreen image, and
+ * when parts of the area are uncovered, they are copied from there instead
+ * of calling ondraw again. ondraw is only called when the size of the area
+ * changes, after area:forceredraw(), or for the parts of the area that
+ * changed in the scene. This is only supported on GTK, elsewhere ondraw is
+ * called for every redraw. Default is false.
+ *** Property
+ * Object: area
+ * Name: tiles
+ * a draw.displaylist that is drawn before the scene and ondraw. On GTK,
+ * the list is rendered in tiles of tilesize x tilesize pixels by worker
+ * threads, and each tile is drawn as soon as it is ready. Until then, the
+ * previous content of the tile is shown. Text recorded in the list is not
+ * drawn this way, so text should be drawn in ondraw. Changes to the list
+ * are picked up on the next redraw. Elsewhere, the list is drawn directly.
+ * Set to nil to remove the list.
+ *** Property
+ * Object: area
+ * Name: tilesize
+ * the size of the tiles the tiles display list is rendered in. Default is
+ * 256.
  *** Property_undocumented
  * Object: area
  * Name: ondragbroken
@@ -73,6 +726,22 @@ static int lui_area__index(lua_State *L)
 		lui_objectGetHandler(L, "onkey");
 	} else if (strcmp(what, "ondragbroken") == 0) {
 		lui_objectGetHandler(L, "ondragbroken");
+	} else if (strcmp(what, "drawparams") == 0) {
+		lui_aux_getUservalue(L, 1, "drawparams");
+	} else if (strcmp(what, "scene") == 0) {
+		if (lui_checkArea(L, 1)->scene) {
+			lui_aux_getUservalue(L, 1, "scene");
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strcmp(what, "hitindex") == 0) {
+		lui_aux_getUservalue(L, 1, "hitindex");
+	} else if (strcmp(what, "cached") == 0) {
+		lua_pushboolean(L, lui_checkArea(L, 1)->cached);
+	} else if (strcmp(what, "tiles") == 0) {
+		lui_aux_getUservalue(L, 1, "tiles");
+	} else if (strcmp(what, "tilesize") == 0) {
+		lua_pushinteger(L, lui_checkArea(L, 1)->tilesize);
 	} else {
 		return lui_control__index(L);
 	}
@@ -81,17 +750,57 @@ static int lui_area__index(lua_State *L)
 
 static int lui_area__newindex(lua_State *L)
 {
-	(void) lui_checkArea(L, 1);
+	lui_areaObject *aobj = lui_checkArea(L, 1);
 	const char *what = luaL_checkstring(L, 2);
 
 	if (strcmp(what, "ondraw") == 0) {
 		lui_objectSetHandler(L, "ondraw", 3);
+		lui_areaDirtyAll(aobj);
 	} else if (strcmp(what, "onmouse") == 0) {
 		lui_objectSetHandler(L, "onmouse", 3);
 	} else if (strcmp(what, "onkey") == 0) {
 		lui_objectSetHandler(L, "onkey", 3);
 	} else if (strcmp(what, "ondragbroken") == 0) {
 		lui_objectSetHandler(L, "ondragbroken", 3);
+	} else if (strcmp(what, "drawparams") == 0) {
+		if (lua_type(L, 3) == LUA_TTABLE) {
+			lui_aux_setUservalue(L, 1, "drawparams", 3);
+		} else if (lua_toboolean(L, 3)) {
+			lua_createtable(L, 0, 6);
+			lui_aux_setUservalue(L, 1, "drawparams", -1);
+		} else {
+			lui_aux_clearUservalue(L, 1, "drawparams");
+		}
+	} else if (strcmp(what, "scene") == 0) {
+		lui_area_setScene(L, aobj, 3);
+	} else if (strcmp(what, "hitindex") == 0) {
+		if (lua_isnil(L, 3)) {
+			aobj->hitindex = NULL;
+			lui_aux_clearUservalue(L, 1, "hitindex");
+		} else {
+			aobj->hitindex = (lui_hitIndex*) lui_checkHitIndex(L, 3)->object;
+			lui_aux_setUservalue(L, 1, "hitindex", 3);
+		}
+	} else if (strcmp(what, "cached") == 0) {
+		aobj->cached = lua_toboolean(L, 3);
+		lui_areaFreeCache(aobj);
+	} else if (strcmp(what, "tiles") == 0) {
+		if (lua_isnil(L, 3)) {
+			aobj->tilelist = NULL;
+			lui_aux_clearUservalue(L, 1, "tiles");
+		} else {
+			aobj->tilelist = (lui_displayList*) lui_checkDrawDisplayList(L, 3)->object;
+			lui_aux_setUservalue(L, 1, "tiles", 3);
+		}
+#ifdef LUI_GTK
+		lui_tiles_detach(aobj);
+#endif
+		lui_areaQueueRedrawAll(aobj);
+	} else if (strcmp(what, "tilesize") == 0) {
+		int size = luaL_checkinteger(L, 3);
+		luaL_argcheck(L, size >= 16 && size <= 4096, 3, "tilesize must be between 16 and 4096");
+		aobj->tilesize = size;
+		lui_areaQueueRedrawAll(aobj);
 	} else {
 		return lui_control__newindex(L);
 	}
@@ -104,18 +813,148 @@ typedef struct {
 } lui_areaHandler;
 #define lui_areaHandler(this) ((lui_areaHandler *)(this))
 
+static void lui_areaSetParam(lua_State *L, int tbl, const char *name, double value)
+{
+	lua_pushnumber(L, value);
+	lua_setfield(L, tbl, name);
+}
+
+/* draw the scene and call ondraw for the clip rectangle x, y, w, h. obj is
+ * the stack position of the area, ctxpos that of its draw.context. */
+static void lui_areaRender(lua_State *L, int obj, int ctxpos, uiDrawContext *c, double x, double y, double w, double h, double areaw, double areah)
+{
+	int top = lua_gettop(L);
+	lui_drawContextObject *ctx = (lui_drawContextObject*) lua_touserdata(L, ctxpos);
+	lui_drawcontext_begin(ctx, c, x, y, w, h);
+	lui_areaObject *aobj = (lui_areaObject*) lua_touserdata(L, obj);
+	if (aobj->tilelist) {
+#ifdef LUI_GTK
+		cairo_t *cr = lui_areaCairo(c);
+		if (!cr || !lui_tiles_draw(L, obj, aobj, cr, x, y, w, h, areaw, areah)) {
+			lui_displaylist_play(ctx, aobj->tilelist);
+		}
+#else
+		lui_displaylist_play(ctx, aobj->tilelist);
+#endif
+	}
+	if (aobj->scene) {
+		lui_scene_draw(aobj->scene, ctx);
+	}
+
+	lua_pushvalue(L, ctxpos);
+	int narg = 2;
+	if (lui_aux_getUservalue(L, obj, "drawparams") == LUA_TTABLE) {
+		int tbl = lua_gettop(L);
+		lui_areaSetParam(L, tbl, "x", x);
+		lui_areaSetParam(L, tbl, "y", y);
+		lui_areaSetParam(L, tbl, "w", w);
+		lui_areaSetParam(L, tbl, "h", h);
+		lui_areaSetParam(L, tbl, "areaw", areaw);
+		lui_areaSetParam(L, tbl, "areah", areah);
+	} else {
+		lua_pop(L, 1);
+		lua_pushnumber(L, x);
+		lua_pushnumber(L, y);
+		lua_pushnumber(L, w);
+		lua_pushnumber(L, h);
+		lua_pushnumber(L, areaw);
+		lua_pushnumber(L, areah);
+		narg = 7;
+	}
+	lui_objectHandlerCallback(L, uiControl(aobj->object), "ondraw", top + 1, narg, 0);
+	lua_settop(L, top);
+}
+
+#ifdef LUI_GTK
+/* lui_areaDrawCached
+ *
+ * redraw the dirty part of the cache of an area, and copy the clip
+ * rectangle from the cache to the area. Returns 0 if the area can not be
+ * cached, in which case it must be drawn directly.
+ */
+static int lui_areaDrawCached(lua_State *L, int obj, int ctxpos, lui_areaObject *aobj, uiAreaDrawParams *params)
+{
+	int w = ceil(params->AreaWidth), h = ceil(params->AreaHeight);
+	if (w <= 0 || h <= 0 || (double) w * h > LUI_AREA_MAXCACHE) {
+		lui_areaFreeCache(aobj);
+		return 0;
+	}
+	cairo_t *target = lui_areaCairo(params->Context);
+	if (!target) {
+		lui_areaFreeCache(aobj);
+		return 0;
+	}
+	if (!aobj->cache || aobj->cachew != w || aobj->cacheh != h) {
+		lui_areaFreeCache(aobj);
+		/* a similar surface has the device scale of the window */
+		aobj->cache = cairo_surface_create_similar(cairo_get_target(target), CAIRO_CONTENT_COLOR_ALPHA, w, h);
+		if (cairo_surface_status(aobj->cache) != CAIRO_STATUS_SUCCESS) {
+			lui_areaFreeCache(aobj);
+			return 0;
+		}
+		aobj->cachew = w;
+		aobj->cacheh = h;
+	}
+
+	double *d = aobj->dirty;
+	double x0 = d[0] > 0 ? floor(d[0]) : 0, y0 = d[1] > 0 ? floor(d[1]) : 0;
+	double x1 = d[2] < w ? ceil(d[2]) : w, y1 = d[3] < h ? ceil(d[3]) : h;
+	/* anything invalidated while ondraw runs is drawn next time */
+	d[0] = d[1] = d[2] = d[3] = 0;
+	if (x0 < x1 && y0 < y1) {
+		cairo_t *cr = cairo_create(aobj->cache);
+		cairo_rectangle(cr, x0, y0, x1 - x0, y1 - y0);
+		cairo_clip(cr);
+		cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(cr);
+		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+		lui_gtkDrawContext cdc;
+		cairo_t *prev = lui_areaSubContext(&cdc, params->Context, cr);
+		lui_areaRender(L, obj, ctxpos, (uiDrawContext*) &cdc, x0, y0, x1 - x0, y1 - y0, params->AreaWidth, params->AreaHeight);
+		lui_areaEndSubContext(prev);
+		cairo_destroy(cr);
+	}
+
+	cairo_save(target);
+	cairo_rectangle(target, params->ClipX, params->ClipY, params->ClipWidth, params->ClipHeight);
+	cairo_clip(target);
+	cairo_set_source_surface(target, aobj->cache, 0, 0);
+	cairo_paint(target);
+	cairo_restore(target);
+	return 1;
+}
+#endif
+
 static void lui_areaDrawCallback(uiAreaHandler *ah, uiArea *area, uiAreaDrawParams *params)
 {
 	lua_State *L = lui_areaHandler(ah)->L;
 	int top = lua_gettop(L);
-	lui_wrapDrawcontext(L, params->Context);
-	lua_pushnumber(L, params->ClipX);
-	lua_pushnumber(L, params->ClipY);
-	lua_pushnumber(L, params->ClipWidth);
-	lua_pushnumber(L, params->ClipHeight);
-	lua_pushnumber(L, params->AreaWidth);
-	lua_pushnumber(L, params->AreaHeight);
-	lui_objectHandlerCallback(L, uiControl(area), "ondraw", top + 1, 7, 0);
+	if (lui_findObject(L, uiControl(area)) == LUA_TNIL) {
+		lua_settop(L, top);
+		return;
+	}
+	int obj = top + 1;
+	lui_areaObject *aobj = (lui_areaObject*) lua_touserdata(L, obj);
+
+	/* the context wrapper is created once per area, and the context
+	 * pointer is only set for the duration of the callback. */
+	if (lui_aux_getUservalue(L, obj, "drawcontext") == LUA_TNIL) {
+		lua_pop(L, 1);
+		lui_pushDrawContext(L);
+		lui_aux_setUservalue(L, obj, "drawcontext", -1);
+	}
+	lui_drawContextObject *ctx = (lui_drawContextObject*) lua_touserdata(L, -1);
+	void *prev = ctx->object;
+
+#ifdef LUI_GTK
+	if (aobj->cached && lui_areaDrawCached(L, obj, obj + 1, aobj, params)) {
+		ctx->object = prev;
+		lua_settop(L, top);
+		return;
+	}
+#endif
+	lui_areaRender(L, obj, obj + 1, params->Context, params->ClipX, params->ClipY, params->ClipWidth, params->ClipHeight, params->AreaWidth, params->AreaHeight);
+	ctx->object = prev;
 	lua_settop(L, top);
 }
 
@@ -139,7 +978,18 @@ static void lui_areaMouseEventCallback(uiAreaHandler *ah, uiArea *area, uiAreaMo
 	lua_pushinteger(L, evt->Modifiers);
 	lua_pushnumber(L, evt->AreaWidth);
 	lua_pushnumber(L, evt->AreaHeight);
-	lui_objectHandlerCallback(L, uiControl(area), "onmouse", top + 1, 8, 0);
+	int narg = 8;
+	if (lui_findObject(L, uiControl(area)) != LUA_TNIL) {
+		lui_areaObject *aobj = (lui_areaObject*) lua_touserdata(L, -1);
+		if (aobj->hitindex) {
+			lui_aux_getUservalue(L, -1, "hitindex");
+			lui_hitindex_pushId(L, -1, lui_hitindex_hit(aobj->hitindex, evt->X, evt->Y));
+			lua_replace(L, top + 9);
+			narg = 9;
+		}
+	}
+	lua_settop(L, top + narg);
+	lui_objectHandlerCallback(L, uiControl(area), "onmouse", top + 1, narg, 0);
 	lua_settop(L, top);
 }
 
@@ -266,6 +1116,20 @@ static int luiMakeWindowEdgeEnum(lua_State *L)
 	return 1;
 }
 
+static int lui_area__gc(lua_State *L)
+{
+	lui_areaObject *aobj = lui_checkArea(L, 1);
+	if (aobj->scene) {
+		lui_area_setScene(L, aobj, 0);
+	}
+	lui_areaFreeCache(aobj);
+	lui_areaUnqueueInvalid(aobj);
+#ifdef LUI_GTK
+	lui_tiles_detach(aobj);
+#endif
+	return lui_control__gc(L);
+}
+
 /* L will be filled when the commonAreaHandler is first used. */
 static lui_areaHandler lui_commonAreaHandler = {
 	.H.Draw = lui_areaDrawCallback,
@@ -284,7 +1148,7 @@ static lui_areaHandler lui_commonAreaHandler = {
  */
 static int lui_areaSetSize(lua_State *L)
 {
-	lui_object *lobj = lui_checkArea(L, 1);
+	lui_areaObject *lobj = lui_checkArea(L, 1);
 	int width = luaL_checkinteger(L, 2);
 	int height = luaL_checkinteger(L, 3);
 	uiAreaSetSize(uiArea(lobj->object), width, height);
@@ -299,8 +1163,34 @@ static int lui_areaSetSize(lua_State *L)
  */
 static int lui_areaForceRedraw(lua_State *L)
 {
-	lui_object *lobj = lui_checkArea(L, 1);
-	uiAreaQueueRedrawAll(uiArea(lobj->object));
+	lui_areaObject *lobj = lui_checkArea(L, 1);
+	lui_areaQueueRedrawAll(lobj);
+	return 0;
+}
+
+/*** Method
+ * Object: area
+ * Name: invalidate
+ * Signature: area:invalidate(x = nil, y = nil, w = nil, h = nil)
+ * queue a redraw of the rectangle x, y, w, h of the area, or of the entire
+ * area if called without arguments. Rectangles invalidated while handling
+ * the same event are merged where they overlap, so ondraw is called for
+ * as small a region as possible. On macOS and for scrolling areas, the
+ * entire area is redrawn.
+ */
+static int lui_areaInvalidate(lua_State *L)
+{
+	lui_areaObject *lobj = lui_checkArea(L, 1);
+	if (lua_isnoneornil(L, 2)) {
+		lui_areaUnqueueInvalid(lobj);
+		lui_areaQueueRedrawAll(lobj);
+		return 0;
+	}
+	double x = luaL_checknumber(L, 2);
+	double y = luaL_checknumber(L, 3);
+	double width = luaL_checknumber(L, 4);
+	double height = luaL_checknumber(L, 5);
+	lui_areaAddInvalid(lobj, x, y, width, height);
 	return 0;
 }
 
@@ -312,7 +1202,7 @@ static int lui_areaForceRedraw(lua_State *L)
  */
 static int lui_areaScrollTo(lua_State *L)
 {
-	lui_object *lobj = lui_checkArea(L, 1);
+	lui_areaObject *lobj = lui_checkArea(L, 1);
 	double x = luaL_checknumber(L, 2);
 	double y = luaL_checknumber(L, 3);
 	double width = luaL_checknumber(L, 4);
@@ -329,7 +1219,7 @@ static int lui_areaScrollTo(lua_State *L)
  */
 static int lui_areaBeginUserWindowMove(lua_State *L)
 {
-	lui_object *lobj = lui_checkArea(L, 1);
+	lui_areaObject *lobj = lui_checkArea(L, 1);
 	uiAreaBeginUserWindowMove(uiArea(lobj->object));
 	return 0;
 }
@@ -343,7 +1233,7 @@ static int lui_areaBeginUserWindowMove(lua_State *L)
  */
 static int lui_areaBeginUserWindowResize(lua_State *L)
 {
-	lui_object *lobj = lui_checkArea(L, 1);
+	lui_areaObject *lobj = lui_checkArea(L, 1);
 	int edge = lui_aux_getNumberOrValue(L, 2, "lui_enumwinedge");
 	uiAreaBeginUserWindowResize(uiArea(lobj->object), edge);
 	return 0;
@@ -364,12 +1254,17 @@ static int lui_newArea(lua_State *L)
 	int height = luaL_optinteger(L, 2, 0);
 	int hastable = lui_aux_istable(L, 3);
 
-	lui_object *lobj = lui_pushArea(L);
+	lui_areaObject *lobj = lui_pushArea(L);
+	lobj->tilesize = 256;
 	if (width == 0 && height == 0) {
 		lobj->object = uiNewArea(uiAreaHandler(&lui_commonAreaHandler));
 	} else {
 		lobj->object = uiNewScrollingArea(uiAreaHandler(&lui_commonAreaHandler), width, height);
+		lobj->scrolling = 1;
 	}
+#ifdef LUI_GTK
+	lui_area_watchDraw(lobj->object);
+#endif
 	if (hastable) { lui_aux_setFieldsFromTable(L, lua_gettop(L), 3); }
 	lui_registerObject(L, lua_gettop(L));
 	return 1;
@@ -377,6 +1272,7 @@ static int lui_newArea(lua_State *L)
 
 /* metamethods for areas */
 static const luaL_Reg lui_area_meta[] = {
+	{"__gc", lui_area__gc},
 	{"__index", lui_area__index},
 	{"__newindex", lui_area__newindex},
 	{0, 0}
@@ -386,6 +1282,7 @@ static const luaL_Reg lui_area_meta[] = {
 static const struct luaL_Reg lui_area_methods [] = {
 	{"setsize", lui_areaSetSize},
 	{"forceredraw", lui_areaForceRedraw},
+	{"invalidate", lui_areaInvalidate},
 	{"scrollto", lui_areaScrollTo},
 	{"beginuserwindowmove", lui_areaBeginUserWindowMove},
 	{"beginuserwindowresize", lui_areaBeginUserWindowResize},
@@ -495,7 +1392,8 @@ static const luaL_Reg lui_fontbutton_meta[] = {
  * Object: colorbutton
  * Name: color
  * a table with r, g, b, a fields with values set to the currently selected
- * color. Defaults to 0 for each of r, g, b, a.
+ * color. Defaults to 0 for each of r, g, b, a. Returned as a packed integer
+ * if so selected with lui.colorformat(), and may be set to any color value.
  *** Property
  * Object: colorbutton
  * Name: onchanged
@@ -510,7 +1408,7 @@ static int lui_colorbutton__index(lua_State *L)
 	if (strcmp(what, "color") == 0) {
 		double r, g, b, a;
 		uiColorButtonColor(uiColorButton(lobj->object), &r, &g, &b, &a);
-		lui_aux_pushRgbaAsTable(L, r, g, b, a);
+		lui_aux_pushRgba(L, r, g, b, a);
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectGetHandler(L, "onchanged");
 	} else {
@@ -526,7 +1424,7 @@ static int lui_colorbutton__newindex(lua_State *L)
 
 	if (strcmp(what, "color") == 0) {
 		double r, g, b, a;
-		lui_aux_rgbaFromTable(L, 3, &r, &g, &b, &a);
+		lui_aux_rgbaFromValue(L, 3, &r, &g, &b, &a);
 		uiColorButtonSetColor(uiColorButton(lobj->object), r, g, b, a);
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectSetHandler(L, "onchanged", 3);
@@ -0,0 +1,254 @@
+/* tablemodel.c
+ *
+ * throughput benchmark for the table model bindings in table.inc.c
+ *
+ * Released under MIT/X11 license. See file LICENSE for details.
+ *
+ * This drives the uiTableModelHandler callbacks directly, the way a table
+ * control would when it is scrolled, without ever creating a window, so it
+ * can run headless. For each model size, a lua backed model and a native
+ * (snapshot) backed model with the same contents are measured. Reported are
+ * cells per second, lua allocations per cell and the p50 / p99 latency for
+ * serving one visible page of cells.
+ *
+ * usage: tablemodel [rows ...]
+ */
+
+#include "../lui.c"
+
+#include "lualib.h"
+
+#define BENCH_PAGEROWS 40
+#define BENCH_MAXPAGES 2000
+#define BENCH_SETS 20000
+
+#ifdef LUI_GTK
+/* libui tracks its allocations in a list that is normally set up by
+ * uiInit(), which can not be called without a display. */
+void uiprivInitAlloc(void);
+#endif
+
+typedef struct {
+	size_t allocs;
+	size_t bytes;
+} bench_allocstats;
+
+static void *bench_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	bench_allocstats *stats = (bench_allocstats*) ud;
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+	if (!ptr) {
+		stats->allocs += 1;
+		stats->bytes += nsize;
+	}
+	return realloc(ptr, nsize);
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_cmpdouble(const void *a, const void *b)
+{
+	double da = *(const double*) a, db = *(const double*) b;
+	return da < db ? -1 : da > db;
+}
+
+/* synthetic lua model with mixed column types. Cell contents are computed
+ * from the row number, so that large models need no memory. Edits are kept
+ * in a sparse table.
+ */
+static const char *bench_luamodel =
+	"local rows = ...\n"
+	"local names = {}\n"
+	"for i = 1, 64 do names[i] = 'item ' .. i end\n"
+	"local colors = { {r = 1, g = 0, b = 0}, {r = 0, g = 1, b = 0}, {r = 0, g = 0, b = 1, a = 0.5} }\n"
+	"local types = { 'integer', 'string', 'boolean', 'color', 'string' }\n"
+	"local edits = {}\n"
+	"return lui.tablemodel {\n"
+	"	numcolumns = function() return #types end,\n"
+	"	numrows = function() return rows end,\n"
+	"	columntype = function(col) return types[col + 1] end,\n"
+	"	cellvalue = function(row, col)\n"
+	"		local e = edits[row * 8 + col]\n"
+	"		if e ~= nil then return e end\n"
+	"		if col == 0 then return row\n"
+	"		elseif col == 1 then return names[row % 64 + 1]\n"
+	"		elseif col == 2 then return row % 3 == 0\n"
+	"		elseif col == 3 then return colors[row % 3 + 1]\n"
+	"		else return row * 0.5 end\n"
+	"	end,\n"
+	"	setcellvalue = function(row, col, val) edits[row * 8 + col] = val end,\n"
+	"}\n";
+
+/* return the model handler for the tablemodel at index idx. The handlers
+ * for lua backed models only use their lua_State, so a shared one will do.
+ */
+static uiTableModelHandler *bench_handler(lua_State *L, int idx, struct myUiTableModelHandler *luah)
+{
+	uiTableModelHandler *tmh = &luah->handler;
+	if (lui_aux_getUservalue(L, idx, "snapshot") == LUA_TUSERDATA) {
+		tmh = (uiTableModelHandler*) ((lui_object*) lua_touserdata(L, -1))->object;
+	}
+	lua_pop(L, 1);
+	return tmh;
+}
+
+static void bench_run(lua_State *L, bench_allocstats *stats, const char *source, int idx)
+{
+	struct myUiTableModelHandler luah;
+	luah.handler.NumColumns = lui_tablemodelhandler_numcolumns;
+	luah.handler.ColumnType = lui_tablemodelhandler_columntype;
+	luah.handler.NumRows = lui_tablemodelhandler_numrows;
+	luah.handler.CellValue = lui_tablemodelhandler_cellvalue;
+	luah.handler.SetCellValue = lui_tablemodelhandler_setcellvalue;
+	luah.L = L;
+	uiTableModelHandler *tmh = bench_handler(L, idx, &luah);
+	uiTableModel *tm = uiTableModel(lui_toObject(L, idx)->object);
+	int numcolumns = tmh->NumColumns(tmh, tm);
+	int numrows = tmh->NumRows(tmh, tm);
+	for (int col = 0; col < numcolumns; ++col) {
+		tmh->ColumnType(tmh, tm, col);
+	}
+
+	/* the first half of the pages is scrolled through from the top, the
+	 * other half are random jumps into the model. */
+	int numpages = (numrows + BENCH_PAGEROWS - 1) / BENCH_PAGEROWS;
+	if (numpages > BENCH_MAXPAGES) {
+		numpages = BENCH_MAXPAGES;
+	}
+	double *latency = calloc(numpages, sizeof(double));
+	if (!latency) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	uint32_t seed = 12345;
+	size_t cells = 0;
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	size_t allocs = stats->allocs;
+	double start = bench_now();
+	for (int page = 0; page < numpages; ++page) {
+		int first = page * BENCH_PAGEROWS;
+		if (page >= numpages / 2 && numrows > BENCH_PAGEROWS) {
+			seed = seed * 1664525u + 1013904223u;
+			first = seed % (numrows - BENCH_PAGEROWS + 1);
+		}
+		double t = bench_now();
+		int last = tmh->NumRows(tmh, tm);
+		if (last > first + BENCH_PAGEROWS) {
+			last = first + BENCH_PAGEROWS;
+		}
+		for (int row = first; row < last; ++row) {
+			for (int col = 0; col < numcolumns; ++col) {
+				uiTableValue *tv = tmh->CellValue(tmh, tm, row, col);
+				if (tv) {
+					uiFreeTableValue(tv);
+				}
+				cells += 1;
+			}
+		}
+		latency[page] = bench_now() - t;
+	}
+	double elapsed = bench_now() - start;
+	allocs = stats->allocs - allocs;
+
+	qsort(latency, numpages, sizeof(double), bench_cmpdouble);
+	printf("%10d  %-8s  %12.0f  %11.2f  %10.1f  %10.1f\n", numrows, source,
+		cells / elapsed, (double) allocs / cells,
+		latency[numpages / 2] * 1e6, latency[(numpages * 99) / 100] * 1e6);
+	free(latency);
+
+	/* SetCellValue on the string column */
+	int sets = numrows < BENCH_SETS ? numrows : BENCH_SETS;
+	uiTableValue *tv = uiNewTableValueString("edited");
+	start = bench_now();
+	for (int i = 0; i < sets; ++i) {
+		tmh->SetCellValue(tmh, tm, i, 1, tv);
+	}
+	elapsed = bench_now() - start;
+	uiFreeTableValue(tv);
+	printf("%10s  %-8s  %12.0f  (setcellvalue / s)\n", "", source, sets / elapsed);
+}
+
+static void bench_model(lua_State *L, bench_allocstats *stats, int numrows, const char *snapfile)
+{
+	if (luaL_loadstring(L, bench_luamodel) != LUA_OK) {
+		fprintf(stderr, "%s\n", lua_tostring(L, -1));
+		exit(1);
+	}
+	lua_pushinteger(L, numrows);
+	lua_call(L, 1, 1);
+	int mdl = lua_gettop(L);
+
+	/* build the native model before editing the lua one, so both start
+	 * out with the same contents. */
+	lua_getfield(L, mdl, "save");
+	lua_pushvalue(L, mdl);
+	lua_pushstring(L, snapfile);
+	lua_call(L, 2, 2);
+	if (lua_isnil(L, -2)) {
+		fprintf(stderr, "%s\n", lua_tostring(L, -1));
+		exit(1);
+	}
+	lua_pop(L, 2);
+	lua_getglobal(L, "lui");
+	lua_getfield(L, -1, "loadmodel");
+	lua_pushstring(L, snapfile);
+	lua_call(L, 1, 2);
+	if (lua_isnil(L, -2)) {
+		fprintf(stderr, "%s\n", lua_tostring(L, -1));
+		exit(1);
+	}
+	lua_pop(L, 1);
+	int snap = lua_gettop(L);
+
+	bench_run(L, stats, "lua", mdl);
+	bench_run(L, stats, "native", snap);
+
+	lua_settop(L, mdl - 1);
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	remove(snapfile);
+}
+
+int main(int argc, char **argv)
+{
+	int defaultrows[] = { 1000, 100000, 10000000 };
+	int numsizes = argc > 1 ? argc - 1 : 3;
+
+	bench_allocstats stats = { 0, 0 };
+	lua_State *L = lua_newstate(bench_alloc, &stats);
+	luaL_openlibs(L);
+
+#ifdef LUI_GTK
+	uiprivInitAlloc();
+#endif
+	luaL_requiref(L, "lui", luaopen_lui, 1);
+	lua_pop(L, 1);
+	lui_initialized = 1;
+
+	char snapfile[256];
+	const char *tmpdir = getenv("TMPDIR");
+	snprintf(snapfile, sizeof(snapfile), "%s/lui-bench-%d.snap", tmpdir ? tmpdir : "/tmp", (int) getpid());
+
+	printf("%10s  %-8s  %12s  %11s  %10s  %10s\n", "rows", "source", "cells/s", "allocs/cell", "p50 page", "p99 page");
+	printf("%10s  %-8s  %12s  %11s  %10s  %10s\n", "", "", "", "", "(us)", "(us)");
+	for (int i = 0; i < numsizes; ++i) {
+		int numrows = argc > 1 ? atoi(argv[i + 1]) : defaultrows[i];
+		if (numrows <= 0) {
+			fprintf(stderr, "invalid row count: %s\n", argv[i + 1]);
+			return 1;
+		}
+		bench_model(L, &stats, numrows, snapfile);
+	}
+
+	/* lui was never really initialized, so it must not be finalized */
+	lui_initialized = 0;
+	lua_close(L);
+	return 0;
+}
@@ -0,0 +1,1227 @@
+/* lui.c
+ *
+ * lua binding to libui (https://github.com/andlabs/libui)
+ *
+ * Gunnar Zötl <gz@tset.de>, 2016
+ * Released under MIT/X11 license. See file LICENSE for details.
+ *
+ * This file is included by lui.c
+ */
+
+/* series  *****************************************************************/
+
+/*** Object
+ * Name: series
+ * an append-only buffer of x, y samples to be displayed by a chart. The x
+ * values must not decrease. While appending, a pyramid of the minimum and
+ * maximum y values of ever larger blocks of samples is kept up to date, so
+ * that a chart can find the extent of any range of samples quickly, no
+ * matter how many there are.
+ */
+#define LUI_SERIES "lui_series"
+#define lui_pushSeries(L) lui_pushObject(L, LUI_SERIES, 0)
+#define lui_checkSeries(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_SERIES))
+
+/* number of samples in a block on the lowest pyramid level. Each level
+ * above has blocks twice the size of the one below. */
+#define LUI_SERIES_BLOCK 16
+#define LUI_SERIES_LEVELS 40
+
+typedef struct lui_chartObject lui_chartObject;
+
+typedef struct {
+	double *x, *y;
+	size_t n, max;
+	double *pmin[LUI_SERIES_LEVELS], *pmax[LUI_SERIES_LEVELS];
+	size_t pmaxblocks[LUI_SERIES_LEVELS];
+	int levels;
+	double r, g, b, a;
+	double thickness;
+	/* charts displaying this series */
+	lui_chartObject **charts;
+	int ncharts, maxcharts;
+} lui_series;
+
+static void lui_chart_seriesChanged(lui_chartObject *chart, lui_series *s, size_t from);
+static void lui_chart_detach(lui_chartObject *chart, lui_series *s);
+
+static int lui_series_growLevel(lui_series *s, int l, size_t blocks)
+{
+	if (blocks <= s->pmaxblocks[l]) {
+		return 1;
+	}
+	size_t max = s->pmaxblocks[l] ? s->pmaxblocks[l] * 2 : 16;
+	while (max < blocks) {
+		max *= 2;
+	}
+	double *pmin = realloc(s->pmin[l], max * sizeof(double));
+	if (!pmin) {
+		return 0;
+	}
+	s->pmin[l] = pmin;
+	double *pmax = realloc(s->pmax[l], max * sizeof(double));
+	if (!pmax) {
+		return 0;
+	}
+	s->pmax[l] = pmax;
+	s->pmaxblocks[l] = max;
+	return 1;
+}
+
+/* lui_series_append
+ *
+ * append a sample and update the pyramid. Returns 0 if out of memory.
+ */
+static int lui_series_append(lui_series *s, double x, double y)
+{
+	if (s->n == s->max) {
+		size_t max = s->max ? s->max * 2 : 1024;
+		double *nx = realloc(s->x, max * sizeof(double));
+		if (!nx) {
+			return 0;
+		}
+		s->x = nx;
+		double *ny = realloc(s->y, max * sizeof(double));
+		if (!ny) {
+			return 0;
+		}
+		s->y = ny;
+		s->max = max;
+	}
+	size_t i = s->n;
+	s->x[i] = x;
+	s->y[i] = y;
+	for (int l = 0; l < LUI_SERIES_LEVELS; ++l) {
+		size_t bs = (size_t) LUI_SERIES_BLOCK << l;
+		if (i < bs) {
+			/* this level would only have one block */
+			break;
+		}
+		size_t b = i / bs;
+		if (!lui_series_growLevel(s, l, b + 1)) {
+			return 0;
+		}
+		if (l == s->levels) {
+			/* new level, its first block is complete now */
+			if (l == 0) {
+				lui_decimate_minmax(s->y, bs, &s->pmin[0][0], &s->pmax[0][0]);
+			} else {
+				double *mn = s->pmin[l - 1], *mx = s->pmax[l - 1];
+				s->pmin[l][0] = mn[1] < mn[0] ? mn[1] : mn[0];
+				s->pmax[l][0] = mx[1] > mx[0] ? mx[1] : mx[0];
+			}
+			s->levels = l + 1;
+		}
+		if (i % bs == 0) {
+			s->pmin[l][b] = HUGE_VAL;
+			s->pmax[l][b] = -HUGE_VAL;
+		}
+		if (y < s->pmin[l][b]) {
+			s->pmin[l][b] = y;
+		}
+		if (y > s->pmax[l][b]) {
+			s->pmax[l][b] = y;
+		}
+	}
+	s->n += 1;
+	return 1;
+}
+
+/* lui_series_minmax
+ *
+ * minimum and maximum of the y values of the samples from index i up to,
+ * but not including, j. NaNs are ignored. If there are no values, mn will
+ * be larger than mx.
+ */
+static void lui_series_minmax(lui_series *s, size_t i, size_t j, double *mn, double *mx)
+{
+	double rmn = HUGE_VAL, rmx = -HUGE_VAL, bmn, bmx;
+	while (i < j) {
+		int l = s->levels - 1;
+		while (l >= 0 && ((i % ((size_t) LUI_SERIES_BLOCK << l)) != 0 || i + ((size_t) LUI_SERIES_BLOCK << l) > j)) {
+			--l;
+		}
+		if (l < 0) {
+			size_t e = (i / LUI_SERIES_BLOCK + 1) * LUI_SERIES_BLOCK;
+			if (e > j) {
+				e = j;
+			}
+			lui_decimate_minmax(s->y + i, e - i, &bmn, &bmx);
+			i = e;
+		} else {
+			size_t b = i / ((size_t) LUI_SERIES_BLOCK << l);
+			bmn = s->pmin[l][b];
+			bmx = s->pmax[l][b];
+			i += (size_t) LUI_SERIES_BLOCK << l;
+		}
+		rmn = bmn < rmn ? bmn : rmn;
+		rmx = bmx > rmx ? bmx : rmx;
+	}
+	*mn = rmn;
+	*mx = rmx;
+}
+
+/* index of the first sample with an x value >= x */
+static size_t lui_series_find(lui_series *s, double x)
+{
+	size_t lo = 0, hi = s->n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (s->x[mid] < x) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static void lui_series_clear(lui_series *s)
+{
+	s->n = 0;
+	s->levels = 0;
+}
+
+static void lui_series_free(lui_series *s)
+{
+	while (s->ncharts > 0) {
+		lui_chart_detach(s->charts[0], s);
+	}
+	free(s->charts);
+	free(s->x);
+	free(s->y);
+	for (int l = 0; l < LUI_SERIES_LEVELS; ++l) {
+		free(s->pmin[l]);
+		free(s->pmax[l]);
+	}
+	free(s);
+}
+
+static void lui_series_notify(lui_series *s, size_t from)
+{
+	for (int i = 0; i < s->ncharts; ++i) {
+		lui_chart_seriesChanged(s->charts[i], s, from);
+	}
+}
+
+/*** Property
+ * Object: series
+ * Name: color
+ * the color to draw the series with. Default is black.
+ *** Property
+ * Object: series
+ * Name: thickness
+ * the line thickness to draw the series with. Default is 1.
+ */
+static int lui_series__index(lua_State *L)
+{
+	lui_series *s = (lui_series*) lui_checkSeries(L, 1)->object;
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "color") == 0) {
+		lui_aux_pushRgba(L, s->r, s->g, s->b, s->a);
+	} else if (strcmp(what, "thickness") == 0) {
+		lua_pushnumber(L, s->thickness);
+	} else {
+		return lui_utility__index(L);
+	}
+	return 1;
+}
+
+static int lui_series__newindex(lua_State *L)
+{
+	lui_series *s = (lui_series*) lui_checkSeries(L, 1)->object;
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "color") == 0) {
+		lui_aux_rgbaFromValue(L, 3, &s->r, &s->g, &s->b, &s->a);
+	} else if (strcmp(what, "thickness") == 0) {
+		s->thickness = luaL_checknumber(L, 3);
+	} else {
+		return lui_utility__newindex(L);
+	}
+	lui_series_notify(s, s->n);
+	return 0;
+}
+
+static int lui_series__gc(lua_State *L)
+{
+	lui_object *lobj = lui_checkSeries(L, 1);
+	if (lobj->object) {
+		DEBUGMSG("lui_series__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_series_free((lui_series*) lobj->object);
+		lobj->object = 0;
+	}
+	return 0;
+}
+
+static int lui_series__len(lua_State *L)
+{
+	lui_series *s = (lui_series*) lui_checkSeries(L, 1)->object;
+	lua_pushinteger(L, s->n);
+	return 1;
+}
+
+/*** Method
+ * Object: series
+ * Name: append
+ * Signature: series:append(x, y)<br>series:append(coords, format = "f64")
+ * append samples to the series. In the first form, a single sample is
+ * appended. In the second form, coords is a flat array {x1, y1, x2, y2, ...}
+ * or a packed string of numbers as for path:polyline(). x values must not
+ * be smaller than the last x value in the series. Charts displaying the
+ * series are redrawn if the new samples are visible.
+ */
+static int lui_seriesAppend(lua_State *L)
+{
+	lui_series *s = (lui_series*) lui_checkSeries(L, 1)->object;
+	size_t from = s->n;
+	double last = s->n ? s->x[s->n - 1] : -HUGE_VAL;
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		double x = luaL_checknumber(L, 2);
+		double y = luaL_checknumber(L, 3);
+		if (x < last) {
+			return luaL_error(L, "series x values must not decrease!");
+		}
+		if (!lui_series_append(s, x, y)) {
+			return luaL_error(L, "out of memory!");
+		}
+	} else {
+		lui_drawCoords c;
+		lui_drawcoords_check(L, 2, 3, &c, 2);
+		for (size_t i = 0; i < c.n; i += 2) {
+			double x = lui_drawcoords_get(&c, i);
+			double y = lui_drawcoords_get(&c, i + 1);
+			if (x < last) {
+				lui_series_notify(s, from);
+				return luaL_error(L, "series x values must not decrease!");
+			}
+			if (!lui_series_append(s, x, y)) {
+				lui_series_notify(s, from);
+				return luaL_error(L, "out of memory!");
+			}
+			last = x;
+		}
+	}
+	lui_series_notify(s, from);
+	return 0;
+}
+
+/*** Method
+ * Object: series
+ * Name: get
+ * Signature: x, y = series:get(index)
+ * return the sample at index, or nothing if there is no such sample.
+ */
+static int lui_seriesGet(lua_State *L)
+{
+	lui_series *s = (lui_series*) lui_checkSeries(L, 1)->object;
+	lua_Integer i = luaL_checkinteger(L, 2);
+	if (i < 1 || (size_t) i > s->n) {
+		return 0;
+	}
+	lua_pushnumber(L, s->x[i - 1]);
+	lua_pushnumber(L, s->y[i - 1]);
+	return 2;
+}
+
+/*** Method
+ * Object: series
+ * Name: range
+ * Signature: xmin, xmax, ymin, ymax = series:range()
+ * return the extent of the samples in the series, or nothing if it is
+ * empty.
+ */
+static int lui_seriesRange(lua_State *L)
+{
+	lui_series *s = (lui_series*) lui_checkSeries(L, 1)->object;
+	if (s->n == 0) {
+		return 0;
+	}
+	double mn, mx;
+	lui_series_minmax(s, 0, s->n, &mn, &mx);
+	lua_pushnumber(L, s->x[0]);
+	lua_pushnumber(L, s->x[s->n - 1]);
+	lua_pushnumber(L, mn);
+	lua_pushnumber(L, mx);
+	return 4;
+}
+
+/*** Method
+ * Object: series
+ * Name: clear
+ * Signature: series:clear()
+ * remove all samples from the series.
+ */
+static int lui_seriesClear(lua_State *L)
+{
+	lui_series *s = (lui_series*) lui_checkSeries(L, 1)->object;
+	lui_series_clear(s);
+	lui_series_notify(s, 0);
+	return 0;
+}
+
+/*** Constructor
+ * Object: series
+ * Name: series
+ * Signature: series = lui.series(properties = nil)
+ * create a new, empty series.
+ */
+static int lui_newSeries(lua_State *L)
+{
+	int hastable = lui_aux_istable(L, 1);
+
+	lui_object *lobj = lui_pushSeries(L);
+	lui_series *s = calloc(1, sizeof(lui_series));
+	if (!s) {
+		return luaL_error(L, "out of memory!");
+	}
+	s->a = 1;
+	s->thickness = 1;
+	lobj->object = s;
+	if (hastable) { lui_aux_setFieldsFromTable(L, lua_gettop(L), 1); }
+	lui_registerObject(L, lua_gettop(L));
+	return 1;
+}
+
+/* metamethods for series */
+static const luaL_Reg lui_series_meta[] = {
+	{"__gc", lui_series__gc},
+	{"__len", lui_series__len},
+	{"__index", lui_series__index},
+	{"__newindex", lui_series__newindex},
+	{0, 0}
+};
+
+/* methods for series */
+static const luaL_Reg lui_series_methods[] = {
+	{"append", lui_seriesAppend},
+	{"get", lui_seriesGet},
+	{"range", lui_seriesRange},
+	{"clear", lui_seriesClear},
+	{0, 0}
+};
+
+/* chart control  **********************************************************/
+
+/*** Object
+ * Name: chart
+ * a control that plots one or more series as lines, with axes and a grid.
+ * Drawing, zooming and panning are done natively. Drag with the left mouse
+ * button to pan, drag with the right mouse button to zoom to a range of x
+ * values, and double click to go back to showing all data. The keys + and
+ * - zoom in and out, left and right pan, and home also shows all data.
+ */
+#define LUI_CHART "lui_chart"
+#define lui_pushChart(L) ((lui_chartObject*)lui_pushObjectSized(L, LUI_CHART, 1, sizeof(lui_chartObject)))
+#define lui_checkChart(L, pos) ((lui_chartObject*)luaL_checkudata(L, pos, LUI_CHART))
+
+#define LUI_CHART_MARGIN_LEFT 60
+#define LUI_CHART_MARGIN_RIGHT 12
+#define LUI_CHART_MARGIN_TOP 12
+#define LUI_CHART_MARGIN_BOTTOM 24
+
+enum {
+	LUI_CHART_DRAG_NONE,
+	LUI_CHART_DRAG_PAN,
+	LUI_CHART_DRAG_ZOOM
+};
+
+struct lui_chartObject {
+	void *object;
+	lui_series **series;
+	int nseries, maxseries;
+	/* requested view, for axes not automatically scaled */
+	double xmin, xmax, ymin, ymax;
+	int autox, autoy;
+	/* view and plot rectangle of the last redraw */
+	double view[4];
+	double plot[4];
+	int drawn;
+	/* mouse interaction */
+	int drag;
+	double dragx, dragy, dragview[4];
+	double zoomx0, zoomx1;
+	int redrawqueued;
+	double bg[4], grid[4], text[4];
+	uiFontDescriptor *font;
+};
+
+static uiFontDescriptor lui_chartDefaultFont = {
+	.Family = "sans-serif",
+	.Size = 9,
+	.Weight = uiTextWeightNormal,
+	.Italic = uiTextItalicNormal,
+	.Stretch = uiTextStretchNormal
+};
+
+static void lui_chart_invalidate(lui_chartObject *chart)
+{
+	if (chart->object && !chart->redrawqueued) {
+		chart->redrawqueued = 1;
+		uiAreaQueueRedrawAll(uiArea(chart->object));
+	}
+}
+
+/* samples from index from on were added to, or removed from s */
+static void lui_chart_seriesChanged(lui_chartObject *chart, lui_series *s, size_t from)
+{
+	if (!chart->drawn || chart->autox || chart->autoy || from >= s->n || from == 0) {
+		lui_chart_invalidate(chart);
+		return;
+	}
+	/* only redraw if some of the new samples are visible */
+	if (s->x[from] <= chart->view[1] && s->x[s->n - 1] >= chart->view[0]) {
+		lui_chart_invalidate(chart);
+	}
+}
+
+static int lui_chart_attach(lui_chartObject *chart, lui_series *s)
+{
+	if (chart->nseries == chart->maxseries) {
+		int max = chart->maxseries ? chart->maxseries * 2 : 4;
+		lui_series **series = realloc(chart->series, max * sizeof(lui_series*));
+		if (!series) {
+			return 0;
+		}
+		chart->series = series;
+		chart->maxseries = max;
+	}
+	if (s->ncharts == s->maxcharts) {
+		int max = s->maxcharts ? s->maxcharts * 2 : 4;
+		lui_chartObject **charts = realloc(s->charts, max * sizeof(lui_chartObject*));
+		if (!charts) {
+			return 0;
+		}
+		s->charts = charts;
+		s->maxcharts = max;
+	}
+	chart->series[chart->nseries++] = s;
+	s->charts[s->ncharts++] = chart;
+	return 1;
+}
+
+static void lui_chart_detach(lui_chartObject *chart, lui_series *s)
+{
+	for (int i = 0; i < chart->nseries; ++i) {
+		if (chart->series[i] == s) {
+			memmove(&chart->series[i], &chart->series[i + 1], (chart->nseries - i - 1) * sizeof(lui_series*));
+			chart->nseries -= 1;
+			break;
+		}
+	}
+	for (int i = 0; i < s->ncharts; ++i) {
+		if (s->charts[i] == chart) {
+			memmove(&s->charts[i], &s->charts[i + 1], (s->ncharts - i - 1) * sizeof(lui_chartObject*));
+			s->ncharts -= 1;
+			break;
+		}
+	}
+	lui_chart_invalidate(chart);
+}
+
+/* views are at least this many units in the last place of their center
+ * wide, so that ticks and zooming still have distinct values to work with */
+#define LUI_CHART_MINULPS 64
+
+/* at most this many grid lines are drawn per axis */
+#define LUI_CHART_MAXTICKS 1000
+
+/* make the range lo..hi at least minw wide, and wide enough to be
+ * resolvable around its center */
+static void lui_chart_widen(double *lo, double *hi, double minw)
+{
+	double c = *lo / 2 + *hi / 2;
+	double w = fabs(c) * DBL_EPSILON * LUI_CHART_MINULPS;
+	if (w < minw) {
+		w = minw;
+	}
+	if (w < DBL_MIN) {
+		w = DBL_MIN;
+	}
+	if (!(*hi - *lo >= w)) {
+		*lo = c - w / 2;
+		*hi = c + w / 2;
+	}
+}
+
+/* determine the view to draw, for the axes that are scaled automatically
+ * from the data */
+static void lui_chart_resolveView(lui_chartObject *chart, double *view)
+{
+	view[0] = chart->xmin;
+	view[1] = chart->xmax;
+	view[2] = chart->ymin;
+	view[3] = chart->ymax;
+	if (chart->autox) {
+		view[0] = HUGE_VAL;
+		view[1] = -HUGE_VAL;
+		for (int i = 0; i < chart->nseries; ++i) {
+			lui_series *s = chart->series[i];
+			if (s->n > 0) {
+				view[0] = s->x[0] < view[0] ? s->x[0] : view[0];
+				view[1] = s->x[s->n - 1] > view[1] ? s->x[s->n - 1] : view[1];
+			}
+		}
+		if (view[0] > view[1]) {
+			view[0] = 0;
+			view[1] = 1;
+		}
+	}
+	lui_chart_widen(&view[0], &view[1], view[0] == view[1] ? 1 : 0);
+	if (chart->autoy) {
+		view[2] = HUGE_VAL;
+		view[3] = -HUGE_VAL;
+		for (int i = 0; i < chart->nseries; ++i) {
+			lui_series *s = chart->series[i];
+			double mn, mx;
+			lui_series_minmax(s, lui_series_find(s, view[0]), lui_series_find(s, nextafter(view[1], HUGE_VAL)), &mn, &mx);
+			view[2] = mn < view[2] ? mn : view[2];
+			view[3] = mx > view[3] ? mx : view[3];
+		}
+		if (view[2] > view[3]) {
+			view[2] = 0;
+			view[3] = 1;
+		} else {
+			double pad = (view[3] - view[2]) * 0.05;
+			view[2] -= pad;
+			view[3] += pad;
+		}
+	}
+	lui_chart_widen(&view[2], &view[3], view[2] == view[3] ? 1 : 0);
+}
+
+/* a step of 1, 2 or 5 times a power of 10, giving ticks about spacing
+ * pixels apart */
+static double lui_chart_tickStep(double range, double pixels, double spacing)
+{
+	double raw = range / (pixels / spacing > 1 ? pixels / spacing : 1);
+	double mag = pow(10, floor(log10(raw)));
+	double f = raw / mag;
+	return (f <= 1 ? 1 : f <= 2 ? 2 : f <= 5 ? 5 : 10) * mag;
+}
+
+static void lui_chart_label(lui_chartObject *chart, uiDrawContext *c, double v, double step, double x, double y, int align)
+{
+	char buf[32];
+	v = round(v / step) * step;
+	if (fabs(v) < step * 1e-9) {
+		v = 0;
+	}
+	snprintf(buf, sizeof(buf), "%g", v);
+	uiAttributedString *astr = uiNewAttributedString(buf);
+	uiAttributedStringSetAttribute(astr, uiNewColorAttribute(chart->text[0], chart->text[1], chart->text[2], chart->text[3]), 0, strlen(buf));
+	uiDrawTextLayoutParams params;
+	params.String = astr;
+	params.DefaultFont = chart->font;
+	params.Width = -1;
+	params.Align = uiDrawTextAlignLeft;
+	uiDrawTextLayout *layout = uiDrawNewTextLayout(&params);
+	double w, h;
+	uiDrawTextLayoutExtents(layout, &w, &h);
+	/* align: 0 = centered below x, y; 1 = right aligned and vertically
+	 * centered at x, y */
+	if (align == 0) {
+		uiDrawText(c, layout, x - w / 2, y);
+	} else {
+		uiDrawText(c, layout, x - w, y - h / 2);
+	}
+	uiDrawFreeTextLayout(layout);
+	uiFreeAttributedString(astr);
+}
+
+static void lui_chart_drawSeries(lui_chartObject *chart, uiDrawContext *c, lui_series *s)
+{
+	double *v = chart->view, *p = chart->plot;
+	double kx = (p[2] - p[0]) / (v[1] - v[0]);
+	double ky = (p[3] - p[1]) / (v[3] - v[2]);
+	size_t i0 = lui_series_find(s, v[0]);
+	size_t i1 = lui_series_find(s, nextafter(v[1], HUGE_VAL));
+	/* one sample beyond the view on each side, so that the line reaches
+	 * the edges */
+	i0 = i0 > 0 ? i0 - 1 : 0;
+	i1 = i1 < s->n ? i1 + 1 : s->n;
+	if (i1 <= i0) {
+		return;
+	}
+	size_t columns = (size_t) ceil(p[2] - p[0]);
+	uiDrawPath *path = uiDrawNewPath(uiDrawFillModeWinding);
+	int open = 0;
+
+#define LUI_CHART_POINT(px, py) \
+	if (open) { \
+		uiDrawPathLineTo(path, (px), (py)); \
+	} else { \
+		uiDrawPathNewFigure(path, (px), (py)); \
+		open = 1; \
+	}
+
+	if (i1 - i0 <= 2 * columns) {
+		for (size_t i = i0; i < i1; ++i) {
+			if (isnan(s->y[i])) {
+				open = 0;
+				continue;
+			}
+			LUI_CHART_POINT(p[0] + (s->x[i] - v[0]) * kx, p[3] - (s->y[i] - v[2]) * ky);
+		}
+	} else {
+		/* reduce each pixel column to the minimum and maximum of the
+		 * samples in it, using the pyramid */
+		double prev = NAN;
+		size_t i = lui_series_find(s, v[0]);
+		if (i0 < i && !isnan(s->y[i0])) {
+			prev = s->y[i0];
+			LUI_CHART_POINT(p[0] + (s->x[i0] - v[0]) * kx, p[3] - (prev - v[2]) * ky);
+		}
+		for (size_t col = 0; col < columns && i < s->n; ++col) {
+			size_t e = lui_series_find(s, v[0] + (col + 1) / kx);
+			if (e <= i) {
+				continue;
+			}
+			double mn, mx;
+			lui_series_minmax(s, i, e, &mn, &mx);
+			i = e;
+			if (mn > mx) {
+				continue;
+			}
+			if (!isnan(prev) && fabs(prev - mx) < fabs(prev - mn)) {
+				double t = mn; mn = mx; mx = t;
+			}
+			double px = p[0] + col + 0.5;
+			LUI_CHART_POINT(px, p[3] - (mn - v[2]) * ky);
+			if (mx != mn) {
+				LUI_CHART_POINT(px, p[3] - (mx - v[2]) * ky);
+			}
+			prev = mx;
+		}
+		if (i < i1 && !isnan(s->y[i1 - 1])) {
+			LUI_CHART_POINT(p[0] + (s->x[i1 - 1] - v[0]) * kx, p[3] - (s->y[i1 - 1] - v[2]) * ky);
+		}
+	}
+#undef LUI_CHART_POINT
+
+	uiDrawPathEnd(path);
+	uiDrawBrush brush;
+	memset(&brush, 0, sizeof(brush));
+	brush.Type = uiDrawBrushTypeSolid;
+	brush.R = s->r;
+	brush.G = s->g;
+	brush.B = s->b;
+	brush.A = s->a;
+	uiDrawStrokeParams sp;
+	memset(&sp, 0, sizeof(sp));
+	sp.Cap = uiDrawLineCapFlat;
+	sp.Join = uiDrawLineJoinRound;
+	sp.Thickness = s->thickness;
+	sp.MiterLimit = uiDrawDefaultMiterLimit;
+	uiDrawStroke(c, path, &brush, &sp);
+	uiDrawFreePath(path);
+}
+
+static void lui_chart_draw(lui_chartObject *chart, uiDrawContext *c, double width, double height)
+{
+	uiDrawBrush brush;
+	memset(&brush, 0, sizeof(brush));
+	brush.Type = uiDrawBrushTypeSolid;
+	uiDrawStrokeParams sp;
+	memset(&sp, 0, sizeof(sp));
+	sp.Cap = uiDrawLineCapFlat;
+	sp.Join = uiDrawLineJoinMiter;
+	sp.Thickness = 1;
+	sp.MiterLimit = uiDrawDefaultMiterLimit;
+
+	brush.R = chart->bg[0]; brush.G = chart->bg[1]; brush.B = chart->bg[2]; brush.A = chart->bg[3];
+	uiDrawPath *path = uiDrawNewPath(uiDrawFillModeWinding);
+	uiDrawPathAddRectangle(path, 0, 0, width, height);
+	uiDrawPathEnd(path);
+	uiDrawFill(c, path, &brush);
+	uiDrawFreePath(path);
+
+	double *p = chart->plot;
+	p[0] = LUI_CHART_MARGIN_LEFT;
+	p[1] = LUI_CHART_MARGIN_TOP;
+	p[2] = width - LUI_CHART_MARGIN_RIGHT;
+	p[3] = height - LUI_CHART_MARGIN_BOTTOM;
+	if (p[2] - p[0] < 2 || p[3] - p[1] < 2) {
+		chart->drawn = 0;
+		return;
+	}
+	double *v = chart->view;
+	lui_chart_resolveView(chart, v);
+	chart->drawn = 1;
+	double kx = (p[2] - p[0]) / (v[1] - v[0]);
+	double ky = (p[3] - p[1]) / (v[3] - v[2]);
+
+	/* grid and labels. Lines are put on pixel centers to keep them sharp */
+	double xstep = lui_chart_tickStep(v[1] - v[0], p[2] - p[0], 100);
+	double ystep = lui_chart_tickStep(v[3] - v[2], p[3] - p[1], 50);
+	path = uiDrawNewPath(uiDrawFillModeWinding);
+	/* count ticks, adding up steps stops advancing for tiny steps */
+	double k0 = ceil(v[0] / xstep);
+	for (int n = 0; n < LUI_CHART_MAXTICKS && (k0 + n) * xstep <= v[1]; ++n) {
+		double t = (k0 + n) * xstep;
+		double x = floor(p[0] + (t - v[0]) * kx) + 0.5;
+		uiDrawPathNewFigure(path, x, p[1]);
+		uiDrawPathLineTo(path, x, p[3]);
+		lui_chart_label(chart, c, t, xstep, x, p[3] + 4, 0);
+	}
+	k0 = ceil(v[2] / ystep);
+	for (int n = 0; n < LUI_CHART_MAXTICKS && (k0 + n) * ystep <= v[3]; ++n) {
+		double t = (k0 + n) * ystep;
+		double y = floor(p[3] - (t - v[2]) * ky) + 0.5;
+		uiDrawPathNewFigure(path, p[0], y);
+		uiDrawPathLineTo(path, p[2], y);
+		lui_chart_label(chart, c, t, ystep, p[0] - 4, y, 1);
+	}
+	uiDrawPathEnd(path);
+	brush.R = chart->grid[0]; brush.G = chart->grid[1]; brush.B = chart->grid[2]; brush.A = chart->grid[3];
+	uiDrawStroke(c, path, &brush, &sp);
+	uiDrawFreePath(path);
+
+	uiDrawPath *clip = uiDrawNewPath(uiDrawFillModeWinding);
+	uiDrawPathAddRectangle(clip, p[0], p[1], p[2] - p[0], p[3] - p[1]);
+	uiDrawPathEnd(clip);
+	uiDrawSave(c);
+	uiDrawClip(c, clip);
+	for (int i = 0; i < chart->nseries; ++i) {
+		lui_chart_drawSeries(chart, c, chart->series[i]);
+	}
+	uiDrawRestore(c);
+
+	if (chart->drag == LUI_CHART_DRAG_ZOOM) {
+		double x0 = chart->zoomx0 < chart->zoomx1 ? chart->zoomx0 : chart->zoomx1;
+		double x1 = chart->zoomx0 < chart->zoomx1 ? chart->zoomx1 : chart->zoomx0;
+		path = uiDrawNewPath(uiDrawFillModeWinding);
+		uiDrawPathAddRectangle(path, x0, p[1], x1 - x0, p[3] - p[1]);
+		uiDrawPathEnd(path);
+		brush.R = chart->text[0]; brush.G = chart->text[1]; brush.B = chart->text[2]; brush.A = chart->text[3] * 0.2;
+		uiDrawFill(c, path, &brush);
+		uiDrawFreePath(path);
+	}
+
+	brush.R = chart->text[0]; brush.G = chart->text[1]; brush.B = chart->text[2]; brush.A = chart->text[3];
+	path = uiDrawNewPath(uiDrawFillModeWinding);
+	uiDrawPathAddRectangle(path, floor(p[0]) + 0.5, floor(p[1]) + 0.5, floor(p[2] - p[0]), floor(p[3] - p[1]));
+	uiDrawPathEnd(path);
+	uiDrawStroke(c, path, &brush, &sp);
+	uiDrawFreePath(path);
+	uiDrawFreePath(clip);
+}
+
+typedef struct {
+	uiAreaHandler H;
+	lua_State *L;
+} lui_chartHandler;
+#define lui_chartHandler(this) ((lui_chartHandler *)(this))
+
+/* find the chart object for an area. Leaves the stack as it was, the
+ * chart is kept alive by its uiArea's parent or the object registry */
+static lui_chartObject *lui_chart_find(lua_State *L, uiArea *area)
+{
+	lui_chartObject *chart = NULL;
+	if (lui_findObject(L, uiControl(area)) != LUA_TNIL) {
+		chart = (lui_chartObject*) lua_touserdata(L, -1);
+	}
+	lua_pop(L, 1);
+	return chart;
+}
+
+/*** Property
+ * Object: chart
+ * Name: onviewchanged
+ * a function <code>onviewchanged(chart, xmin, xmax, ymin, ymax)</code> that
+ * is called when the user has finished zooming or panning the chart. It is
+ * not called while the mouse moves.
+ */
+static void lui_chart_viewChanged(lua_State *L, lui_chartObject *chart)
+{
+	int top = lua_gettop(L);
+	double v[4];
+	lui_chart_resolveView(chart, v);
+	for (int i = 0; i < 4; ++i) {
+		lua_pushnumber(L, v[i]);
+	}
+	lui_objectHandlerCallback(L, uiControl(chart->object), "onviewchanged", top + 1, 4, 0);
+	lua_settop(L, top);
+}
+
+/* set the x range of the view, and keep the y range if it was set */
+static void lui_chart_setX(lui_chartObject *chart, double x0, double x1)
+{
+	if (!isfinite(x0) || !isfinite(x1)) {
+		return;
+	}
+	lui_chart_widen(&x0, &x1, 0);
+	chart->xmin = x0;
+	chart->xmax = x1;
+	chart->autox = 0;
+	lui_chart_invalidate(chart);
+}
+
+static void lui_chart_reset(lui_chartObject *chart)
+{
+	chart->autox = chart->autoy = 1;
+	lui_chart_invalidate(chart);
+}
+
+static void lui_chartDrawCallback(uiAreaHandler *ah, uiArea *area, uiAreaDrawParams *params)
+{
+	lui_chartObject *chart = lui_chart_find(lui_chartHandler(ah)->L, area);
+	if (!chart) {
+		return;
+	}
+	chart->redrawqueued = 0;
+	lui_chart_draw(chart, params->Context, params->AreaWidth, params->AreaHeight);
+}
+
+static void lui_chartMouseEventCallback(uiAreaHandler *ah, uiArea *area, uiAreaMouseEvent *evt)
+{
+	lua_State *L = lui_chartHandler(ah)->L;
+	lui_chartObject *chart = lui_chart_find(L, area);
+	if (!chart || !chart->drawn) {
+		return;
+	}
+	double *p = chart->plot, *v = chart->view;
+	double kx = (p[2] - p[0]) / (v[1] - v[0]);
+	double ky = (p[3] - p[1]) / (v[3] - v[2]);
+
+	if (evt->Down == 1 && evt->Count == 2) {
+		chart->drag = LUI_CHART_DRAG_NONE;
+		lui_chart_reset(chart);
+		lui_chart_viewChanged(L, chart);
+	} else if (evt->Down == 1) {
+		chart->drag = LUI_CHART_DRAG_PAN;
+		chart->dragx = evt->X;
+		chart->dragy = evt->Y;
+		memcpy(chart->dragview, v, sizeof(chart->dragview));
+	} else if (evt->Down == 3) {
+		chart->drag = LUI_CHART_DRAG_ZOOM;
+		chart->zoomx0 = chart->zoomx1 = evt->X;
+	} else if (evt->Up) {
+		int drag = chart->drag;
+		chart->drag = LUI_CHART_DRAG_NONE;
+		if (drag == LUI_CHART_DRAG_ZOOM) {
+			double x0 = chart->zoomx0 < chart->zoomx1 ? chart->zoomx0 : chart->zoomx1;
+			double x1 = chart->zoomx0 < chart->zoomx1 ? chart->zoomx1 : chart->zoomx0;
+			lui_chart_invalidate(chart);
+			if (x1 - x0 >= 3) {
+				lui_chart_setX(chart, v[0] + (x0 - p[0]) / kx, v[0] + (x1 - p[0]) / kx);
+				lui_chart_viewChanged(L, chart);
+			}
+		} else if (drag == LUI_CHART_DRAG_PAN && (evt->X != chart->dragx || evt->Y != chart->dragy)) {
+			lui_chart_viewChanged(L, chart);
+		}
+	} else if (chart->drag == LUI_CHART_DRAG_PAN) {
+		double dx = (evt->X - chart->dragx) / kx;
+		lui_chart_setX(chart, chart->dragview[0] - dx, chart->dragview[1] - dx);
+		if (!chart->autoy) {
+			double dy = (evt->Y - chart->dragy) / ky;
+			chart->ymin = chart->dragview[2] + dy;
+			chart->ymax = chart->dragview[3] + dy;
+		}
+	} else if (chart->drag == LUI_CHART_DRAG_ZOOM) {
+		chart->zoomx1 = evt->X < p[0] ? p[0] : evt->X > p[2] ? p[2] : evt->X;
+		lui_chart_invalidate(chart);
+	}
+}
+
+static void lui_chartMouseCrossedCallback(uiAreaHandler *ah, uiArea *area, int left)
+{
+}
+
+static void lui_chartDragBrokenCallback(uiAreaHandler *ah, uiArea *area)
+{
+	lui_chartObject *chart = lui_chart_find(lui_chartHandler(ah)->L, area);
+	if (chart) {
+		chart->drag = LUI_CHART_DRAG_NONE;
+		lui_chart_invalidate(chart);
+	}
+}
+
+static int lui_chartKeyEventCallback(uiAreaHandler *ah, uiArea *area, uiAreaKeyEvent *evt)
+{
+	lua_State *L = lui_chartHandler(ah)->L;
+	lui_chartObject *chart = lui_chart_find(L, area);
+	if (!chart || !chart->drawn || evt->Up) {
+		return 0;
+	}
+	double *v = chart->view;
+	double c = (v[0] + v[1]) / 2, w = v[1] - v[0];
+	if (evt->Key == '+' || evt->Key == '=') {
+		lui_chart_setX(chart, c - w / 4, c + w / 4);
+	} else if (evt->Key == '-') {
+		lui_chart_setX(chart, c - w, c + w);
+	} else if (evt->ExtKey == uiExtKeyLeft) {
+		lui_chart_setX(chart, v[0] - w / 10, v[1] - w / 10);
+	} else if (evt->ExtKey == uiExtKeyRight) {
+		lui_chart_setX(chart, v[0] + w / 10, v[1] + w / 10);
+	} else if (evt->ExtKey == uiExtKeyHome) {
+		lui_chart_reset(chart);
+	} else {
+		return 0;
+	}
+	/* keep the view up to date for further keys before the next redraw */
+	if (!chart->autox) {
+		v[0] = chart->xmin;
+		v[1] = chart->xmax;
+	}
+	lui_chart_viewChanged(L, chart);
+	return 1;
+}
+
+/* L will be filled when the chartHandler is first used. */
+static lui_chartHandler lui_commonChartHandler = {
+	.H.Draw = lui_chartDrawCallback,
+	.H.MouseEvent = lui_chartMouseEventCallback,
+	.H.MouseCrossed = lui_chartMouseCrossedCallback,
+	.H.DragBroken = lui_chartDragBrokenCallback,
+	.H.KeyEvent = lui_chartKeyEventCallback,
+	.L = 0
+};
+
+/* replace the series shown by the chart with those in the array at pos */
+static void lui_chart_setSeries(lua_State *L, lui_chartObject *chart, int pos)
+{
+	luaL_checktype(L, pos, LUA_TTABLE);
+	int len = lua_rawlen(L, pos);
+	for (int i = 1; i <= len; ++i) {
+		lua_rawgeti(L, pos, i);
+		lui_checkSeries(L, -1);
+		lua_pop(L, 1);
+	}
+	while (chart->nseries > 0) {
+		lui_chart_detach(chart, chart->series[0]);
+	}
+	lua_createtable(L, len, 0);
+	for (int i = 1; i <= len; ++i) {
+		lua_rawgeti(L, pos, i);
+		if (!lui_chart_attach(chart, (lui_series*) lui_checkSeries(L, -1)->object)) {
+			luaL_error(L, "out of memory!");
+		}
+		lua_rawseti(L, -2, i);
+	}
+	lui_aux_setUservalue(L, 1, "series", -1);
+	lua_pop(L, 1);
+	lui_chart_invalidate(chart);
+}
+
+/*** Property
+ * Object: chart
+ * Name: series
+ * an array of the series displayed by the chart. Changing the array after
+ * assigning it has no effect, assign a new one or use chart:add() instead.
+ *** Property
+ * Object: chart
+ * Name: background
+ * the background color. Default is white.
+ *** Property
+ * Object: chart
+ * Name: gridcolor
+ * the color of the grid lines. Default is light grey.
+ *** Property
+ * Object: chart
+ * Name: textcolor
+ * the color of the labels and the frame around the plot. Default is dark
+ * grey.
+ *** Property
+ * Object: chart
+ * Name: font
+ * the text.font to draw the labels with.
+ */
+static int lui_chart__index(lua_State *L)
+{
+	lui_chartObject *chart = lui_checkChart(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "series") == 0) {
+		lui_aux_getUservalue(L, 1, "series");
+	} else if (strcmp(what, "onviewchanged") == 0) {
+		lui_objectGetHandler(L, "onviewchanged");
+	} else if (strcmp(what, "background") == 0) {
+		lui_aux_pushRgba(L, chart->bg[0], chart->bg[1], chart->bg[2], chart->bg[3]);
+	} else if (strcmp(what, "gridcolor") == 0) {
+		lui_aux_pushRgba(L, chart->grid[0], chart->grid[1], chart->grid[2], chart->grid[3]);
+	} else if (strcmp(what, "textcolor") == 0) {
+		lui_aux_pushRgba(L, chart->text[0], chart->text[1], chart->text[2], chart->text[3]);
+	} else if (strcmp(what, "font") == 0) {
+		lui_aux_getUservalue(L, 1, "font");
+	} else {
+		return lui_control__index(L);
+	}
+	return 1;
+}
+
+static int lui_chart__newindex(lua_State *L)
+{
+	lui_chartObject *chart = lui_checkChart(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "series") == 0) {
+		lui_chart_setSeries(L, chart, 3);
+	} else if (strcmp(what, "onviewchanged") == 0) {
+		lui_objectSetHandler(L, "onviewchanged", 3);
+	} else if (strcmp(what, "background") == 0) {
+		lui_aux_rgbaFromValue(L, 3, &chart->bg[0], &chart->bg[1], &chart->bg[2], &chart->bg[3]);
+	} else if (strcmp(what, "gridcolor") == 0) {
+		lui_aux_rgbaFromValue(L, 3, &chart->grid[0], &chart->grid[1], &chart->grid[2], &chart->grid[3]);
+	} else if (strcmp(what, "textcolor") == 0) {
+		lui_aux_rgbaFromValue(L, 3, &chart->text[0], &chart->text[1], &chart->text[2], &chart->text[3]);
+	} else if (strcmp(what, "font") == 0) {
+		if (lua_isnoneornil(L, 3)) {
+			chart->font = &lui_chartDefaultFont;
+			lui_aux_clearUservalue(L, 1, "font");
+		} else {
+			chart->font = uiFontDescriptor(lui_checkTextFont(L, 3)->object);
+			lui_aux_setUservalue(L, 1, "font", 3);
+		}
+	} else {
+		return lui_control__newindex(L);
+	}
+	lui_chart_invalidate(chart);
+	return 0;
+}
+
+static int lui_chart__gc(lua_State *L)
+{
+	lui_chartObject *chart = lui_checkChart(L, 1);
+	while (chart->nseries > 0) {
+		lui_chart_detach(chart, chart->series[0]);
+	}
+	free(chart->series);
+	chart->series = 0;
+	chart->maxseries = 0;
+	return lui_control__gc(L);
+}
+
+/*** Method
+ * Object: chart
+ * Name: add
+ * Signature: chart:add(series)
+ * add a series to the chart.
+ */
+static int lui_chartAdd(lua_State *L)
+{
+	lui_chartObject *chart = lui_checkChart(L, 1);
+	lui_series *s = (lui_series*) lui_checkSeries(L, 2)->object;
+	if (lui_aux_getUservalue(L, 1, "series") != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lui_aux_setUservalue(L, 1, "series", -1);
+	}
+	for (int i = 0; i < chart->nseries; ++i) {
+		if (chart->series[i] == s) {
+			return 0;
+		}
+	}
+	if (!lui_chart_attach(chart, s)) {
+		return luaL_error(L, "out of memory!");
+	}
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+	lui_chart_invalidate(chart);
+	return 0;
+}
+
+/*** Method
+ * Object: chart
+ * Name: setview
+ * Signature: chart:setview(xmin, xmax, ymin = nil, ymax = nil)
+ * set the range of values shown. If xmin and xmax are nil, all x values
+ * are shown. If ymin and ymax are nil, the y range is fitted to the data
+ * in view.
+ */
+static int lui_chartSetView(lua_State *L)
+{
+	lui_chartObject *chart = lui_checkChart(L, 1);
+	if (lua_isnoneornil(L, 2) && lua_isnoneornil(L, 3)) {
+		chart->autox = 1;
+	} else {
+		chart->xmin = luaL_checknumber(L, 2);
+		chart->xmax = luaL_checknumber(L, 3);
+		chart->autox = 0;
+	}
+	if (lua_isnoneornil(L, 4) && lua_isnoneornil(L, 5)) {
+		chart->autoy = 1;
+	} else {
+		chart->ymin = luaL_checknumber(L, 4);
+		chart->ymax = luaL_checknumber(L, 5);
+		chart->autoy = 0;
+	}
+	lui_chart_invalidate(chart);
+	return 0;
+}
+
+/*** Method
+ * Object: chart
+ * Name: getview
+ * Signature: xmin, xmax, ymin, ymax = chart:getview()
+ * return the range of values currently shown.
+ */
+static int lui_chartGetView(lua_State *L)
+{
+	lui_chartObject *chart = lui_checkChart(L, 1);
+	double v[4];
+	lui_chart_resolveView(chart, v);
+	for (int i = 0; i < 4; ++i) {
+		lua_pushnumber(L, v[i]);
+	}
+	return 4;
+}
+
+/*** Constructor
+ * Object: chart
+ * Name: chart
+ * Signature: chart = lui.chart(properties = nil)
+ * create a new chart. To display data, set the series property, or use
+ * chart:add().
+ */
+static int lui_newChart(lua_State *L)
+{
+	lui_commonChartHandler.L = L;
+	int hastable = lui_aux_istable(L, 1);
+
+	lui_chartObject *chart = lui_pushChart(L);
+	chart->object = uiNewArea(uiAreaHandler(&lui_commonChartHandler));
+	chart->autox = chart->autoy = 1;
+	chart->bg[0] = chart->bg[1] = chart->bg[2] = chart->bg[3] = 1;
+	chart->grid[0] = chart->grid[1] = chart->grid[2] = 0.85;
+	chart->grid[3] = 1;
+	chart->text[0] = chart->text[1] = chart->text[2] = 0.25;
+	chart->text[3] = 1;
+	chart->font = &lui_chartDefaultFont;
+	if (hastable) { lui_aux_setFieldsFromTable(L, lua_gettop(L), 1); }
+	lui_registerObject(L, lua_gettop(L));
+	return 1;
+}
+
+/* metamethods for charts */
+static const luaL_Reg lui_chart_meta[] = {
+	{"__gc", lui_chart__gc},
+	{"__index", lui_chart__index},
+	{"__newindex", lui_chart__newindex},
+	{0, 0}
+};
+
+/* methods for charts */
+static const struct luaL_Reg lui_chart_methods [] = {
+	{"add", lui_chartAdd},
+	{"setview", lui_chartSetView},
+	{"getview", lui_chartGetView},
+	{0, 0}
+};
+
+static const struct luaL_Reg lui_chart_funcs [] ={
+	{"series", lui_newSeries},
+	{"chart", lui_newChart},
+	{0, 0}
+};
+
+static int lui_init_chart(lua_State *L)
+{
+	luaL_setfuncs(L, lui_chart_funcs, 0);
+
+	lui_add_utility_type(L, LUI_SERIES, lui_series_methods, lui_series_meta);
+	lui_add_control_type(L, LUI_CHART, lui_chart_methods, lui_chart_meta);
+
+	return 1;
+}
@@ -45,6 +45,14 @@
  * Name: oncontentsizechanged
  * a function <code>oncontentsizechanged(window)</code> to be called when the user
  * changes the window size.
+ *** Property
+ * Object: window
+ * Name: throttle
+ * throttles oncontentsizechanged, see control.throttle.
+ *** Property
+ * Object: window
+ * Name: debounce
+ * debounces oncontentsizechanged, see control.debounce.
  */
 static int lui_window__index(lua_State *L)
 {
@@ -63,6 +71,8 @@ static int lui_window__index(lua_State *L)
 		lua_pushboolean(L, uiWindowBorderless(uiWindow(lobj->object)) != 0);
 	} else if (strcmp(what, "oncontentsizechanged") == 0) {
 		lui_objectGetHandler(L, "oncontentsizechanged");
+	} else if (strcmp(what, "throttle") == 0 || strcmp(what, "debounce") == 0) {
+		lui_objectGetGate(L, "oncontentsizechanged", what);
 	} else if (strcmp(what, "onclosing") == 0) {
 		lui_objectGetHandler(L, "onclosing");
 	} else {
@@ -90,6 +100,8 @@ static int lui_window__newindex(lua_State *L)
 		uiWindowSetBorderless(uiWindow(lobj->object), borderless);
 	} else if (strcmp(what, "oncontentsizechanged") == 0) {
 		lui_objectSetHandler(L, "oncontentsizechanged", 3);
+	} else if (strcmp(what, "throttle") == 0 || strcmp(what, "debounce") == 0) {
+		lui_objectSetGate(L, "oncontentsizechanged", what, 3);
 	} else if (strcmp(what, "onclosing") == 0) {
 		lui_objectSetHandler(L, "onclosing", 3);
 	} else {
@@ -101,9 +113,7 @@ static int lui_window__newindex(lua_State *L)
 static void lui_windowOnContentSizeChangedCallback(uiWindow *win, void *data)
 {
 	lua_State *L = (lua_State*) data;
-	int top = lua_gettop(L);
-	lui_objectHandlerCallback(L, uiControl(win), "oncontentsizechanged", top, 0, 0);
-	lua_settop(L, top);
+	lui_objectGatedCallback(L, uiControl(win), "oncontentsizechanged");
 }
 
 static int lui_windowOnClosingCallback(uiWindow *win, void *data)
@@ -118,6 +118,14 @@ static const luaL_Reg lui_button_meta[] = {
  * Name: onchanged
  * a function <code>onchanged(entry)</code> that is called when the contents
  * of the entry is changed by the user.
+ *** Property
+ * Object: entry
+ * Name: throttle
+ * throttles onchanged, see control.throttle.
+ *** Property
+ * Object: entry
+ * Name: debounce
+ * debounces onchanged, see control.debounce.
  */
 static int lui_entry__index(lua_State *L)
 {
@@ -132,6 +140,8 @@ static int lui_entry__index(lua_State *L)
 		lua_pushboolean(L, uiEntryReadOnly(uiEntry(lobj->object)) != 0);
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectGetHandler(L, "onchanged");
+	} else if (strcmp(what, "throttle") == 0 || strcmp(what, "debounce") == 0) {
+		lui_objectGetGate(L, "onchanged", what);
 	} else {
 		return lui_control__index(L);
 	}
@@ -151,6 +161,8 @@ static int lui_entry__newindex(lua_State *L)
 		uiEntrySetReadOnly(uiEntry(lobj->object), readonly);
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectSetHandler(L, "onchanged", 3);
+	} else if (strcmp(what, "throttle") == 0 || strcmp(what, "debounce") == 0) {
+		lui_objectSetGate(L, "onchanged", what, 3);
 	} else {
 		return lui_control__newindex(L);
 	}
@@ -160,9 +172,7 @@ static int lui_entry__newindex(lua_State *L)
 static void lui_entryOnChangedCallback(uiEntry *btn, void *data)
 {
 	lua_State *L = (lua_State*) data;
-	int top = lua_gettop(L);
-	lui_objectHandlerCallback(L, uiControl(btn), "onchanged", top, 0, 1);
-	lua_settop(L, top);
+	lui_objectGatedCallback(L, uiControl(btn), "onchanged");
 }
 
 static int lui_newBasicEntry(lua_State *L, uiEntry* (construct)(void))
@@ -399,6 +409,14 @@ static const luaL_Reg lui_label_meta[] = {
  * Name: onchanged
  * a function <code>function(spinbox)</code> that is called when the value
  * of the spinbox is changed by the user.
+ *** Property
+ * Object: spinbox
+ * Name: throttle
+ * throttles onchanged, see control.throttle.
+ *** Property
+ * Object: spinbox
+ * Name: debounce
+ * debounces onchanged, see control.debounce.
  */
 static int lui_spinbox__index(lua_State *L)
 {
@@ -409,6 +427,8 @@ static int lui_spinbox__index(lua_State *L)
 		lua_pushinteger(L, uiSpinboxValue(uiSpinbox(lobj->object)));
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectGetHandler(L, "onchanged");
+	} else if (strcmp(what, "throttle") == 0 || strcmp(what, "debounce") == 0) {
+		lui_objectGetGate(L, "onchanged", what);
 	} else {
 		return lui_control__index(L);
 	}
@@ -425,6 +445,8 @@ static int lui_spinbox__newindex(lua_State *L)
 		uiSpinboxSetValue(uiSpinbox(lobj->object), value);
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectSetHandler(L, "onchanged", 3);
+	} else if (strcmp(what, "throttle") == 0 || strcmp(what, "debounce") == 0) {
+		lui_objectSetGate(L, "onchanged", what, 3);
 	} else {
 		return lui_control__newindex(L);
 	}
@@ -434,9 +456,7 @@ static int lui_spinbox__newindex(lua_State *L)
 static void lui_spinboxOnChangedCallback(uiSpinbox *spb, void *data)
 {
 	lua_State *L = (lua_State*) data;
-	int top = lua_gettop(L);
-	lui_objectHandlerCallback(L, uiControl(spb), "onchanged", top, 0, 1);
-	lua_settop(L, top);
+	lui_objectGatedCallback(L, uiControl(spb), "onchanged");
 }
 
 /*** Constructor
@@ -559,6 +579,14 @@ static const luaL_Reg lui_progressbar_meta[] = {
  * Name: onchanged
  * a function <code>onchanged(slider)</code> that is called when the value of
  * the slider is changed by the user.
+ *** Property
+ * Object: slider
+ * Name: throttle
+ * throttles onchanged, see control.throttle.
+ *** Property
+ * Object: slider
+ * Name: debounce
+ * debounces onchanged, see control.debounce.
  */
 static int lui_slider__index(lua_State *L)
 {
@@ -569,6 +597,8 @@ static int lui_slider__index(lua_State *L)
 		lua_pushinteger(L, uiSliderValue(uiSlider(lobj->object)));
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectGetHandler(L, "onchanged");
+	} else if (strcmp(what, "throttle") == 0 || strcmp(what, "debounce") == 0) {
+		lui_objectGetGate(L, "onchanged", what);
 	} else {
 		return lui_control__index(L);
 	}
@@ -585,6 +615,8 @@ static int lui_slider__newindex(lua_State *L)
 		uiSliderSetValue(uiSlider(lobj->object), value);
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectSetHandler(L, "onchanged", 3);
+	} else if (strcmp(what, "throttle") == 0 || strcmp(what, "debounce") == 0) {
+		lui_objectSetGate(L, "onchanged", what, 3);
 	} else {
 		return lui_control__newindex(L);
 	}
@@ -594,9 +626,7 @@ static int lui_slider__newindex(lua_State *L)
 static void lui_sliderOnChangedCallback(uiSlider *spb, void *data)
 {
 	lua_State *L = (lua_State*) data;
-	int top = lua_gettop(L);
-	lui_objectHandlerCallback(L, uiControl(spb), "onchanged", top, 0, 1);
-	lua_settop(L, top);
+	lui_objectGatedCallback(L, uiControl(spb), "onchanged");
 }
 
 /*** Constructor
@@ -1292,34 +1322,275 @@ static const luaL_Reg lui_dateTimePicker_meta[] = {
  * a multiline entry control
  */
 #define LUI_MULTILINEENTRY "lui_multilineentry"
-#define lui_pushMultilineEntry(L) lui_pushObject(L, LUI_MULTILINEENTRY, 1)
-#define lui_checkMultilineEntry(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_MULTILINEENTRY))
+#define lui_pushMultilineEntry(L) ((lui_multilineEntryObject*)lui_pushObjectSized(L, LUI_MULTILINEENTRY, 1, sizeof(lui_multilineEntryObject)))
+#define lui_checkMultilineEntry(L, pos) ((lui_multilineEntryObject*)luaL_checkudata(L, pos, LUI_MULTILINEENTRY))
+
+typedef struct lui_multilineEntryObject {
+	void *object;
+	int flushms;			/* -1: unbuffered, 0: every loop turn, else ms */
+	char *buf;				/* appended text not yet passed to the control */
+	size_t len, size;
+	double due;				/* when the buffer is to be flushed */
+	int queued;
+	struct lui_multilineEntryObject *nextqueued;
+	int maxlines;
+	int newlines;			/* newlines in the text, -1 if unknown */
+	int open;				/* whether the last line has no newline yet */
+} lui_multilineEntryObject;
+
+/* implemented in loop.inc.c */
+static double lui_monotonicMs(void);
+
+/* lui_multilineentry_trim
+ *
+ * remove lines from the start of the text of e, so that at most keep lines
+ * remain. Returns the number of lines e contains afterwards.
+ */
+static int lui_multilineentry_trim(uiMultilineEntry *e, int keep)
+{
+	char *text = uiMultilineEntryText(e);
+	size_t len = strlen(text);
+	int lines = len > 0 ? 1 : 0;
+	/* a trailing newline does not start another line */
+	for (size_t i = len > 0 ? len - 1 : 0; i-- > 0; ) {
+		if (text[i] == '\n') {
+			if (lines == keep) {
+				uiMultilineEntrySetText(e, text + i + 1);
+				break;
+			}
+			lines += 1;
+		}
+	}
+	uiFreeText(text);
+	return lines;
+}
+
+/* count the newlines in text, and note whether it ends in an open line */
+static int lui_multilineEntryCount(const char *text, size_t len, int *open)
+{
+	int newlines = 0;
+	for (size_t i = 0; i < len; ++i) {
+		newlines += text[i] == '\n';
+	}
+	if (len > 0) {
+		*open = text[len - 1] != '\n';
+	}
+	return newlines;
+}
+
+/* lui_multilineEntryWrite
+ *
+ * append len bytes of text (which must be 0 terminated) to the control and
+ * enforce maxlines. Once there are more than maxlines lines, the oldest ones
+ * are dropped in bulk, so that only 7/8 of maxlines remain and the control
+ * is not trimmed again on every following line. If the new text alone has
+ * enough lines, the control is set to its tail instead.
+ */
+static void lui_multilineEntryWrite(lui_multilineEntryObject *mobj, const char *text, size_t len)
+{
+	uiMultilineEntry *e = uiMultilineEntry(mobj->object);
+	if (len == 0) {
+		return;
+	}
+	if (mobj->maxlines <= 0) {
+		uiMultilineEntryAppend(e, text);
+		return;
+	}
+	int keep = mobj->maxlines - mobj->maxlines / 8;
+	int open = 0;
+	int newlines = lui_multilineEntryCount(text, len, &open);
+	if (newlines + open > keep) {
+		/* the new text replaces everything, find the start of its tail */
+		size_t start = 0;
+		int lines = 1;
+		for (size_t i = len - 1; i-- > 0; ) {
+			if (text[i] == '\n') {
+				if (lines == keep) {
+					start = i + 1;
+					break;
+				}
+				lines += 1;
+			}
+		}
+		uiMultilineEntrySetText(e, text + start);
+		mobj->newlines = keep - open;
+		mobj->open = open;
+		return;
+	}
+	uiMultilineEntryAppend(e, text);
+	if (mobj->newlines < 0) {
+		char *all = uiMultilineEntryText(e);
+		mobj->newlines = lui_multilineEntryCount(all, strlen(all), &mobj->open);
+		uiFreeText(all);
+	} else {
+		mobj->newlines += newlines;
+		mobj->open = open;
+	}
+	if (mobj->newlines + mobj->open > mobj->maxlines) {
+		mobj->newlines = lui_multilineentry_trim(e, keep) - mobj->open;
+	}
+}
+
+/* multiline entries with buffered text, flushed together */
+static struct {
+	lui_multilineEntryObject *queue;
+	int turnqueued;			/* a flush is queued with uiQueueMain */
+	unsigned armgen;		/* generation of the last flush timer */
+	double armedfor;		/* time the flush timer fires, 0 if none */
+} lui_multilineEntryFlush;
+
+static void lui_multilineEntryUnqueue(lui_multilineEntryObject *mobj)
+{
+	if (mobj->queued) {
+		lui_multilineEntryObject **m = &lui_multilineEntryFlush.queue;
+		while (*m != mobj) {
+			m = &(*m)->nextqueued;
+		}
+		*m = mobj->nextqueued;
+		mobj->nextqueued = NULL;
+		mobj->queued = 0;
+	}
+}
+
+/* pass the buffered text of mobj to the control in one piece */
+static void lui_multilineEntryFlushBuffer(lui_multilineEntryObject *mobj)
+{
+	lui_multilineEntryUnqueue(mobj);
+	if (mobj->len > 0 && mobj->object) {
+		mobj->buf[mobj->len] = 0;
+		lui_multilineEntryWrite(mobj, mobj->buf, mobj->len);
+	}
+	mobj->len = 0;
+	/* do not keep the memory of a single large burst around */
+	if (mobj->size > 65536) {
+		free(mobj->buf);
+		mobj->buf = NULL;
+		mobj->size = 0;
+	}
+}
+
+static int lui_multilineEntryFlushTimer(void *data);
+
+static void lui_multilineEntryFlushDue(void)
+{
+	double now = lui_monotonicMs(), next = 0;
+	lui_multilineEntryObject **m = &lui_multilineEntryFlush.queue;
+	while (*m) {
+		lui_multilineEntryObject *mobj = *m;
+		if (mobj->due <= now) {
+			lui_multilineEntryFlushBuffer(mobj);
+		} else {
+			if (next == 0 || mobj->due < next) {
+				next = mobj->due;
+			}
+			m = &mobj->nextqueued;
+		}
+	}
+	if (next > 0 && (lui_multilineEntryFlush.armedfor == 0 || lui_multilineEntryFlush.armedfor > next)) {
+		int ms = (int) ceil(next - now);
+		lui_multilineEntryFlush.armgen += 1;
+		lui_multilineEntryFlush.armedfor = next;
+		uiTimer(ms > 0 ? ms : 0, lui_multilineEntryFlushTimer, (void*)(uintptr_t) lui_multilineEntryFlush.armgen);
+	}
+}
+
+static int lui_multilineEntryFlushTimer(void *data)
+{
+	if ((unsigned)(uintptr_t) data == lui_multilineEntryFlush.armgen) {
+		lui_multilineEntryFlush.armedfor = 0;
+	}
+	lui_multilineEntryFlushDue();
+	return 0;
+}
+
+static void lui_multilineEntryFlushTurn(void *data)
+{
+	lui_multilineEntryFlush.turnqueued = 0;
+	lui_multilineEntryFlushDue();
+}
+
+/* add text to the buffer of mobj and make sure it is flushed in time */
+static void lui_multilineEntryBuffer(lui_multilineEntryObject *mobj, const char *text, size_t len)
+{
+	if (mobj->len + len + 1 > mobj->size) {
+		size_t size = mobj->size > 0 ? mobj->size : 256;
+		while (size < mobj->len + len + 1) {
+			size *= 2;
+		}
+		char *buf = realloc(mobj->buf, size);
+		if (!buf) {
+			lui_multilineEntryFlushBuffer(mobj);
+			lui_multilineEntryWrite(mobj, text, len);
+			return;
+		}
+		mobj->buf = buf;
+		mobj->size = size;
+	}
+	memcpy(mobj->buf + mobj->len, text, len);
+	mobj->len += len;
+	if (!mobj->queued) {
+		mobj->queued = 1;
+		mobj->due = mobj->flushms > 0 ? lui_monotonicMs() + mobj->flushms : 0;
+		mobj->nextqueued = lui_multilineEntryFlush.queue;
+		lui_multilineEntryFlush.queue = mobj;
+		if (mobj->flushms > 0) {
+			lui_multilineEntryFlushDue();
+		} else if (!lui_multilineEntryFlush.turnqueued) {
+			lui_multilineEntryFlush.turnqueued = 1;
+			uiQueueMain(lui_multilineEntryFlushTurn, NULL);
+		}
+	}
+}
 
 /*** Property
  * Object: multilineentry
  * Name: text
- * the text the multiline entry contains.
+ * the text the multiline entry contains. Buffered text is flushed before
+ * the text is read, and discarded when it is set.
  *** Property
  * Object: multilineentry
  * Name: readonly
  * true if the multiline entry is / should be read only, false if not.
  *** Property
  * Object: multilineentry
+ * Name: buffered
+ * false (the default) if appended text is passed to the control right
+ * away. If true, text appended while handling an event is collected and
+ * inserted in one piece on the next turn of the main loop, if a number,
+ * it is inserted at most every that many milliseconds. Use this for log
+ * consoles that receive many small appends.
+ *** Property
+ * Object: multilineentry
+ * Name: maxlines
+ * if greater than 0, the maximum number of lines the multiline entry keeps.
+ * When appending exceeds it, the oldest lines are removed in bulk, down to
+ * 7/8 of maxlines. Defaults to 0, for no limit.
+ *** Property
+ * Object: multilineentry
  * Name: onchanged
  * a function <code>onchanged(multilineentry)</code> that is called when the
  * contents of the multilineentry is changed by the user.
  */
 static int lui_multilineEntry__index(lua_State *L)
 {
-	lui_object *lobj = lui_checkMultilineEntry(L, 1);
+	lui_multilineEntryObject *lobj = lui_checkMultilineEntry(L, 1);
 	const char *what = luaL_checkstring(L, 2);
 
 	if (strcmp(what, "text") == 0) {
+		lui_multilineEntryFlushBuffer(lobj);
 		char *text = uiMultilineEntryText(uiMultilineEntry(lobj->object));
 		lua_pushstring(L, text);
 		uiFreeText(text);
 	} else if (strcmp(what, "readonly") == 0) {
 		lua_pushboolean(L, uiMultilineEntryReadOnly(uiMultilineEntry(lobj->object)) != 0);
+	} else if (strcmp(what, "buffered") == 0) {
+		if (lobj->flushms > 0) {
+			lua_pushinteger(L, lobj->flushms);
+		} else {
+			lua_pushboolean(L, lobj->flushms == 0);
+		}
+	} else if (strcmp(what, "maxlines") == 0) {
+		lua_pushinteger(L, lobj->maxlines);
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectGetHandler(L, "onchanged");
 	} else {
@@ -1330,15 +1601,37 @@ static int lui_multilineEntry__index(lua_State *L)
 
 static int lui_multilineEntry__newindex(lua_State *L)
 {
-	lui_object *lobj = lui_checkMultilineEntry(L, 1);
+	lui_multilineEntryObject *lobj = lui_checkMultilineEntry(L, 1);
 	const char *what = luaL_checkstring(L, 2);
 
 	if (strcmp(what, "text") == 0) {
-		const char *text = luaL_checkstring(L, 3);
+		size_t len;
+		const char *text = luaL_checklstring(L, 3, &len);
+		lui_multilineEntryUnqueue(lobj);
+		lobj->len = 0;
+		lobj->open = 0;
+		lobj->newlines = lui_multilineEntryCount(text, len, &lobj->open);
 		uiMultilineEntrySetText(uiMultilineEntry(lobj->object), text);
 	} else if (strcmp(what, "readonly") == 0) {
 		int readonly = lua_toboolean(L, 3);
 		uiMultilineEntrySetReadOnly(uiMultilineEntry(lobj->object), readonly);
+	} else if (strcmp(what, "buffered") == 0) {
+		if (lua_type(L, 3) == LUA_TNUMBER) {
+			int ms = (int) lua_tointeger(L, 3);
+			lobj->flushms = ms > 0 ? ms : 0;
+		} else {
+			lobj->flushms = lua_toboolean(L, 3) ? 0 : -1;
+		}
+		/* buffered text must not wait for a different schedule */
+		lui_multilineEntryFlushBuffer(lobj);
+	} else if (strcmp(what, "maxlines") == 0) {
+		int maxlines = (int) luaL_checkinteger(L, 3);
+		lobj->maxlines = maxlines > 0 ? maxlines : 0;
+		if (lobj->maxlines > 0) {
+			lui_multilineEntryFlushBuffer(lobj);
+			lui_multilineentry_trim(uiMultilineEntry(lobj->object), lobj->maxlines);
+			lobj->newlines = -1;
+		}
 	} else if (strcmp(what, "onchanged") == 0) {
 		lui_objectSetHandler(L, "onchanged", 3);
 	} else {
@@ -1351,23 +1644,51 @@ static int lui_multilineEntry__newindex(lua_State *L)
  * Object: multilineentry
  * Name: append
  * Signature: multilineentry:append(text, ...)
- * append one or more text pieces to the multilineentry control.
+ * append one or more text pieces to the multilineentry control. The pieces
+ * are inserted together, or buffered if the buffered property is set.
  */
 static int lui_multilineEntryAppend(lua_State *L)
 {
-	lui_object *lobj = lui_checkMultilineEntry(L, 1);
-	const char *text = lua_tostring(L, 2);
-	uiMultilineEntryAppend(uiMultilineEntry(lobj->object), text);
-	for (int i = 3; i <= lua_gettop(L); ++i) {
-		text = lua_tostring(L, i);
-		uiMultilineEntryAppend(uiMultilineEntry(lobj->object), text);
-	}	return 0;
+	lui_multilineEntryObject *lobj = lui_checkMultilineEntry(L, 1);
+	int top = lua_gettop(L);
+	for (int i = 2; i <= top; ++i) {
+		luaL_checkstring(L, i);
+	}
+	if (top > 2) {
+		lua_concat(L, top - 1);
+	}
+	size_t len;
+	const char *text = luaL_optlstring(L, 2, "", &len);
+	if (lobj->flushms >= 0) {
+		lui_multilineEntryBuffer(lobj, text, len);
+	} else {
+		lui_multilineEntryWrite(lobj, text, len);
+	}
+	return 0;
+}
+
+/*** Method
+ * Object: multilineentry
+ * Name: flush
+ * Signature: multilineentry:flush()
+ * insert all buffered text into the multilineentry control right away.
+ */
+static int lui_multilineEntryFlushMethod(lua_State *L)
+{
+	lui_multilineEntryObject *lobj = lui_checkMultilineEntry(L, 1);
+	lui_multilineEntryFlushBuffer(lobj);
+	return 0;
 }
 
 static void lui_multilineEntryOnChangedCallback(uiMultilineEntry *spb, void *data)
 {
 	lua_State *L = (lua_State*) data;
 	int top = lua_gettop(L);
+	if (lui_findObject(L, uiControl(spb)) != LUA_TNIL) {
+		/* the user edited the text, lines must be counted again */
+		lui_checkMultilineEntry(L, -1)->newlines = -1;
+	}
+	lua_settop(L, top);
 	lui_objectHandlerCallback(L, uiControl(spb), "onchanged", top, 0, 1);
 	lua_settop(L, top);
 }
@@ -1385,20 +1706,32 @@ static int lui_newMultilineEntry(lua_State *L)
 	int nowrapping = lua_toboolean(L, 1);
 	int hastable = lui_aux_istable(L, 2);
 
-	lui_object *lobj = lui_pushMultilineEntry(L);
+	lui_multilineEntryObject *lobj = lui_pushMultilineEntry(L);
 	if (nowrapping) {
 		lobj->object = uiNewNonWrappingMultilineEntry();
 	} else {
 		lobj->object = uiNewMultilineEntry();
 	}
+	lobj->flushms = -1;
 	uiMultilineEntryOnChanged(uiMultilineEntry(lobj->object), lui_multilineEntryOnChangedCallback, L);
 	if (hastable) { lui_aux_setFieldsFromTable(L, lua_gettop(L), 2); }
 	lui_registerObject(L, lua_gettop(L));
 	return 1;
 }
 
+static int lui_multilineEntry__gc(lua_State *L)
+{
+	lui_multilineEntryObject *lobj = lui_checkMultilineEntry(L, 1);
+	lui_multilineEntryUnqueue(lobj);
+	free(lobj->buf);
+	lobj->buf = NULL;
+	lobj->len = lobj->size = 0;
+	return lui_control__gc(L);
+}
+
 /* metamethods for multiline entry */
 static const luaL_Reg lui_multilineEntry_meta[] = {
+	{"__gc", lui_multilineEntry__gc},
 	{"__index", lui_multilineEntry__index},
 	{"__newindex", lui_multilineEntry__newindex},
 	{0, 0}
@@ -1407,6 +1740,7 @@ static const luaL_Reg lui_multilineEntry_meta[] = {
 /* methods for multiline entry */
 static const luaL_Reg lui_multilineEntry_methods[] = {
 	{"append", lui_multilineEntryAppend},
+	{"flush", lui_multilineEntryFlushMethod},
 	{0, 0}
 };
 
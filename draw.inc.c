@@ -47,10 +47,14 @@ static int lui_drawbrush_setGradientStops(lua_State *L, uiDrawBrush *brush, int
 		if (lua_type(L, lua_gettop(L)) != LUA_TTABLE) {
 			return luaL_error(L, "invalid value in table for gradientstops");
 		}
-		lui_aux_rgbaFromTable(L, lua_gettop(L), &stop->R, &stop->G, &stop->B, &stop->A);
-		lua_geti(L, -1, 1);
+		if (lua_geti(L, -1, 2) != LUA_TNIL) {
+			lui_aux_rgbaFromValue(L, -1, &stop->R, &stop->G, &stop->B, &stop->A);
+		} else {
+			lui_aux_rgbaFromTable(L, -2, &stop->R, &stop->G, &stop->B, &stop->A);
+		}
+		lua_geti(L, -2, 1);
 		stop->Pos = luaL_checknumber(L, -1);
-		lua_pop(L, 2);
+		lua_pop(L, 3);
 	}
 	return 1;
 }
@@ -64,7 +68,13 @@ static int lui_drawbrush_getGradientStops(lua_State *L, uiDrawBrush *brush)
 	lua_newtable(L);
 	for (int i = 0; i < brush->NumStops; ++i) {
 		uiDrawBrushGradientStop *stop = &brush->Stops[i];
-		lui_aux_pushRgbaAsTable(L, stop->R, stop->G, stop->B, stop->A);
+		if (lui_colorPacked) {
+			lua_createtable(L, 2, 0);
+			lua_pushinteger(L, lui_aux_packRgba(stop->R, stop->G, stop->B, stop->A));
+			lua_rawseti(L, -2, 2);
+		} else {
+			lui_aux_pushRgbaAsTable(L, stop->R, stop->G, stop->B, stop->A);
+		}
 		lua_pushnumber(L, stop->Pos);
 		lua_rawseti(L, -2, 1);
 		lua_seti(L, -2, i + 1);
@@ -80,7 +90,9 @@ static int lui_drawbrush_getGradientStops(lua_State *L, uiDrawBrush *brush)
  *** Property
  * Object: draw.brush
  * Name: color
- * color of the brush
+ * color of the brush, a table {r = ?, g = ?, b = ?, a = ?}, a packed integer
+ * 0xRRGGBBAA or a string "#rrggbb[aa]". See lui.colorformat() for how it is
+ * returned.
  *** Property
  * Object: draw.brush
  * Name: x0
@@ -104,7 +116,8 @@ static int lui_drawbrush_getGradientStops(lua_State *L, uiDrawBrush *brush)
  *** Property
  * Object: draw.brush
  * Name: gradientstops
- * { { pos, r=?, g=?, b=?, a=?}, ... }, don't modify what you read
+ * { { pos, r=?, g=?, b=?, a=?}, ... } or { { pos, color }, ... } with any
+ * color value, don't modify what you read
  */
 static int lui_drawbrush__index(lua_State *L)
 {
@@ -115,7 +128,7 @@ static int lui_drawbrush__index(lua_State *L)
 	if (strcmp(what, "type") == 0) {
 		lui_aux_pushNameOrValue(L, brush->Type, "lui_enumbrushtype");
 	} else if (strcmp(what, "color") == 0) {
-		lui_aux_pushRgbaAsTable(L, brush->R, brush->A, brush->B, brush->A);
+		lui_aux_pushRgba(L, brush->R, brush->G, brush->B, brush->A);
 	} else if (strcmp(what, "x0") == 0) {
 		lua_pushnumber(L, brush->X0);
 	} else if (strcmp(what, "y0") == 0) {
@@ -127,11 +140,13 @@ static int lui_drawbrush__index(lua_State *L)
 	} else if (strcmp(what, "outerradius") == 0) {
 		lua_pushnumber(L, brush->OuterRadius);
 	} else if (strcmp(what, "gradientstops") == 0) {
-		if (lui_aux_getUservalue(L, 1, "gradientstops") == LUA_TNIL) {
+		/* cached separately for each color format */
+		const char *cached = lui_colorPacked ? "packedgradientstops" : "gradientstops";
+		if (lui_aux_getUservalue(L, 1, cached) == LUA_TNIL) {
 			DEBUGMSG("(uncached)");
 			lua_pop(L, 1);
 			lui_drawbrush_getGradientStops(L, brush);
-			lui_aux_setUservalue(L, 1, "gradientstops", 3);
+			lui_aux_setUservalue(L, 1, cached, 3);
 		}
 	} else {
 		return lui_utility__index(L);
@@ -148,10 +163,7 @@ static int lui_drawbrush__newindex(lua_State *L)
 	if (strcmp(what, "type") == 0) {
 		brush->Type = lui_aux_getNumberOrValue(L, 3, "lui_enumbrushtype");
 	} else if (strcmp(what, "color") == 0) {
-		if (lua_type(L, 3) != LUA_TTABLE) {
-			return luaL_error(L, "invalid value for gradientstops");
-		}
-		lui_aux_rgbaFromTable(L, 3, &brush->R, &brush->G, &brush->B, &brush->A);
+		lui_aux_rgbaFromValue(L, 3, &brush->R, &brush->G, &brush->B, &brush->A);
 	} else if (strcmp(what, "x0") == 0) {
 		brush->X0 = lua_tonumber(L, 3);
 	} else if (strcmp(what, "y0") == 0) {
@@ -164,9 +176,8 @@ static int lui_drawbrush__newindex(lua_State *L)
 		brush->OuterRadius = lua_tonumber(L, 3);
 	} else if (strcmp(what, "gradientstops") == 0) {
 		lui_drawbrush_setGradientStops(L, brush, 3);
-		lua_pushnil(L);
-		lui_aux_setUservalue(L, 1, "gradientstops", 4);
-		lua_pop(L, 1);
+		lui_aux_clearUservalue(L, 1, "gradientstops");
+		lui_aux_clearUservalue(L, 1, "packedgradientstops");
 	} else {
 		return lui_utility__newindex(L);
 	}
@@ -200,6 +211,22 @@ static int lui_newDrawBrush(lua_State *L)
 	return 1;
 }
 
+/* copy a brush, including its gradient stops. Returns 0 if out of memory */
+static int lui_drawbrush_copy(uiDrawBrush *dst, const uiDrawBrush *src)
+{
+	*dst = *src;
+	dst->Stops = 0;
+	if (src->NumStops > 0) {
+		dst->Stops = malloc(src->NumStops * sizeof(uiDrawBrushGradientStop));
+		if (!dst->Stops) {
+			dst->NumStops = 0;
+			return 0;
+		}
+		memcpy(dst->Stops, src->Stops, src->NumStops * sizeof(uiDrawBrushGradientStop));
+	}
+	return 1;
+}
+
 /* metamethods for draw.brush */
 static const luaL_Reg lui_drawbrush_meta[] = {
 	{"__index", lui_drawbrush__index},
@@ -380,6 +407,35 @@ static int lui_newDrawStrokeParams(lua_State *L)
 	return 1;
 }
 
+/* copy strokeparams, including the dashes. Returns 0 if out of memory */
+static int lui_drawstrokeparams_copy(uiDrawStrokeParams *dst, const uiDrawStrokeParams *src)
+{
+	*dst = *src;
+	dst->Dashes = 0;
+	if (src->NumDashes > 0) {
+		dst->Dashes = malloc(src->NumDashes * sizeof(double));
+		if (!dst->Dashes) {
+			dst->NumDashes = 0;
+			return 0;
+		}
+		memcpy(dst->Dashes, src->Dashes, src->NumDashes * sizeof(double));
+	}
+	return 1;
+}
+
+/* how far a stroke may reach beyond the path it follows */
+static double lui_drawstrokeparams_extent(const uiDrawStrokeParams *sp)
+{
+	double w = sp->Thickness / 2;
+	if (sp->Join == uiDrawLineJoinMiter && sp->MiterLimit > 1) {
+		w *= sp->MiterLimit;
+	}
+	if (sp->Cap == uiDrawLineCapSquare) {
+		w *= 1.5;
+	}
+	return w;
+}
+
 /* metamethods for draw.strokeparams */
 static const luaL_Reg lui_drawstrokeparams_meta[] = {
 	{"__index", lui_drawstrokeparams__index},
@@ -398,6 +454,52 @@ static const luaL_Reg lui_drawstrokeparams_meta[] = {
 #define lui_pushDrawMatrix(L) lui_pushObject(L, LUI_DRAWMATRIX, 0)
 #define lui_checkDrawMatrix(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_DRAWMATRIX))
 
+/* native matrix helpers, used to keep track of transformations for
+ * culling. They do the same math as libui, without the round trip through
+ * the platform. */
+static void lui_drawmatrix_identity(uiDrawMatrix *m)
+{
+	m->M11 = m->M22 = 1;
+	m->M12 = m->M21 = m->M31 = m->M32 = 0;
+}
+
+/* r = a, followed by b. r may be the same as a or b */
+static void lui_drawmatrix_then(uiDrawMatrix *r, const uiDrawMatrix *a, const uiDrawMatrix *b)
+{
+	uiDrawMatrix t;
+	t.M11 = a->M11 * b->M11 + a->M12 * b->M21;
+	t.M12 = a->M11 * b->M12 + a->M12 * b->M22;
+	t.M21 = a->M21 * b->M11 + a->M22 * b->M21;
+	t.M22 = a->M21 * b->M12 + a->M22 * b->M22;
+	t.M31 = a->M31 * b->M11 + a->M32 * b->M21 + b->M31;
+	t.M32 = a->M31 * b->M12 + a->M32 * b->M22 + b->M32;
+	*r = t;
+}
+
+/* transform the box b = {x0, y0, x1, y1} with m, and return the axis
+ * aligned box around the result in r. */
+static void lui_drawmatrix_bounds(const uiDrawMatrix *m, const double *b, double *r)
+{
+	if (m->M12 == 0 && m->M21 == 0) {
+		double x0 = b[0] * m->M11 + m->M31, x1 = b[2] * m->M11 + m->M31;
+		double y0 = b[1] * m->M22 + m->M32, y1 = b[3] * m->M22 + m->M32;
+		r[0] = x0 < x1 ? x0 : x1;
+		r[2] = x0 < x1 ? x1 : x0;
+		r[1] = y0 < y1 ? y0 : y1;
+		r[3] = y0 < y1 ? y1 : y0;
+		return;
+	}
+	for (int i = 0; i < 4; ++i) {
+		double x = b[(i & 1) ? 2 : 0], y = b[(i & 2) ? 3 : 1];
+		double tx = m->M11 * x + m->M21 * y + m->M31;
+		double ty = m->M12 * x + m->M22 * y + m->M32;
+		if (i == 0 || tx < r[0]) r[0] = tx;
+		if (i == 0 || tx > r[2]) r[2] = tx;
+		if (i == 0 || ty < r[1]) r[1] = ty;
+		if (i == 0 || ty > r[3]) r[3] = ty;
+	}
+}
+
 /*** Method
  * Object: draw.matrix
  * Name: setidentity
@@ -602,16 +704,201 @@ static const luaL_Reg lui_drawmatrix_methods[] = {
  */
 #define uiDrawPath(this) ((uiDrawPath *) (this))
 #define LUI_DRAWPATH "lui_drawpath"
-#define lui_pushDrawPath(L) lui_pushObject(L, LUI_DRAWPATH, 0)
-#define lui_checkDrawPath(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_DRAWPATH))
+#define lui_pushDrawPath(L) ((lui_drawPathObject*)lui_pushObjectSized(L, LUI_DRAWPATH, 0, sizeof(lui_drawPathObject)))
+#define lui_checkDrawPath(L, pos) ((lui_drawPathObject*)luaL_checkudata(L, pos, LUI_DRAWPATH))
+
+/* libui has no way to query a path, so lui keeps track of its bounding box
+ * itself. The box is conservative: arcs count with their full circle, and
+ * bezier curves with their control points. */
+#ifdef LUI_GTK
+enum {
+	LUI_PATH_NEWFIGURE,
+	LUI_PATH_NEWFIGUREARC,
+	LUI_PATH_LINETO,
+	LUI_PATH_ARCTO,
+	LUI_PATH_BEZIERTO,
+	LUI_PATH_CLOSEFIGURE,
+	LUI_PATH_RECTANGLE
+};
+
+/* a piece of a path. Paths are also recorded by lui on GTK, so that tiles
+ * can draw them with cairo from other threads, where libui's drawing
+ * functions must not be used. */
+typedef struct {
+	int type;
+	int negative;
+	double d[6];
+} lui_pathPiece;
+#endif
+
+typedef struct {
+	void *object;
+	double bounds[4];
+	int empty;
+#ifdef LUI_GTK
+	int fillmode;
+	lui_pathPiece *pieces;
+	int numpieces, maxpieces;
+	int incomplete;			/* recording the pieces ran out of memory */
+#endif
+} lui_drawPathObject;
+
+static void lui_drawpath_extend(lui_drawPathObject *path, double x0, double y0, double x1, double y1)
+{
+	if (path->empty) {
+		path->bounds[0] = x0;
+		path->bounds[1] = y0;
+		path->bounds[2] = x1;
+		path->bounds[3] = y1;
+		path->empty = 0;
+		return;
+	}
+	if (x0 < path->bounds[0]) path->bounds[0] = x0;
+	if (y0 < path->bounds[1]) path->bounds[1] = y0;
+	if (x1 > path->bounds[2]) path->bounds[2] = x1;
+	if (y1 > path->bounds[3]) path->bounds[3] = y1;
+}
+
+#define lui_drawpath_extendPoint(path, x, y) lui_drawpath_extend((path), (x), (y), (x), (y))
+
+#ifdef LUI_GTK
+static void lui_drawpath_record(lui_drawPathObject *path, int type, int negative, double d0, double d1, double d2, double d3, double d4, double d5)
+{
+	if (path->incomplete) {
+		return;
+	}
+	if (path->numpieces == path->maxpieces) {
+		int max = path->maxpieces ? path->maxpieces * 2 : 8;
+		lui_pathPiece *pieces = realloc(path->pieces, max * sizeof(lui_pathPiece));
+		if (!pieces) {
+			path->incomplete = 1;
+			return;
+		}
+		path->pieces = pieces;
+		path->maxpieces = max;
+	}
+	lui_pathPiece *p = &path->pieces[path->numpieces++];
+	p->type = type;
+	p->negative = negative;
+	p->d[0] = d0; p->d[1] = d1; p->d[2] = d2;
+	p->d[3] = d3; p->d[4] = d4; p->d[5] = d5;
+}
+
+/* build the path in cr, like libui does on GTK */
+static void lui_drawpath_cairo(cairo_t *cr, lui_drawPathObject *path)
+{
+	cairo_new_path(cr);
+	for (int i = 0; i < path->numpieces; ++i) {
+		lui_pathPiece *p = &path->pieces[i];
+		double sweep = p->d[4] > 2 * uiPi ? 2 * uiPi : p->d[4];
+		switch (p->type) {
+			case LUI_PATH_NEWFIGURE:
+				cairo_move_to(cr, p->d[0], p->d[1]);
+				break;
+			case LUI_PATH_NEWFIGUREARC:
+				cairo_new_sub_path(cr);
+				/* fall through */
+			case LUI_PATH_ARCTO:
+				if (p->negative) {
+					cairo_arc_negative(cr, p->d[0], p->d[1], p->d[2], p->d[3], p->d[3] - sweep);
+				} else {
+					cairo_arc(cr, p->d[0], p->d[1], p->d[2], p->d[3], p->d[3] + sweep);
+				}
+				break;
+			case LUI_PATH_LINETO:
+				cairo_line_to(cr, p->d[0], p->d[1]);
+				break;
+			case LUI_PATH_BEZIERTO:
+				cairo_curve_to(cr, p->d[0], p->d[1], p->d[2], p->d[3], p->d[4], p->d[5]);
+				break;
+			case LUI_PATH_CLOSEFIGURE:
+				cairo_close_path(cr);
+				break;
+			case LUI_PATH_RECTANGLE:
+				cairo_rectangle(cr, p->d[0], p->d[1], p->d[2], p->d[3]);
+				break;
+		}
+	}
+	cairo_set_fill_rule(cr, path->fillmode == uiDrawFillModeAlternate ? CAIRO_FILL_RULE_EVEN_ODD : CAIRO_FILL_RULE_WINDING);
+}
+#else
+#define lui_drawpath_record(path, type, negative, d0, d1, d2, d3, d4, d5)
+#endif
+
+/* the functions below add to a path, and keep its bounds and pieces */
+static void lui_drawpath_newFigure(lui_drawPathObject *path, double x, double y)
+{
+	uiDrawPathNewFigure(uiDrawPath(path->object), x, y);
+	lui_drawpath_extendPoint(path, x, y);
+	lui_drawpath_record(path, LUI_PATH_NEWFIGURE, 0, x, y, 0, 0, 0, 0);
+}
+
+static void lui_drawpath_newFigureWithArc(lui_drawPathObject *path, double xcenter, double ycenter, double radius, double start, double sweep, int negative)
+{
+	uiDrawPathNewFigureWithArc(uiDrawPath(path->object), xcenter, ycenter, radius, start, sweep, negative);
+	lui_drawpath_extend(path, xcenter - radius, ycenter - radius, xcenter + radius, ycenter + radius);
+	lui_drawpath_record(path, LUI_PATH_NEWFIGUREARC, negative, xcenter, ycenter, radius, start, sweep, 0);
+}
+
+static void lui_drawpath_lineTo(lui_drawPathObject *path, double x, double y)
+{
+	uiDrawPathLineTo(uiDrawPath(path->object), x, y);
+	lui_drawpath_extendPoint(path, x, y);
+	lui_drawpath_record(path, LUI_PATH_LINETO, 0, x, y, 0, 0, 0, 0);
+}
+
+static void lui_drawpath_arcTo(lui_drawPathObject *path, double xcenter, double ycenter, double radius, double start, double sweep, int negative)
+{
+	uiDrawPathArcTo(uiDrawPath(path->object), xcenter, ycenter, radius, start, sweep, negative);
+	lui_drawpath_extend(path, xcenter - radius, ycenter - radius, xcenter + radius, ycenter + radius);
+	lui_drawpath_record(path, LUI_PATH_ARCTO, negative, xcenter, ycenter, radius, start, sweep, 0);
+}
+
+static void lui_drawpath_bezierTo(lui_drawPathObject *path, double c1x, double c1y, double c2x, double c2y, double x, double y)
+{
+	uiDrawPathBezierTo(uiDrawPath(path->object), c1x, c1y, c2x, c2y, x, y);
+	lui_drawpath_extendPoint(path, c1x, c1y);
+	lui_drawpath_extendPoint(path, c2x, c2y);
+	lui_drawpath_extendPoint(path, x, y);
+	lui_drawpath_record(path, LUI_PATH_BEZIERTO, 0, c1x, c1y, c2x, c2y, x, y);
+}
+
+static void lui_drawpath_closeFigure(lui_drawPathObject *path)
+{
+	uiDrawPathCloseFigure(uiDrawPath(path->object));
+	lui_drawpath_record(path, LUI_PATH_CLOSEFIGURE, 0, 0, 0, 0, 0, 0, 0);
+}
+
+static void lui_drawpath_addRectangle(lui_drawPathObject *path, double x, double y, double w, double h)
+{
+	uiDrawPathAddRectangle(uiDrawPath(path->object), x, y, w, h);
+	lui_drawpath_extendPoint(path, x, y);
+	lui_drawpath_extendPoint(path, x + w, y + h);
+	lui_drawpath_record(path, LUI_PATH_RECTANGLE, 0, x, y, w, h, 0, 0);
+}
+
+/* create the libui path of a new path object */
+static void lui_drawpath_init(lui_drawPathObject *path, int fillmode)
+{
+	path->object = uiDrawNewPath(fillmode);
+	path->empty = 1;
+#ifdef LUI_GTK
+	path->fillmode = fillmode;
+#endif
+}
 
 static int lui_drawpath__gc(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawPath(L, 1);
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
 	if (lobj->object) {
 		DEBUGMSG("lui_drawpath__gc (%s)", lui_debug_controlTostring(L, 1));
 		uiDrawFreePath(uiDrawPath(lobj->object));
 		lobj->object = 0;
+#ifdef LUI_GTK
+		free(lobj->pieces);
+		lobj->pieces = NULL;
+		lobj->numpieces = lobj->maxpieces = 0;
+#endif
 	}
 	return 0;
 }
@@ -624,10 +911,10 @@ static int lui_drawpath__gc(lua_State *L)
  */
 static int lui_drawPathNewFigure(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawPath(L, 1);
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
 	double x = luaL_checknumber(L, 2);
 	double y = luaL_checknumber(L, 3);
-	uiDrawPathNewFigure(uiDrawPath(lobj->object), x, y);
+	lui_drawpath_newFigure(lobj, x, y);
 	return 0;
 }
 
@@ -639,14 +926,14 @@ static int lui_drawPathNewFigure(lua_State *L)
  */
 static int lui_drawPathNewFigureWithArc(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawPath(L, 1);
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
 	double xcenter = luaL_checknumber(L, 2);
 	double ycenter = luaL_checknumber(L, 3);
 	double radius = luaL_checknumber(L, 4);
 	double start = luaL_checknumber(L, 5);
 	double sweep = luaL_checknumber(L, 6);
 	int negative = lua_toboolean(L, 7);
-	uiDrawPathNewFigureWithArc(uiDrawPath(lobj->object), xcenter, ycenter, radius, start, sweep, negative);
+	lui_drawpath_newFigureWithArc(lobj, xcenter, ycenter, radius, start, sweep, negative);
 	return 0;
 }
 
@@ -658,10 +945,10 @@ static int lui_drawPathNewFigureWithArc(lua_State *L)
  */
 static int lui_drawPathLineTo(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawPath(L, 1);
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
 	double x = luaL_checknumber(L, 2);
 	double y = luaL_checknumber(L, 3);
-	uiDrawPathLineTo(uiDrawPath(lobj->object), x, y);
+	lui_drawpath_lineTo(lobj, x, y);
 	return 0;
 }
 
@@ -673,14 +960,14 @@ static int lui_drawPathLineTo(lua_State *L)
  */
 static int lui_drawPathArcTo(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawPath(L, 1);
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
 	double xcenter = luaL_checknumber(L, 2);
 	double ycenter = luaL_checknumber(L, 3);
 	double radius = luaL_checknumber(L, 4);
 	double start = luaL_checknumber(L, 5);
 	double sweep = luaL_checknumber(L, 6);
 	int negative = lua_toboolean(L, 7);
-	uiDrawPathArcTo(uiDrawPath(lobj->object), xcenter, ycenter, radius, start, sweep, negative);
+	lui_drawpath_arcTo(lobj, xcenter, ycenter, radius, start, sweep, negative);
 	return 0;
 }
 
@@ -693,14 +980,14 @@ static int lui_drawPathArcTo(lua_State *L)
  */
 static int lui_drawPathBezierTo(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawPath(L, 1);
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
 	double c1x = luaL_checknumber(L, 2);
 	double c1y = luaL_checknumber(L, 3);
 	double c2x = luaL_checknumber(L, 4);
 	double c2y = luaL_checknumber(L, 5);
 	double endx = luaL_checknumber(L, 6);
 	double endy = luaL_checknumber(L, 7);
-	uiDrawPathBezierTo(uiDrawPath(lobj->object), c1x, c1y, c2x, c2y, endx, endy);
+	lui_drawpath_bezierTo(lobj, c1x, c1y, c2x, c2y, endx, endy);
 	return 0;
 }
 
@@ -712,8 +999,8 @@ static int lui_drawPathBezierTo(lua_State *L)
  */
 static int lui_drawPathCloseFigure(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawPath(L, 1);
-	uiDrawPathCloseFigure(uiDrawPath(lobj->object));
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
+	lui_drawpath_closeFigure(lobj);
 	return 0;
 }
 
@@ -725,15 +1012,450 @@ static int lui_drawPathCloseFigure(lua_State *L)
  */
 static int lui_drawPathAddRectangle(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawPath(L, 1);
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
 	double x = luaL_checknumber(L, 2);
 	double y = luaL_checknumber(L, 3);
 	double w = luaL_checknumber(L, 4);
 	double h = luaL_checknumber(L, 5);
-	uiDrawPathAddRectangle(uiDrawPath(lobj->object), x, y, w, h);
+	lui_drawpath_addRectangle(lobj, x, y, w, h);
 	return 0;
 }
 
+/* coordinates for the bulk path methods, either from a flat lua array
+ * or from a string of packed native float64 or float32 values. */
+typedef struct {
+	lua_State *L;
+	int pos;
+	const char *data;
+	int f32;
+	size_t n;
+} lui_drawCoords;
+
+/* fmtpos is the stack position of the format argument for packed strings */
+static void lui_drawcoords_check(lua_State *L, int pos, int fmtpos, lui_drawCoords *c, int multiple)
+{
+	c->L = L;
+	c->pos = pos;
+	c->data = 0;
+	c->f32 = 0;
+	if (lua_type(L, pos) == LUA_TSTRING) {
+		static const char *const formats[] = {"f64", "f32", 0};
+		size_t len;
+		c->data = lua_tolstring(L, pos, &len);
+		c->f32 = luaL_checkoption(L, fmtpos, "f64", formats);
+		c->n = len / (c->f32 ? sizeof(float) : sizeof(double));
+		if (c->n * (c->f32 ? sizeof(float) : sizeof(double)) != len) {
+			luaL_error(L, "packed coordinate string length is not a multiple of the value size!");
+		}
+	} else {
+		luaL_checktype(L, pos, LUA_TTABLE);
+		c->n = lua_rawlen(L, pos);
+	}
+	if (c->n % multiple) {
+		luaL_error(L, "number of coordinates must be a multiple of %d!", multiple);
+	}
+}
+
+/* i is 0-based */
+static double lui_drawcoords_get(lui_drawCoords *c, size_t i)
+{
+	if (c->data) {
+		if (c->f32) {
+			float f;
+			memcpy(&f, c->data + i * sizeof(float), sizeof(float));
+			return f;
+		}
+		double d;
+		memcpy(&d, c->data + i * sizeof(double), sizeof(double));
+		return d;
+	}
+	lua_rawgeti(c->L, c->pos, i + 1);
+	int isnum;
+	double d = lua_tonumberx(c->L, -1, &isnum);
+	lua_pop(c->L, 1);
+	if (!isnum) {
+		luaL_error(c->L, "coordinate %d is not a number!", (int) i + 1);
+	}
+	return d;
+}
+
+static void lui_drawpath_addPolyline(lua_State *L, int close)
+{
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
+	lui_drawCoords c;
+	lui_drawcoords_check(L, 2, 3, &c, 2);
+	if (c.n == 0) {
+		return;
+	}
+	double x = lui_drawcoords_get(&c, 0);
+	double y = lui_drawcoords_get(&c, 1);
+	lui_drawpath_newFigure(lobj, x, y);
+	for (size_t i = 2; i < c.n; i += 2) {
+		x = lui_drawcoords_get(&c, i);
+		y = lui_drawcoords_get(&c, i + 1);
+		lui_drawpath_lineTo(lobj, x, y);
+	}
+	if (close) {
+		lui_drawpath_closeFigure(lobj);
+	}
+}
+
+/*** Method
+ * Object: draw.path
+ * Name: polyline
+ * Signature: path:polyline(coords, format = "f64")
+ * add an open figure made of straight lines through the points in coords.
+ * coords is either a flat array {x1, y1, x2, y2, ...}, or a string of
+ * packed native numbers in the same order. For a string, format tells
+ * whether the numbers are "f64" (double) or "f32" (float) values, as
+ * produced by string.pack("d") or string.pack("f"). No figure may be open.
+ */
+static int lui_drawPathPolyline(lua_State *L)
+{
+	lui_drawpath_addPolyline(L, 0);
+	return 0;
+}
+
+/*** Method
+ * Object: draw.path
+ * Name: polygon
+ * Signature: path:polygon(coords, format = "f64")
+ * like path:polyline(), but closes the figure.
+ */
+static int lui_drawPathPolygon(lua_State *L)
+{
+	lui_drawpath_addPolyline(L, 1);
+	return 0;
+}
+
+/*** Method
+ * Object: draw.path
+ * Name: rects
+ * Signature: path:rects(coords, format = "f64")
+ * add a number of rectangles to the path. coords is a flat array or packed
+ * string as for path:polyline(), containing x, y, width, height for each
+ * rectangle. No figure may be open.
+ */
+static int lui_drawPathRects(lua_State *L)
+{
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
+	lui_drawCoords c;
+	lui_drawcoords_check(L, 2, 3, &c, 4);
+	for (size_t i = 0; i < c.n; i += 4) {
+		double x = lui_drawcoords_get(&c, i);
+		double y = lui_drawcoords_get(&c, i + 1);
+		double w = lui_drawcoords_get(&c, i + 2);
+		double h = lui_drawcoords_get(&c, i + 3);
+		lui_drawpath_addRectangle(lobj, x, y, w, h);
+	}
+	return 0;
+}
+
+/* decimation of large series  *********************************************/
+
+/* return count values of the series starting at index from as a contiguous
+ * array of doubles. Packed float64 data is used in place, everything else
+ * is converted into a temporary buffer left on the lua stack. */
+static const double *lui_drawcoords_doubles(lui_drawCoords *c, size_t from, size_t count)
+{
+	if (c->data && !c->f32 && ((uintptr_t) c->data % sizeof(double)) == 0) {
+		return (const double*) c->data + from;
+	}
+	double *buf = (double*) lua_newuserdata(c->L, (count ? count : 1) * sizeof(double));
+	for (size_t i = 0; i < count; ++i) {
+		buf[i] = lui_drawcoords_get(c, from + i);
+	}
+	return buf;
+}
+
+typedef struct {
+	double x0, k, left;		/* x = left + (index + 1 - x0) * k */
+	double ymax, ky, top;	/* y = top + (ymax - value) * ky, if ky != 0 */
+} lui_decimateMapping;
+
+#define lui_decimate_x(m, i) ((m)->left + ((double)(i) + 1 - (m)->x0) * (m)->k)
+#define lui_decimate_y(m, v) ((m)->ky != 0 ? (m)->top + ((m)->ymax - (v)) * (m)->ky : (v))
+
+/* minimum and maximum of n values. NaNs are ignored. Four independent
+ * accumulators and no branches, so that the compiler can vectorize this. */
+static void lui_decimate_minmax(const double *v, size_t n, double *mn, double *mx)
+{
+	double mn0 = HUGE_VAL, mn1 = HUGE_VAL, mn2 = HUGE_VAL, mn3 = HUGE_VAL;
+	double mx0 = -HUGE_VAL, mx1 = -HUGE_VAL, mx2 = -HUGE_VAL, mx3 = -HUGE_VAL;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		mn0 = v[i] < mn0 ? v[i] : mn0;
+		mn1 = v[i + 1] < mn1 ? v[i + 1] : mn1;
+		mn2 = v[i + 2] < mn2 ? v[i + 2] : mn2;
+		mn3 = v[i + 3] < mn3 ? v[i + 3] : mn3;
+		mx0 = v[i] > mx0 ? v[i] : mx0;
+		mx1 = v[i + 1] > mx1 ? v[i + 1] : mx1;
+		mx2 = v[i + 2] > mx2 ? v[i + 2] : mx2;
+		mx3 = v[i + 3] > mx3 ? v[i + 3] : mx3;
+	}
+	for (; i < n; ++i) {
+		mn0 = v[i] < mn0 ? v[i] : mn0;
+		mx0 = v[i] > mx0 ? v[i] : mx0;
+	}
+	mn0 = mn1 < mn0 ? mn1 : mn0;
+	mn2 = mn3 < mn2 ? mn3 : mn2;
+	mx0 = mx1 > mx0 ? mx1 : mx0;
+	mx2 = mx3 > mx2 ? mx3 : mx2;
+	*mn = mn2 < mn0 ? mn2 : mn0;
+	*mx = mx2 > mx0 ? mx2 : mx0;
+}
+
+/* reduce the samples v[0..n-1], which have the indices first.. in the
+ * series, to at most two points per pixel column: the minimum and the
+ * maximum, the one closer to the previous point first. out must have room
+ * for 4 * (columns + 2) values. Returns the number of points. */
+static size_t lui_decimate_columns(const double *v, size_t n, size_t first, const lui_decimateMapping *m, double *out)
+{
+	size_t np = 0, i = 0;
+	double prev = NAN;
+	while (i < n) {
+		double col = floor(((double)(first + i) + 1 - m->x0) * m->k);
+		size_t end = (size_t) ceil((col + 1) / m->k + m->x0 - 1);
+		end = end > first + i ? end - first : i + 1;
+		if (end > n) {
+			end = n;
+		}
+		double mn, mx;
+		lui_decimate_minmax(v + i, end - i, &mn, &mx);
+		i = end;
+		if (mn > mx) {
+			continue;
+		}
+		double x = m->left + col + 0.5;
+		if (!isnan(prev) && fabs(prev - mx) < fabs(prev - mn)) {
+			double t = mn; mn = mx; mx = t;
+		}
+		out[np * 2] = x;
+		out[np * 2 + 1] = lui_decimate_y(m, mn);
+		++np;
+		if (mx != mn) {
+			out[np * 2] = x;
+			out[np * 2 + 1] = lui_decimate_y(m, mx);
+			++np;
+		}
+		prev = mx;
+	}
+	return np;
+}
+
+/* largest triangle three buckets: pick threshold of the n samples that
+ * best preserve the visual shape, skipping NaN samples. out must have room
+ * for 2 * threshold values. Returns the number of points. */
+static size_t lui_decimate_lttb(const double *v, size_t n, size_t first, size_t threshold, const lui_decimateMapping *m, double *out)
+{
+	size_t np = 0;
+	/* the first and last points are always kept, so they must be numbers */
+	size_t lo = 0, hi = n;
+	while (lo < hi && isnan(v[lo])) {
+		++lo;
+	}
+	while (hi > lo && isnan(v[hi - 1])) {
+		--hi;
+	}
+	v += lo;
+	first += lo;
+	n = hi - lo;
+	if (threshold >= n || threshold < 3) {
+		for (size_t i = 0; i < n && (threshold >= n || np < threshold); ++i) {
+			if (isnan(v[i])) {
+				continue;
+			}
+			out[np * 2] = lui_decimate_x(m, first + i);
+			out[np * 2 + 1] = lui_decimate_y(m, v[i]);
+			++np;
+		}
+		return np;
+	}
+	double every = (double)(n - 2) / (threshold - 2);
+	size_t a = 0;
+	out[0] = lui_decimate_x(m, first);
+	out[1] = lui_decimate_y(m, v[0]);
+	np = 1;
+	for (size_t b = 0; b < threshold - 2; ++b) {
+		/* average of the next bucket */
+		size_t nstart = (size_t)((b + 1) * every) + 1;
+		size_t nend = (size_t)((b + 2) * every) + 1;
+		if (nend > n) {
+			nend = n;
+		}
+		double avgx = 0, avgy = 0;
+		size_t cnt = 0;
+		for (size_t j = nstart; j < nend; ++j) {
+			if (!isnan(v[j])) {
+				avgx += j;
+				avgy += v[j];
+				++cnt;
+			}
+		}
+		if (cnt) {
+			avgx /= cnt;
+			avgy /= cnt;
+		} else {
+			avgx = nstart;
+			avgy = v[a];
+		}
+		/* point of the current bucket forming the largest triangle */
+		size_t start = (size_t)(b * every) + 1;
+		size_t end = nstart;
+		double maxarea = -1;
+		size_t pick = start;
+		for (size_t j = start; j < end; ++j) {
+			if (isnan(v[j])) {
+				continue;
+			}
+			double area = fabs(((double)a - avgx) * (v[j] - v[a]) - ((double)a - j) * (avgy - v[a]));
+			if (area > maxarea) {
+				maxarea = area;
+				pick = j;
+			}
+		}
+		if (maxarea < 0) {
+			/* nothing but NaN in this bucket */
+			continue;
+		}
+		out[np * 2] = lui_decimate_x(m, first + pick);
+		out[np * 2 + 1] = lui_decimate_y(m, v[pick]);
+		++np;
+		a = pick;
+	}
+	out[np * 2] = lui_decimate_x(m, first + n - 1);
+	out[np * 2 + 1] = lui_decimate_y(m, v[n - 1]);
+	return np + 1;
+}
+
+/* lui_drawDecimate
+ *
+ * common part of lui.draw.decimate() and path:decimate(). The arguments
+ * start at stack position pos. Leaves the result as x, y pairs in a buffer
+ * on top of the stack and returns the number of points.
+ */
+static size_t lui_drawDecimate(lua_State *L, int pos, double **result)
+{
+	double x0 = luaL_checknumber(L, pos + 1);
+	double x1 = luaL_checknumber(L, pos + 2);
+	double width = luaL_checknumber(L, pos + 3);
+	int hasopts = lui_aux_istable(L, pos + 4);
+	static const char *const modes[] = {"minmax", "lttb", 0};
+	int lttb = 0;
+	lui_decimateMapping m = { x0, 0, 0, 0, 0, 0 };
+
+	if (x1 <= x0 || width <= 0) {
+		luaL_error(L, "invalid decimation range!");
+	}
+	int fmtpos = lua_gettop(L) + 1;
+	if (hasopts) {
+		lua_getfield(L, pos + 4, "format");
+		lua_getfield(L, pos + 4, "mode");
+		lttb = luaL_checkoption(L, -1, "minmax", modes);
+		lua_pop(L, 1);
+		m.left = lui_aux_optNumberField(L, pos + 4, "left", 0);
+		m.top = lui_aux_optNumberField(L, pos + 4, "top", 0);
+		double height = lui_aux_optNumberField(L, pos + 4, "height", 0);
+		double ymin = lui_aux_optNumberField(L, pos + 4, "ymin", 0);
+		m.ymax = lui_aux_optNumberField(L, pos + 4, "ymax", 0);
+		if (height > 0 && m.ymax != ymin) {
+			m.ky = height / (m.ymax - ymin);
+		}
+	} else {
+		lua_pushnil(L);
+	}
+	m.k = width / (x1 - x0);
+
+	lui_drawCoords c;
+	lui_drawcoords_check(L, pos, fmtpos, &c, 1);
+
+	/* one sample beyond the range on each side, so that the line reaches
+	 * the edges */
+	double from = floor(x0) - 1, to = ceil(x1);
+	size_t first = from < 0 ? 0 : (size_t) from;
+	size_t last = to < 1 ? 0 : (size_t) to;
+	if (last > c.n) {
+		last = c.n;
+	}
+	size_t n = last > first ? last - first : 0;
+	size_t columns = (size_t) ceil(width);
+	size_t maxpoints = lttb ? columns : 2 * (columns + 2);
+
+	*result = (double*) lua_newuserdata(L, (maxpoints > n ? maxpoints : n) * 2 * sizeof(double));
+	int respos = lua_gettop(L);
+	if (n == 0) {
+		return 0;
+	}
+	const double *v = lui_drawcoords_doubles(&c, first, n);
+	size_t np;
+	if (lttb) {
+		np = lui_decimate_lttb(v, n, first, columns, &m, *result);
+	} else if (n <= 2 * columns) {
+		np = lui_decimate_lttb(v, n, first, n, &m, *result);
+	} else {
+		np = lui_decimate_columns(v, n, first, &m, *result);
+	}
+	lua_settop(L, respos);
+	return np;
+}
+
+/*** Method
+ * Object: draw.path
+ * Name: decimate
+ * Signature: count = path:decimate(series, x0, x1, pixelwidth, options = nil)
+ * add the part of a large series of values visible in a plot as an open
+ * figure to the path, reduced to what can actually be seen. Arguments and
+ * options are as for lui.draw.decimate(). Returns the number of points
+ * added.
+ */
+static int lui_drawPathDecimate(lua_State *L)
+{
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
+	double *pts;
+	size_t np = lui_drawDecimate(L, 2, &pts);
+	for (size_t i = 0; i < np; ++i) {
+		double x = pts[i * 2], y = pts[i * 2 + 1];
+		if (i == 0) {
+			lui_drawpath_newFigure(lobj, x, y);
+		} else {
+			lui_drawpath_lineTo(lobj, x, y);
+		}
+	}
+	lua_pushinteger(L, np);
+	return 1;
+}
+
+/*** Function
+ * Name: draw.decimate
+ * Signature: coords, count = lui.draw.decimate(series, x0, x1, pixelwidth, options = nil)
+ * reduce a large series of values to the points needed to plot the part
+ * of it from sample index x0 to x1 (1-based, may be fractional) into
+ * pixelwidth pixels. series is a flat array of values, or a string of
+ * packed native numbers. Sample index x is plotted at x coordinate
+ * left + (x - x0) * pixelwidth / (x1 - x0). By default, each pixel column
+ * is reduced to the minimum and maximum of the samples in it, so that no
+ * peaks are lost, and the work done to draw the result only depends on the
+ * width of the plot. options is a table with these optional fields:
+ * - mode: "minmax" (default) or "lttb" for largest triangle three buckets,
+ *   which picks pixelwidth actual samples and gives a smoother line.
+ * - format: "f64" (default) or "f32", for packed strings.
+ * - left, top: offset of the plot, default 0.
+ * - ymin, ymax, height: if all given, values are mapped so that ymax is at
+ *   top and ymin at top + height. Otherwise the values are used as y
+ *   coordinates.
+ * NaN values are skipped. Returns the resulting points as a packed f64
+ * string of x, y pairs, as accepted by path:polyline(), and the number of
+ * points.
+ */
+static int lui_drawDecimateFunc(lua_State *L)
+{
+	double *pts;
+	size_t np = lui_drawDecimate(L, 1, &pts);
+	lua_pushlstring(L, (const char*) pts, np * 2 * sizeof(double));
+	lua_pushinteger(L, np);
+	return 2;
+}
+
 /*** Method
  * Object: draw.path
  * Name: done
@@ -742,11 +1464,33 @@ static int lui_drawPathAddRectangle(lua_State *L)
  */
 static int lui_drawPathEnd(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawPath(L, 1);
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
 	uiDrawPathEnd(uiDrawPath(lobj->object));
 	return 0;
 }
 
+/*** Method
+ * Object: draw.path
+ * Name: bounds
+ * Signature: x, y, w, h = path:bounds()
+ * return the bounding box of the path. This may be larger than the area
+ * actually covered by the path, as arcs are accounted for with their full
+ * circle, and bezier curves with their control points. Returns nothing for
+ * an empty path.
+ */
+static int lui_drawPathBounds(lua_State *L)
+{
+	lui_drawPathObject *lobj = lui_checkDrawPath(L, 1);
+	if (lobj->empty) {
+		return 0;
+	}
+	lua_pushnumber(L, lobj->bounds[0]);
+	lua_pushnumber(L, lobj->bounds[1]);
+	lua_pushnumber(L, lobj->bounds[2] - lobj->bounds[0]);
+	lua_pushnumber(L, lobj->bounds[3] - lobj->bounds[1]);
+	return 4;
+}
+
 /*** Constructor
  * Object: draw.path
  * Name: draw.path
@@ -760,8 +1504,8 @@ static int lui_newDrawPath(lua_State *L)
 	if (lua_gettop(L) > 0) {
 		fillmode = lui_aux_getNumberOrValue(L, 1, "lui_enumfillmode");
 	}
-	lui_object *lobj = lui_pushDrawPath(L);
-	lobj->object = uiDrawNewPath(fillmode);
+	lui_drawPathObject *lobj = lui_pushDrawPath(L);
+	lui_drawpath_init(lobj, fillmode);
 	lui_registerObject(L, lua_gettop(L));
 	return 1;
 }
@@ -783,7 +1527,12 @@ static const luaL_Reg lui_drawpath_methods[] = {
 	{"bezierto", lui_drawPathBezierTo},
 	{"closefigure", lui_drawPathCloseFigure},
 	{"addrectangle", lui_drawPathAddRectangle},
+	{"polyline", lui_drawPathPolyline},
+	{"polygon", lui_drawPathPolygon},
+	{"rects", lui_drawPathRects},
+	{"decimate", lui_drawPathDecimate},
 	{"done", lui_drawPathEnd},
+	{"bounds", lui_drawPathBounds},
 	{0, 0}
 };
 
@@ -793,20 +1542,457 @@ static const luaL_Reg lui_drawpath_meta[] = {
 	{0, 0}
 };
 
+/* svg path data  **********************************************************/
+
+#define LUI_SVGPATH_CACHE "lui_svgpathcache"
+#define LUI_PI 3.14159265358979323846
+
+typedef struct {
+	lua_State *L;
+	const char *d;
+	const char *p;
+	lui_drawPathObject *path;
+	int open;
+} lui_svgParser;
+
+static void lui_svgpath_error(lui_svgParser *sp)
+{
+	luaL_error(sp->L, "invalid svg path data at position %d!", (int) (sp->p - sp->d) + 1);
+}
+
+static void lui_svgpath_skipSpace(lui_svgParser *sp)
+{
+	while (*sp->p == ' ' || *sp->p == '\t' || *sp->p == '\n' || *sp->p == '\r' || *sp->p == '\f' || *sp->p == ',') {
+		++sp->p;
+	}
+}
+
+/* is there another argument for the current command? */
+static int lui_svgpath_hasNumber(lui_svgParser *sp)
+{
+	lui_svgpath_skipSpace(sp);
+	char c = *sp->p;
+	return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+}
+
+/* svg numbers are a strict subset of what strtod() accepts, and strtod()
+ * depends on the locale, so they are scanned here. */
+static double lui_svgpath_number(lui_svgParser *sp)
+{
+	lui_svgpath_skipSpace(sp);
+	const char *p = sp->p;
+	double sign = 1, val = 0;
+	int digits = 0;
+	if (*p == '-' || *p == '+') {
+		sign = *p == '-' ? -1 : 1;
+		++p;
+	}
+	while (*p >= '0' && *p <= '9') {
+		val = val * 10 + (*p++ - '0');
+		++digits;
+	}
+	if (*p == '.') {
+		double scale = 0.1;
+		++p;
+		while (*p >= '0' && *p <= '9') {
+			val += (*p++ - '0') * scale;
+			scale *= 0.1;
+			++digits;
+		}
+	}
+	if (!digits) {
+		lui_svgpath_error(sp);
+	}
+	if ((*p == 'e' || *p == 'E') && (p[1] == '-' || p[1] == '+' || (p[1] >= '0' && p[1] <= '9'))) {
+		int esign = 1, exp = 0;
+		++p;
+		if (*p == '-' || *p == '+') {
+			esign = *p == '-' ? -1 : 1;
+			++p;
+		}
+		if (!(*p >= '0' && *p <= '9')) {
+			lui_svgpath_error(sp);
+		}
+		while (*p >= '0' && *p <= '9') {
+			if (exp < 1000) {
+				exp = exp * 10 + (*p - '0');
+			}
+			++p;
+		}
+		val *= pow(10, esign * exp);
+	}
+	sp->p = p;
+	return sign * val;
+}
+
+/* arc flags are single characters and need no separator */
+static int lui_svgpath_flag(lui_svgParser *sp)
+{
+	lui_svgpath_skipSpace(sp);
+	if (*sp->p != '0' && *sp->p != '1') {
+		lui_svgpath_error(sp);
+	}
+	return *sp->p++ == '1';
+}
+
+static void lui_svgpath_moveTo(lui_svgParser *sp, double x, double y)
+{
+	lui_drawpath_newFigure(sp->path, x, y);
+	sp->open = 1;
+}
+
+static void lui_svgpath_lineTo(lui_svgParser *sp, double x, double y)
+{
+	lui_drawpath_lineTo(sp->path, x, y);
+}
+
+static void lui_svgpath_cubicTo(lui_svgParser *sp, double x1, double y1, double x2, double y2, double x, double y)
+{
+	lui_drawpath_bezierTo(sp->path, x1, y1, x2, y2, x, y);
+}
+
+/* convert an svg endpoint arc to cubic bezier curves of at most 90 degrees
+ * each, see the implementation notes of the svg specification. */
+static void lui_svgpath_arcTo(lui_svgParser *sp, double x1, double y1, double rx, double ry, double angle, int large, int sweep, double x2, double y2)
+{
+	if (x1 == x2 && y1 == y2) {
+		return;
+	}
+	rx = fabs(rx);
+	ry = fabs(ry);
+	if (rx == 0 || ry == 0) {
+		lui_svgpath_lineTo(sp, x2, y2);
+		return;
+	}
+	double phi = angle * LUI_PI / 180;
+	double cphi = cos(phi), sphi = sin(phi);
+	double dx = (x1 - x2) / 2, dy = (y1 - y2) / 2;
+	double x1p = cphi * dx + sphi * dy;
+	double y1p = -sphi * dx + cphi * dy;
+	double lambda = (x1p * x1p) / (rx * rx) + (y1p * y1p) / (ry * ry);
+	if (lambda > 1) {
+		lambda = sqrt(lambda);
+		rx *= lambda;
+		ry *= lambda;
+	}
+	double num = rx * rx * ry * ry - rx * rx * y1p * y1p - ry * ry * x1p * x1p;
+	double den = rx * rx * y1p * y1p + ry * ry * x1p * x1p;
+	double coef = (den > 0 && num > 0) ? sqrt(num / den) : 0;
+	if (large == sweep) {
+		coef = -coef;
+	}
+	double cxp = coef * rx * y1p / ry;
+	double cyp = -coef * ry * x1p / rx;
+	double cx = cphi * cxp - sphi * cyp + (x1 + x2) / 2;
+	double cy = sphi * cxp + cphi * cyp + (y1 + y2) / 2;
+	double ux = (x1p - cxp) / rx, uy = (y1p - cyp) / ry;
+	double vx = (-x1p - cxp) / rx, vy = (-y1p - cyp) / ry;
+	double theta = atan2(uy, ux);
+	double dtheta = atan2(ux * vy - uy * vx, ux * vx + uy * vy);
+	if (!sweep && dtheta > 0) {
+		dtheta -= 2 * LUI_PI;
+	} else if (sweep && dtheta < 0) {
+		dtheta += 2 * LUI_PI;
+	}
+	int segs = (int) ceil(fabs(dtheta) / (LUI_PI / 2) - 1e-9);
+	if (segs < 1) {
+		segs = 1;
+	}
+	double delta = dtheta / segs;
+	double k = 4.0 / 3.0 * tan(delta / 4);
+	double ca = cos(theta), sa = sin(theta);
+	for (int i = 0; i < segs; ++i) {
+		double a1 = theta + (i + 1) * delta;
+		double cb = cos(a1), sb = sin(a1);
+		/* control and end points on the unit circle */
+		double p1x = ca - k * sa, p1y = sa + k * ca;
+		double p2x = cb + k * sb, p2y = sb - k * cb;
+		double ex = x2, ey = y2;
+		if (i < segs - 1) {
+			ex = cx + rx * cphi * cb - ry * sphi * sb;
+			ey = cy + rx * sphi * cb + ry * cphi * sb;
+		}
+		lui_svgpath_cubicTo(sp,
+			cx + rx * cphi * p1x - ry * sphi * p1y, cy + rx * sphi * p1x + ry * cphi * p1y,
+			cx + rx * cphi * p2x - ry * sphi * p2y, cy + rx * sphi * p2x + ry * cphi * p2y,
+			ex, ey);
+		ca = cb;
+		sa = sb;
+	}
+}
+
+static void lui_svgpath_parse(lui_svgParser *sp)
+{
+	double x = 0, y = 0;		/* current point */
+	double sx = 0, sy = 0;		/* start of current subpath */
+	double cx = 0, cy = 0;		/* last control point, for S and T */
+	char cmd = 0, last = 0;
+
+	lui_svgpath_skipSpace(sp);
+	while (*sp->p) {
+		if (lui_svgpath_hasNumber(sp)) {
+			/* implicit repetition of the last command, after a moveto
+			 * that is a lineto */
+			if (!cmd || cmd == 'z' || cmd == 'Z') {
+				lui_svgpath_error(sp);
+			}
+			if (cmd == 'M') {
+				cmd = 'L';
+			} else if (cmd == 'm') {
+				cmd = 'l';
+			}
+		} else {
+			cmd = *sp->p++;
+		}
+		if (!last && cmd != 'M' && cmd != 'm') {
+			--sp->p;
+			lui_svgpath_error(sp);
+		}
+		int rel = cmd >= 'a';
+		double ox = rel ? x : 0, oy = rel ? y : 0;
+		/* drawing after a closepath continues at the start of the subpath */
+		if (!sp->open && cmd != 'M' && cmd != 'm') {
+			lui_svgpath_moveTo(sp, x, y);
+		}
+		switch (cmd) {
+			case 'M': case 'm':
+				x = ox + lui_svgpath_number(sp);
+				y = oy + lui_svgpath_number(sp);
+				lui_svgpath_moveTo(sp, x, y);
+				sx = x;
+				sy = y;
+				break;
+			case 'L': case 'l':
+				x = ox + lui_svgpath_number(sp);
+				y = oy + lui_svgpath_number(sp);
+				lui_svgpath_lineTo(sp, x, y);
+				break;
+			case 'H': case 'h':
+				x = ox + lui_svgpath_number(sp);
+				lui_svgpath_lineTo(sp, x, y);
+				break;
+			case 'V': case 'v':
+				y = oy + lui_svgpath_number(sp);
+				lui_svgpath_lineTo(sp, x, y);
+				break;
+			case 'C': case 'c': case 'S': case 's': {
+				double x1, y1;
+				if (cmd == 'C' || cmd == 'c') {
+					x1 = ox + lui_svgpath_number(sp);
+					y1 = oy + lui_svgpath_number(sp);
+				} else if (strchr("CcSs", last)) {
+					x1 = 2 * x - cx;
+					y1 = 2 * y - cy;
+				} else {
+					x1 = x;
+					y1 = y;
+				}
+				cx = ox + lui_svgpath_number(sp);
+				cy = oy + lui_svgpath_number(sp);
+				x = ox + lui_svgpath_number(sp);
+				y = oy + lui_svgpath_number(sp);
+				lui_svgpath_cubicTo(sp, x1, y1, cx, cy, x, y);
+				break;
+			}
+			case 'Q': case 'q': case 'T': case 't': {
+				double x0 = x, y0 = y;
+				if (cmd == 'Q' || cmd == 'q') {
+					cx = ox + lui_svgpath_number(sp);
+					cy = oy + lui_svgpath_number(sp);
+				} else if (strchr("QqTt", last)) {
+					cx = 2 * x - cx;
+					cy = 2 * y - cy;
+				} else {
+					cx = x;
+					cy = y;
+				}
+				x = ox + lui_svgpath_number(sp);
+				y = oy + lui_svgpath_number(sp);
+				/* raise the quadratic curve to a cubic one */
+				lui_svgpath_cubicTo(sp, x0 + 2.0 / 3.0 * (cx - x0), y0 + 2.0 / 3.0 * (cy - y0),
+					x + 2.0 / 3.0 * (cx - x), y + 2.0 / 3.0 * (cy - y), x, y);
+				break;
+			}
+			case 'A': case 'a': {
+				double rx = lui_svgpath_number(sp);
+				double ry = lui_svgpath_number(sp);
+				double angle = lui_svgpath_number(sp);
+				int large = lui_svgpath_flag(sp);
+				int sweep = lui_svgpath_flag(sp);
+				double x0 = x, y0 = y;
+				x = ox + lui_svgpath_number(sp);
+				y = oy + lui_svgpath_number(sp);
+				lui_svgpath_arcTo(sp, x0, y0, rx, ry, angle, large, sweep, x, y);
+				break;
+			}
+			case 'Z': case 'z':
+				lui_drawpath_closeFigure(sp->path);
+				sp->open = 0;
+				x = sx;
+				y = sy;
+				break;
+			default:
+				--sp->p;
+				lui_svgpath_error(sp);
+		}
+		last = cmd;
+		lui_svgpath_skipSpace(sp);
+	}
+}
+
+/*** Function
+ * Name: draw.svgpath
+ * Signature: path = lui.draw.svgpath(d, fillmode = "winding")
+ * create a draw.path from svg path data, as found in the d attribute of an
+ * svg path element. All path commands are supported, both absolute and
+ * relative. Quadratic curves and elliptical arcs are converted to bezier
+ * curves. The path is finished, so no further figures can be added to it.
+ * Paths are cached by path data and fillmode, so calling this again with
+ * the same arguments, for example in an ondraw handler, returns the same
+ * draw.path object as long as that is still referenced somewhere.
+ */
+static int lui_drawSvgPath(lua_State *L)
+{
+	size_t len;
+	const char *d = luaL_checklstring(L, 1, &len);
+	int fillmode = uiDrawFillModeWinding;
+	if (!lua_isnoneornil(L, 2)) {
+		fillmode = lui_aux_getNumberOrValue(L, 2, "lui_enumfillmode");
+	}
+	lua_settop(L, 1);
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_SVGPATH_CACHE);
+	if (lua_rawgeti(L, 2, fillmode + 1) != LUA_TTABLE) {
+		return luaL_error(L, "invalid fillmode!");
+	}
+	lua_pushvalue(L, 1);
+	if (lua_rawget(L, 3) != LUA_TNIL) {
+		return 1;
+	}
+	lua_pop(L, 1);
+
+	lui_drawPathObject *lobj = lui_pushDrawPath(L);
+	lui_drawpath_init(lobj, fillmode);
+	lui_registerObject(L, lua_gettop(L));
+	if (strlen(d) != len) {
+		return luaL_error(L, "invalid svg path data!");
+	}
+	lui_svgParser sp = { L, d, d, lobj, 0 };
+	lui_svgpath_parse(&sp);
+	uiDrawPathEnd(uiDrawPath(lobj->object));
+
+	lua_pushvalue(L, 1);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, 3);
+	return 1;
+}
+
 /* uiDrawContext  **********************************************************/
 
 /*** Object
  * Name: draw.context
- * a drawing context object, passed to area.ondraw handler
+ * a drawing context object, passed to area.ondraw handler. It can only be
+ * used while that handler runs.
  */
 #define uiDrawContext(this) ((uiDrawContext *) (this))
 #define LUI_DRAWCONTEXT "lui_drawcontext"
-#define lui_pushDrawContext(L) lui_pushObject(L, LUI_DRAWCONTEXT, 0)
-#define lui_checkDrawContext(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_DRAWCONTEXT))
+#define lui_pushDrawContext(L) ((lui_drawContextObject*)lui_pushObjectSized(L, LUI_DRAWCONTEXT, 0, sizeof(lui_drawContextObject)))
+
+/* besides the uiDrawContext, lui keeps track of the clip rectangle of the
+ * current redraw and of the transformations applied through lui, so that
+ * things that are not visible can be skipped. */
+typedef struct {
+	void *object;
+	int hasclip;
+	double clip[4];
+	uiDrawMatrix m;
+	uiDrawMatrix *stack;
+	int depth, maxdepth;
+} lui_drawContextObject;
+
+/* a draw.context is only valid while the ondraw handler it was passed to
+ * runs, afterwards its object is cleared. */
+static lui_drawContextObject *lui_checkDrawContext(lua_State *L, int pos)
+{
+	lui_drawContextObject *lobj = (lui_drawContextObject*) luaL_checkudata(L, pos, LUI_DRAWCONTEXT);
+	if (!lobj->object) {
+		luaL_error(L, "draw context used outside of ondraw handler!");
+	}
+	return lobj;
+}
+
+/* start a redraw with the clip rectangle x, y, w, h */
+static void lui_drawcontext_begin(lui_drawContextObject *ctx, uiDrawContext *c, double x, double y, double w, double h)
+{
+	ctx->object = c;
+	ctx->hasclip = 1;
+	ctx->clip[0] = x;
+	ctx->clip[1] = y;
+	ctx->clip[2] = x + w;
+	ctx->clip[3] = y + h;
+	lui_drawmatrix_identity(&ctx->m);
+	ctx->depth = 0;
+}
+
+static void lui_drawcontext_transform(lui_drawContextObject *ctx, uiDrawMatrix *m)
+{
+	uiDrawTransform(uiDrawContext(ctx->object), m);
+	lui_drawmatrix_then(&ctx->m, m, &ctx->m);
+}
+
+/* keep track of the transformation over a save */
+static void lui_drawcontext_pushMatrix(lui_drawContextObject *ctx)
+{
+	if (ctx->depth == ctx->maxdepth) {
+		int maxdepth = ctx->maxdepth ? ctx->maxdepth * 2 : 8;
+		uiDrawMatrix *stack = realloc(ctx->stack, maxdepth * sizeof(uiDrawMatrix));
+		if (!stack) {
+			/* can not track the transformation any more */
+			ctx->hasclip = 0;
+			return;
+		}
+		ctx->stack = stack;
+		ctx->maxdepth = maxdepth;
+	}
+	ctx->stack[ctx->depth++] = ctx->m;
+}
+
+static void lui_drawcontext_popMatrix(lui_drawContextObject *ctx)
+{
+	if (ctx->depth > 0) {
+		ctx->m = ctx->stack[--ctx->depth];
+	}
+}
+
+static void lui_drawcontext_save(lui_drawContextObject *ctx)
+{
+	uiDrawSave(uiDrawContext(ctx->object));
+	lui_drawcontext_pushMatrix(ctx);
+}
+
+static void lui_drawcontext_restore(lui_drawContextObject *ctx)
+{
+	uiDrawRestore(uiDrawContext(ctx->object));
+	lui_drawcontext_popMatrix(ctx);
+}
+
+/* check whether the box b = {x0, y0, x1, y1} in current user coordinates
+ * is within the clip rectangle */
+static int lui_drawcontext_visible(lui_drawContextObject *ctx, const double *b)
+{
+	if (!ctx->hasclip) {
+		return 1;
+	}
+	double r[4];
+	lui_drawmatrix_bounds(&ctx->m, b, r);
+	return r[2] >= ctx->clip[0] && r[0] <= ctx->clip[2] && r[3] >= ctx->clip[1] && r[1] <= ctx->clip[3];
+}
 
 static int lui_drawcontext__gc(lua_State *L)
 {
-	/* nothing to do here */
+	lui_drawContextObject *lobj = (lui_drawContextObject*) luaL_checkudata(L, 1, LUI_DRAWCONTEXT);
+	free(lobj->stack);
+	lobj->stack = 0;
+	lobj->maxdepth = lobj->depth = 0;
 	return 0;
 }
 
@@ -819,8 +2005,8 @@ static int lui_drawcontext__gc(lua_State *L)
  */
 static int lui_drawContextFill(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawContext(L, 1);
-	lui_object *path = lui_checkDrawPath(L, 2);
+	lui_drawContextObject *lobj = lui_checkDrawContext(L, 1);
+	lui_drawPathObject *path = lui_checkDrawPath(L, 2);
 	lui_object *brush = lui_checkDrawBrush(L, 3);
 	uiDrawFill(uiDrawContext(lobj->object), uiDrawPath(path->object), uiDrawBrush(brush->object));
 	return 0;
@@ -835,8 +2021,8 @@ static int lui_drawContextFill(lua_State *L)
  */
 static int lui_drawContextStroke(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawContext(L, 1);
-	lui_object *path = lui_checkDrawPath(L, 2);
+	lui_drawContextObject *lobj = lui_checkDrawContext(L, 1);
+	lui_drawPathObject *path = lui_checkDrawPath(L, 2);
 	lui_object *brush = lui_checkDrawBrush(L, 3);
 	lui_object *sparm = lui_checkDrawStrokeParams(L, 4);
 	uiDrawStroke(uiDrawContext(lobj->object), uiDrawPath(path->object), uiDrawBrush(brush->object), uiDrawStrokeParams(sparm->object));
@@ -852,9 +2038,9 @@ static int lui_drawContextStroke(lua_State *L)
  */
 static int lui_drawContextTransform(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawContext(L, 1);
+	lui_drawContextObject *lobj = lui_checkDrawContext(L, 1);
 	lui_object *matrix = lui_checkDrawMatrix(L, 2);	
-	uiDrawTransform(uiDrawContext(lobj->object), uiDrawMatrix(matrix->object));
+	lui_drawcontext_transform(lobj, uiDrawMatrix(matrix->object));
 	return 0;
 }
 
@@ -866,8 +2052,8 @@ static int lui_drawContextTransform(lua_State *L)
  */
 static int lui_drawContextClip(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawContext(L, 1);
-	lui_object *path = lui_checkDrawPath(L, 2);
+	lui_drawContextObject *lobj = lui_checkDrawContext(L, 1);
+	lui_drawPathObject *path = lui_checkDrawPath(L, 2);
 	uiDrawClip(uiDrawContext(lobj->object), uiDrawPath(path->object));
 	return 0;
 }
@@ -880,8 +2066,8 @@ static int lui_drawContextClip(lua_State *L)
  */
 static int lui_drawContextSave(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawContext(L, 1);
-	uiDrawSave(uiDrawContext(lobj->object));
+	lui_drawContextObject *lobj = lui_checkDrawContext(L, 1);
+	lui_drawcontext_save(lobj);
 	return 0;
 }
 
@@ -893,8 +2079,8 @@ static int lui_drawContextSave(lua_State *L)
  */
 static int lui_drawContextRestore(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawContext(L, 1);
-	uiDrawRestore(uiDrawContext(lobj->object));
+	lui_drawContextObject *lobj = lui_checkDrawContext(L, 1);
+	lui_drawcontext_restore(lobj);
 	return 0;
 }
 
@@ -908,7 +2094,7 @@ static int lui_drawContextRestore(lua_State *L)
  */
 static int lui_drawContextText(lua_State *L)
 {
-	lui_object *lobj = lui_checkDrawContext(L, 1);
+	lui_drawContextObject *lobj = lui_checkDrawContext(L, 1);
 	double x = luaL_checknumber(L, 2);
 	double y = luaL_checknumber(L, 3);
 	lui_object *text = lui_toTextLayout(L, 4);
@@ -936,10 +2122,604 @@ static int lui_drawContextText(lua_State *L)
 	return 0;
 }
 
-static int lui_wrapDrawcontext(lua_State *L, uiDrawContext *ctx)
+/* display lists  *********************************************************/
+
+/*** Object
+ * Name: draw.displaylist
+ * a recorded sequence of drawing commands, that can be replayed to a
+ * draw.context with a single call to context:play(). The brushes and
+ * strokeparams used are copied when recording, so changing them later does
+ * not affect the list. Paths and text layouts are referenced, and must not
+ * be changed after they have been added to a list. When replayed, drawing
+ * commands that lie completely outside of the area being redrawn are
+ * skipped.
+ */
+#define LUI_DRAWDISPLAYLIST "lui_drawdisplaylist"
+#define lui_pushDrawDisplayList(L) lui_pushObject(L, LUI_DRAWDISPLAYLIST, 1)
+#define lui_checkDrawDisplayList(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_DRAWDISPLAYLIST))
+
+enum {
+	LUI_DL_FILL,
+	LUI_DL_STROKE,
+	LUI_DL_TRANSFORM,
+	LUI_DL_CLIP,
+	LUI_DL_SAVE,
+	LUI_DL_RESTORE,
+	LUI_DL_TEXT
+};
+
+typedef struct {
+	int op;
+	int index;			/* brush for fill and stroke, matrix for transform */
+	int params;			/* strokeparams for stroke */
+	void *object;		/* path for fill, stroke and clip, layout for text */
+	lui_drawPathObject *path;	/* for fill, stroke and clip */
+	double bounds[4];	/* user space bounds of fill, stroke and text */
+} lui_dlCommand;
+
+typedef struct {
+	lui_dlCommand *cmds;
+	int numcmds, maxcmds;
+	uiDrawBrush *brushes;
+	int numbrushes, maxbrushes;
+	uiDrawStrokeParams *params;
+	int numparams, maxparams;
+	uiDrawMatrix *matrices;
+	int nummatrices, maxmatrices;
+	int numrefs;
+	/* transformation while recording, for the bounds of the whole list */
+	uiDrawMatrix m;
+	uiDrawMatrix *stack;
+	int depth, maxdepth;
+	double bounds[4];
+	int empty;
+	unsigned version;	/* changes whenever the list changes */
+} lui_displayList;
+
+/* make room for one more element in an array of elements of size elsize */
+static int lui_displaylist_grow(void **array, int num, int *max, size_t elsize)
+{
+	if (num < *max) {
+		return 1;
+	}
+	int newmax = *max ? *max * 2 : 16;
+	void *newarray = realloc(*array, newmax * elsize);
+	if (!newarray) {
+		return 0;
+	}
+	*array = newarray;
+	*max = newmax;
+	return 1;
+}
+
+static void lui_displaylist_clear(lui_displayList *dl)
+{
+	for (int i = 0; i < dl->numbrushes; ++i) {
+		free(dl->brushes[i].Stops);
+	}
+	for (int i = 0; i < dl->numparams; ++i) {
+		free(dl->params[i].Dashes);
+	}
+	dl->numcmds = dl->numbrushes = dl->numparams = dl->nummatrices = 0;
+	dl->numrefs = 0;
+	lui_drawmatrix_identity(&dl->m);
+	dl->depth = 0;
+	dl->empty = 1;
+	dl->version += 1;
+}
+
+static void lui_displaylist_free(lui_displayList *dl)
+{
+	lui_displaylist_clear(dl);
+	free(dl->cmds);
+	free(dl->brushes);
+	free(dl->params);
+	free(dl->matrices);
+	free(dl->stack);
+	free(dl);
+}
+
+static lui_dlCommand *lui_displaylist_add(lua_State *L, lui_displayList *dl, int op)
+{
+	if (!lui_displaylist_grow((void**) &dl->cmds, dl->numcmds, &dl->maxcmds, sizeof(lui_dlCommand))) {
+		luaL_error(L, "out of memory!");
+	}
+	lui_dlCommand *cmd = &dl->cmds[dl->numcmds++];
+	memset(cmd, 0, sizeof(lui_dlCommand));
+	cmd->op = op;
+	dl->version += 1;
+	return cmd;
+}
+
+/* keep the object at pos alive as long as it is referenced by the list */
+static void lui_displaylist_ref(lua_State *L, lui_displayList *dl, int pos)
+{
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, pos);
+	lua_rawseti(L, -2, ++dl->numrefs);
+	lua_pop(L, 1);
+}
+
+/* add the bounds of a drawing command to the bounds of the whole list */
+static void lui_displaylist_extend(lui_displayList *dl, const double *b)
+{
+	double r[4];
+	lui_drawmatrix_bounds(&dl->m, b, r);
+	if (dl->empty) {
+		memcpy(dl->bounds, r, sizeof(r));
+		dl->empty = 0;
+		return;
+	}
+	if (r[0] < dl->bounds[0]) dl->bounds[0] = r[0];
+	if (r[1] < dl->bounds[1]) dl->bounds[1] = r[1];
+	if (r[2] > dl->bounds[2]) dl->bounds[2] = r[2];
+	if (r[3] > dl->bounds[3]) dl->bounds[3] = r[3];
+}
+
+static int lui_displaylist_sameBrush(const uiDrawBrush *a, const uiDrawBrush *b)
+{
+	if (a->Type != b->Type || a->R != b->R || a->G != b->G || a->B != b->B || a->A != b->A) {
+		return 0;
+	}
+	if (a->Type == uiDrawBrushTypeSolid) {
+		return 1;
+	}
+	if (a->X0 != b->X0 || a->Y0 != b->Y0 || a->X1 != b->X1 || a->Y1 != b->Y1 || a->OuterRadius != b->OuterRadius || a->NumStops != b->NumStops) {
+		return 0;
+	}
+	return a->NumStops == 0 || memcmp(a->Stops, b->Stops, a->NumStops * sizeof(uiDrawBrushGradientStop)) == 0;
+}
+
+/* copy a brush into the list, or reuse the last one if it is the same */
+static int lui_displaylist_addBrush(lua_State *L, lui_displayList *dl, const uiDrawBrush *brush)
+{
+	if (dl->numbrushes > 0 && lui_displaylist_sameBrush(&dl->brushes[dl->numbrushes - 1], brush)) {
+		return dl->numbrushes - 1;
+	}
+	if (!lui_displaylist_grow((void**) &dl->brushes, dl->numbrushes, &dl->maxbrushes, sizeof(uiDrawBrush))) {
+		luaL_error(L, "out of memory!");
+	}
+	if (!lui_drawbrush_copy(&dl->brushes[dl->numbrushes], brush)) {
+		luaL_error(L, "out of memory!");
+	}
+	return dl->numbrushes++;
+}
+
+static int lui_displaylist_addParams(lua_State *L, lui_displayList *dl, const uiDrawStrokeParams *sp)
+{
+	if (dl->numparams > 0) {
+		uiDrawStrokeParams *last = &dl->params[dl->numparams - 1];
+		if (last->Cap == sp->Cap && last->Join == sp->Join && last->Thickness == sp->Thickness && last->MiterLimit == sp->MiterLimit && last->DashPhase == sp->DashPhase && last->NumDashes == sp->NumDashes && (sp->NumDashes == 0 || memcmp(last->Dashes, sp->Dashes, sp->NumDashes * sizeof(double)) == 0)) {
+			return dl->numparams - 1;
+		}
+	}
+	if (!lui_displaylist_grow((void**) &dl->params, dl->numparams, &dl->maxparams, sizeof(uiDrawStrokeParams))) {
+		luaL_error(L, "out of memory!");
+	}
+	if (!lui_drawstrokeparams_copy(&dl->params[dl->numparams], sp)) {
+		luaL_error(L, "out of memory!");
+	}
+	return dl->numparams++;
+}
+
+/* lui_displaylist_play
+ *
+ * replay a display list to a context. Returns the number of drawing
+ * commands that were not culled.
+ */
+static int lui_displaylist_play(lui_drawContextObject *ctx, lui_displayList *dl)
+{
+	uiDrawContext *c = uiDrawContext(ctx->object);
+	int drawn = 0;
+	for (int i = 0; i < dl->numcmds; ++i) {
+		lui_dlCommand *cmd = &dl->cmds[i];
+		switch (cmd->op) {
+			case LUI_DL_FILL:
+				if (lui_drawcontext_visible(ctx, cmd->bounds)) {
+					uiDrawFill(c, uiDrawPath(cmd->object), &dl->brushes[cmd->index]);
+					drawn += 1;
+				}
+				break;
+			case LUI_DL_STROKE:
+				if (lui_drawcontext_visible(ctx, cmd->bounds)) {
+					uiDrawStroke(c, uiDrawPath(cmd->object), &dl->brushes[cmd->index], &dl->params[cmd->params]);
+					drawn += 1;
+				}
+				break;
+			case LUI_DL_TRANSFORM:
+				lui_drawcontext_transform(ctx, &dl->matrices[cmd->index]);
+				break;
+			case LUI_DL_CLIP:
+				uiDrawClip(c, uiDrawPath(cmd->object));
+				break;
+			case LUI_DL_SAVE:
+				lui_drawcontext_save(ctx);
+				break;
+			case LUI_DL_RESTORE:
+				lui_drawcontext_restore(ctx);
+				break;
+			case LUI_DL_TEXT:
+				if (lui_drawcontext_visible(ctx, cmd->bounds)) {
+					uiDrawText(c, uiDrawTextLayout(cmd->object), cmd->bounds[0], cmd->bounds[1]);
+					drawn += 1;
+				}
+				break;
+		}
+	}
+	return drawn;
+}
+
+#ifdef LUI_GTK
+/* make a cairo pattern for a brush, like libui does on GTK */
+static cairo_pattern_t *lui_drawbrush_cairo(const uiDrawBrush *b)
+{
+	cairo_pattern_t *pat;
+	switch (b->Type) {
+		case uiDrawBrushTypeLinearGradient:
+			pat = cairo_pattern_create_linear(b->X0, b->Y0, b->X1, b->Y1);
+			break;
+		case uiDrawBrushTypeRadialGradient:
+			/* libui gradients start with a circle of radius 0 */
+			pat = cairo_pattern_create_radial(b->X0, b->Y0, 0, b->X1, b->Y1, b->OuterRadius);
+			break;
+		default:
+			return cairo_pattern_create_rgba(b->R, b->G, b->B, b->A);
+	}
+	for (size_t i = 0; i < b->NumStops; ++i) {
+		uiDrawBrushGradientStop *st = &b->Stops[i];
+		cairo_pattern_add_color_stop_rgba(pat, st->Pos, st->R, st->G, st->B, st->A);
+	}
+	return pat;
+}
+
+static void lui_drawstrokeparams_cairo(cairo_t *cr, const uiDrawStrokeParams *sp)
+{
+	static const cairo_line_cap_t caps[] = { CAIRO_LINE_CAP_BUTT, CAIRO_LINE_CAP_ROUND, CAIRO_LINE_CAP_SQUARE };
+	static const cairo_line_join_t joins[] = { CAIRO_LINE_JOIN_MITER, CAIRO_LINE_JOIN_ROUND, CAIRO_LINE_JOIN_BEVEL };
+	cairo_set_line_cap(cr, sp->Cap <= uiDrawLineCapSquare ? caps[sp->Cap] : CAIRO_LINE_CAP_BUTT);
+	cairo_set_line_join(cr, sp->Join <= uiDrawLineJoinBevel ? joins[sp->Join] : CAIRO_LINE_JOIN_MITER);
+	cairo_set_line_width(cr, sp->Thickness);
+	cairo_set_miter_limit(cr, sp->MiterLimit);
+	cairo_set_dash(cr, sp->Dashes, sp->NumDashes, sp->DashPhase);
+}
+
+static void lui_displaylist_paint(cairo_t *cr, const uiDrawBrush *b, int stroke)
+{
+	cairo_pattern_t *pat = lui_drawbrush_cairo(b);
+	cairo_set_source(cr, pat);
+	if (stroke) {
+		cairo_stroke(cr);
+	} else {
+		cairo_fill(cr);
+	}
+	cairo_pattern_destroy(pat);
+}
+
+/* lui_displaylist_playCairo
+ *
+ * like lui_displaylist_play(), but draw with cairo directly. libui's
+ * drawing functions are not thread safe, so this is what is used off the
+ * main thread. ctx only tracks the transformation for culling. Text is not
+ * supported. The paths of dl must have been recorded completely.
+ */
+static int lui_displaylist_playCairo(cairo_t *cr, lui_drawContextObject *ctx, lui_displayList *dl)
+{
+	int drawn = 0;
+	for (int i = 0; i < dl->numcmds; ++i) {
+		lui_dlCommand *cmd = &dl->cmds[i];
+		switch (cmd->op) {
+			case LUI_DL_FILL:
+				if (lui_drawcontext_visible(ctx, cmd->bounds)) {
+					lui_drawpath_cairo(cr, cmd->path);
+					lui_displaylist_paint(cr, &dl->brushes[cmd->index], 0);
+					drawn += 1;
+				}
+				break;
+			case LUI_DL_STROKE:
+				if (lui_drawcontext_visible(ctx, cmd->bounds)) {
+					cairo_save(cr);
+					lui_drawpath_cairo(cr, cmd->path);
+					lui_drawstrokeparams_cairo(cr, &dl->params[cmd->params]);
+					lui_displaylist_paint(cr, &dl->brushes[cmd->index], 1);
+					cairo_restore(cr);
+					drawn += 1;
+				}
+				break;
+			case LUI_DL_TRANSFORM: {
+				uiDrawMatrix *m = &dl->matrices[cmd->index];
+				cairo_matrix_t cm;
+				cairo_matrix_init(&cm, m->M11, m->M12, m->M21, m->M22, m->M31, m->M32);
+				cairo_transform(cr, &cm);
+				lui_drawmatrix_then(&ctx->m, m, &ctx->m);
+				break;
+			}
+			case LUI_DL_CLIP:
+				lui_drawpath_cairo(cr, cmd->path);
+				cairo_clip(cr);
+				break;
+			case LUI_DL_SAVE:
+				cairo_save(cr);
+				lui_drawcontext_pushMatrix(ctx);
+				break;
+			case LUI_DL_RESTORE:
+				cairo_restore(cr);
+				lui_drawcontext_popMatrix(ctx);
+				break;
+		}
+	}
+	return drawn;
+}
+#endif
+
+static int lui_drawdisplaylist__gc(lua_State *L)
+{
+	lui_object *lobj = lui_checkDrawDisplayList(L, 1);
+	if (lobj->object) {
+		DEBUGMSG("lui_drawdisplaylist__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_displaylist_free((lui_displayList*) lobj->object);
+		lobj->object = 0;
+	}
+	return 0;
+}
+
+static int lui_drawdisplaylist__len(lua_State *L)
+{
+	lui_object *lobj = lui_checkDrawDisplayList(L, 1);
+	lua_pushinteger(L, ((lui_displayList*) lobj->object)->numcmds);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.displaylist
+ * Name: fill
+ * Signature: list = list:fill(path, brush)
+ * record filling a path, as with context:fill(). Returns the list.
+ */
+static int lui_drawDisplayListFill(lua_State *L)
+{
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 1)->object;
+	lui_drawPathObject *path = lui_checkDrawPath(L, 2);
+	lui_object *brush = lui_checkDrawBrush(L, 3);
+	int index = lui_displaylist_addBrush(L, dl, uiDrawBrush(brush->object));
+	lui_dlCommand *cmd = lui_displaylist_add(L, dl, LUI_DL_FILL);
+	cmd->index = index;
+	cmd->object = path->object;
+	cmd->path = path;
+	if (!path->empty) {
+		memcpy(cmd->bounds, path->bounds, sizeof(cmd->bounds));
+		lui_displaylist_extend(dl, cmd->bounds);
+	}
+	lui_displaylist_ref(L, dl, 2);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.displaylist
+ * Name: stroke
+ * Signature: list = list:stroke(path, brush, strokeparams)
+ * record stroking a path, as with context:stroke(). Returns the list.
+ */
+static int lui_drawDisplayListStroke(lua_State *L)
+{
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 1)->object;
+	lui_drawPathObject *path = lui_checkDrawPath(L, 2);
+	lui_object *brush = lui_checkDrawBrush(L, 3);
+	uiDrawStrokeParams *sp = uiDrawStrokeParams(lui_checkDrawStrokeParams(L, 4)->object);
+	int index = lui_displaylist_addBrush(L, dl, uiDrawBrush(brush->object));
+	int params = lui_displaylist_addParams(L, dl, sp);
+	lui_dlCommand *cmd = lui_displaylist_add(L, dl, LUI_DL_STROKE);
+	cmd->index = index;
+	cmd->params = params;
+	cmd->object = path->object;
+	cmd->path = path;
+	if (!path->empty) {
+		double w = lui_drawstrokeparams_extent(sp);
+		cmd->bounds[0] = path->bounds[0] - w;
+		cmd->bounds[1] = path->bounds[1] - w;
+		cmd->bounds[2] = path->bounds[2] + w;
+		cmd->bounds[3] = path->bounds[3] + w;
+		lui_displaylist_extend(dl, cmd->bounds);
+	}
+	lui_displaylist_ref(L, dl, 2);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.displaylist
+ * Name: transform
+ * Signature: list = list:transform(matrix)
+ * record a transformation, as with context:transform(). The matrix is
+ * copied. Returns the list.
+ */
+static int lui_drawDisplayListTransform(lua_State *L)
+{
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 1)->object;
+	uiDrawMatrix *m = uiDrawMatrix(lui_checkDrawMatrix(L, 2)->object);
+	if (!lui_displaylist_grow((void**) &dl->matrices, dl->nummatrices, &dl->maxmatrices, sizeof(uiDrawMatrix))) {
+		return luaL_error(L, "out of memory!");
+	}
+	dl->matrices[dl->nummatrices] = *m;
+	lui_dlCommand *cmd = lui_displaylist_add(L, dl, LUI_DL_TRANSFORM);
+	cmd->index = dl->nummatrices++;
+	lui_drawmatrix_then(&dl->m, m, &dl->m);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.displaylist
+ * Name: clip
+ * Signature: list = list:clip(path)
+ * record clipping to a path, as with context:clip(). Returns the list.
+ */
+static int lui_drawDisplayListClip(lua_State *L)
+{
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 1)->object;
+	lui_drawPathObject *path = lui_checkDrawPath(L, 2);
+	lui_dlCommand *cmd = lui_displaylist_add(L, dl, LUI_DL_CLIP);
+	cmd->object = path->object;
+	cmd->path = path;
+	lui_displaylist_ref(L, dl, 2);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.displaylist
+ * Name: save
+ * Signature: list = list:save()
+ * record saving the context state, as with context:save(). Returns the
+ * list.
+ */
+static int lui_drawDisplayListSave(lua_State *L)
+{
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 1)->object;
+	if (!lui_displaylist_grow((void**) &dl->stack, dl->depth, &dl->maxdepth, sizeof(uiDrawMatrix))) {
+		return luaL_error(L, "out of memory!");
+	}
+	lui_displaylist_add(L, dl, LUI_DL_SAVE);
+	dl->stack[dl->depth++] = dl->m;
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.displaylist
+ * Name: restore
+ * Signature: list = list:restore()
+ * record restoring the context state, as with context:restore(). Returns
+ * the list.
+ */
+static int lui_drawDisplayListRestore(lua_State *L)
 {
-	lui_object *lobj = lui_pushDrawContext(L);
-	lobj->object = ctx;
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 1)->object;
+	lui_displaylist_add(L, dl, LUI_DL_RESTORE);
+	if (dl->depth > 0) {
+		dl->m = dl->stack[--dl->depth];
+	}
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.displaylist
+ * Name: text
+ * Signature: list = list:text(x, y, textlayout)
+ * record drawing a text layout, as with the first form of context:text().
+ * Returns the list.
+ */
+static int lui_drawDisplayListText(lua_State *L)
+{
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 1)->object;
+	double x = luaL_checknumber(L, 2);
+	double y = luaL_checknumber(L, 3);
+	lui_object *text = lui_checkTextLayout(L, 4);
+	double w, h;
+	uiDrawTextLayoutExtents(uiDrawTextLayout(text->object), &w, &h);
+	lui_dlCommand *cmd = lui_displaylist_add(L, dl, LUI_DL_TEXT);
+	cmd->object = text->object;
+	cmd->bounds[0] = x;
+	cmd->bounds[1] = y;
+	cmd->bounds[2] = x + w;
+	cmd->bounds[3] = y + h;
+	lui_displaylist_extend(dl, cmd->bounds);
+	lui_displaylist_ref(L, dl, 4);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.displaylist
+ * Name: clear
+ * Signature: list = list:clear()
+ * remove all commands from the list. Returns the list.
+ */
+static int lui_drawDisplayListClear(lua_State *L)
+{
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 1)->object;
+	lui_displaylist_clear(dl);
+	lua_newtable(L);
+	lua_setuservalue(L, 1);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.displaylist
+ * Name: bounds
+ * Signature: x, y, w, h = list:bounds()
+ * return the bounding box of everything drawn by the list, in the
+ * coordinates in effect when the list is played. Returns nothing if the
+ * list does not draw anything.
+ */
+static int lui_drawDisplayListBounds(lua_State *L)
+{
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 1)->object;
+	if (dl->empty) {
+		return 0;
+	}
+	lua_pushnumber(L, dl->bounds[0]);
+	lua_pushnumber(L, dl->bounds[1]);
+	lua_pushnumber(L, dl->bounds[2] - dl->bounds[0]);
+	lua_pushnumber(L, dl->bounds[3] - dl->bounds[1]);
+	return 4;
+}
+
+/*** Constructor
+ * Object: draw.displaylist
+ * Name: draw.displaylist
+ * Signature: list = lui.draw.displaylist()
+ * create a new, empty draw.displaylist object.
+ */
+static int lui_newDrawDisplayList(lua_State *L)
+{
+	lui_object *lobj = lui_pushDrawDisplayList(L);
+	lui_displayList *dl = calloc(1, sizeof(lui_displayList));
+	if (!dl) {
+		return luaL_error(L, "out of memory!");
+	}
+	lui_displaylist_clear(dl);
+	lobj->object = dl;
+	lui_registerObject(L, lua_gettop(L));
+	return 1;
+}
+
+/* metamethods for draw.displaylist */
+static const luaL_Reg lui_drawdisplaylist_meta[] = {
+	{"__gc", lui_drawdisplaylist__gc},
+	{"__len", lui_drawdisplaylist__len},
+	{0, 0}
+};
+
+/* methods for draw.displaylist */
+static const luaL_Reg lui_drawdisplaylist_methods[] = {
+	{"fill", lui_drawDisplayListFill},
+	{"stroke", lui_drawDisplayListStroke},
+	{"transform", lui_drawDisplayListTransform},
+	{"clip", lui_drawDisplayListClip},
+	{"save", lui_drawDisplayListSave},
+	{"restore", lui_drawDisplayListRestore},
+	{"text", lui_drawDisplayListText},
+	{"clear", lui_drawDisplayListClear},
+	{"bounds", lui_drawDisplayListBounds},
+	{0, 0}
+};
+
+/*** Method
+ * Object: draw.context
+ * Name: play
+ * Signature: count = context:play(displaylist)
+ * replay a draw.displaylist to the context. Drawing commands whose bounds
+ * are completely outside of the area being redrawn are skipped. Returns
+ * the number of drawing commands that were actually executed.
+ */
+static int lui_drawContextPlay(lua_State *L)
+{
+	lui_drawContextObject *lobj = lui_checkDrawContext(L, 1);
+	lui_displayList *dl = (lui_displayList*) lui_checkDrawDisplayList(L, 2)->object;
+	lua_pushinteger(L, lui_displaylist_play(lobj, dl));
 	return 1;
 }
 
@@ -958,6 +2738,7 @@ static const struct luaL_Reg lui_drawContext_methods [] ={
 	{"save", lui_drawContextSave},
 	{"restore", lui_drawContextRestore},
 	{"text", lui_drawContextText},
+	{"play", lui_drawContextPlay},
 	{0, 0}
 };
 
@@ -969,6 +2750,10 @@ static const struct luaL_Reg lui_draw_funcs [] ={
 	{"strokeparams", lui_newDrawStrokeParams},
 	{"matrix", lui_newDrawMatrix},
 	{"path", lui_newDrawPath},
+	{"displaylist", lui_newDrawDisplayList},
+	/* utility functions */
+	{"svgpath", lui_drawSvgPath},
+	{"decimate", lui_drawDecimateFunc},
 	{0, 0}
 };
 
@@ -1014,6 +2799,19 @@ static int lui_init_draw(lua_State *L)
 	lui_add_utility_type(L, LUI_DRAWMATRIX, lui_drawmatrix_methods, 0);
 	lui_add_utility_type(L, LUI_DRAWPATH, lui_drawpath_methods, lui_drawpath_meta);
 	lui_add_utility_type(L, LUI_DRAWCONTEXT, lui_drawContext_methods, lui_drawcontext_meta);
+	lui_add_utility_type(L, LUI_DRAWDISPLAYLIST, lui_drawdisplaylist_methods, lui_drawdisplaylist_meta);
+
+	/* create svg path cache, one weak table per fillmode */
+	lua_newtable(L);
+	for (int i = uiDrawFillModeWinding; i <= uiDrawFillModeAlternate; ++i) {
+		lua_newtable(L);
+		lua_newtable(L);
+		lua_pushstring(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, LUA_REGISTRYINDEX, LUI_SVGPATH_CACHE);
 
 	lui_addDrawEnums(L);
 
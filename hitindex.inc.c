@@ -0,0 +1,599 @@
+/* lui.c
+ *
+ * lua binding to libui (https://github.com/andlabs/libui)
+ *
+ * Gunnar Zötl <gz@tset.de>, 2016
+ * Released under MIT/X11 license. See file LICENSE for details.
+ *
+ * This file is included by lui.c
+ */
+
+/* hit index  **************************************************************/
+
+/*** Object
+ * Name: hitindex
+ * a spatial index of rectangles, each identified by an id, for finding out
+ * what is at a position in an area. An id can be any lua value except nil
+ * and NaN. When a hitindex is set as the hitindex property of an area, the
+ * onmouse handler of that area receives the id of the topmost rectangle
+ * under the mouse. Rectangles with a higher z are on top of rectangles with
+ * a lower z, and for equal z, rectangles inserted later are on top.
+ */
+#define LUI_HITINDEX "lui_hitindex"
+#define lui_pushHitIndex(L) lui_pushObject(L, LUI_HITINDEX, 1)
+#define lui_checkHitIndex(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_HITINDEX))
+
+/* rectangles that cover more grid cells than this are not entered into the
+ * grid, but kept in a list that is searched for every lookup. */
+#define LUI_HITINDEX_MAXCELLS 64
+/* cell coordinates must stay well within the range of int */
+#define LUI_HITINDEX_MAXCOORD 1e8
+
+typedef struct {
+	double b[4];			/* x0, y0, x1, y1 */
+	double z;
+	unsigned seq;
+	unsigned mark;			/* for deduplicating query results */
+	int cx0, cy0, cx1, cy1;	/* covered cells, cx0 > cx1 if not in the grid */
+	int used;
+	int nextfree;
+} lui_hitEntry;
+
+typedef struct {
+	int cx, cy;
+	int used;
+	int num, max;
+	int *items;
+} lui_hitCell;
+
+typedef struct {
+	double cellsize;
+	lui_hitEntry *entries;
+	int numentries, maxentries, freelist, count;
+	lui_hitCell *cells;		/* open addressing hash table */
+	int numcells, maxcells;
+	lui_hitCell big;
+	unsigned seq, mark;
+} lui_hitIndex;
+
+static unsigned lui_hitindex_hash(int cx, int cy)
+{
+	return (unsigned)cx * 73856093u ^ (unsigned)cy * 19349663u;
+}
+
+/* find the cell for cx, cy, or the free slot where it would go */
+static lui_hitCell *lui_hitindex_findCell(lui_hitIndex *hi, int cx, int cy)
+{
+	unsigned mask = hi->maxcells - 1;
+	unsigned i = lui_hitindex_hash(cx, cy) & mask;
+	while (hi->cells[i].used && (hi->cells[i].cx != cx || hi->cells[i].cy != cy)) {
+		i = (i + 1) & mask;
+	}
+	return &hi->cells[i];
+}
+
+/* lui_hitindex_growCells
+ *
+ * rehash the cells when the table is half full. Cells that became empty as
+ * rectangles were moved or removed are dropped here, and the table only
+ * grows if the remaining cells still fill more than a quarter of it, so an
+ * index of moving rectangles does not grow without bounds.
+ */
+static int lui_hitindex_growCells(lui_hitIndex *hi)
+{
+	int live = 0;
+	for (int i = 0; i < hi->maxcells; ++i) {
+		live += hi->cells[i].used && hi->cells[i].num > 0;
+	}
+	int max = hi->maxcells ? hi->maxcells : 64;
+	while ((live + 1) * 4 > max) {
+		max *= 2;
+	}
+	lui_hitCell *old = hi->cells;
+	int oldmax = hi->maxcells;
+	hi->cells = calloc(max, sizeof(lui_hitCell));
+	if (!hi->cells) {
+		hi->cells = old;
+		return 0;
+	}
+	hi->maxcells = max;
+	hi->numcells = live;
+	for (int i = 0; i < oldmax; ++i) {
+		if (old[i].used && old[i].num > 0) {
+			*lui_hitindex_findCell(hi, old[i].cx, old[i].cy) = old[i];
+		} else if (old[i].used) {
+			free(old[i].items);
+		}
+	}
+	free(old);
+	return 1;
+}
+
+static int lui_hitcell_add(lui_hitCell *cell, int item)
+{
+	if (cell->num == cell->max) {
+		int max = cell->max ? cell->max * 2 : 4;
+		int *items = realloc(cell->items, max * sizeof(int));
+		if (!items) {
+			return 0;
+		}
+		cell->items = items;
+		cell->max = max;
+	}
+	cell->items[cell->num++] = item;
+	return 1;
+}
+
+static void lui_hitcell_remove(lui_hitCell *cell, int item)
+{
+	for (int i = 0; i < cell->num; ++i) {
+		if (cell->items[i] == item) {
+			cell->items[i] = cell->items[--cell->num];
+			return;
+		}
+	}
+}
+
+static int lui_hitindex_cellcoord(lui_hitIndex *hi, double v, int *c)
+{
+	double cv = floor(v / hi->cellsize);
+	if (!(cv > -LUI_HITINDEX_MAXCOORD && cv < LUI_HITINDEX_MAXCOORD)) {
+		return 0;
+	}
+	*c = (int) cv;
+	return 1;
+}
+
+static void lui_hitindex_unlink(lui_hitIndex *hi, int item)
+{
+	lui_hitEntry *e = &hi->entries[item];
+	if (e->cx0 > e->cx1) {
+		lui_hitcell_remove(&hi->big, item);
+		return;
+	}
+	for (int cy = e->cy0; cy <= e->cy1; ++cy) {
+		for (int cx = e->cx0; cx <= e->cx1; ++cx) {
+			lui_hitCell *cell = lui_hitindex_findCell(hi, cx, cy);
+			if (cell->used) {
+				lui_hitcell_remove(cell, item);
+			}
+		}
+	}
+}
+
+/* enter an entry into the grid, or into the big list. Returns 0 if out of
+ * memory, in which case the entry is not linked anywhere. */
+static int lui_hitindex_link(lui_hitIndex *hi, int item)
+{
+	lui_hitEntry *e = &hi->entries[item];
+	int ok = lui_hitindex_cellcoord(hi, e->b[0], &e->cx0) && lui_hitindex_cellcoord(hi, e->b[1], &e->cy0) &&
+		lui_hitindex_cellcoord(hi, e->b[2], &e->cx1) && lui_hitindex_cellcoord(hi, e->b[3], &e->cy1);
+	if (!ok || (double)(e->cx1 - e->cx0 + 1) * (e->cy1 - e->cy0 + 1) > LUI_HITINDEX_MAXCELLS) {
+		e->cx0 = 1;
+		e->cx1 = 0;
+		return lui_hitcell_add(&hi->big, item);
+	}
+	for (int cy = e->cy0; cy <= e->cy1; ++cy) {
+		for (int cx = e->cx0; cx <= e->cx1; ++cx) {
+			if ((hi->numcells + 1) * 2 > hi->maxcells && !lui_hitindex_growCells(hi)) {
+				goto oom;
+			}
+			lui_hitCell *cell = lui_hitindex_findCell(hi, cx, cy);
+			if (!cell->used) {
+				cell->used = 1;
+				cell->cx = cx;
+				cell->cy = cy;
+				hi->numcells += 1;
+			}
+			if (!lui_hitcell_add(cell, item)) {
+				goto oom;
+			}
+		}
+	}
+	return 1;
+
+oom:
+	lui_hitindex_unlink(hi, item);
+	return 0;
+}
+
+/* is a on top of b? */
+static int lui_hitindex_above(lui_hitEntry *a, lui_hitEntry *b)
+{
+	return a->z > b->z || (a->z == b->z && a->seq > b->seq);
+}
+
+static int lui_hitindex_topmostIn(lui_hitIndex *hi, lui_hitCell *cell, double x, double y, int best)
+{
+	for (int i = 0; i < cell->num; ++i) {
+		lui_hitEntry *e = &hi->entries[cell->items[i]];
+		if (x >= e->b[0] && x <= e->b[2] && y >= e->b[1] && y <= e->b[3] &&
+			(best < 0 || lui_hitindex_above(e, &hi->entries[best]))) {
+			best = cell->items[i];
+		}
+	}
+	return best;
+}
+
+/* lui_hitindex_hit
+ *
+ * return the index of the topmost entry containing x, y, or -1 if there is
+ * none. Only the one grid cell containing x, y is searched.
+ */
+static int lui_hitindex_hit(lui_hitIndex *hi, double x, double y)
+{
+	int best = lui_hitindex_topmostIn(hi, &hi->big, x, y, -1);
+	int cx, cy;
+	if (hi->maxcells && lui_hitindex_cellcoord(hi, x, &cx) && lui_hitindex_cellcoord(hi, y, &cy)) {
+		lui_hitCell *cell = lui_hitindex_findCell(hi, cx, cy);
+		if (cell->used) {
+			best = lui_hitindex_topmostIn(hi, cell, x, y, best);
+		}
+	}
+	return best;
+}
+
+/* lui_hitindex_pushId
+ *
+ * push the id of entry item of the hitindex at stack position pos, or nil
+ * if item is < 0.
+ */
+static void lui_hitindex_pushId(lua_State *L, int pos, int item)
+{
+	if (item < 0) {
+		lua_pushnil(L);
+		return;
+	}
+	lui_aux_getUservalue(L, pos, "ids");
+	lua_rawgeti(L, -1, item + 1);
+	lua_remove(L, -2);
+}
+
+static void lui_hitindex_free(lui_hitIndex *hi)
+{
+	for (int i = 0; i < hi->maxcells; ++i) {
+		free(hi->cells[i].items);
+	}
+	free(hi->cells);
+	free(hi->big.items);
+	free(hi->entries);
+}
+
+static int lui_hitindex__gc(lua_State *L)
+{
+	lui_object *lobj = lui_checkHitIndex(L, 1);
+	if (lobj->object) {
+		DEBUGMSG("lui_hitindex__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_hitindex_free((lui_hitIndex*) lobj->object);
+		free(lobj->object);
+		lobj->object = 0;
+	}
+	return 0;
+}
+
+static int lui_hitindex__len(lua_State *L)
+{
+	lui_hitIndex *hi = (lui_hitIndex*) lui_checkHitIndex(L, 1)->object;
+	lua_pushinteger(L, hi->count);
+	return 1;
+}
+
+/* look up the entry for the id at stack position pos, -1 if there is none */
+static int lui_hitindex_find(lua_State *L, int pos)
+{
+	lui_aux_getUservalue(L, 1, "map");
+	lua_pushvalue(L, pos);
+	int item = lua_rawget(L, -2) == LUA_TNUMBER ? (int) lua_tointeger(L, -1) : -1;
+	lua_pop(L, 2);
+	return item;
+}
+
+/*** Method
+ * Object: hitindex
+ * Name: insert
+ * Signature: hitindex:insert(id, x, y, w, h, z = nil)
+ * add a rectangle with an id to the index. If the id is already in the
+ * index, its rectangle is moved, keeping its position in the stacking order
+ * unless a new z is given. z defaults to 0 for new rectangles.
+ */
+static int lui_hitIndexInsert(lua_State *L)
+{
+	lui_hitIndex *hi = (lui_hitIndex*) lui_checkHitIndex(L, 1)->object;
+	luaL_argcheck(L, !lua_isnil(L, 2) && lua_rawequal(L, 2, 2), 2, "invalid id");
+	double x = luaL_checknumber(L, 3);
+	double y = luaL_checknumber(L, 4);
+	double w = luaL_checknumber(L, 5);
+	double h = luaL_checknumber(L, 6);
+	int hasz = !lua_isnoneornil(L, 7);
+	double z = luaL_optnumber(L, 7, 0);
+
+	int item = lui_hitindex_find(L, 2);
+	lui_hitEntry *e;
+	if (item >= 0) {
+		lui_hitindex_unlink(hi, item);
+		e = &hi->entries[item];
+	} else {
+		if (hi->freelist >= 0) {
+			item = hi->freelist;
+			hi->freelist = hi->entries[item].nextfree;
+		} else {
+			if (hi->numentries == hi->maxentries) {
+				int max = hi->maxentries ? hi->maxentries * 2 : 64;
+				lui_hitEntry *entries = realloc(hi->entries, max * sizeof(lui_hitEntry));
+				if (!entries) {
+					return luaL_error(L, "out of memory!");
+				}
+				hi->entries = entries;
+				hi->maxentries = max;
+			}
+			item = hi->numentries++;
+		}
+		e = &hi->entries[item];
+		memset(e, 0, sizeof(lui_hitEntry));
+		e->used = 1;
+		e->seq = hi->seq++;
+		hi->count += 1;
+		lui_aux_getUservalue(L, 1, "ids");
+		lua_pushvalue(L, 2);
+		lua_rawseti(L, -2, item + 1);
+		lui_aux_getUservalue(L, 1, "map");
+		lua_pushvalue(L, 2);
+		lua_pushinteger(L, item);
+		lua_rawset(L, -3);
+		lua_pop(L, 2);
+	}
+	if (hasz) {
+		e->z = z;
+	}
+	e->b[0] = w < 0 ? x + w : x;
+	e->b[1] = h < 0 ? y + h : y;
+	e->b[2] = w < 0 ? x : x + w;
+	e->b[3] = h < 0 ? y : y + h;
+	if (!lui_hitindex_link(hi, item)) {
+		/* keep the entry, but where no lookup will find it */
+		e->b[0] = e->b[1] = 1;
+		e->b[2] = e->b[3] = 0;
+		return luaL_error(L, "out of memory!");
+	}
+	return 0;
+}
+
+/*** Method
+ * Object: hitindex
+ * Name: remove
+ * Signature: hitindex:remove(id)
+ * remove the rectangle with an id from the index.
+ */
+static int lui_hitIndexRemove(lua_State *L)
+{
+	lui_hitIndex *hi = (lui_hitIndex*) lui_checkHitIndex(L, 1)->object;
+	luaL_checkany(L, 2);
+	if (lua_isnil(L, 2)) {
+		return 0;
+	}
+	int item = lui_hitindex_find(L, 2);
+	if (item < 0) {
+		return 0;
+	}
+	lui_hitindex_unlink(hi, item);
+	hi->entries[item].used = 0;
+	hi->entries[item].nextfree = hi->freelist;
+	hi->freelist = item;
+	hi->count -= 1;
+	lui_aux_getUservalue(L, 1, "ids");
+	lua_pushnil(L);
+	lua_rawseti(L, -2, item + 1);
+	lui_aux_getUservalue(L, 1, "map");
+	lua_pushvalue(L, 2);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	return 0;
+}
+
+static void lui_hitindex_reset(lua_State *L, int pos, lui_hitIndex *hi)
+{
+	lui_hitindex_free(hi);
+	double cellsize = hi->cellsize;
+	memset(hi, 0, sizeof(lui_hitIndex));
+	hi->cellsize = cellsize;
+	hi->freelist = -1;
+	lua_newtable(L);
+	lui_aux_setUservalue(L, pos, "ids", -1);
+	lua_newtable(L);
+	lui_aux_setUservalue(L, pos, "map", -1);
+	lua_pop(L, 2);
+}
+
+/*** Method
+ * Object: hitindex
+ * Name: clear
+ * Signature: hitindex:clear()
+ * remove all rectangles from the index.
+ */
+static int lui_hitIndexClear(lua_State *L)
+{
+	lui_hitIndex *hi = (lui_hitIndex*) lui_checkHitIndex(L, 1)->object;
+	lui_hitindex_reset(L, 1, hi);
+	return 0;
+}
+
+/*** Method
+ * Object: hitindex
+ * Name: hit
+ * Signature: id = hitindex:hit(x, y)
+ * return the id of the topmost rectangle containing x, y, or nil if there
+ * is none.
+ */
+static int lui_hitIndexHit(lua_State *L)
+{
+	lui_hitIndex *hi = (lui_hitIndex*) lui_checkHitIndex(L, 1)->object;
+	double x = luaL_checknumber(L, 2);
+	double y = luaL_checknumber(L, 3);
+	lui_hitindex_pushId(L, 1, lui_hitindex_hit(hi, x, y));
+	return 1;
+}
+
+static lui_hitIndex *lui_hitindex_sortIndex;
+
+static int lui_hitindex_compareTopmost(const void *a, const void *b)
+{
+	lui_hitEntry *ea = &lui_hitindex_sortIndex->entries[*(const int*)a];
+	lui_hitEntry *eb = &lui_hitindex_sortIndex->entries[*(const int*)b];
+	return lui_hitindex_above(ea, eb) ? -1 : lui_hitindex_above(eb, ea);
+}
+
+static int lui_hitindex_collect(lui_hitIndex *hi, lui_hitCell *cell, const double *q, lui_hitCell *res)
+{
+	for (int i = 0; i < cell->num; ++i) {
+		lui_hitEntry *e = &hi->entries[cell->items[i]];
+		if (e->mark != hi->mark && e->b[0] <= q[2] && e->b[2] >= q[0] && e->b[1] <= q[3] && e->b[3] >= q[1]) {
+			e->mark = hi->mark;
+			if (!lui_hitcell_add(res, cell->items[i])) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/*** Method
+ * Object: hitindex
+ * Name: query
+ * Signature: ids = hitindex:query(x, y, w, h)
+ * return a table with the ids of all rectangles that intersect the
+ * rectangle x, y, w, h, topmost first.
+ */
+static int lui_hitIndexQuery(lua_State *L)
+{
+	lui_hitIndex *hi = (lui_hitIndex*) lui_checkHitIndex(L, 1)->object;
+	double x = luaL_checknumber(L, 2);
+	double y = luaL_checknumber(L, 3);
+	double w = luaL_checknumber(L, 4);
+	double h = luaL_checknumber(L, 5);
+	double q[4] = { w < 0 ? x + w : x, h < 0 ? y + h : y, w < 0 ? x : x + w, h < 0 ? y : y + h };
+	lui_hitCell res = { 0 };
+	int ok = 1;
+
+	hi->mark += 1;
+	ok = lui_hitindex_collect(hi, &hi->big, q, &res);
+	int cx0, cy0, cx1, cy1;
+	if (ok && hi->numcells > 0 && lui_hitindex_cellcoord(hi, q[0], &cx0) && lui_hitindex_cellcoord(hi, q[1], &cy0) &&
+		lui_hitindex_cellcoord(hi, q[2], &cx1) && lui_hitindex_cellcoord(hi, q[3], &cy1)) {
+		if ((double)(cx1 - cx0 + 1) * (cy1 - cy0 + 1) > hi->numcells) {
+			/* cheaper to look at every cell there is */
+			for (int i = 0; ok && i < hi->maxcells; ++i) {
+				if (hi->cells[i].used) {
+					ok = lui_hitindex_collect(hi, &hi->cells[i], q, &res);
+				}
+			}
+		} else {
+			for (int cy = cy0; ok && cy <= cy1; ++cy) {
+				for (int cx = cx0; ok && cx <= cx1; ++cx) {
+					lui_hitCell *cell = lui_hitindex_findCell(hi, cx, cy);
+					if (cell->used) {
+						ok = lui_hitindex_collect(hi, cell, q, &res);
+					}
+				}
+			}
+		}
+	} else if (ok) {
+		for (int i = 0; ok && i < hi->maxcells; ++i) {
+			if (hi->cells[i].used) {
+				ok = lui_hitindex_collect(hi, &hi->cells[i], q, &res);
+			}
+		}
+	}
+	if (!ok) {
+		free(res.items);
+		return luaL_error(L, "out of memory!");
+	}
+	lui_hitindex_sortIndex = hi;
+	qsort(res.items, res.num, sizeof(int), lui_hitindex_compareTopmost);
+
+	lua_createtable(L, res.num, 0);
+	lui_aux_getUservalue(L, 1, "ids");
+	for (int i = 0; i < res.num; ++i) {
+		lua_rawgeti(L, -1, res.items[i] + 1);
+		lua_rawseti(L, -3, i + 1);
+	}
+	lua_pop(L, 1);
+	free(res.items);
+	return 1;
+}
+
+/*** Method
+ * Object: hitindex
+ * Name: bounds
+ * Signature: x, y, w, h = hitindex:bounds(id)
+ * return the rectangle for an id, or nothing if the id is not in the index.
+ */
+static int lui_hitIndexBounds(lua_State *L)
+{
+	lui_hitIndex *hi = (lui_hitIndex*) lui_checkHitIndex(L, 1)->object;
+	luaL_checkany(L, 2);
+	int item = lua_isnil(L, 2) ? -1 : lui_hitindex_find(L, 2);
+	if (item < 0) {
+		return 0;
+	}
+	lui_hitEntry *e = &hi->entries[item];
+	lua_pushnumber(L, e->b[0]);
+	lua_pushnumber(L, e->b[1]);
+	lua_pushnumber(L, e->b[2] - e->b[0]);
+	lua_pushnumber(L, e->b[3] - e->b[1]);
+	return 4;
+}
+
+/*** Constructor
+ * Object: hitindex
+ * Name: hitindex
+ * Signature: hitindex = lui.hitindex(cellsize = 64)
+ * create a new, empty hitindex. The index is a grid of cells of size
+ * cellsize, and a lookup only searches the cell the position falls into,
+ * so cellsize should be about the size of a typical rectangle.
+ */
+static int lui_newHitIndex(lua_State *L)
+{
+	double cellsize = luaL_optnumber(L, 1, 64);
+	luaL_argcheck(L, cellsize > 0, 1, "cellsize must be > 0");
+
+	lui_object *lobj = lui_pushHitIndex(L);
+	lui_hitIndex *hi = calloc(1, sizeof(lui_hitIndex));
+	if (!hi) {
+		return luaL_error(L, "out of memory!");
+	}
+	lobj->object = hi;
+	hi->cellsize = cellsize;
+	lui_hitindex_reset(L, lua_gettop(L), hi);
+	lui_registerObject(L, lua_gettop(L));
+	return 1;
+}
+
+/* metamethods for hitindexes */
+static const luaL_Reg lui_hitindex_meta[] = {
+	{"__gc", lui_hitindex__gc},
+	{"__len", lui_hitindex__len},
+	{0, 0}
+};
+
+/* methods for hitindexes */
+static const luaL_Reg lui_hitindex_methods[] = {
+	{"insert", lui_hitIndexInsert},
+	{"remove", lui_hitIndexRemove},
+	{"clear", lui_hitIndexClear},
+	{"hit", lui_hitIndexHit},
+	{"query", lui_hitIndexQuery},
+	{"bounds", lui_hitIndexBounds},
+	{0, 0}
+};
+
+static const struct luaL_Reg lui_hitindex_funcs [] ={
+	{"hitindex", lui_newHitIndex},
+	{0, 0}
+};
+
+static int lui_init_hitindex(lua_State *L)
+{
+	luaL_setfuncs(L, lui_hitindex_funcs, 0);
+	lui_add_utility_type(L, LUI_HITINDEX, lui_hitindex_methods, lui_hitindex_meta);
+	return 1;
+}
@@ -72,18 +72,577 @@ static int lui_newImage(lua_State *L)
 	return 1;
 }
 
+/* lui_decodeImage
+ *
+ * load an image file into a freshly allocated buffer of premultiplied rgba
+ * pixels, as expected by uiImageAppend(). If maxwidth and maxheight are > 0,
+ * the image is scaled to fit into that size, keeping its aspect ratio. On
+ * success, *width and *height are set to the size of the decoded image. On
+ * failure, NULL is returned and an error message is written to err. This
+ * does not touch any lua or libui state, so it may be called from any
+ * thread.
+ */
+static unsigned char *lui_decodeImage(const char *file, int maxwidth, int maxheight, int *width, int *height, char *err, size_t errlen)
+{
+#ifdef LUI_GTK
+	GError *gerr = NULL;
+	GdkPixbuf *pb;
+	if (maxwidth > 0 && maxheight > 0) {
+		pb = gdk_pixbuf_new_from_file_at_scale(file, maxwidth, maxheight, TRUE, &gerr);
+	} else {
+		pb = gdk_pixbuf_new_from_file(file, &gerr);
+	}
+	if (!pb) {
+		snprintf(err, errlen, "%s", gerr ? gerr->message : "could not load image");
+		if (gerr) {
+			g_error_free(gerr);
+		}
+		return NULL;
+	}
+	int w = gdk_pixbuf_get_width(pb);
+	int h = gdk_pixbuf_get_height(pb);
+	int nchannels = gdk_pixbuf_get_n_channels(pb);
+	int hasalpha = gdk_pixbuf_get_has_alpha(pb);
+	int rowstride = gdk_pixbuf_get_rowstride(pb);
+	const unsigned char *src = gdk_pixbuf_get_pixels(pb);
+	unsigned char *pixels = malloc((size_t) w * h * 4);
+	if (!pixels) {
+		g_object_unref(pb);
+		snprintf(err, errlen, "out of memory");
+		return NULL;
+	}
+	unsigned char *dst = pixels;
+	for (int y = 0; y < h; ++y) {
+		const unsigned char *p = src + (size_t) y * rowstride;
+		for (int x = 0; x < w; ++x, p += nchannels, dst += 4) {
+			unsigned int a = hasalpha ? p[3] : 255;
+			dst[0] = (p[0] * a + 127) / 255;
+			dst[1] = (p[1] * a + 127) / 255;
+			dst[2] = (p[2] * a + 127) / 255;
+			dst[3] = a;
+		}
+	}
+	g_object_unref(pb);
+	*width = w;
+	*height = h;
+	return pixels;
+#else
+	(void) file;
+	(void) maxwidth;
+	(void) maxheight;
+	(void) width;
+	(void) height;
+	snprintf(err, errlen, "loading images is not supported on this platform");
+	return NULL;
+#endif
+}
+
 /*** Constructor
  * Object: image
  * Name: loadimage
  * Signature: image = lui.loadimage(filename)
  * create a new image object by loading it from a file. Width and height are
- * set from the respective sizes of the image file.
+ * set from the respective sizes of the image file. Returns nil and an error
+ * message if the file could not be loaded. Currently only supported on
+ * Linux.
  */
 static int lui_loadImage(lua_State *L)
 {
 	const char *file = luaL_checkstring(L, 1);
-	(void) file; // TODO
-	return luaL_error(L, "not implemented");
+	char err[256];
+	int width, height;
+	unsigned char *pixels = lui_decodeImage(file, 0, 0, &width, &height, err, sizeof(err));
+	if (!pixels) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", file, err);
+		return 2;
+	}
+	lui_object *lobj = lui_pushImage(L);
+	lobj->object = uiNewImage(width, height);
+	uiImageAppend(uiImage(lobj->object), pixels, width, height, width * 4);
+	free(pixels);
+	lui_registerObject(L, lua_gettop(L));
+	return 1;
+}
+
+/* image sources ************************************************************/
+
+/*** Object
+ * Name: imagesource
+ * an image source provides images for image columns of tables from file
+ * names. Images are decoded and scaled down in background threads, until
+ * an image is ready, a placeholder is displayed in its place, and the table
+ * row is updated once it has arrived. Decoded images are held in a cache
+ * limited by the number of pixels it holds, the least recently used images
+ * are dropped from it first. See tablemodel:setimagesource().
+ */
+#define LUI_IMAGESOURCE "lui_imagesource"
+#define lui_pushImageSource(L) lui_pushObject(L, LUI_IMAGESOURCE, 1)
+#define lui_checkImageSource(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_IMAGESOURCE))
+
+#define LUI_IMAGESOURCE_DEFAULTPIXELS (4 * 1024 * 1024)
+#define LUI_IMAGESOURCE_MAXTHREADS 4
+/* every cache entry counts as at least this many pixels, so that entries
+ * for files that could not be loaded are dropped eventually, too. */
+#define LUI_IMAGESOURCE_MINCOST 64
+
+enum {
+	LUI_IMAGEENTRY_PENDING,
+	LUI_IMAGEENTRY_READY,
+	LUI_IMAGEENTRY_FAILED
+};
+
+typedef struct lui_imageWaiter {
+	uiTableModelHandler *tmh;
+	uiTableModel *tm;
+	int row;
+	struct lui_imageWaiter *next;
+} lui_imageWaiter;
+
+/* an entry is in the hash table, and either in the pending list or in the
+ * lru list, both of which use prev and next.
+ */
+typedef struct lui_imageEntry {
+	struct lui_imageEntry *hnext;
+	struct lui_imageEntry *prev, *next;
+	uint32_t hash;
+	int state;
+	size_t cost;
+	uiImage *image;
+	lui_imageWaiter *waiters;
+	char path[];
+} lui_imageEntry;
+
+typedef struct lui_imageSource {
+	lui_imageEntry **buckets;
+	size_t numbuckets, count;
+	lui_imageEntry *lruhead, *lrutail;
+	lui_imageEntry *pending;
+	size_t cost, maxcost;
+	int width, height;
+	uiImage *placeholder;
+	int ownplaceholder;
+	int jobs;
+	int closed;
+	struct lui_imageSource *nextsource;
+} lui_imageSource;
+
+typedef struct {
+	lui_poolJob job;
+	lui_imageSource *src;
+	lui_imageEntry *entry;
+	int width, height;
+	unsigned char *pixels;
+} lui_imageJob;
+
+static lui_pool *lui_imagePool = NULL;
+static lui_imageSource *lui_imageSources = NULL;
+
+static uint32_t lui_imagesource_hash(const char *str)
+{
+	uint32_t h = 2166136261u;
+	while (*str) {
+		h = (h ^ (unsigned char) *str++) * 16777619u;
+	}
+	return h;
+}
+
+static lui_imageEntry *lui_imagesource_find(lui_imageSource *src, const char *path, uint32_t hash)
+{
+	lui_imageEntry *e = src->buckets[hash & (src->numbuckets - 1)];
+	while (e && (e->hash != hash || strcmp(e->path, path) != 0)) {
+		e = e->hnext;
+	}
+	return e;
+}
+
+static int lui_imagesource_insert(lui_imageSource *src, lui_imageEntry *e)
+{
+	if ((src->count + 1) * 4 > src->numbuckets * 3) {
+		size_t numbuckets = src->numbuckets * 2;
+		lui_imageEntry **buckets = calloc(numbuckets, sizeof(lui_imageEntry*));
+		if (!buckets) {
+			return 0;
+		}
+		for (size_t i = 0; i < src->numbuckets; ++i) {
+			lui_imageEntry *o = src->buckets[i];
+			while (o) {
+				lui_imageEntry *next = o->hnext;
+				o->hnext = buckets[o->hash & (numbuckets - 1)];
+				buckets[o->hash & (numbuckets - 1)] = o;
+				o = next;
+			}
+		}
+		free(src->buckets);
+		src->buckets = buckets;
+		src->numbuckets = numbuckets;
+	}
+	lui_imageEntry **b = &src->buckets[e->hash & (src->numbuckets - 1)];
+	e->hnext = *b;
+	*b = e;
+	src->count += 1;
+	return 1;
+}
+
+static void lui_imagesource_remove(lui_imageSource *src, lui_imageEntry *e)
+{
+	lui_imageEntry **b = &src->buckets[e->hash & (src->numbuckets - 1)];
+	while (*b != e) {
+		b = &(*b)->hnext;
+	}
+	*b = e->hnext;
+	src->count -= 1;
+}
+
+static void lui_imagesource_lruUnlink(lui_imageSource *src, lui_imageEntry *e)
+{
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		src->lruhead = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	} else {
+		src->lrutail = e->prev;
+	}
+	e->prev = e->next = NULL;
+}
+
+static void lui_imagesource_lruPush(lui_imageSource *src, lui_imageEntry *e)
+{
+	e->prev = NULL;
+	e->next = src->lruhead;
+	if (src->lruhead) {
+		src->lruhead->prev = e;
+	} else {
+		src->lrutail = e;
+	}
+	src->lruhead = e;
+}
+
+static void lui_imagesource_pendingUnlink(lui_imageSource *src, lui_imageEntry *e)
+{
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		src->pending = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	}
+	e->prev = e->next = NULL;
+}
+
+static void lui_imagesource_freeEntry(lui_imageEntry *e)
+{
+	while (e->waiters) {
+		lui_imageWaiter *w = e->waiters;
+		e->waiters = w->next;
+		free(w);
+	}
+	if (e->image) {
+		uiFreeImage(e->image);
+	}
+	free(e);
+}
+
+/* drop least recently used entries until the cache fits into its limit
+ * again. keep is never dropped.
+ */
+static void lui_imagesource_evict(lui_imageSource *src, lui_imageEntry *keep)
+{
+	while (src->cost > src->maxcost && src->lrutail && src->lrutail != keep) {
+		lui_imageEntry *e = src->lrutail;
+		lui_imagesource_lruUnlink(src, e);
+		lui_imagesource_remove(src, e);
+		src->cost -= e->cost;
+		lui_imagesource_freeEntry(e);
+	}
+}
+
+static void lui_imagesource_clear(lui_imageSource *src)
+{
+	while (src->lruhead) {
+		lui_imageEntry *e = src->lruhead;
+		lui_imagesource_lruUnlink(src, e);
+		lui_imagesource_remove(src, e);
+		lui_imagesource_freeEntry(e);
+	}
+	src->cost = 0;
+}
+
+/* may only be called when there are no more outstanding jobs, as those
+ * hold pointers to the pending entries.
+ */
+static void lui_imagesource_free(lui_imageSource *src)
+{
+	lui_imagesource_clear(src);
+	while (src->pending) {
+		lui_imageEntry *e = src->pending;
+		lui_imagesource_pendingUnlink(src, e);
+		lui_imagesource_freeEntry(e);
+	}
+	if (src->ownplaceholder) {
+		uiFreeImage(src->placeholder);
+	}
+	free(src->buckets);
+	free(src);
+}
+
+static void lui_imagesource_run(lui_poolJob *job, void *threaddata)
+{
+	lui_imageJob *ijob = (lui_imageJob*) job;
+	char err[256];
+	(void) threaddata;
+	ijob->pixels = lui_decodeImage(ijob->entry->path, ijob->width, ijob->height, &ijob->width, &ijob->height, err, sizeof(err));
+}
+
+static void lui_imagesource_done(lui_poolJob *job)
+{
+	lui_imageJob *ijob = (lui_imageJob*) job;
+	lui_imageSource *src = ijob->src;
+	lui_imageEntry *e = ijob->entry;
+
+	src->jobs -= 1;
+	if (src->closed) {
+		free(ijob->pixels);
+		free(ijob);
+		if (src->jobs == 0) {
+			lui_imagesource_free(src);
+		}
+		return;
+	}
+
+	lui_imagesource_pendingUnlink(src, e);
+	if (ijob->pixels) {
+		e->image = uiNewImage(ijob->width, ijob->height);
+		uiImageAppend(e->image, ijob->pixels, ijob->width, ijob->height, ijob->width * 4);
+		e->state = LUI_IMAGEENTRY_READY;
+		e->cost = (size_t) ijob->width * ijob->height;
+		if (e->cost < LUI_IMAGESOURCE_MINCOST) {
+			e->cost = LUI_IMAGESOURCE_MINCOST;
+		}
+	} else {
+		e->state = LUI_IMAGEENTRY_FAILED;
+		e->cost = LUI_IMAGESOURCE_MINCOST;
+	}
+	free(ijob->pixels);
+	free(ijob);
+	lui_imagesource_lruPush(src, e);
+	src->cost += e->cost;
+	lui_imagesource_evict(src, e);
+
+	/* updating a row may call back into the image source, so the waiter
+	 * list is detached before anything is signalled. */
+	lui_imageWaiter *w = e->waiters;
+	e->waiters = NULL;
+	while (w) {
+		lui_imageWaiter *next = w->next;
+		if (w->row < w->tmh->NumRows(w->tmh, w->tm)) {
+			uiTableModelRowChanged(w->tm, w->row);
+		}
+		free(w);
+		w = next;
+	}
+}
+
+/* lui_imagesource_get
+ *
+ * return the image for path if it is in the cache, or the placeholder
+ * otherwise. In the latter case, loading the image is started if it is not
+ * already underway, and row of the table model tm is marked to be updated
+ * when it is ready.
+ */
+static uiImage *lui_imagesource_get(lui_imageSource *src, const char *path, uiTableModelHandler *tmh, uiTableModel *tm, int row)
+{
+	uint32_t hash = lui_imagesource_hash(path);
+	lui_imageEntry *e = lui_imagesource_find(src, path, hash);
+	if (e && e->state == LUI_IMAGEENTRY_PENDING) {
+		for (lui_imageWaiter *w = e->waiters; w; w = w->next) {
+			if (w->tm == tm && w->row == row) {
+				return src->placeholder;
+			}
+		}
+		lui_imageWaiter *w = malloc(sizeof(lui_imageWaiter));
+		if (w) {
+			w->tmh = tmh;
+			w->tm = tm;
+			w->row = row;
+			w->next = e->waiters;
+			e->waiters = w;
+		}
+		return src->placeholder;
+	} else if (e) {
+		if (e != src->lruhead) {
+			lui_imagesource_lruUnlink(src, e);
+			lui_imagesource_lruPush(src, e);
+		}
+		return e->image ? e->image : src->placeholder;
+	}
+
+	if (!lui_imagePool) {
+		int threads = lui_numCpus();
+		lui_imagePool = lui_poolNew(threads < LUI_IMAGESOURCE_MAXTHREADS ? threads : LUI_IMAGESOURCE_MAXTHREADS, NULL, NULL);
+	}
+	size_t len = strlen(path);
+	e = calloc(1, sizeof(lui_imageEntry) + len + 1);
+	lui_imageJob *job = calloc(1, sizeof(lui_imageJob));
+	lui_imageWaiter *w = malloc(sizeof(lui_imageWaiter));
+	if (!e || !job || !w || !lui_imagePool || lui_imagePool->numthreads == 0) {
+		free(e);
+		free(job);
+		free(w);
+		return src->placeholder;
+	}
+	memcpy(e->path, path, len + 1);
+	e->hash = hash;
+	if (!lui_imagesource_insert(src, e)) {
+		free(e);
+		free(job);
+		free(w);
+		return src->placeholder;
+	}
+	e->state = LUI_IMAGEENTRY_PENDING;
+	w->tmh = tmh;
+	w->tm = tm;
+	w->row = row;
+	w->next = NULL;
+	e->waiters = w;
+	e->next = src->pending;
+	if (src->pending) {
+		src->pending->prev = e;
+	}
+	src->pending = e;
+
+	job->job.run = lui_imagesource_run;
+	job->job.done = lui_imagesource_done;
+	job->src = src;
+	job->entry = e;
+	job->width = src->width;
+	job->height = src->height;
+	src->jobs += 1;
+	/* the rows requested last are most likely the ones currently visible */
+	lui_poolSubmit(lui_imagePool, &job->job, 1);
+	return src->placeholder;
+}
+
+/* forget all pending updates for a table model, called when it goes away */
+static void lui_imagesource_forgetModel(uiTableModel *tm)
+{
+	for (lui_imageSource *src = lui_imageSources; src; src = src->nextsource) {
+		for (lui_imageEntry *e = src->pending; e; e = e->next) {
+			lui_imageWaiter **w = &e->waiters;
+			while (*w) {
+				if ((*w)->tm == tm) {
+					lui_imageWaiter *dead = *w;
+					*w = dead->next;
+					free(dead);
+				} else {
+					w = &(*w)->next;
+				}
+			}
+		}
+	}
+}
+
+static int lui_imagesource__gc(lua_State *L)
+{
+	lui_object *lobj = lui_checkImageSource(L, 1);
+	if (lobj->object) {
+		DEBUGMSG("lui_imagesource__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_imageSource *src = (lui_imageSource*) lobj->object;
+		lui_imageSource **s = &lui_imageSources;
+		while (*s && *s != src) {
+			s = &(*s)->nextsource;
+		}
+		if (*s) {
+			*s = src->nextsource;
+		}
+		/* images still being decoded refer to the source, it is freed when
+		 * the last of them is done. */
+		src->closed = 1;
+		if (src->jobs == 0) {
+			lui_imagesource_free(src);
+		}
+		lobj->object = 0;
+	}
+	return 0;
+}
+
+/* metamethods for imagesource */
+static const luaL_Reg lui_imagesource_meta[] = {
+	{"__gc", lui_imagesource__gc},
+	{0, 0}
+};
+
+/*** Method
+ * Object: imagesource
+ * Name: clear
+ * Signature: src:clear()
+ * drop all images from the cache. Images that are currently being loaded
+ * are not affected.
+ */
+static int lui_imagesource_clearCache(lua_State *L)
+{
+	lui_object *lobj = lui_checkImageSource(L, 1);
+	lui_imagesource_clear((lui_imageSource*) lobj->object);
+	return 0;
+}
+
+/* methods for imagesource */
+static const luaL_Reg lui_imagesource_methods[] = {
+	{"clear", lui_imagesource_clearCache},
+	{0, 0}
+};
+
+/*** Constructor
+ * Object: imagesource
+ * Name: imagesource
+ * Signature: src = lui.imagesource(width, height, maxpixels = 4194304, placeholder = nil)
+ * create a new image source. Images are scaled down to fit into width x
+ * height, keeping their aspect ratio. maxpixels is the number of pixels
+ * the cache may hold. placeholder is an image to display while an image is
+ * not yet loaded, or could not be loaded. If it is nil, a transparent image
+ * is used.
+ */
+static int lui_newImageSource(lua_State *L)
+{
+	int width = luaL_checkinteger(L, 1);
+	int height = luaL_checkinteger(L, 2);
+	lua_Integer maxpixels = luaL_optinteger(L, 3, LUI_IMAGESOURCE_DEFAULTPIXELS);
+	lui_object *plobj = lua_isnoneornil(L, 4) ? NULL : lui_checkImage(L, 4);
+	if (width <= 0 || height <= 0) {
+		return luaL_error(L, "invalid image size!");
+	}
+
+	lui_object *lobj = lui_pushImageSource(L);
+	lui_imageSource *src = calloc(1, sizeof(lui_imageSource));
+	if (src) {
+		src->numbuckets = 64;
+		src->buckets = calloc(src->numbuckets, sizeof(lui_imageEntry*));
+	}
+	if (!src || !src->buckets) {
+		free(src);
+		return luaL_error(L, "out of memory!");
+	}
+	src->width = width;
+	src->height = height;
+	src->maxcost = maxpixels > 0 ? maxpixels : 0;
+	if (plobj) {
+		src->placeholder = uiImage(plobj->object);
+		lui_aux_setUservalue(L, -1, "placeholder", 4);
+	} else {
+		unsigned char pixel[4] = {0, 0, 0, 0};
+		src->placeholder = uiNewImage(1, 1);
+		uiImageAppend(src->placeholder, pixel, 1, 1, 4);
+		src->ownplaceholder = 1;
+	}
+	src->nextsource = lui_imageSources;
+	lui_imageSources = src;
+	lobj->object = src;
+	lui_registerObject(L, lua_gettop(L));
+	return 1;
 }
 
 /* image function list table
@@ -92,6 +651,7 @@ static const struct luaL_Reg lui_image_funcs [] ={
 	/* utility constructors */
 	{"image", lui_newImage},
 	{"loadimage", lui_loadImage},
+	{"imagesource", lui_newImageSource},
 	{0, 0}
 };
 
@@ -100,6 +660,7 @@ static int lui_init_image(lua_State *L)
 	luaL_setfuncs(L, lui_image_funcs, 0);
 
 	lui_add_utility_type(L, LUI_IMAGE, lui_image_methods, lui_image_meta);
+	lui_add_utility_type(L, LUI_IMAGESOURCE, lui_imagesource_methods, lui_imagesource_meta);
 
 	return 1;
 }
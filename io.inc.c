@@ -0,0 +1,906 @@
+/* lui.c
+ *
+ * lua binding to libui (https://github.com/andlabs/libui)
+ *
+ * Gunnar Zötl <gz@tset.de>, 2016
+ * Released under MIT/X11 license. See file LICENSE for details.
+ *
+ * This file is included by lui.c
+ */
+
+/* file descriptor watches  ************************************************/
+
+/* Watches are GLib unix fd sources in the main context uiMain() runs, so
+ * they only exist where libui uses GTK.
+ */
+#ifdef LUI_GTK
+
+/*** Object
+ * Name: watch
+ * a watch on a file descriptor, created by lui.watch(). An active watch is
+ * kept alive by lui, so it need not be referenced to keep working.
+ */
+#define LUI_WATCH "lui_watch"
+#define LUI_WATCH_REGISTRY "lui_watches"
+#define lui_pushWatch(L) ((lui_watchObject*)lui_pushObjectSized(L, LUI_WATCH, 1, sizeof(lui_watchObject)))
+#define lui_checkWatch(L, pos) ((lui_watchObject*)luaL_checkudata(L, pos, LUI_WATCH))
+
+typedef struct {
+	void *object;
+	int fd;
+	GIOCondition events;
+	guint source;			/* 0 if the watch is not active */
+} lui_watchObject;
+
+static lua_State *lui_watchL = NULL;
+
+static void lui_watch_stop(lua_State *L, lui_watchObject *w)
+{
+	if (w->source) {
+		g_source_remove(w->source);
+		w->source = 0;
+		lua_getfield(L, LUA_REGISTRYINDEX, LUI_WATCH_REGISTRY);
+		lua_pushlightuserdata(L, w);
+		lua_pushnil(L);
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+	}
+}
+
+static gboolean lui_watch_callback(gint fd, GIOCondition cond, gpointer data)
+{
+	lui_watchObject *w = (lui_watchObject*) data;
+	lua_State *L = lui_watchL;
+	int top = lua_gettop(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_WATCH_REGISTRY);
+	lua_pushlightuserdata(L, w);
+	if (lua_rawget(L, -2) == LUA_TNIL) {
+		lua_settop(L, top);
+		return G_SOURCE_REMOVE;
+	}
+	int wpos = lua_gettop(L);
+	lui_aux_getUservalue(L, wpos, "fn");
+	lua_pushvalue(L, wpos);
+	lua_pushboolean(L, (cond & (G_IO_IN | G_IO_PRI)) != 0);
+	lua_pushboolean(L, (cond & G_IO_OUT) != 0);
+	lua_pushboolean(L, (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)) != 0);
+	lua_call(L, 4, 0);
+	/* a hangup or error is reported on every turn of the main loop until
+	 * the descriptor is closed, and an invalid descriptor can not become
+	 * ready again, so in all those cases the watch is of no further use */
+	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)) {
+		lui_watch_stop(L, w);
+	}
+	lua_settop(L, top);
+	return w->source != 0 ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/* start watching. The watch must be at stack position pos */
+static int lui_watch_start(lua_State *L, int pos, lui_watchObject *w)
+{
+	w->source = g_unix_fd_add(w->fd, w->events, lui_watch_callback, w);
+	if (w->source == 0) {
+		return 0;
+	}
+	lui_watchL = lui_mainState(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_WATCH_REGISTRY);
+	lua_pushlightuserdata(L, w);
+	lua_pushvalue(L, pos);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+	return 1;
+}
+
+static int lui_watch__gc(lua_State *L)
+{
+	lui_watchObject *w = lui_checkWatch(L, 1);
+	if (w->object) {
+		DEBUGMSG("lui_watch__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_watch_stop(L, w);
+		w->object = 0;
+	}
+	return 0;
+}
+
+/*** Property
+ * Object: watch
+ * Name: fd
+ * the file descriptor that is watched. Read only.
+ *** Property
+ * Object: watch
+ * Name: active
+ * true until the watch is removed. Read only.
+ */
+static int lui_watch__index(lua_State *L)
+{
+	lui_watchObject *w = lui_checkWatch(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "fd") == 0) {
+		lua_pushinteger(L, w->fd);
+	} else if (strcmp(what, "active") == 0) {
+		lua_pushboolean(L, w->source != 0);
+	} else {
+		return lui_utility__index(L);
+	}
+	return 1;
+}
+
+/*** Method
+ * Object: watch
+ * Name: remove
+ * Signature: watch:remove()
+ * stop watching the file descriptor. This takes constant time. The file
+ * descriptor is not closed.
+ */
+static int lui_watchRemove(lua_State *L)
+{
+	lui_watchObject *w = lui_checkWatch(L, 1);
+	lui_watch_stop(L, w);
+	return 0;
+}
+
+/* get a file descriptor from an integer or a lua file handle */
+static int lui_watch_checkFd(lua_State *L, int pos)
+{
+	luaL_Stream *stream = (luaL_Stream*) luaL_testudata(L, pos, LUA_FILEHANDLE);
+	if (stream) {
+		luaL_argcheck(L, stream->closef != NULL, pos, "attempt to use a closed file");
+		return fileno(stream->f);
+	}
+	int fd = luaL_checkinteger(L, pos);
+	luaL_argcheck(L, fd >= 0, pos, "invalid file descriptor");
+	return fd;
+}
+
+/*** Function
+ * Name: watch
+ * Signature: watch = lui.watch(fd, events = nil, function)
+ * call function(watch, readable, writable, hangup) whenever the file
+ * descriptor fd is ready, while the main loop runs. fd may be an integer
+ * or a lua file handle. events is a table with the fields read and write,
+ * which select what to wait for; if it is nil, fd is watched for reading.
+ * readable and writable tell what fd is ready for, hangup is true if the
+ * other end was closed or an error occurred. The watch is removed
+ * automatically once hangup has been reported, so function should read
+ * all that is left then, and also if fd is closed. There is no polling
+ * involved: the main loop sleeps until the descriptor is ready. Only
+ * available where libui uses GTK.
+ */
+static int lui_newWatch(lua_State *L)
+{
+	ensure_initialized();
+	int fd = lui_watch_checkFd(L, 1);
+	GIOCondition events = G_IO_IN;
+	if (lui_aux_istable(L, 2)) {
+		events = 0;
+		lua_getfield(L, 2, "read");
+		if (lua_toboolean(L, -1)) {
+			events |= G_IO_IN;
+		}
+		lua_getfield(L, 2, "write");
+		if (lua_toboolean(L, -1)) {
+			events |= G_IO_OUT;
+		}
+		lua_pop(L, 2);
+		luaL_argcheck(L, events != 0, 2, "nothing to watch for");
+	} else if (!lua_isnoneornil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+	}
+	luaL_argcheck(L, lui_aux_iscallable(L, 3), 3, "expected callable");
+
+	lui_watchObject *w = lui_pushWatch(L);
+	w->object = w;
+	w->fd = fd;
+	w->events = events;
+	lui_aux_setUservalue(L, -1, "fn", 3);
+	int pos = lua_gettop(L);
+	if (!lui_watch_start(L, pos, w)) {
+		return luaL_error(L, "could not watch file descriptor %d!", fd);
+	}
+	lui_registerObject(L, pos);
+	return 1;
+}
+
+/* metamethods for watches */
+static const luaL_Reg lui_watch_meta[] = {
+	{"__gc", lui_watch__gc},
+	{"__index", lui_watch__index},
+	{0, 0}
+};
+
+/* methods for watches */
+static const luaL_Reg lui_watch_methods[] = {
+	{"remove", lui_watchRemove},
+	{0, 0}
+};
+
+/* subprocesses  ***********************************************************/
+
+/*** Object
+ * Name: process
+ * a child process started by lui.spawn(). A process is kept alive by lui
+ * until it has exited and all of its output has been delivered.
+ */
+#define LUI_PROCESS "lui_process"
+#define LUI_PROCESS_REGISTRY "lui_processes"
+#define lui_pushProcess(L) ((lui_processObject*)lui_pushObjectSized(L, LUI_PROCESS, 1, sizeof(lui_processObject)))
+#define lui_checkProcess(L, pos) ((lui_processObject*)luaL_checkudata(L, pos, LUI_PROCESS))
+
+/* output is delivered at most this often, in ms */
+#define LUI_SPAWN_FLUSHMS 16
+/* read at most this much from a pipe per wakeup, so that a chatty process
+ * does not starve the event loop */
+#define LUI_SPAWN_READMAX 65536
+
+typedef struct {
+	int fd;					/* -1 when closed */
+	guint source;
+	char *data;				/* output not yet delivered, input not yet written */
+	size_t len, size;
+	int wanted;				/* whether anybody wants this output */
+} lui_spawnPipe;
+
+typedef struct lui_processObject {
+	void *object;
+	GPid pid;
+	int running;
+	int exitcode;
+	int signal;
+	lui_spawnPipe in, out, err;
+	int closein;			/* close stdin once its queue is written */
+	int pending;			/* in the list of processes with output */
+	struct lui_processObject *nextpending;
+} lui_processObject;
+
+static struct {
+	lui_processObject *pending;
+	int armed;
+	lua_State *L;
+} lui_spawns;
+
+/* append n bytes of data to the buffer of pipe p. Returns 0 if out of
+ * memory */
+static int lui_spawn_append(lui_spawnPipe *p, const char *data, size_t n)
+{
+	if (p->len + n > p->size) {
+		size_t size = p->size ? p->size * 2 : 16384;
+		while (size < p->len + n) {
+			size *= 2;
+		}
+		char *ndata = realloc(p->data, size);
+		if (!ndata) {
+			return 0;
+		}
+		p->data = ndata;
+		p->size = size;
+	}
+	memcpy(p->data + p->len, data, n);
+	p->len += n;
+	return 1;
+}
+
+static void lui_spawn_closePipe(lui_spawnPipe *p)
+{
+	if (p->source) {
+		g_source_remove(p->source);
+		p->source = 0;
+	}
+	if (p->fd >= 0) {
+		close(p->fd);
+		p->fd = -1;
+	}
+}
+
+static void lui_spawn_unpend(lui_processObject *proc)
+{
+	if (proc->pending) {
+		lui_processObject **pp = &lui_spawns.pending;
+		while (*pp != proc) {
+			pp = &(*pp)->nextpending;
+		}
+		*pp = proc->nextpending;
+		proc->pending = 0;
+	}
+}
+
+/* push the process object for proc, or nil */
+static int lui_spawn_push(lua_State *L, lui_processObject *proc)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_PROCESS_REGISTRY);
+	lua_pushlightuserdata(L, proc);
+	lua_rawget(L, -2);
+	lua_remove(L, -2);
+	return lua_type(L, -1);
+}
+
+/* length of the start of s that does not end in an incomplete UTF-8
+ * sequence */
+static size_t lui_spawn_utf8Complete(const char *s, size_t len)
+{
+	size_t i = len, n = 0;
+	while (i > 0 && n < 3 && ((unsigned char) s[i - 1] & 0xC0) == 0x80) {
+		i -= 1;
+		n += 1;
+	}
+	if (i == 0) {
+		return len;
+	}
+	unsigned char c = (unsigned char) s[i - 1];
+	size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+	return n + 1 < need ? i - 1 : len;
+}
+
+/* deliver the output collected from pipe p to handler and the target. A
+ * UTF-8 sequence split between reads is held back until the rest of it
+ * arrives, unless this is the final delivery. */
+static void lui_spawn_deliver(lua_State *L, int pos, lui_processObject *proc, lui_spawnPipe *p, const char *handler, int final)
+{
+	size_t len = final ? p->len : lui_spawn_utf8Complete(p->data, p->len);
+	if (len == 0) {
+		return;
+	}
+	int top = lua_gettop(L);
+	lua_pushlstring(L, p->data, len);
+	p->len -= len;
+	memmove(p->data, p->data + len, p->len);
+	if (lui_aux_getUservalue(L, pos, "target") != LUA_TNIL) {
+		lui_multilineEntryObject *target = lui_checkMultilineEntry(L, -1);
+		const char *str = lua_tolstring(L, top + 1, &len);
+		/* the entry only takes valid text */
+		gchar *valid = NULL;
+		if (!g_utf8_validate(str, len, NULL)) {
+			valid = g_utf8_make_valid(str, len);
+			str = valid;
+			len = strlen(valid);
+		}
+		if (target->flushms >= 0) {
+			lui_multilineEntryBuffer(target, str, len);
+		} else if (target->object) {
+			lui_multilineEntryWrite(target, str, len);
+		}
+		g_free(valid);
+	}
+	lui_objectHandlerCallback(L, (uiControl*) proc->object, handler, top + 1, 1, 0);
+	lua_settop(L, top);
+}
+
+static void lui_spawn_flush(lua_State *L, lui_processObject *proc, int final)
+{
+	lui_spawn_unpend(proc);
+	if (lui_spawn_push(L, proc) == LUA_TNIL) {
+		lua_pop(L, 1);
+		return;
+	}
+	int pos = lua_gettop(L);
+	lui_spawn_deliver(L, pos, proc, &proc->out, "onstdout", final);
+	lui_spawn_deliver(L, pos, proc, &proc->err, "onstderr", final);
+	lua_settop(L, pos - 1);
+}
+
+static int lui_spawn_flushTimer(void *data)
+{
+	lua_State *L = lui_spawns.L;
+	lui_spawns.armed = 0;
+	while (lui_spawns.pending) {
+		lui_spawn_flush(L, lui_spawns.pending, 0);
+	}
+	return 0;
+}
+
+/* once a process has exited and closed its output, deliver what is left
+ * and tell about its exit */
+static void lui_spawn_checkFinished(lua_State *L, lui_processObject *proc)
+{
+	if (proc->running || proc->out.fd >= 0 || proc->err.fd >= 0) {
+		return;
+	}
+	lui_spawn_flush(L, proc, 1);
+	if (lui_spawn_push(L, proc) == LUA_TNIL) {
+		lua_pop(L, 1);
+		return;
+	}
+	int pos = lua_gettop(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_PROCESS_REGISTRY);
+	lua_pushlightuserdata(L, proc);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+	lua_pushinteger(L, proc->exitcode);
+	if (proc->signal) {
+		lua_pushinteger(L, proc->signal);
+	} else {
+		lua_pushnil(L);
+	}
+	lui_objectHandlerCallback(L, (uiControl*) proc->object, "onexit", pos + 1, 2, 0);
+	lua_settop(L, pos - 1);
+}
+
+static gboolean lui_spawn_readable(gint fd, GIOCondition cond, gpointer data)
+{
+	lui_processObject *proc = (lui_processObject*) data;
+	lui_spawnPipe *p = fd == proc->out.fd ? &proc->out : &proc->err;
+	lua_State *L = lui_spawns.L;
+	size_t total = 0;
+	int eof = 0;
+	char buf[4096];
+	while (total < LUI_SPAWN_READMAX) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n > 0) {
+			total += n;
+			if (p->wanted) {
+				lui_spawn_append(p, buf, n);
+			}
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			eof = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+			break;
+		}
+	}
+	if (p->len > 0 && !proc->pending) {
+		proc->pending = 1;
+		proc->nextpending = lui_spawns.pending;
+		lui_spawns.pending = proc;
+		if (!lui_spawns.armed) {
+			lui_spawns.armed = 1;
+			uiTimer(LUI_SPAWN_FLUSHMS, lui_spawn_flushTimer, NULL);
+		}
+	}
+	if (eof) {
+		p->source = 0;
+		lui_spawn_closePipe(p);
+		lui_spawn_checkFinished(L, proc);
+		return G_SOURCE_REMOVE;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+/* write() to a pipe, failing with EPIPE instead of killing the ui with
+ * SIGPIPE if the process closed its end. SIGPIPE is blocked around the
+ * write, and a SIGPIPE raised by it is taken off the pending signals
+ * before it is unblocked again. */
+static ssize_t lui_spawn_write(int fd, const char *data, size_t len)
+{
+	sigset_t pipeset, oldset, pending;
+	sigemptyset(&pipeset);
+	sigaddset(&pipeset, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipeset, &oldset);
+	/* a SIGPIPE that was pending before is not ours to consume */
+	sigpending(&pending);
+	int waspending = sigismember(&pending, SIGPIPE);
+	ssize_t n = write(fd, data, len);
+	int err = errno;
+	if (n < 0 && err == EPIPE && !waspending) {
+		struct timespec zero = { 0, 0 };
+		while (sigtimedwait(&pipeset, NULL, &zero) < 0 && errno == EINTR) {
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	errno = err;
+	return n;
+}
+
+/* write as much of the queued input as the pipe takes without blocking.
+ * Returns 0, or the errno if writing failed. */
+static int lui_spawn_drainInput(lui_spawnPipe *p)
+{
+	size_t done = 0;
+	int err = 0;
+	while (done < p->len) {
+		ssize_t n = lui_spawn_write(p->fd, p->data + done, p->len - done);
+		if (n >= 0) {
+			done += n;
+		} else if (errno != EINTR) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				err = errno;
+			}
+			break;
+		}
+	}
+	p->len -= done;
+	memmove(p->data, p->data + done, p->len);
+	return err;
+}
+
+static gboolean lui_spawn_writable(gint fd, GIOCondition cond, gpointer data)
+{
+	lui_processObject *proc = (lui_processObject*) data;
+	lui_spawnPipe *p = &proc->in;
+	int failed = (cond & (G_IO_ERR | G_IO_NVAL)) != 0 || lui_spawn_drainInput(p) != 0;
+	if (p->len > 0 && !failed) {
+		return G_SOURCE_CONTINUE;
+	}
+	p->source = 0;
+	/* the process does not read its input any more, drop what is left */
+	if (failed || proc->closein) {
+		p->len = 0;
+		lui_spawn_closePipe(p);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void lui_spawn_exited(GPid pid, gint status, gpointer data)
+{
+	lui_processObject *proc = (lui_processObject*) data;
+	g_spawn_close_pid(pid);
+	proc->running = 0;
+	if (WIFEXITED(status)) {
+		proc->exitcode = WEXITSTATUS(status);
+	} else if (WIFSIGNALED(status)) {
+		proc->exitcode = -1;
+		proc->signal = WTERMSIG(status);
+	}
+	/* unless somebody else still reads the queued input, it can be dropped
+	 * now, so that process:write() in onexit fails */
+	if (proc->in.source && lui_spawn_drainInput(&proc->in) != 0) {
+		proc->in.len = 0;
+		lui_spawn_closePipe(&proc->in);
+	}
+	lui_spawn_checkFinished(lui_spawns.L, proc);
+}
+
+static void lui_spawn_mergeStderr(gpointer data)
+{
+	dup2(STDOUT_FILENO, STDERR_FILENO);
+}
+
+static int lui_process__gc(lua_State *L)
+{
+	lui_processObject *proc = lui_checkProcess(L, 1);
+	if (proc->object) {
+		DEBUGMSG("lui_process__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_spawn_unpend(proc);
+		lui_spawn_closePipe(&proc->in);
+		lui_spawn_closePipe(&proc->out);
+		lui_spawn_closePipe(&proc->err);
+		free(proc->in.data);
+		free(proc->out.data);
+		free(proc->err.data);
+		proc->object = 0;
+	}
+	return 0;
+}
+
+/*** Property
+ * Object: process
+ * Name: pid
+ * the process id. Read only.
+ *** Property
+ * Object: process
+ * Name: running
+ * true until the process has exited. Read only.
+ *** Property
+ * Object: process
+ * Name: exitcode
+ * the exit code of the process, -1 if it was killed by a signal, or nil
+ * while it is running. Read only.
+ *** Property
+ * Object: process
+ * Name: onstdout
+ * a function <code>onstdout(process, text)</code> that is called with the
+ * output of the process, collected into chunks that are delivered at most
+ * once per 16 ms. A chunk does not end in the middle of a UTF-8 sequence,
+ * unless the process exited there.
+ *** Property
+ * Object: process
+ * Name: onstderr
+ * like onstdout, for the error output of the process.
+ *** Property
+ * Object: process
+ * Name: onexit
+ * a function <code>onexit(process, exitcode, signal)</code> that is called
+ * when the process has exited and all of its output has been delivered.
+ * signal is the number of the signal that killed the process, or nil.
+ */
+static int lui_process__index(lua_State *L)
+{
+	lui_processObject *proc = lui_checkProcess(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "pid") == 0) {
+		lua_pushinteger(L, proc->pid);
+	} else if (strcmp(what, "running") == 0) {
+		lua_pushboolean(L, proc->running);
+	} else if (strcmp(what, "exitcode") == 0) {
+		if (proc->running) {
+			lua_pushnil(L);
+		} else {
+			lua_pushinteger(L, proc->exitcode);
+		}
+	} else if (strcmp(what, "onstdout") == 0) {
+		lui_objectGetHandler(L, "onstdout");
+	} else if (strcmp(what, "onstderr") == 0) {
+		lui_objectGetHandler(L, "onstderr");
+	} else if (strcmp(what, "onexit") == 0) {
+		lui_objectGetHandler(L, "onexit");
+	} else {
+		return lui_utility__index(L);
+	}
+	return 1;
+}
+
+static int lui_process__newindex(lua_State *L)
+{
+	lui_processObject *proc = lui_checkProcess(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "onstdout") == 0) {
+		lui_objectSetHandler(L, "onstdout", 3);
+		proc->out.wanted = 1;
+	} else if (strcmp(what, "onstderr") == 0) {
+		lui_objectSetHandler(L, "onstderr", 3);
+		proc->err.wanted = 1;
+	} else if (strcmp(what, "onexit") == 0) {
+		lui_objectSetHandler(L, "onexit", 3);
+	} else {
+		return lui_utility__newindex(L);
+	}
+	return 0;
+}
+
+/*** Method
+ * Object: process
+ * Name: write
+ * Signature: process:write(text)
+ * write text to the standard input of the process. Only possible if the
+ * process was spawned with the stdin option. This does not block: what the
+ * process does not take right away is queued, and written while the main
+ * loop runs. Raises an error if the process no longer reads its input.
+ */
+static int lui_processWrite(lua_State *L)
+{
+	lui_processObject *proc = lui_checkProcess(L, 1);
+	size_t len;
+	const char *text = luaL_checklstring(L, 2, &len);
+	lui_spawnPipe *p = &proc->in;
+	if (p->fd < 0 || proc->closein) {
+		return luaL_error(L, "standard input of process is not open!");
+	}
+	if (!lui_spawn_append(p, text, len)) {
+		return luaL_error(L, "out of memory!");
+	}
+	/* if there is a queue already, text must wait its turn */
+	if (p->source == 0) {
+		int err = lui_spawn_drainInput(p);
+		if (err) {
+			p->len = 0;
+			lui_spawn_closePipe(p);
+			return luaL_error(L, "write failed: %s!", strerror(err));
+		}
+		if (p->len > 0) {
+			p->source = g_unix_fd_add(p->fd, G_IO_OUT | G_IO_ERR, lui_spawn_writable, proc);
+		}
+	}
+	return 0;
+}
+
+/*** Method
+ * Object: process
+ * Name: closestdin
+ * Signature: process:closestdin()
+ * close the standard input of the process, once everything queued by
+ * process:write() has been written.
+ */
+static int lui_processCloseStdin(lua_State *L)
+{
+	lui_processObject *proc = lui_checkProcess(L, 1);
+	if (proc->in.source) {
+		proc->closein = 1;
+	} else {
+		lui_spawn_closePipe(&proc->in);
+	}
+	return 0;
+}
+
+/*** Method
+ * Object: process
+ * Name: kill
+ * Signature: process:kill(signal = 15)
+ * send signal to the process, SIGTERM by default.
+ */
+static int lui_processKill(lua_State *L)
+{
+	lui_processObject *proc = lui_checkProcess(L, 1);
+	int sig = luaL_optinteger(L, 2, SIGTERM);
+	if (proc->running) {
+		kill(proc->pid, sig);
+	}
+	return 0;
+}
+
+/* get the argument vector for lui.spawn(). cmd is either a string, which is
+ * split like a shell would, or an array of strings. */
+static gchar **lui_spawn_argv(lua_State *L, int pos)
+{
+	gchar **argv = NULL;
+	if (lua_type(L, pos) == LUA_TTABLE) {
+		int n = lua_rawlen(L, pos);
+		luaL_argcheck(L, n > 0, pos, "empty command");
+		argv = calloc(n + 1, sizeof(gchar*));
+		if (!argv) {
+			luaL_error(L, "out of memory!");
+		}
+		for (int i = 0; i < n; ++i) {
+			lua_rawgeti(L, pos, i + 1);
+			const char *arg = lua_tostring(L, -1);
+			argv[i] = arg ? strdup(arg) : NULL;
+			lua_pop(L, 1);
+			if (!argv[i]) {
+				g_strfreev(argv);
+				luaL_argerror(L, pos, "command must be an array of strings");
+			}
+		}
+	} else {
+		const char *cmd = luaL_checkstring(L, pos);
+		GError *error = NULL;
+		if (!g_shell_parse_argv(cmd, NULL, &argv, &error)) {
+			lua_pushstring(L, error->message);
+			g_error_free(error);
+			luaL_error(L, "could not parse command: %s!", lua_tostring(L, -1));
+		}
+	}
+	return argv;
+}
+
+/*** Function
+ * Name: spawn
+ * Signature: process = lui.spawn(cmd, options = nil)
+ * start a child process, and stream its output into the main loop without
+ * blocking. cmd is either a command line, which is split into words like a
+ * shell would, but is not run by a shell, or an array with the program and
+ * its arguments. options is a table, with the fields onstdout, onstderr
+ * and onexit, which set the process' properties of the same names, target,
+ * a multilineentry the standard output of the process is appended to,
+ * maxlines, which if set becomes the maxlines property of target,
+ * mergestderr, which if true sends the error output to the same place as
+ * the standard output, and stdin, which if true allows to write to the
+ * process with process:write(). Output is read as it becomes available,
+ * and delivered in chunks at most once per 16 ms, so that even processes
+ * with a lot of output do not slow down the ui. Invalid UTF-8 in the
+ * output is replaced before it is appended to target. Only available
+ * where libui uses GTK.
+ */
+static int lui_spawnProcess(lua_State *L)
+{
+	ensure_initialized();
+	int hastable = lui_aux_istable(L, 2);
+	int mergestderr = 0, wantstdin = 0, maxlines = 0;
+	if (hastable) {
+		lua_getfield(L, 2, "mergestderr");
+		mergestderr = lua_toboolean(L, -1);
+		lua_getfield(L, 2, "stdin");
+		wantstdin = lua_toboolean(L, -1);
+		lua_getfield(L, 2, "maxlines");
+		maxlines = luaL_optinteger(L, -1, 0);
+		lua_getfield(L, 2, "target");
+		if (!lua_isnil(L, -1)) {
+			(void) lui_checkMultilineEntry(L, -1);
+		}
+		lua_pop(L, 4);
+	} else if (!lua_isnoneornil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+	}
+	gchar **argv = lui_spawn_argv(L, 1);
+
+	lui_processObject *proc = lui_pushProcess(L);
+	int pos = lua_gettop(L);
+	proc->in.fd = proc->out.fd = proc->err.fd = -1;
+	GError *error = NULL;
+	gboolean ok = g_spawn_async_with_pipes(NULL, argv, NULL,
+		G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+		mergestderr ? lui_spawn_mergeStderr : NULL, NULL, &proc->pid,
+		wantstdin ? &proc->in.fd : NULL, &proc->out.fd,
+		mergestderr ? NULL : &proc->err.fd, &error);
+	g_strfreev(argv);
+	if (!ok) {
+		lua_pushstring(L, error->message);
+		g_error_free(error);
+		return luaL_error(L, "could not start process: %s!", lua_tostring(L, -1));
+	}
+	proc->object = proc;
+	proc->running = 1;
+	lui_spawns.L = lui_mainState(L);
+
+	lui_registerObject(L, pos);
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_PROCESS_REGISTRY);
+	lua_pushlightuserdata(L, proc);
+	lua_pushvalue(L, pos);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	if (hastable) {
+		lua_getfield(L, 2, "target");
+		if (!lua_isnil(L, -1)) {
+			lui_aux_setUservalue(L, pos, "target", lua_gettop(L));
+			proc->out.wanted = 1;
+			if (maxlines > 0) {
+				lua_pushinteger(L, maxlines);
+				lua_setfield(L, -2, "maxlines");
+			}
+		}
+		lua_pop(L, 1);
+		static const char *handlers[] = { "onstdout", "onstderr", "onexit", NULL };
+		for (int i = 0; handlers[i]; ++i) {
+			if (lua_getfield(L, 2, handlers[i]) != LUA_TNIL) {
+				lua_pushvalue(L, pos);
+				lua_pushstring(L, handlers[i]);
+				lua_pushvalue(L, -3);
+				lua_settable(L, -3);
+				lua_pop(L, 1);
+			}
+			lua_pop(L, 1);
+		}
+	}
+
+	lui_spawnPipe *pipes[3] = { &proc->in, &proc->out, &proc->err };
+	for (int i = 0; i < 3; ++i) {
+		if (pipes[i]->fd >= 0) {
+			fcntl(pipes[i]->fd, F_SETFL, fcntl(pipes[i]->fd, F_GETFL) | O_NONBLOCK);
+		}
+	}
+	for (int i = 1; i < 3; ++i) {
+		if (pipes[i]->fd >= 0) {
+			pipes[i]->source = g_unix_fd_add(pipes[i]->fd, G_IO_IN | G_IO_HUP | G_IO_ERR, lui_spawn_readable, proc);
+		}
+	}
+	g_child_watch_add(proc->pid, lui_spawn_exited, proc);
+
+	lua_settop(L, pos);
+	return 1;
+}
+
+/* metamethods for processes */
+static const luaL_Reg lui_process_meta[] = {
+	{"__gc", lui_process__gc},
+	{"__index", lui_process__index},
+	{"__newindex", lui_process__newindex},
+	{0, 0}
+};
+
+/* methods for processes */
+static const luaL_Reg lui_process_methods[] = {
+	{"write", lui_processWrite},
+	{"closestdin", lui_processCloseStdin},
+	{"kill", lui_processKill},
+	{0, 0}
+};
+
+#else
+
+static int lui_newWatch(lua_State *L)
+{
+	return luaL_error(L, "lui.watch is not supported on this platform!");
+}
+
+static int lui_spawnProcess(lua_State *L)
+{
+	return luaL_error(L, "lui.spawn is not supported on this platform!");
+}
+
+#endif /* LUI_GTK */
+
+static const struct luaL_Reg lui_io_funcs [] ={
+	{"watch", lui_newWatch},
+	{"spawn", lui_spawnProcess},
+	{0, 0}
+};
+
+static int lui_init_io(lua_State *L)
+{
+	luaL_setfuncs(L, lui_io_funcs, 0);
+
+#ifdef LUI_GTK
+	lui_add_utility_type(L, LUI_WATCH, lui_watch_methods, lui_watch_meta);
+
+	lua_newtable(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, LUI_WATCH_REGISTRY);
+
+	lui_add_utility_type(L, LUI_PROCESS, lui_process_methods, lui_process_meta);
+
+	lua_newtable(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, LUI_PROCESS_REGISTRY);
+#endif
+
+	return 1;
+}
@@ -0,0 +1,1712 @@
+/* lui.c
+ *
+ * lua binding to libui (https://github.com/andlabs/libui)
+ *
+ * Gunnar Zötl <gz@tset.de>, 2016
+ * Released under MIT/X11 license. See file LICENSE for details.
+ *
+ * This file is included by lui.c
+ */
+
+/* lui_mainState
+ *
+ * callbacks from the main loop must run on the main lua thread, not on a
+ * coroutine that happened to register them, which may be suspended or dead
+ * by the time they are called.
+ */
+static lua_State *lui_mainState(lua_State *L)
+{
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	lua_State *ML = lua_tothread(L, -1);
+	lua_pop(L, 1);
+	return ML;
+}
+
+/* clock  ******************************************************************/
+
+/* milliseconds from an arbitrary starting point, never going backwards */
+static double lui_monotonicMs(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (freq.QuadPart == 0) {
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&now);
+	return (double) now.QuadPart * 1000.0 / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+#endif
+}
+
+/*** Function
+ * Name: now
+ * Signature: ms = lui.now()
+ * return the time in milliseconds, with fractions, from a monotonic clock.
+ * Only differences between values returned by this are meaningful.
+ */
+static int lui_now(lua_State *L)
+{
+	lua_pushnumber(L, lui_monotonicMs());
+	return 1;
+}
+
+/* timers  *****************************************************************/
+
+/*** Object
+ * Name: timer
+ * a timer, created by lui.timer(). All timers share a single native timer,
+ * and are kept in a hashed timing wheel with one slot per millisecond, so
+ * that many timers are cheap, and starting and cancelling them takes
+ * constant time. An active timer is kept alive by lui, so it need not be
+ * referenced to keep running.
+ */
+#define LUI_TIMER "lui_timer"
+#define LUI_TIMER_REGISTRY "lui_timers"
+#define lui_pushTimer(L) ((lui_timerObject*)lui_pushObjectSized(L, LUI_TIMER, 1, sizeof(lui_timerObject)))
+#define lui_checkTimer(L, pos) ((lui_timerObject*)luaL_checkudata(L, pos, LUI_TIMER))
+
+/* must be a power of 2 */
+#define LUI_TIMER_SLOTS 256
+
+typedef struct lui_timerObject {
+	void *object;			/* points to the timer itself */
+	struct lui_timerObject *next, *prev;			/* in a wheel slot */
+	struct lui_timerObject *firenext, *fireprev;	/* in the fire list */
+	uint64_t due;			/* in ms, on the timer wheel clock */
+	int ms;
+	int repeat;
+	int active;
+	int inwheel;
+	int firing;
+} lui_timerObject;
+
+static struct {
+	lui_timerObject *slots[LUI_TIMER_SLOTS];
+	lui_timerObject *firehead, *firetail;
+	double start;			/* lui_monotonicMs() at wheel time 0 */
+	uint64_t last;			/* last ms that was processed */
+	int numwheel;
+	unsigned armgen;		/* generation of the current native timer */
+	uint64_t armedfor;		/* when it fires next, 0 if none is running */
+	int armedms;			/* its interval */
+	lua_State *L;
+} lui_timers;
+
+static uint64_t lui_timers_now(void)
+{
+	if (lui_timers.start == 0) {
+		/* start at 1, so that 0 can mean "never" */
+		lui_timers.start = lui_monotonicMs() - 1;
+	}
+	return (uint64_t) (lui_monotonicMs() - lui_timers.start);
+}
+
+static void lui_timers_link(lui_timerObject *t)
+{
+	lui_timerObject **slot = &lui_timers.slots[t->due & (LUI_TIMER_SLOTS - 1)];
+	t->prev = NULL;
+	t->next = *slot;
+	if (*slot) {
+		(*slot)->prev = t;
+	}
+	*slot = t;
+	t->inwheel = 1;
+	lui_timers.numwheel += 1;
+}
+
+static void lui_timers_unlink(lui_timerObject *t)
+{
+	if (!t->inwheel) {
+		return;
+	}
+	if (t->prev) {
+		t->prev->next = t->next;
+	} else {
+		lui_timers.slots[t->due & (LUI_TIMER_SLOTS - 1)] = t->next;
+	}
+	if (t->next) {
+		t->next->prev = t->prev;
+	}
+	t->next = t->prev = NULL;
+	t->inwheel = 0;
+	lui_timers.numwheel -= 1;
+}
+
+static void lui_timers_pushFire(lui_timerObject *t)
+{
+	t->firenext = NULL;
+	t->fireprev = lui_timers.firetail;
+	if (lui_timers.firetail) {
+		lui_timers.firetail->firenext = t;
+	} else {
+		lui_timers.firehead = t;
+	}
+	lui_timers.firetail = t;
+	t->firing = 1;
+}
+
+static void lui_timers_unlinkFire(lui_timerObject *t)
+{
+	if (!t->firing) {
+		return;
+	}
+	if (t->fireprev) {
+		t->fireprev->firenext = t->firenext;
+	} else {
+		lui_timers.firehead = t->firenext;
+	}
+	if (t->firenext) {
+		t->firenext->fireprev = t->fireprev;
+	} else {
+		lui_timers.firetail = t->fireprev;
+	}
+	t->firenext = t->fireprev = NULL;
+	t->firing = 0;
+}
+
+/* find when the next timer in the wheel is due. Only one turn of the wheel
+ * is looked at, if nothing is due within it, the wheel is looked at again
+ * after that turn. Returns 0 if there are no timers in the wheel. */
+static uint64_t lui_timers_next(void)
+{
+	if (lui_timers.numwheel == 0) {
+		return 0;
+	}
+	uint64_t end = lui_timers.last + LUI_TIMER_SLOTS;
+	for (uint64_t ms = lui_timers.last + 1; ms < end; ++ms) {
+		for (lui_timerObject *t = lui_timers.slots[ms & (LUI_TIMER_SLOTS - 1)]; t; t = t->next) {
+			if (t->due <= ms) {
+				return ms;
+			}
+		}
+	}
+	return end;
+}
+
+/* move all timers that are due at now into the fire list. Repeating timers
+ * are put back into the wheel for their next turn right away. */
+static void lui_timers_collect(uint64_t now)
+{
+	if (now <= lui_timers.last) {
+		return;
+	}
+	uint64_t from = lui_timers.last + 1;
+	if (now - from >= LUI_TIMER_SLOTS) {
+		from = now - LUI_TIMER_SLOTS + 1;
+	}
+	for (uint64_t ms = from; ms <= now; ++ms) {
+		lui_timerObject *t = lui_timers.slots[ms & (LUI_TIMER_SLOTS - 1)];
+		while (t) {
+			lui_timerObject *next = t->next;
+			if (t->due <= now) {
+				lui_timers_unlink(t);
+				if (t->repeat) {
+					uint64_t due = t->due + t->ms;
+					if (due <= now) {
+						/* skip what was missed instead of firing in a burst */
+						due = now + t->ms - (now - t->due) % t->ms;
+					}
+					t->due = due;
+					lui_timers_link(t);
+				}
+				if (!t->firing) {
+					lui_timers_pushFire(t);
+				}
+			}
+			t = next;
+		}
+	}
+	lui_timers.last = now;
+}
+
+static int lui_timers_tick(void *data);
+
+/* make sure the native timer fires at due or earlier */
+static void lui_timers_arm(uint64_t due, uint64_t now)
+{
+	if (lui_timers.armedfor && lui_timers.armedfor <= due) {
+		return;
+	}
+	int ms = due > now ? (int) (due - now) : 1;
+	lui_timers.armgen += 1;
+	lui_timers.armedfor = now + ms;
+	lui_timers.armedms = ms;
+	uiTimer(ms, lui_timers_tick, (void*) (uintptr_t) lui_timers.armgen);
+}
+
+static void lui_timers_schedule(lui_timerObject *t, uint64_t now)
+{
+	t->due = now + t->ms;
+	/* the wheel must not be behind the time the timer is due */
+	if (t->due <= lui_timers.last) {
+		t->due = lui_timers.last + 1;
+	}
+	lui_timers_link(t);
+	lui_timers_arm(t->due, now);
+}
+
+static void lui_timers_cancel(lua_State *L, lui_timerObject *t)
+{
+	if (!t->active) {
+		return;
+	}
+	lui_timers_unlink(t);
+	lui_timers_unlinkFire(t);
+	t->active = 0;
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_TIMER_REGISTRY);
+	lua_pushlightuserdata(L, t);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
+/* the native timer callback. All timers that are due are handled in one
+ * go. The native timer for the next tick is set up before any handler
+ * runs, so if a handler raises an error, the timers not handled yet are
+ * handled on the next tick. */
+static int lui_timers_tick(void *data)
+{
+	if ((uintptr_t) data != lui_timers.armgen) {
+		/* superseded by a timer armed for an earlier time */
+		return 0;
+	}
+	lua_State *L = lui_timers.L;
+	uint64_t now = lui_timers_now();
+	lui_timers_collect(now);
+
+	int keep = 0;
+	uint64_t next = lui_timers_next();
+	lui_timers.armedfor = 0;
+	if (next) {
+		int ms = next > now ? (int) (next - now) : 1;
+		if (ms == lui_timers.armedms) {
+			lui_timers.armedfor = now + ms;
+			keep = 1;
+		} else {
+			lui_timers_arm(next, now);
+		}
+	}
+
+	if (!lui_timers.firehead) {
+		return keep;
+	}
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_TIMER_REGISTRY);
+	int reg = lua_gettop(L);
+	while (lui_timers.firehead) {
+		lui_timerObject *t = lui_timers.firehead;
+		lui_timers_unlinkFire(t);
+		lua_pushlightuserdata(L, t);
+		lua_rawget(L, reg);
+		if (!t->repeat) {
+			lui_timers_cancel(L, t);
+		}
+		lui_aux_getUservalue(L, -1, "fn");
+		lua_insert(L, -2);
+		lua_call(L, 1, 0);
+	}
+	lua_pop(L, 1);
+	return keep;
+}
+
+static int lui_timer__gc(lua_State *L)
+{
+	lui_timerObject *t = lui_checkTimer(L, 1);
+	if (t->object) {
+		DEBUGMSG("lui_timer__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_timers_cancel(L, t);
+		t->object = 0;
+	}
+	return 0;
+}
+
+/*** Property
+ * Object: timer
+ * Name: active
+ * true if the timer has not fired yet or is repeating, and has not been
+ * cancelled. Read only.
+ *** Property
+ * Object: timer
+ * Name: interval
+ * the interval of the timer in milliseconds. Read only.
+ *** Property
+ * Object: timer
+ * Name: repeat
+ * true if the timer is a repeating timer. Read only.
+ */
+static int lui_timer__index(lua_State *L)
+{
+	lui_timerObject *t = lui_checkTimer(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "active") == 0) {
+		lua_pushboolean(L, t->active);
+	} else if (strcmp(what, "interval") == 0) {
+		lua_pushinteger(L, t->ms);
+	} else if (strcmp(what, "repeat") == 0) {
+		lua_pushboolean(L, t->repeat);
+	} else {
+		return lui_utility__index(L);
+	}
+	return 1;
+}
+
+/* (re)start the timer at stack position pos */
+static void lui_timer_start(lua_State *L, lui_timerObject *t, int pos)
+{
+	lui_timers.L = lui_mainState(L);
+	lui_timers_unlink(t);
+	lui_timers_unlinkFire(t);
+	if (!t->active) {
+		t->active = 1;
+		lua_getfield(L, LUA_REGISTRYINDEX, LUI_TIMER_REGISTRY);
+		lua_pushlightuserdata(L, t);
+		lua_pushvalue(L, pos);
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+	}
+	lui_timers_schedule(t, lui_timers_now());
+}
+
+/*** Method
+ * Object: timer
+ * Name: cancel
+ * Signature: timer:cancel()
+ * stop the timer. It can be started again with timer:restart().
+ */
+static int lui_timerCancel(lua_State *L)
+{
+	lui_timerObject *t = lui_checkTimer(L, 1);
+	lui_timers_cancel(L, t);
+	return 0;
+}
+
+/*** Method
+ * Object: timer
+ * Name: restart
+ * Signature: timer:restart(ms = nil)
+ * start the timer again, counting from now, with an interval of ms, or
+ * with its previous interval if ms is nil.
+ */
+static int lui_timerRestart(lua_State *L)
+{
+	lui_timerObject *t = lui_checkTimer(L, 1);
+	if (!lua_isnoneornil(L, 2)) {
+		int ms = luaL_checkinteger(L, 2);
+		luaL_argcheck(L, ms >= 0, 2, "interval must be >= 0");
+		t->ms = ms > 0 || !t->repeat ? ms : 1;
+	}
+	lui_timer_start(L, t, 1);
+	return 0;
+}
+
+/*** Function
+ * Name: timer
+ * Signature: timer = lui.timer(ms, function, options = nil)
+ * call function(timer) after ms milliseconds. options is a table, with the
+ * field repeat, which if true makes the function be called every ms
+ * milliseconds until the timer is cancelled. Returns a timer object.
+ */
+static int lui_newTimer(lua_State *L)
+{
+	int ms = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, ms >= 0, 1, "interval must be >= 0");
+	luaL_argcheck(L, lui_aux_iscallable(L, 2), 2, "expected callable");
+	int repeat = 0;
+	if (lui_aux_istable(L, 3)) {
+		lua_getfield(L, 3, "repeat");
+		repeat = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+	}
+
+	lui_timerObject *t = lui_pushTimer(L);
+	t->object = t;
+	t->repeat = repeat;
+	/* repeating timers fire at most once per ms */
+	t->ms = ms > 0 || !repeat ? ms : 1;
+	lui_aux_setUservalue(L, -1, "fn", 2);
+	lua_replace(L, 1);
+	lua_settop(L, 1);
+	lui_timer_start(L, t, 1);
+	lui_registerObject(L, 1);
+	return 1;
+}
+
+/* metamethods for timers */
+static const luaL_Reg lui_timer_meta[] = {
+	{"__gc", lui_timer__gc},
+	{"__index", lui_timer__index},
+	{0, 0}
+};
+
+/* methods for timers */
+static const luaL_Reg lui_timer_methods[] = {
+	{"cancel", lui_timerCancel},
+	{"restart", lui_timerRestart},
+	{0, 0}
+};
+
+/* handler throttling  *****************************************************/
+
+/* a gate holds back the calls of one handler of a control. It is a timer on
+ * the timer wheel, which calls the handler when the held back calls are to
+ * be delivered. As all gated handlers read the state they report from the
+ * control, a single call delivers the latest value. */
+typedef struct lui_gateObject {
+	lui_timerObject timer;
+	int throttle;			/* ms between calls, 0 for no throttling */
+	int debounce;			/* ms of quiet before a call, 0 for none */
+	double since;			/* the first call held back */
+	double last;			/* the last call delivered */
+	double due;				/* end of the debounce period */
+} lui_gateObject;
+
+/* the time held back calls of g are to be delivered */
+static double lui_gate_next(lui_gateObject *g)
+{
+	if (g->debounce > 0) {
+		if (g->throttle > 0 && g->since + g->throttle < g->due) {
+			return g->since + g->throttle;
+		}
+		return g->due;
+	}
+	return g->last + g->throttle;
+}
+
+static void lui_gate_arm(lua_State *L, lui_gateObject *g, int pos, double now)
+{
+	int ms = (int) ceil(lui_gate_next(g) - now);
+	g->timer.ms = ms > 0 ? ms : 0;
+	lui_timer_start(L, &g->timer, pos);
+}
+
+/* the timer function of a gate, upvalues are the control and the name of
+ * the handler */
+static int lui_gate_fire(lua_State *L)
+{
+	lui_gateObject *g = (lui_gateObject*) lua_touserdata(L, 1);
+	double now = lui_monotonicMs();
+	if ((g->debounce > 0 || g->throttle > 0) && lui_gate_next(g) > now + 0.5) {
+		/* more calls arrived while the timer was running */
+		lui_gate_arm(L, g, 1, now);
+		return 0;
+	}
+	g->last = now;
+	lui_object *lobj = lui_toObject(L, lua_upvalueindex(1));
+	if (lobj->object) {
+		int top = lua_gettop(L);
+		lui_objectHandlerCallback(L, uiControl(lobj->object), lua_tostring(L, lua_upvalueindex(2)), top, 0, 0);
+		lua_settop(L, top);
+	}
+	return 0;
+}
+
+/* push the gate for handler of the control at pos, or nil */
+static int lui_gate_push(lua_State *L, int pos, const char *handler)
+{
+	char key[64];
+	snprintf(key, sizeof(key), "%s.gate", handler);
+	return lui_aux_getUservalue(L, pos, key);
+}
+
+/* lui_objectGatedCallback
+ *
+ * call handler of control like lui_objectHandlerCallback() does with no
+ * arguments and results, unless the throttle or debounce properties for it
+ * are set. Then the call is held back and delivered later by the gate, and
+ * calls arriving in between are dropped. Keeps the stack as it is.
+ */
+static void lui_objectGatedCallback(lua_State *L, const uiControl *control, const char *handler)
+{
+	int top = lua_gettop(L);
+	lui_gateObject *g = NULL;
+	if (lui_findObject(L, control) != LUA_TNIL && lui_gate_push(L, top + 1, handler) != LUA_TNIL) {
+		g = (lui_gateObject*) lua_touserdata(L, top + 2);
+	}
+	if (!g || (g->throttle <= 0 && g->debounce <= 0)) {
+		lua_settop(L, top);
+		lui_objectHandlerCallback(L, control, handler, top, 0, 0);
+		lua_settop(L, top);
+		return;
+	}
+	double now = lui_monotonicMs();
+	if (g->debounce > 0) {
+		g->due = now + g->debounce;
+	}
+	if (!g->timer.active) {
+		g->since = now;
+		if (g->debounce <= 0 && now - g->last >= g->throttle) {
+			/* the first call after a quiet period goes through */
+			g->last = now;
+			lua_settop(L, top);
+			lui_objectHandlerCallback(L, control, handler, top, 0, 0);
+			lua_settop(L, top);
+			return;
+		}
+		lui_gate_arm(L, g, top + 2, now);
+	}
+	lua_settop(L, top);
+}
+
+/*** Property
+ * Object: control
+ * Name: throttle
+ * on controls with a change handler that supports it, if greater than 0,
+ * the handler is called at most once every that many milliseconds.
+ * Changes in between are not reported separately, the next call sees the
+ * latest state. Default is 0.
+ *** Property
+ * Object: control
+ * Name: debounce
+ * on controls with a change handler that supports it, if greater than 0,
+ * the handler is only called once the control did not change for that
+ * many milliseconds. If throttle is set as well, it is called at least
+ * every throttle milliseconds during longer changes. Default is 0.
+ */
+/* push the throttle or debounce value for handler of the object at 1 */
+static int lui_objectGetGate(lua_State *L, const char *handler, const char *what)
+{
+	int ms = 0;
+	if (lui_gate_push(L, 1, handler) != LUA_TNIL) {
+		lui_gateObject *g = (lui_gateObject*) lua_touserdata(L, -1);
+		ms = strcmp(what, "throttle") == 0 ? g->throttle : g->debounce;
+	}
+	lua_pop(L, 1);
+	lua_pushinteger(L, ms);
+	return 1;
+}
+
+/* set the throttle or debounce value for handler of the object at 1 from
+ * the value at pos. nil or false mean 0. */
+static int lui_objectSetGate(lua_State *L, const char *handler, const char *what, int pos)
+{
+	int ms = lua_toboolean(L, pos) ? (int) luaL_checkinteger(L, pos) : 0;
+	luaL_argcheck(L, ms >= 0, pos, "interval must be >= 0");
+	lui_gateObject *g;
+	if (lui_gate_push(L, 1, handler) != LUA_TNIL) {
+		g = (lui_gateObject*) lua_touserdata(L, -1);
+	} else if (ms > 0) {
+		char key[64];
+		snprintf(key, sizeof(key), "%s.gate", handler);
+		lua_pop(L, 1);
+		g = (lui_gateObject*) lui_pushObjectSized(L, LUI_TIMER, 1, sizeof(lui_gateObject));
+		g->timer.object = g;
+		lua_pushvalue(L, 1);
+		lua_pushstring(L, handler);
+		lua_pushcclosure(L, lui_gate_fire, 2);
+		lui_aux_setUservalue(L, -2, "fn", lua_gettop(L));
+		lua_pop(L, 1);
+		lui_aux_setUservalue(L, 1, key, lua_gettop(L));
+	} else {
+		lua_pop(L, 1);
+		return 0;
+	}
+	if (strcmp(what, "throttle") == 0) {
+		g->throttle = ms;
+	} else {
+		g->debounce = ms;
+	}
+	lua_pop(L, 1);
+	return 0;
+}
+
+/* idle tasks  *************************************************************/
+
+/* by default, idle tasks run for at most this many ms per main loop turn */
+#define LUI_IDLE_BUDGET 4
+
+typedef struct lui_idleTask {
+	int ref;
+	struct lui_idleTask *next;
+} lui_idleTask;
+
+/* the tasks of one priority, in the order they were added */
+typedef struct lui_idleQueue {
+	int priority;
+	lui_idleTask *head, *tail;
+	struct lui_idleQueue *next;
+} lui_idleQueue;
+
+static struct {
+	lui_idleQueue *queues;	/* highest priority first */
+	int count;
+	int queued;				/* whether a round is queued with uiQueueMain */
+	double budget;
+} lui_idle = { NULL, 0, 0, LUI_IDLE_BUDGET };
+
+static void lui_idle_round(void *data);
+
+static void lui_idle_schedule(lua_State *L)
+{
+	if (!lui_idle.queued && lui_idle.count > 0) {
+		lui_idle.queued = 1;
+		uiQueueMain(lui_idle_round, lui_mainState(L));
+	}
+}
+
+/* put task at the end of the queue for priority. Returns 0 if out of
+ * memory */
+static int lui_idle_append(lui_idleTask *task, int priority)
+{
+	lui_idleQueue **qp = &lui_idle.queues;
+	while (*qp && (*qp)->priority > priority) {
+		qp = &(*qp)->next;
+	}
+	lui_idleQueue *q = *qp;
+	if (!q || q->priority != priority) {
+		q = calloc(1, sizeof(lui_idleQueue));
+		if (!q) {
+			return 0;
+		}
+		q->priority = priority;
+		q->next = *qp;
+		*qp = q;
+	}
+	task->next = NULL;
+	if (q->tail) {
+		q->tail->next = task;
+	} else {
+		q->head = task;
+	}
+	q->tail = task;
+	lui_idle.count += 1;
+	return 1;
+}
+
+/* take the first task of the highest priority. Returns NULL if there are
+ * none, else the task and its priority in *priority. */
+static lui_idleTask *lui_idle_take(int *priority)
+{
+	lui_idleQueue *q = lui_idle.queues;
+	if (!q) {
+		return NULL;
+	}
+	lui_idleTask *task = q->head;
+	q->head = task->next;
+	*priority = q->priority;
+	if (!q->head) {
+		lui_idle.queues = q->next;
+		free(q);
+	}
+	lui_idle.count -= 1;
+	return task;
+}
+
+/* lui_idle_push
+ *
+ * add the function at stack position pos to the idle tasks
+ */
+static void lui_idle_push(lua_State *L, int pos, int priority)
+{
+	lui_idleTask *task = malloc(sizeof(lui_idleTask));
+	if (!task) {
+		luaL_error(L, "out of memory!");
+	}
+	lua_pushvalue(L, pos);
+	task->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	if (!lui_idle_append(task, priority)) {
+		luaL_unref(L, LUA_REGISTRYINDEX, task->ref);
+		free(task);
+		luaL_error(L, "out of memory!");
+	}
+	lui_idle_schedule(L);
+}
+
+/* run idle tasks until there are none left or the budget is used up. At
+ * least one task is run per round. */
+static void lui_idle_round(void *data)
+{
+	lua_State *L = (lua_State*) data;
+	lui_idle.queued = 0;
+	/* queue the next round first, so that the remaining tasks are not lost
+	 * if a task raises an error */
+	lui_idle_schedule(L);
+	double end = lui_monotonicMs() + lui_idle.budget;
+	int priority;
+	lui_idleTask *task;
+	do {
+		task = lui_idle_take(&priority);
+		if (!task) {
+			break;
+		}
+		lua_rawgeti(L, LUA_REGISTRYINDEX, task->ref);
+		if (lui_aux_iscallable(L, -1)) {
+			lua_call(L, 0, 1);
+		} else {
+			lua_pushnil(L);
+		}
+		/* a task that returned true is run again, if it can be requeued */
+		if (!lua_toboolean(L, -1) || !lui_idle_append(task, priority)) {
+			luaL_unref(L, LUA_REGISTRYINDEX, task->ref);
+			free(task);
+		}
+		lua_pop(L, 1);
+	} while (lui_monotonicMs() < end);
+}
+
+static void lui_idle_clear(lua_State *L)
+{
+	int priority;
+	lui_idleTask *task;
+	while ((task = lui_idle_take(&priority))) {
+		luaL_unref(L, LUA_REGISTRYINDEX, task->ref);
+		free(task);
+	}
+}
+
+/*** Function
+ * Name: idle
+ * Signature: lui.idle(function, priority = 0)
+ * add a task to be run when there are no events pending. Tasks are run in
+ * order of their priority, highest first, and in the order they were added
+ * for tasks of the same priority. If the function returns true, it is put
+ * at the end of the tasks with its priority, to be called again, which
+ * allows to split long running work into small chunks. Tasks only run for
+ * as long as lui.idlebudget() allows per turn of the main loop, so events
+ * are handled in between.
+ */
+static int lui_idleAdd(lua_State *L)
+{
+	luaL_argcheck(L, lui_aux_iscallable(L, 1), 1, "expected callable");
+	int priority = luaL_optinteger(L, 2, 0);
+	lui_idle_push(L, 1, priority);
+	return 0;
+}
+
+/*** Function
+ * Name: idlebudget
+ * Signature: oldbudget = lui.idlebudget(ms = nil)
+ * set the time in milliseconds idle tasks may run per turn of the main
+ * loop. At least one task is run per turn, regardless of the budget. The
+ * default is 4. If ms is nil, the budget is left unchanged. Returns the
+ * previous budget.
+ */
+static int lui_idleBudget(lua_State *L)
+{
+	lua_pushnumber(L, lui_idle.budget);
+	if (!lua_isnoneornil(L, 1)) {
+		double budget = luaL_checknumber(L, 1);
+		luaL_argcheck(L, budget >= 0, 1, "budget must be >= 0");
+		lui_idle.budget = budget;
+	}
+	return 1;
+}
+
+/* async handlers  *********************************************************/
+
+/* An async function runs in a coroutine of its own. When it yields, it is
+ * resumed by a wake function: lui.sleep() and lui.await() arrange for the
+ * wake function to be called by a timer or a finished job, any other yield
+ * queues it as an idle task. Coroutines that have not finished are kept in
+ * a registry table, so that they are not collected while they wait.
+ */
+#define LUI_ASYNC_REGISTRY "lui_async"
+
+/* yielded by lui.sleep() and lui.await(), which schedule their own wakeup */
+static int lui_asyncWaiting;
+
+/* is L a coroutine started by an async function? */
+static int lui_async_isAsync(lua_State *L)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_ASYNC_REGISTRY);
+	lua_pushthread(L);
+	int isasync = lua_rawget(L, -2) != LUA_TNIL;
+	lua_pop(L, 2);
+	return isasync;
+}
+
+static void lui_async_setRegistered(lua_State *co, int registered)
+{
+	lua_getfield(co, LUA_REGISTRYINDEX, LUI_ASYNC_REGISTRY);
+	lua_pushthread(co);
+	if (registered) {
+		lua_pushboolean(co, 1);
+	} else {
+		lua_pushnil(co);
+	}
+	lua_rawset(co, -3);
+	lua_pop(co, 1);
+}
+
+static int lui_async_wake(lua_State *L);
+
+/* push a function onto L that resumes the coroutine co when called */
+static void lui_async_pushWake(lua_State *L, lua_State *co)
+{
+	lua_pushthread(co);
+	if (co != L) {
+		lua_xmove(co, L, 1);
+	}
+	lua_pushcclosure(L, lui_async_wake, 1);
+}
+
+/* lui_async_resume
+ *
+ * resume the coroutine co with the narg values on top of its stack. If it
+ * finishes, its results are moved to L and their number is returned. If it
+ * yields, 0 is returned. Errors in the coroutine are raised in L.
+ */
+static int lui_async_resume(lua_State *L, lua_State *co, int narg)
+{
+#if LUA_VERSION_NUM >= 504
+	int nres;
+	int status = lua_resume(co, L, narg, &nres);
+#else
+	int status = lua_resume(co, L, narg);
+	int nres = lua_gettop(co);
+#endif
+	if (status == LUA_OK) {
+		lui_async_setRegistered(co, 0);
+		luaL_checkstack(L, nres, "too many results");
+		lua_xmove(co, L, nres);
+		return nres;
+	} else if (status == LUA_YIELD) {
+		int waiting = nres == 1 && lua_touserdata(co, -1) == &lui_asyncWaiting;
+		/* only the yielded values, on 5.4 the frame of a yielding C
+		 * function lies below them and must be kept */
+		lua_pop(co, nres);
+		if (!waiting) {
+			lui_async_pushWake(L, co);
+			lui_idle_push(L, -1, 0);
+			lua_pop(L, 1);
+		}
+		return 0;
+	}
+	lui_async_setRegistered(co, 0);
+	luaL_traceback(L, co, lua_tostring(co, -1), 0);
+	return lua_error(L);
+}
+
+static int lui_async_wake(lua_State *L)
+{
+	lua_State *co = lua_tothread(L, lua_upvalueindex(1));
+	if (lua_status(co) == LUA_YIELD) {
+		lua_settop(L, 0);
+		lui_async_resume(L, co, 0);
+	}
+	return 0;
+}
+
+static int lui_async_call(lua_State *L)
+{
+	int narg = lua_gettop(L);
+	lua_State *co = lua_newthread(L);
+	lui_async_setRegistered(co, 1);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_xmove(L, co, 1);
+	for (int i = 1; i <= narg; ++i) {
+		lua_pushvalue(L, i);
+	}
+	lua_xmove(L, co, narg);
+	return lui_async_resume(L, co, narg);
+}
+
+/*** Function
+ * Name: async
+ * Signature: fn = lui.async(function)
+ * wrap function so that every call to it runs in a coroutine of its own.
+ * The result is meant to be used as an event handler: when function yields,
+ * the handler returns to the main loop, and function is resumed later, so
+ * that long running handlers do not freeze the ui. A plain coroutine.yield()
+ * resumes with the next idle turn of the main loop, see also lui.sleep()
+ * and lui.await(). If function finishes without yielding, its results are
+ * returned, else the call returns nothing. Errors are raised from wherever
+ * the coroutine was resumed.
+ */
+static int lui_async(lua_State *L)
+{
+	luaL_argcheck(L, lui_aux_iscallable(L, 1), 1, "expected callable");
+	lua_settop(L, 1);
+	lua_pushcclosure(L, lui_async_call, 1);
+	return 1;
+}
+
+/*** Function
+ * Name: sleep
+ * Signature: lui.sleep(ms)
+ * suspend the calling async function for ms milliseconds, while the main
+ * loop keeps running. May only be called from functions run by lui.async().
+ */
+static int lui_asyncSleep(lua_State *L)
+{
+	int ms = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, ms >= 0, 1, "interval must be >= 0");
+	if (!lui_async_isAsync(L)) {
+		return luaL_error(L, "lui.sleep can only be called from async functions!");
+	}
+	lua_pushcfunction(L, lui_newTimer);
+	lua_pushinteger(L, ms);
+	lui_async_pushWake(L, L);
+	lua_call(L, 2, 0);
+	lua_pushlightuserdata(L, &lui_asyncWaiting);
+	return lua_yield(L, 1);
+}
+
+/* scheduler  **************************************************************/
+
+/* lui.run() interleaves event processing with cooperative tasks. Each turn
+ * of its loop handles all pending events, then resumes runnable tasks until
+ * the budget for the turn is used up, but at least one. If no task is
+ * runnable, it blocks in uiMainStep() until the next event, with a native
+ * timer armed to wake it when the next sleeping task is due.
+ */
+#define LUI_RUN_BUDGET 8
+/* at most this many events are handled per turn before tasks get to run */
+#define LUI_RUN_MAXEVENTS 64
+
+typedef struct {
+	int ref;				/* the coroutine of the task */
+	double due;				/* when a sleeping task may run again */
+} lui_runTask;
+
+static struct {
+	int running;
+	double budget;
+	lui_runTask *tasks;
+	int numtasks;
+	/* statistics */
+	double start, stop;
+	double eventms, taskms, idlems;
+	unsigned long turns, overruns, resumes;
+	/* wakeup timer */
+	unsigned armgen;
+	double armedfor;
+} lui_run;
+
+static int lui_run_wakeup(void *data)
+{
+	if ((unsigned)(uintptr_t) data == lui_run.armgen) {
+		lui_run.armedfor = 0;
+	}
+	return 0;
+}
+
+/* make sure uiMainStep(1) returns no later than at time due */
+static void lui_run_arm(double due)
+{
+	if (lui_run.armedfor > 0 && lui_run.armedfor <= due) {
+		return;
+	}
+	int ms = (int) ceil(due - lui_monotonicMs());
+	lui_run.armgen += 1;
+	lui_run.armedfor = due;
+	uiTimer(ms > 0 ? ms : 0, lui_run_wakeup, (void*)(uintptr_t) lui_run.armgen);
+}
+
+static void lui_run_removeTask(lua_State *L, int i)
+{
+	luaL_unref(L, LUA_REGISTRYINDEX, lui_run.tasks[i].ref);
+	lui_run.numtasks -= 1;
+	memmove(&lui_run.tasks[i], &lui_run.tasks[i + 1], (lui_run.numtasks - i) * sizeof(lui_runTask));
+}
+
+static void lui_run_clear(lua_State *L)
+{
+	while (lui_run.numtasks > 0) {
+		lui_run_removeTask(L, lui_run.numtasks - 1);
+	}
+	free(lui_run.tasks);
+	lui_run.tasks = NULL;
+	lui_run.running = 0;
+}
+
+/* resume task i. Returns 1 if it is still alive afterwards. */
+static int lui_run_resume(lua_State *L, int i)
+{
+	lua_rawgeti(L, LUA_REGISTRYINDEX, lui_run.tasks[i].ref);
+	lua_State *co = lua_tothread(L, -1);
+	lua_pop(L, 1);
+	lui_run.resumes += 1;
+#if LUA_VERSION_NUM >= 504
+	int nres;
+	int status = lua_resume(co, L, 0, &nres);
+#else
+	int status = lua_resume(co, L, 0);
+	int nres = lua_gettop(co);
+#endif
+	if (status == LUA_YIELD) {
+		lui_run.tasks[i].due = 0;
+		if (nres > 0 && lua_type(co, -nres) == LUA_TNUMBER) {
+			double ms = lua_tonumber(co, -nres);
+			if (ms > 0) {
+				lui_run.tasks[i].due = lui_monotonicMs() + ms;
+			}
+		}
+		lua_pop(co, nres);
+		return 1;
+	} else if (status != LUA_OK) {
+		luaL_traceback(L, co, lua_tostring(co, -1), 0);
+		lua_error(L);
+	}
+	lui_run_removeTask(L, i);
+	return 0;
+}
+
+/* run tasks until the budget is used up or none is runnable. At least one
+ * runnable task is resumed, even if the budget is 0. Returns the time the
+ * next sleeping task is due, 0 if a task is runnable right away, or -1 if
+ * there are no tasks. */
+static double lui_run_tasks(lua_State *L, double end)
+{
+	for (;;) {
+		double now = lui_monotonicMs();
+		double next = -1;
+		int ran = 0;
+		for (int i = 0; i < lui_run.numtasks; ) {
+			if (lui_run.tasks[i].due > now) {
+				if (next < 0 || lui_run.tasks[i].due < next) {
+					next = lui_run.tasks[i].due;
+				}
+				i += 1;
+				continue;
+			}
+			if (ran && now >= end) {
+				lui_run.overruns += 1;
+				return 0;
+			}
+			ran = 1;
+			if (lui_run_resume(L, i)) {
+				if (lui_run.tasks[i].due == 0) {
+					next = 0;
+				} else if (next < 0 || lui_run.tasks[i].due < next) {
+					next = lui_run.tasks[i].due;
+				}
+				i += 1;
+			}
+			now = lui_monotonicMs();
+		}
+		if (!ran || next != 0) {
+			return next;
+		}
+		if (now >= end) {
+			lui_run.overruns += 1;
+			return 0;
+		}
+	}
+}
+
+static void lui_run_pushStats(lua_State *L)
+{
+	double total = (lui_run.stop > 0 ? lui_run.stop : lui_monotonicMs()) - lui_run.start;
+	lua_createtable(L, 0, 9);
+	lua_pushnumber(L, total);
+	lua_setfield(L, -2, "total_ms");
+	lua_pushnumber(L, lui_run.eventms);
+	lua_setfield(L, -2, "event_ms");
+	lua_pushnumber(L, lui_run.taskms);
+	lua_setfield(L, -2, "task_ms");
+	lua_pushnumber(L, lui_run.idlems);
+	lua_setfield(L, -2, "idle_ms");
+	lua_pushnumber(L, total > 0 ? (total - lui_run.idlems) / total : 0);
+	lua_setfield(L, -2, "utilization");
+	lua_pushinteger(L, lui_run.turns);
+	lua_setfield(L, -2, "turns");
+	lua_pushinteger(L, lui_run.overruns);
+	lua_setfield(L, -2, "overruns");
+	lua_pushinteger(L, lui_run.resumes);
+	lua_setfield(L, -2, "resumes");
+	lua_pushinteger(L, lui_run.numtasks);
+	lua_setfield(L, -2, "tasks");
+}
+
+/* the loop of lui.run(), called protected so that the tasks can be cleaned
+ * up when an event handler or a task raises an error */
+static int lui_run_loop(lua_State *L)
+{
+	uiMainSteps();
+	int running = 1;
+	while (running) {
+		double t0 = lui_monotonicMs();
+		lui_run.turns += 1;
+		running = uiMainStep(0);
+		for (int n = 1; running && n < LUI_RUN_MAXEVENTS; ++n) {
+#ifdef LUI_GTK
+			if (!gtk_events_pending()) {
+				break;
+			}
+#endif
+			running = uiMainStep(0);
+		}
+		if (!running) {
+			break;
+		}
+		double t1 = lui_monotonicMs();
+		lui_run.eventms += t1 - t0;
+
+		double next = lui_run_tasks(L, t1 + lui_run.budget);
+		double t2 = lui_monotonicMs();
+		lui_run.taskms += t2 - t1;
+
+		if (next != 0) {
+			if (next > 0) {
+				lui_run_arm(next);
+			}
+			running = uiMainStep(1);
+			lui_run.idlems += lui_monotonicMs() - t2;
+		}
+	}
+	return 0;
+}
+
+/*** Function
+ * Name: run
+ * Signature: stats = lui.run(options = nil)
+ * run the main loop like lui.main(), together with cooperative tasks.
+ * options is a table with the fields budget_ms, the time in milliseconds
+ * tasks may run per turn of the loop after pending events have been
+ * handled, default 8, at least one runnable task is resumed per turn even
+ * if it is 0, and tasks, an array of functions or coroutines. Each
+ * task is resumed in turn until it finishes. A task that yields a number
+ * sleeps for that many milliseconds, any other yield just lets the other
+ * tasks and pending events run. When no task is runnable, lui.run() sleeps
+ * until the next event or until the next sleeping task is due, instead of
+ * polling. Returns the statistics described at lui.runstats() when
+ * lui.quit() is called.
+ */
+static int lui_runLoop(lua_State *L)
+{
+	ensure_initialized();
+	if (lui_run.running) {
+		return luaL_error(L, "lui.run is already running!");
+	}
+	double budget = LUI_RUN_BUDGET;
+	int ntasks = 0;
+	lua_settop(L, 1);
+	if (lui_aux_istable(L, 1)) {
+		lua_getfield(L, 1, "budget_ms");
+		if (!lua_isnil(L, -1)) {
+			budget = luaL_checknumber(L, -1);
+			luaL_argcheck(L, budget >= 0, 1, "budget_ms must be >= 0");
+		}
+		lua_pop(L, 1);
+		if (lua_getfield(L, 1, "tasks") != LUA_TNIL) {
+			luaL_checktype(L, -1, LUA_TTABLE);
+			ntasks = lua_rawlen(L, -1);
+		}
+	} else if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TTABLE);
+	}
+
+	memset(&lui_run, 0, sizeof(lui_run));
+	lui_run.budget = budget;
+	if (ntasks > 0) {
+		lui_run.tasks = calloc(ntasks, sizeof(lui_runTask));
+		if (!lui_run.tasks) {
+			return luaL_error(L, "out of memory!");
+		}
+	}
+	for (int i = 1; i <= ntasks; ++i) {
+		lua_rawgeti(L, 2, i);
+		if (lua_type(L, -1) != LUA_TTHREAD) {
+			if (!lui_aux_iscallable(L, -1)) {
+				lui_run_clear(L);
+				return luaL_error(L, "task %d is not a function or coroutine!", i);
+			}
+			lua_State *co = lua_newthread(L);
+			lua_insert(L, -2);
+			lua_xmove(L, co, 1);
+		}
+		lui_run.tasks[lui_run.numtasks].ref = luaL_ref(L, LUA_REGISTRYINDEX);
+		lui_run.numtasks += 1;
+	}
+
+	lui_run.running = 1;
+	lui_run.start = lui_monotonicMs();
+	lua_pushcfunction(L, lui_run_loop);
+	int status = lua_pcall(L, 0, 0, 0);
+	lui_run.stop = lui_monotonicMs();
+	if (status == LUA_OK) {
+		lui_run_pushStats(L);
+	}
+	lui_run_clear(L);
+	return status == LUA_OK ? 1 : lua_error(L);
+}
+
+/*** Function
+ * Name: runstats
+ * Signature: stats = lui.runstats()
+ * returns statistics about the loop run by lui.run(), as a table with the
+ * fields total_ms, the time since lui.run() was called, event_ms, task_ms
+ * and idle_ms, the time spent handling events, running tasks, and waiting
+ * for something to do, utilization, the fraction of the time that was not
+ * spent waiting, turns, the number of turns of the loop, overruns, the
+ * number of turns where tasks used up their whole budget, resumes, the
+ * number of times a task was resumed, and tasks, the number of tasks still
+ * alive. The time spent waiting includes the time spent in the event
+ * handler that ended the wait. Returns nil if lui.run() has not been called.
+ */
+static int lui_runStats(lua_State *L)
+{
+	if (lui_run.start == 0) {
+		lua_pushnil(L);
+	} else {
+		lui_run_pushStats(L);
+	}
+	return 1;
+}
+
+/* message packing  *******************************************************/
+
+/* values are packed into a flat buffer so that they can be handed between
+ * lua states that may live on different threads. Only nil, booleans,
+ * numbers, strings and tables of those can be packed.
+ */
+#define LUI_PACK_MAXDEPTH 64
+
+enum {
+	LUI_PACK_NIL = 'n',
+	LUI_PACK_TRUE = 't',
+	LUI_PACK_FALSE = 'f',
+	LUI_PACK_INTEGER = 'i',
+	LUI_PACK_NUMBER = 'd',
+	LUI_PACK_STRING = 's',
+	LUI_PACK_TABLE = 'T',
+	LUI_PACK_END = 'E'
+};
+
+typedef struct {
+	char *data;
+	size_t len, size;
+	const char *error;		/* error message, or */
+	const char *badtype;	/* type name of a value that can not be packed */
+} lui_packBuffer;
+
+static int lui_pack_put(lui_packBuffer *b, const void *data, size_t len)
+{
+	if (b->len + len > b->size) {
+		size_t size = b->size ? b->size : 64;
+		while (size < b->len + len) {
+			size *= 2;
+		}
+		char *ndata = realloc(b->data, size);
+		if (!ndata) {
+			b->error = "out of memory";
+			return 0;
+		}
+		b->data = ndata;
+		b->size = size;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return 1;
+}
+
+static int lui_pack_tag(lui_packBuffer *b, char tag)
+{
+	return lui_pack_put(b, &tag, 1);
+}
+
+/* lui_pack_value
+ *
+ * append the value at stack position pos to the buffer. Returns 1 on
+ * success, 0 on error, with b->error set.
+ */
+static int lui_pack_value(lua_State *L, int pos, lui_packBuffer *b, int depth)
+{
+	if (pos < 0) {
+		pos = lua_gettop(L) + pos + 1;
+	}
+	switch (lua_type(L, pos)) {
+		case LUA_TNIL:
+			return lui_pack_tag(b, LUI_PACK_NIL);
+		case LUA_TBOOLEAN:
+			return lui_pack_tag(b, lua_toboolean(L, pos) ? LUI_PACK_TRUE : LUI_PACK_FALSE);
+		case LUA_TNUMBER:
+#if LUA_VERSION_NUM >= 503
+			if (lua_isinteger(L, pos)) {
+				lua_Integer i = lua_tointeger(L, pos);
+				return lui_pack_tag(b, LUI_PACK_INTEGER) && lui_pack_put(b, &i, sizeof(i));
+			}
+#endif
+			{
+				lua_Number n = lua_tonumber(L, pos);
+				return lui_pack_tag(b, LUI_PACK_NUMBER) && lui_pack_put(b, &n, sizeof(n));
+			}
+		case LUA_TSTRING: {
+			size_t len;
+			const char *str = lua_tolstring(L, pos, &len);
+			return lui_pack_tag(b, LUI_PACK_STRING) && lui_pack_put(b, &len, sizeof(len)) && lui_pack_put(b, str, len);
+		}
+		case LUA_TTABLE:
+			if (depth >= LUI_PACK_MAXDEPTH || !lua_checkstack(L, 3)) {
+				b->error = "tables nested too deeply";
+				return 0;
+			}
+			if (!lui_pack_tag(b, LUI_PACK_TABLE)) {
+				return 0;
+			}
+			lua_pushnil(L);
+			while (lua_next(L, pos) != 0) {
+				if (!lui_pack_value(L, -2, b, depth + 1) || !lui_pack_value(L, -1, b, depth + 1)) {
+					lua_pop(L, 2);
+					return 0;
+				}
+				lua_pop(L, 1);
+			}
+			return lui_pack_tag(b, LUI_PACK_END);
+	}
+	b->badtype = lua_typename(L, lua_type(L, pos));
+	return 0;
+}
+
+/* lui_pack
+ *
+ * pack the value at stack position pos into a freshly allocated buffer,
+ * leaving room for a header of hdrsize bytes in front of it. Raises an
+ * error if the value can not be packed.
+ */
+static char *lui_pack(lua_State *L, int pos, size_t hdrsize, size_t *len)
+{
+	lui_packBuffer b = { NULL, 0, 0, NULL, NULL };
+	char hdr[64] = { 0 };
+	int ok = 1;
+	while (ok && hdrsize > 0) {
+		size_t n = hdrsize > sizeof(hdr) ? sizeof(hdr) : hdrsize;
+		ok = lui_pack_put(&b, hdr, n);
+		hdrsize -= n;
+	}
+	if (!ok || !lui_pack_value(L, pos, &b, 0)) {
+		free(b.data);
+		if (b.badtype) {
+			luaL_error(L, "can not pack values of type %s!", b.badtype);
+		}
+		luaL_error(L, "%s!", b.error);
+	}
+	*len = b.len;
+	return b.data;
+}
+
+/* lui_unpack_value
+ *
+ * push the value packed at *data onto the stack and advance *data past it.
+ * Returns 0 if the data is malformed, in which case nothing is pushed.
+ */
+static int lui_unpack_value(lua_State *L, const char **data, const char *end)
+{
+	const char *p = *data;
+	if (p >= end || !lua_checkstack(L, 3)) {
+		return 0;
+	}
+	char tag = *p++;
+	switch (tag) {
+		case LUI_PACK_NIL:
+			lua_pushnil(L);
+			break;
+		case LUI_PACK_TRUE:
+		case LUI_PACK_FALSE:
+			lua_pushboolean(L, tag == LUI_PACK_TRUE);
+			break;
+		case LUI_PACK_INTEGER: {
+			lua_Integer i;
+			if (end - p < (ptrdiff_t) sizeof(i)) {
+				return 0;
+			}
+			memcpy(&i, p, sizeof(i));
+			p += sizeof(i);
+			lua_pushinteger(L, i);
+			break;
+		}
+		case LUI_PACK_NUMBER: {
+			lua_Number n;
+			if (end - p < (ptrdiff_t) sizeof(n)) {
+				return 0;
+			}
+			memcpy(&n, p, sizeof(n));
+			p += sizeof(n);
+			lua_pushnumber(L, n);
+			break;
+		}
+		case LUI_PACK_STRING: {
+			size_t len;
+			if (end - p < (ptrdiff_t) sizeof(len)) {
+				return 0;
+			}
+			memcpy(&len, p, sizeof(len));
+			p += sizeof(len);
+			if ((size_t) (end - p) < len) {
+				return 0;
+			}
+			lua_pushlstring(L, p, len);
+			p += len;
+			break;
+		}
+		case LUI_PACK_TABLE:
+			lua_newtable(L);
+			while (p < end && *p != LUI_PACK_END) {
+				if (!lui_unpack_value(L, &p, end)) {
+					lua_pop(L, 1);
+					return 0;
+				}
+				if (lua_isnil(L, -1) || !lui_unpack_value(L, &p, end)) {
+					lua_pop(L, 2);
+					return 0;
+				}
+				lua_rawset(L, -3);
+			}
+			if (p >= end) {
+				lua_pop(L, 1);
+				return 0;
+			}
+			p += 1;
+			break;
+		default:
+			return 0;
+	}
+	*data = p;
+	return 1;
+}
+
+/* lui_unpack
+ *
+ * push the value packed into data, or nil if the data is malformed
+ */
+static void lui_unpack(lua_State *L, const char *data, size_t len)
+{
+	if (!lui_unpack_value(L, &data, data + len)) {
+		lua_pushnil(L);
+	}
+}
+
+/* messages  ***************************************************************/
+
+/* Messages may be posted from any thread, and are delivered to the handler
+ * registered with lui.onmessage() on the ui thread. Posting appends to a
+ * list under a lock; the ui thread takes the whole list at once, with only
+ * one uiQueueMain() call outstanding at any time.
+ */
+typedef struct lui_message {
+	struct lui_message *next;
+	int packed;		/* data is a packed lua value, else a plain string */
+	size_t len;
+	char data[];
+} lui_message;
+
+#define LUI_MESSAGE_HDRSIZE offsetof(lui_message, data)
+
+static struct {
+	lui_mutex lock;
+	int initialized;		/* lock has been initialized */
+	int ready;				/* messages are accepted, guarded by lock */
+	lui_message *head, *tail;
+	int handler;			/* a handler has been registered */
+	int delivering;			/* a delivery is queued with uiQueueMain */
+	lua_State *L;
+} lui_messages;
+
+static void lui_messages_deliver(void *data);
+
+/* must be called with the lock held */
+static void lui_messages_wake(void)
+{
+	if (lui_messages.head && lui_messages.handler && !lui_messages.delivering) {
+		lui_messages.delivering = 1;
+		uiQueueMain(lui_messages_deliver, lui_messages.L);
+	}
+}
+
+static int lui_messages_append(lui_message *msg)
+{
+	if (!lui_messages.initialized) {
+		free(msg);
+		return 0;
+	}
+	msg->next = NULL;
+	lui_mutexLock(&lui_messages.lock);
+	if (!lui_messages.ready) {
+		lui_mutexUnlock(&lui_messages.lock);
+		free(msg);
+		return 0;
+	}
+	if (lui_messages.tail) {
+		lui_messages.tail->next = msg;
+	} else {
+		lui_messages.head = msg;
+	}
+	lui_messages.tail = msg;
+	lui_messages_wake();
+	lui_mutexUnlock(&lui_messages.lock);
+	return 1;
+}
+
+static void lui_messages_free(lui_message *msg)
+{
+	while (msg) {
+		lui_message *next = msg->next;
+		free(msg);
+		msg = next;
+	}
+}
+
+/* deliver all pending messages as one array to the message handler. If
+ * the handler was removed since the delivery was queued, the messages are
+ * kept until lui.onmessage() sets a new one. */
+static void lui_messages_deliver(void *data)
+{
+	lua_State *L = (lua_State*) data;
+	lua_pushstring(L, LUI_OBJECT_REGISTRY);
+	lua_gettable(L, LUA_REGISTRYINDEX);
+	lua_pushstring(L, "lui_onmessage");
+	int hashandler = lua_gettable(L, -2) != LUA_TNIL;
+
+	lui_mutexLock(&lui_messages.lock);
+	lui_message *msg = hashandler ? lui_messages.head : NULL;
+	if (hashandler) {
+		lui_messages.head = lui_messages.tail = NULL;
+	}
+	lui_messages.delivering = 0;
+	lui_mutexUnlock(&lui_messages.lock);
+	if (!msg) {
+		lua_pop(L, 2);
+		return;
+	}
+	lua_newtable(L);
+	int n = 0;
+	while (msg) {
+		lui_message *next = msg->next;
+		if (msg->packed) {
+			lui_unpack(L, msg->data, msg->len);
+		} else {
+			lua_pushlstring(L, msg->data, msg->len);
+		}
+		lua_rawseti(L, -2, ++n);
+		free(msg);
+		msg = next;
+	}
+	lua_call(L, 1, 0);
+	lua_pop(L, 1);
+}
+
+/* drop pending messages and reject new ones until lui is loaded again */
+static void lui_messages_close(void)
+{
+	if (!lui_messages.initialized) {
+		return;
+	}
+	lui_mutexLock(&lui_messages.lock);
+	lui_message *msg = lui_messages.head;
+	lui_messages.head = lui_messages.tail = NULL;
+	lui_messages.handler = 0;
+	lui_messages.ready = 0;
+	lui_mutexUnlock(&lui_messages.lock);
+	lui_messages_free(msg);
+}
+
+/* lui_post
+ *
+ * C API, see lui.h. Post a string message from any thread.
+ */
+int lui_post(const void *data, size_t len)
+{
+	lui_message *msg = malloc(LUI_MESSAGE_HDRSIZE + len);
+	if (!msg) {
+		return 0;
+	}
+	msg->packed = 0;
+	msg->len = len;
+	memcpy(msg->data, data, len);
+	return lui_messages_append(msg);
+}
+
+/*** Function
+ * Name: post
+ * Signature: lui.post(msg)
+ * post a message to the handler registered with lui.onmessage(). This
+ * function may be called from any lua state on any thread, see
+ * require "lui.post". msg may be nil, a boolean, number, string or a table
+ * of those; it is copied, so tables arrive as new tables on the ui thread.
+ * Messages posted before a handler is registered are kept until there is
+ * one.
+ */
+static int lui_postMessage(lua_State *L)
+{
+	luaL_checkany(L, 1);
+	size_t len;
+	lui_message *msg = (lui_message*) lui_pack(L, 1, LUI_MESSAGE_HDRSIZE, &len);
+	msg->packed = 1;
+	msg->len = len - LUI_MESSAGE_HDRSIZE;
+	if (!lui_messages_append(msg)) {
+		return luaL_error(L, "lui has not been loaded or has been shut down!");
+	}
+	return 0;
+}
+
+/*** Function
+ * Name: onmessage
+ * Signature: lui.onmessage(function)
+ * register the function that receives messages posted with lui.post() or
+ * the C function lui_post(). Pending messages are delivered in batches, as
+ * function(msgs), where msgs is an array of the messages in the order they
+ * were posted. Messages posted from C arrive as strings. Passing nil
+ * unregisters the handler; messages are then kept until a new one is set.
+ */
+static int lui_onMessage(lua_State *L)
+{
+	ensure_initialized();
+	if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TFUNCTION);
+	}
+	lua_pushstring(L, LUI_OBJECT_REGISTRY);
+	lua_gettable(L, LUA_REGISTRYINDEX);
+	lua_pushstring(L, "lui_onmessage");
+	lua_pushvalue(L, 1);
+	lua_settable(L, -3);
+	lua_pop(L, 1);
+
+	lui_mutexLock(&lui_messages.lock);
+	lui_messages.handler = !lua_isnoneornil(L, 1);
+	lui_messages_wake();
+	lui_mutexUnlock(&lui_messages.lock);
+	return 0;
+}
+
+/* luaopen_lui_post
+ *
+ * open the lui.post module in any lua state, on any thread. It returns just
+ * the function lui.post. lui must have been loaded on the ui thread before.
+ */
+int luaopen_lui_post(lua_State *L)
+{
+	lua_pushcfunction(L, lui_postMessage);
+	return 1;
+}
+
+static const struct luaL_Reg lui_loop_funcs [] ={
+	{"now", lui_now},
+	{"timer", lui_newTimer},
+	{"idle", lui_idleAdd},
+	{"idlebudget", lui_idleBudget},
+	{"post", lui_postMessage},
+	{"onmessage", lui_onMessage},
+	{"async", lui_async},
+	{"sleep", lui_asyncSleep},
+	{"run", lui_runLoop},
+	{"runstats", lui_runStats},
+	{0, 0}
+};
+
+static int lui_init_loop(lua_State *L)
+{
+	luaL_setfuncs(L, lui_loop_funcs, 0);
+
+	lui_add_utility_type(L, LUI_TIMER, lui_timer_methods, lui_timer_meta);
+
+	lua_newtable(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, LUI_TIMER_REGISTRY);
+
+	lua_newtable(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, LUI_ASYNC_REGISTRY);
+
+	if (!lui_messages.initialized) {
+		lui_mutexInit(&lui_messages.lock);
+		lui_messages.initialized = 1;
+	}
+	lui_mutexLock(&lui_messages.lock);
+	lui_messages.L = lui_mainState(L);
+	lui_messages.ready = 1;
+	lui_mutexUnlock(&lui_messages.lock);
+
+	return 1;
+}
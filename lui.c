@@ -19,13 +19,44 @@ const int LUI_DEFAULT_WINDOW_HEIGHT = 600;
  */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
 #include <string.h>
+#include <stdio.h>
 #include <time.h>
+#include <math.h>
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define LUI_GTK 1
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#endif
+
+#ifdef LUI_GTK
+#include <gtk/gtk.h>
+#include <glib-unix.h>
+#endif
 
 #include "ui.h"
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "lualib.h"
+
+#include "lui.h"
 
 /* very raw approximations of some newer functions for lua 5.1 */
 #if LUA_VERSION_NUM == 501
@@ -188,6 +219,15 @@ static int lui_aux_getRegistryTableField(lua_State *L, const char *tbl, const ch
 	return lua_type(L, -1);
 }
 
+/* return the numeric field of the table at tbl, or def if it is nil */
+static double lui_aux_optNumberField(lua_State *L, int tbl, const char *field, double def)
+{
+	lua_getfield(L, tbl, field);
+	double res = luaL_optnumber(L, -1, def);
+	lua_pop(L, 1);
+	return res;
+}
+
 static int lui_aux_getNumberOrValue(lua_State *L, int pos, const char *map)
 {
 	int isnum;
@@ -313,6 +353,26 @@ static int lui_findObject(lua_State *L, const uiControl *control)
 	return lua_type(L, -1);
 }
 
+/* lui_pushObjectSized
+ *
+ * like lui_pushObject(), but for types that keep additional data after the
+ * lui_object header. size is the size of the whole struct, which must
+ * start with the object pointer.
+ */
+static lui_object* lui_pushObjectSized(lua_State *L, const char *type, int needuv, size_t size)
+{
+	ensure_initialized();
+	lui_object *lobj = (lui_object*) lua_newuserdata(L, size);
+	memset(lobj, 0, size);
+	luaL_getmetatable(L, type);
+	lua_setmetatable(L, -2);
+	if (needuv) {
+		lua_newtable(L);
+		lua_setuservalue(L, -2);
+	}
+	return lobj;
+}
+
 static lui_object* lui_pushObject(lua_State *L, const char *type, int needuv)
 {
 	ensure_initialized();
@@ -677,6 +737,11 @@ static int lui_objectHandlerCallback(lua_State *L, const uiControl *control, con
 	return nres;
 }
 
+/* implemented in loop.inc.c */
+static void lui_objectGatedCallback(lua_State *L, const uiControl *control, const char *handler);
+static int lui_objectGetGate(lua_State *L, const char *handler, const char *what);
+static int lui_objectSetGate(lua_State *L, const char *handler, const char *what, int pos);
+
 /* generic metamethods for uiControls */
 static const luaL_Reg lui_control_meta[] = {
 	{"__gc", lui_control__gc},
@@ -779,6 +844,10 @@ static void lui_add_utility_type(lua_State *L, const char *name, const struct lu
 
 /* color handling helper functions ****************************************/
 
+/* if set, colors are returned to lua as packed 0xRRGGBBAA integers instead
+ * of {r, g, b, a} tables. See lui.colorformat(). */
+static int lui_colorPacked = 0;
+
 static int lui_aux_pushRgbaAsTable(lua_State *L, double r, double g, double b, double a)
 {
 	lua_newtable(L);
@@ -793,6 +862,39 @@ static int lui_aux_pushRgbaAsTable(lua_State *L, double r, double g, double b, d
 	return 1;
 }
 
+static uint32_t lui_aux_packColorComponent(double c)
+{
+	if (c <= 0) {
+		return 0;
+	} else if (c >= 1) {
+		return 255;
+	}
+	return (uint32_t) (c * 255 + 0.5);
+}
+
+static lua_Integer lui_aux_packRgba(double r, double g, double b, double a)
+{
+	return (lui_aux_packColorComponent(r) << 24) | (lui_aux_packColorComponent(g) << 16) | (lui_aux_packColorComponent(b) << 8) | lui_aux_packColorComponent(a);
+}
+
+static void lui_aux_unpackRgba(uint32_t rgba, double *r, double *g, double *b, double *a)
+{
+	*r = ((rgba >> 24) & 0xff) / 255.0;
+	*g = ((rgba >> 16) & 0xff) / 255.0;
+	*b = ((rgba >> 8) & 0xff) / 255.0;
+	*a = (rgba & 0xff) / 255.0;
+}
+
+/* push a color in the format selected by lui.colorformat() */
+static int lui_aux_pushRgba(lua_State *L, double r, double g, double b, double a)
+{
+	if (lui_colorPacked) {
+		lua_pushinteger(L, lui_aux_packRgba(r, g, b, a));
+		return 1;
+	}
+	return lui_aux_pushRgbaAsTable(L, r, g, b, a);
+}
+
 static int lui_aux_rgbaFromTable(lua_State *L, int pos, double *r, double *g, double *b, double *a)
 {
 	if (pos < 0) {
@@ -810,17 +912,115 @@ static int lui_aux_rgbaFromTable(lua_State *L, int pos, double *r, double *g, do
 	return 1;
 }	
 
+/* color strings are usually constants in the lua code, so the same string
+ * object is parsed over and over again. The cache is keyed by the address
+ * of the string, but as that may be reused for a different string once the
+ * original is collected, the contents are compared, too.
+ */
+#define LUI_COLORCACHE_SIZE 64
+
+static struct {
+	const char *key;
+	char str[10];
+	uint32_t rgba;
+} lui_colorCache[LUI_COLORCACHE_SIZE];
+
+static int lui_aux_hexDigit(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+/* parse "#rrggbb" or "#rrggbbaa". Returns 0 if str is not a valid color */
+static int lui_aux_parseColor(const char *str, size_t len, uint32_t *rgba)
+{
+	if ((len != 7 && len != 9) || str[0] != '#') {
+		return 0;
+	}
+	uint32_t res = 0;
+	for (size_t i = 1; i < len; ++i) {
+		int d = lui_aux_hexDigit(str[i]);
+		if (d < 0) {
+			return 0;
+		}
+		res = (res << 4) | d;
+	}
+	*rgba = len == 7 ? (res << 8) | 0xff : res;
+	return 1;
+}
+
+static int lui_aux_rgbaFromString(lua_State *L, int pos, uint32_t *rgba)
+{
+	size_t len;
+	const char *str = lua_tolstring(L, pos, &len);
+	size_t slot = ((uintptr_t) str >> 4) % LUI_COLORCACHE_SIZE;
+	if (lui_colorCache[slot].key == str && strcmp(lui_colorCache[slot].str, str) == 0) {
+		*rgba = lui_colorCache[slot].rgba;
+		return 1;
+	}
+	if (!lui_aux_parseColor(str, len, rgba)) {
+		return 0;
+	}
+	lui_colorCache[slot].key = str;
+	memcpy(lui_colorCache[slot].str, str, len + 1);
+	lui_colorCache[slot].rgba = *rgba;
+	return 1;
+}
+
+/* lui_aux_rgbaFromValue
+ *
+ * read a color from the value at pos. This may be a table {r, g, b, a}, a
+ * packed integer 0xRRGGBBAA or a string "#rrggbb" or "#rrggbbaa". Raises an
+ * error for anything else.
+ */
+static int lui_aux_rgbaFromValue(lua_State *L, int pos, double *r, double *g, double *b, double *a)
+{
+	uint32_t rgba;
+	int isnum;
+	switch (lua_type(L, pos)) {
+		case LUA_TTABLE:
+			return lui_aux_rgbaFromTable(L, pos, r, g, b, a);
+		case LUA_TNUMBER:
+			rgba = (uint32_t) lua_tointegerx(L, pos, &isnum);
+			if (isnum) {
+				lui_aux_unpackRgba(rgba, r, g, b, a);
+				return 1;
+			}
+			break;
+		case LUA_TSTRING:
+			if (lui_aux_rgbaFromString(L, pos, &rgba)) {
+				lui_aux_unpackRgba(rgba, r, g, b, a);
+				return 1;
+			}
+			break;
+	}
+	return luaL_error(L, "invalid color value!");
+}
+
 /* include controls *******************************************************/
 
+#include "thread.inc.c"
 #include "container.inc.c"
 #include "controls.inc.c"
 #include "menu.inc.c"
 #include "text.inc.c"
 #include "draw.inc.c"
+#include "hitindex.inc.c"
 #include "area.inc.c"
+#include "scene.inc.c"
+#include "chart.inc.c"
 #include "dialog.inc.c"
 #include "image.inc.c"
 #include "table.inc.c"
+#include "loop.inc.c"
+#include "worker.inc.c"
+#include "io.inc.c"
 
 /* misc functions  *********************************************************/
 
@@ -881,6 +1081,19 @@ static int lui_finalize(lua_State *L)
 		lua_pushnil(L);
 		lua_settable(L, LUA_REGISTRYINDEX);
 
+		lui_idle_clear(L);
+		lui_messages_close();
+		lui_worker_close();
+
+		/* stop image decoder threads */
+		lui_poolFree(lui_imagePool);
+		lui_imagePool = NULL;
+#ifdef LUI_GTK
+		/* stop tile renderer threads */
+		lui_poolFree(lui_tilePool);
+		lui_tilePool = NULL;
+#endif
+
 		uiUninit();
 	}
 	return 0;
@@ -934,33 +1147,25 @@ static int lui_mainStep(lua_State *L)
  * Name: onnextidle
  * Signature: lui.onnextidle(function)
  * register a function to be called the next time when there are no events
- * pending. This function will only be called once.
+ * pending. This function will only be called once. This is the same as
+ * lui.idle(function), except that the return value of function is ignored.
  */
-static void lui_onNextIdleCallback(void *data)
+static int lui_onNextIdleCall(lua_State *L)
 {
-	DEBUGMSG("lui_onNextIdleCallback");
-	lua_State *L = (lua_State*) data;
-	lua_pushstring(L, LUI_OBJECT_REGISTRY);
-	lua_gettable(L, LUA_REGISTRYINDEX);
-	lua_pushstring(L, "lui_onnextidle");
-	if (lua_gettable(L, -2) != LUA_TNIL) {
-		lua_call(L, 0, 0);
-	}
-	lua_pop(L, 2);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_call(L, 0, 0);
+	return 0;
 }
 
 static int lui_onNextIdle(lua_State *L)
 {
-	if (!lua_isnoneornil(L, 1)) {
-		luaL_checktype(L, 1, LUA_TFUNCTION);
+	if (lua_isnoneornil(L, 1)) {
+		return 0;
 	}
-	lua_pushstring(L, LUI_OBJECT_REGISTRY);
-	lua_gettable(L, LUA_REGISTRYINDEX);
-	lua_pushstring(L, "lui_onnextidle");
+	luaL_checktype(L, 1, LUA_TFUNCTION);
 	lua_pushvalue(L, 1);
-	lua_settable(L, -3);
-	lua_pop(L, 1);
-	uiQueueMain(lui_onNextIdleCallback, L);
+	lua_pushcclosure(L, lui_onNextIdleCall, 1);
+	lui_idle_push(L, lua_gettop(L), 0);
 	return 0;
 }
 
@@ -1075,6 +1280,27 @@ static int lui_errorBox(lua_State *L)
 	return 0;
 }
 
+/*** Function
+ * Name: colorformat
+ * Signature: oldformat = lui.colorformat(format = nil)
+ * set the format colors are returned in. format may be "table", which
+ * returns colors as tables {r = ?, g = ?, b = ?, a = ?}, or "packed",
+ * which returns colors as integers 0xRRGGBBAA, and does not create any
+ * garbage. The default is "table". If format is nil, the format is left
+ * unchanged. Returns the previous format. Wherever a color is accepted, it
+ * may be given as a table, a packed integer, or a string "#rrggbb" or
+ * "#rrggbbaa", regardless of this setting.
+ */
+static int lui_colorFormat(lua_State *L)
+{
+	static const char *const formats[] = { "table", "packed", 0 };
+	lua_pushstring(L, formats[lui_colorPacked]);
+	if (!lua_isnoneornil(L, 1)) {
+		lui_colorPacked = luaL_checkoption(L, 1, 0, formats);
+	}
+	return 1;
+}
+
 /* module function list table
  */
 static const struct luaL_Reg lui_funcs [] ={
@@ -1090,6 +1316,7 @@ static const struct luaL_Reg lui_funcs [] ={
 	{"savefile", lui_saveFile},
 	{"msgbox", lui_msgBox},
 	{"errorbox", lui_errorBox},
+	{"colorformat", lui_colorFormat},
 	{0, 0}
 };
 
@@ -1114,10 +1341,16 @@ int luaopen_lui(lua_State *L)
 	lui_init_menu(L);
 	lui_init_text(L);
 	lui_init_draw(L);
+	lui_init_hitindex(L);
 	lui_init_area(L);
+	lui_init_scene(L);
+	lui_init_chart(L);
 	lui_init_dialog(L);
 	lui_init_image(L);
 	lui_init_table(L);
+	lui_init_loop(L);
+	lui_init_worker(L);
+	lui_init_io(L);
 
 	/* create control registry */
 	lua_newtable(L);
@@ -0,0 +1,24 @@
+/* lui.h
+ *
+ * C API of lui, for native code that needs to talk to the ui thread
+ *
+ * Gunnar Zötl <gz@tset.de>, 2016
+ * Released under MIT/X11 license. See file LICENSE for details.
+ */
+
+#ifndef lui_h
+#define lui_h
+
+#include <stddef.h>
+
+/* lui_post
+ *
+ * post a message of len bytes to the handler registered with lui.onmessage()
+ * on the ui thread, where it arrives as a string. The data is copied, so it
+ * may be reused when this returns. May be called from any thread, after lui
+ * has been loaded. Returns 1 on success, 0 if the message could not be
+ * posted, which includes after lui has been shut down.
+ */
+int lui_post(const void *data, size_t len);
+
+#endif // lui_h
@@ -0,0 +1,36 @@
+require "testing_c_path"
+lui = require "lui"
+
+lui.init()
+
+win = lui.window("Run Test", {
+	onclosing = function() lui.quit() return true end,
+	visible = true
+})
+local label = win:setchild(lui.label("0"))
+
+-- a task that does some work every 100 ms
+local function counter()
+	local n = 0
+	while true do
+		n = n + 1
+		label.text = tostring(n)
+		coroutine.yield(100)
+	end
+end
+
+-- and one that crunches numbers in small chunks, yielding after each one
+local function cruncher()
+	local sum = 0
+	for i = 1, 1e9 do
+		sum = sum + i
+		if i % 10000 == 0 then
+			coroutine.yield()
+		end
+	end
+end
+
+-- run the main loop with the tasks, letting them run for at most 4 ms per
+-- turn of the loop
+local stats = lui.run { budget_ms = 4, tasks = { counter, cruncher } }
+print(string.format("utilization %.2f over %d turns", stats.utilization, stats.turns))
@@ -0,0 +1,34 @@
+require "testing_c_path"
+lui = require "lui"
+
+lui.init()
+
+-- writing to a process that no longer reads its input raises an error,
+-- instead of killing the ui with SIGPIPE
+local left = 2
+local function done()
+	left = left - 1
+	if left == 0 then lui.quit() end
+end
+
+-- the process has exited before it is written to
+lui.spawn("true", {
+	stdin = true,
+	onexit = function(p)
+		print("write after exit:", pcall(p.write, p, "hello\n"))
+		done()
+	end
+})
+
+-- the process exits while most of the input is still queued
+local q = lui.spawn("sh -c 'sleep 0.2; head -c 1'", {
+	stdin = true,
+	onstdout = function() end,
+	onexit = function(p)
+		print("write after queued input:", pcall(p.write, p, "more\n"))
+		done()
+	end
+})
+q:write(string.rep("x", 1024 * 1024))
+
+lui.main()
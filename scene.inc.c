@@ -0,0 +1,601 @@
+/* lui.c
+ *
+ * lua binding to libui (https://github.com/andlabs/libui)
+ *
+ * Gunnar Zötl <gz@tset.de>, 2016
+ * Released under MIT/X11 license. See file LICENSE for details.
+ *
+ * This file is included by lui.c
+ */
+
+/* scene nodes  ************************************************************/
+
+/*** Object
+ * Name: draw.node
+ * a node in a draw.scene. A node draws a path, filled and/or stroked, or a
+ * text layout, or both, transformed by a matrix. Brushes, strokeparams and
+ * the matrix are copied when they are assigned, so they must be assigned
+ * again for changes to them to take effect. Paths and text layouts are
+ * referenced, and must not change while they are used by a node. Changing
+ * a property of a node that is part of a scene displayed in an area only
+ * causes the parts of the area covered by the node before and after the
+ * change to be redrawn.
+ */
+#define LUI_DRAWNODE "lui_drawnode"
+#define lui_pushDrawNode(L) ((lui_sceneNode*)lui_pushObjectSized(L, LUI_DRAWNODE, 1, sizeof(lui_sceneNode)))
+#define lui_checkDrawNode(L, pos) ((lui_sceneNode*)luaL_checkudata(L, pos, LUI_DRAWNODE))
+
+typedef struct {
+	void *object;			/* points to the node itself */
+	lui_scene *scene;
+	unsigned seq;			/* order of insertion into the scene */
+	lui_drawPathObject *path;
+	uiDrawTextLayout *text;
+	double textx, texty, textw, texth;
+	uiDrawBrush fill, stroke;
+	int hasfill, hasstroke;
+	uiDrawStrokeParams sp;
+	uiDrawMatrix m;
+	int hasmatrix;
+	double z;
+	int visible;
+	double bounds[4];		/* in scene coordinates */
+	int empty;
+} lui_sceneNode;
+
+/*** Object
+ * Name: draw.scene
+ * a set of draw.node objects, drawn in order of their z property, and for
+ * equal z in the order they were added. A scene can be displayed in an area
+ * by setting area.scene, or drawn with scene:draw(). Nodes that are
+ * entirely outside of the region being redrawn are skipped.
+ */
+#define LUI_DRAWSCENE "lui_drawscene"
+#define lui_pushDrawScene(L) lui_pushObject(L, LUI_DRAWSCENE, 1)
+#define lui_checkDrawScene(L, pos) ((lui_object*)luaL_checkudata(L, pos, LUI_DRAWSCENE))
+
+struct lui_scene {
+	lui_sceneNode **nodes;
+	int numnodes, maxnodes;
+	int unsorted;
+	unsigned seq;
+	lui_areaObject *area;
+};
+
+static void lui_scenenode_updateBounds(lui_sceneNode *node)
+{
+	double b[4];
+	int empty = 1;
+	if (node->path && !node->path->empty && (node->hasfill || node->hasstroke)) {
+		double w = node->hasstroke ? lui_drawstrokeparams_extent(&node->sp) : 0;
+		b[0] = node->path->bounds[0] - w;
+		b[1] = node->path->bounds[1] - w;
+		b[2] = node->path->bounds[2] + w;
+		b[3] = node->path->bounds[3] + w;
+		empty = 0;
+	}
+	if (node->text) {
+		if (empty) {
+			b[0] = node->textx;
+			b[1] = node->texty;
+			b[2] = node->textx + node->textw;
+			b[3] = node->texty + node->texth;
+			empty = 0;
+		} else {
+			if (node->textx < b[0]) b[0] = node->textx;
+			if (node->texty < b[1]) b[1] = node->texty;
+			if (node->textx + node->textw > b[2]) b[2] = node->textx + node->textw;
+			if (node->texty + node->texth > b[3]) b[3] = node->texty + node->texth;
+		}
+	}
+	node->empty = empty;
+	if (empty) {
+		return;
+	}
+	if (node->hasmatrix) {
+		lui_drawmatrix_bounds(&node->m, b, node->bounds);
+	} else {
+		memcpy(node->bounds, b, sizeof(b));
+	}
+}
+
+/* queue a redraw of the part of the area the node covers */
+static void lui_scenenode_dirty(lui_sceneNode *node)
+{
+	if (node->scene && node->scene->area && node->visible && !node->empty) {
+		/* one pixel more for antialiasing */
+		double *b = node->bounds;
+		lui_areaQueueRedrawRect(node->scene->area, b[0] - 1, b[1] - 1, b[2] - b[0] + 2, b[3] - b[1] + 2);
+	}
+}
+
+static void lui_scenenode_draw(lui_sceneNode *node, uiDrawContext *c)
+{
+	if (node->hasmatrix) {
+		uiDrawSave(c);
+		uiDrawTransform(c, &node->m);
+	}
+	if (node->path) {
+		if (node->hasfill) {
+			uiDrawFill(c, uiDrawPath(node->path->object), &node->fill);
+		}
+		if (node->hasstroke) {
+			uiDrawStroke(c, uiDrawPath(node->path->object), &node->stroke, &node->sp);
+		}
+	}
+	if (node->text) {
+		uiDrawText(c, node->text, node->textx, node->texty);
+	}
+	if (node->hasmatrix) {
+		uiDrawRestore(c);
+	}
+}
+
+static void lui_scene_remove(lui_scene *scene, lui_sceneNode *node)
+{
+	lui_scenenode_dirty(node);
+	for (int i = 0; i < scene->numnodes; ++i) {
+		if (scene->nodes[i] == node) {
+			memmove(&scene->nodes[i], &scene->nodes[i + 1], (scene->numnodes - i - 1) * sizeof(lui_sceneNode*));
+			scene->numnodes -= 1;
+			break;
+		}
+	}
+	node->scene = NULL;
+}
+
+/* set a brush from the value at pos, which may be a draw.brush or nil */
+static void lui_scenenode_setBrush(lua_State *L, uiDrawBrush *brush, int *has, int pos)
+{
+	uiDrawBrush *src = lua_isnil(L, pos) ? NULL : uiDrawBrush(lui_checkDrawBrush(L, pos)->object);
+	if (*has) {
+		free(brush->Stops);
+		*has = 0;
+	}
+	if (src) {
+		if (!lui_drawbrush_copy(brush, src)) {
+			luaL_error(L, "out of memory!");
+		}
+		*has = 1;
+	}
+}
+
+/*** Property
+ * Object: draw.node
+ * Name: path
+ * the draw.path to draw.
+ *** Property
+ * Object: draw.node
+ * Name: fill
+ * the draw.brush to fill the path with, or nil to not fill it.
+ *** Property
+ * Object: draw.node
+ * Name: stroke
+ * the draw.brush to stroke the path with, or nil to not stroke it.
+ *** Property
+ * Object: draw.node
+ * Name: strokeparams
+ * the draw.strokeparams to stroke the path with. Default is a solid line of
+ * thickness 1.
+ *** Property
+ * Object: draw.node
+ * Name: text
+ * a text.layout to draw, or nil.
+ *** Property
+ * Object: draw.node
+ * Name: x
+ * x position of the text. Default is 0.
+ *** Property
+ * Object: draw.node
+ * Name: y
+ * y position of the text. Default is 0.
+ *** Property
+ * Object: draw.node
+ * Name: transform
+ * a draw.matrix to transform the node with, or nil.
+ *** Property
+ * Object: draw.node
+ * Name: z
+ * the z order of the node. Nodes with a higher z are drawn on top of nodes
+ * with a lower z. Default is 0.
+ *** Property
+ * Object: draw.node
+ * Name: visible
+ * whether the node is drawn. Default is true.
+ */
+static int lui_drawnode__index(lua_State *L)
+{
+	lui_sceneNode *node = lui_checkDrawNode(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "path") == 0 || strcmp(what, "text") == 0 || strcmp(what, "fill") == 0 ||
+		strcmp(what, "stroke") == 0 || strcmp(what, "strokeparams") == 0 || strcmp(what, "transform") == 0) {
+		lui_aux_getUservalue(L, 1, what);
+	} else if (strcmp(what, "x") == 0) {
+		lua_pushnumber(L, node->textx);
+	} else if (strcmp(what, "y") == 0) {
+		lua_pushnumber(L, node->texty);
+	} else if (strcmp(what, "z") == 0) {
+		lua_pushnumber(L, node->z);
+	} else if (strcmp(what, "visible") == 0) {
+		lua_pushboolean(L, node->visible);
+	} else {
+		return lui_utility__index(L);
+	}
+	return 1;
+}
+
+static int lui_drawnode__newindex(lua_State *L)
+{
+	lui_sceneNode *node = lui_checkDrawNode(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+	int keep = 0;
+
+	/* mark the old position dirty before anything can raise an error */
+	lui_scenenode_dirty(node);
+	if (strcmp(what, "path") == 0) {
+		node->path = lua_isnil(L, 3) ? NULL : lui_checkDrawPath(L, 3);
+		keep = 1;
+	} else if (strcmp(what, "text") == 0) {
+		node->text = NULL;
+		if (!lua_isnil(L, 3)) {
+			node->text = uiDrawTextLayout(lui_checkTextLayout(L, 3)->object);
+			uiDrawTextLayoutExtents(node->text, &node->textw, &node->texth);
+		}
+		keep = 1;
+	} else if (strcmp(what, "fill") == 0) {
+		lui_scenenode_setBrush(L, &node->fill, &node->hasfill, 3);
+		keep = 1;
+	} else if (strcmp(what, "stroke") == 0) {
+		lui_scenenode_setBrush(L, &node->stroke, &node->hasstroke, 3);
+		keep = 1;
+	} else if (strcmp(what, "strokeparams") == 0) {
+		uiDrawStrokeParams *sp = uiDrawStrokeParams(lui_checkDrawStrokeParams(L, 3)->object);
+		free(node->sp.Dashes);
+		if (!lui_drawstrokeparams_copy(&node->sp, sp)) {
+			return luaL_error(L, "out of memory!");
+		}
+		keep = 1;
+	} else if (strcmp(what, "transform") == 0) {
+		node->hasmatrix = 0;
+		if (!lua_isnil(L, 3)) {
+			node->m = *uiDrawMatrix(lui_checkDrawMatrix(L, 3)->object);
+			node->hasmatrix = 1;
+		}
+		keep = 1;
+	} else if (strcmp(what, "x") == 0) {
+		node->textx = luaL_checknumber(L, 3);
+	} else if (strcmp(what, "y") == 0) {
+		node->texty = luaL_checknumber(L, 3);
+	} else if (strcmp(what, "z") == 0) {
+		node->z = luaL_checknumber(L, 3);
+		if (node->scene) {
+			node->scene->unsorted = 1;
+		}
+	} else if (strcmp(what, "visible") == 0) {
+		node->visible = lua_toboolean(L, 3);
+	} else {
+		return lui_utility__newindex(L);
+	}
+	if (keep) {
+		lui_aux_setUservalue(L, 1, what, 3);
+	}
+	lui_scenenode_updateBounds(node);
+	lui_scenenode_dirty(node);
+	return 0;
+}
+
+static int lui_drawnode__gc(lua_State *L)
+{
+	lui_sceneNode *node = lui_checkDrawNode(L, 1);
+	if (node->object) {
+		DEBUGMSG("lui_drawnode__gc (%s)", lui_debug_controlTostring(L, 1));
+		if (node->scene) {
+			lui_scene_remove(node->scene, node);
+		}
+		if (node->hasfill) {
+			free(node->fill.Stops);
+		}
+		if (node->hasstroke) {
+			free(node->stroke.Stops);
+		}
+		free(node->sp.Dashes);
+		node->hasfill = node->hasstroke = 0;
+		node->sp.Dashes = 0;
+		node->object = 0;
+	}
+	return 0;
+}
+
+/*** Method
+ * Object: draw.node
+ * Name: bounds
+ * Signature: x, y, w, h = node:bounds()
+ * return the bounding box of what the node draws, in scene coordinates.
+ * Returns nothing if the node draws nothing.
+ */
+static int lui_drawNodeBounds(lua_State *L)
+{
+	lui_sceneNode *node = lui_checkDrawNode(L, 1);
+	if (node->empty) {
+		return 0;
+	}
+	lua_pushnumber(L, node->bounds[0]);
+	lua_pushnumber(L, node->bounds[1]);
+	lua_pushnumber(L, node->bounds[2] - node->bounds[0]);
+	lua_pushnumber(L, node->bounds[3] - node->bounds[1]);
+	return 4;
+}
+
+/*** Constructor
+ * Object: draw.node
+ * Name: draw.node
+ * Signature: node = lui.draw.node(properties = nil)
+ * create a new draw.node object.
+ */
+static int lui_newDrawNode(lua_State *L)
+{
+	int hastable = lui_aux_istable(L, 1);
+
+	lui_sceneNode *node = lui_pushDrawNode(L);
+	node->object = node;
+	node->visible = 1;
+	node->empty = 1;
+	node->sp.Thickness = 1;
+	node->sp.MiterLimit = uiDrawDefaultMiterLimit;
+	if (hastable) { lui_aux_setFieldsFromTable(L, lua_gettop(L), 1); }
+	lui_registerObject(L, lua_gettop(L));
+	return 1;
+}
+
+/* metamethods for draw.node */
+static const luaL_Reg lui_drawnode_meta[] = {
+	{"__gc", lui_drawnode__gc},
+	{"__index", lui_drawnode__index},
+	{"__newindex", lui_drawnode__newindex},
+	{0, 0}
+};
+
+/* methods for draw.node */
+static const luaL_Reg lui_drawnode_methods[] = {
+	{"bounds", lui_drawNodeBounds},
+	{0, 0}
+};
+
+/* scenes  *****************************************************************/
+
+static int lui_scene_compareNodes(const void *a, const void *b)
+{
+	const lui_sceneNode *na = *(const lui_sceneNode**) a;
+	const lui_sceneNode *nb = *(const lui_sceneNode**) b;
+	if (na->z != nb->z) {
+		return na->z < nb->z ? -1 : 1;
+	}
+	return na->seq < nb->seq ? -1 : na->seq > nb->seq;
+}
+
+/* lui_scene_draw
+ *
+ * draw all visible nodes of a scene that intersect the clip rectangle of
+ * the context.
+ */
+static void lui_scene_draw(lui_scene *scene, lui_drawContextObject *ctx)
+{
+	if (scene->unsorted) {
+		qsort(scene->nodes, scene->numnodes, sizeof(lui_sceneNode*), lui_scene_compareNodes);
+		scene->unsorted = 0;
+	}
+	uiDrawContext *c = uiDrawContext(ctx->object);
+	for (int i = 0; i < scene->numnodes; ++i) {
+		lui_sceneNode *node = scene->nodes[i];
+		if (node->visible && !node->empty && lui_drawcontext_visible(ctx, node->bounds)) {
+			lui_scenenode_draw(node, c);
+		}
+	}
+}
+
+/* lui_area_setScene
+ *
+ * display the scene at stack position pos in an area. If pos is 0 or the
+ * value is nil, the area's scene is removed.
+ */
+static void lui_area_setScene(lua_State *L, lui_areaObject *area, int pos)
+{
+	lui_scene *scene = NULL;
+	if (pos && !lua_isnil(L, pos)) {
+		scene = (lui_scene*) lui_checkDrawScene(L, pos)->object;
+	}
+	if (area->scene) {
+		area->scene->area = NULL;
+		area->scene = NULL;
+	}
+	if (scene) {
+		if (scene->area) {
+			lui_areaObject *other = scene->area;
+			other->scene = NULL;
+			lui_areaQueueRedrawAll(other);
+		}
+		scene->area = area;
+		area->scene = scene;
+	}
+	if (pos) {
+		lui_aux_setUservalue(L, 1, "scene", pos);
+	}
+	lui_areaQueueRedrawAll(area);
+}
+
+static int lui_drawscene__gc(lua_State *L)
+{
+	lui_object *lobj = lui_checkDrawScene(L, 1);
+	if (lobj->object) {
+		DEBUGMSG("lui_drawscene__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_scene *scene = (lui_scene*) lobj->object;
+		for (int i = 0; i < scene->numnodes; ++i) {
+			scene->nodes[i]->scene = NULL;
+		}
+		if (scene->area) {
+			scene->area->scene = NULL;
+		}
+		free(scene->nodes);
+		free(scene);
+		lobj->object = 0;
+	}
+	return 0;
+}
+
+static int lui_drawscene__len(lua_State *L)
+{
+	lui_scene *scene = (lui_scene*) lui_checkDrawScene(L, 1)->object;
+	lua_pushinteger(L, scene->numnodes);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.scene
+ * Name: add
+ * Signature: node = scene:add(node)
+ * add a draw.node to the scene. A node can only be part of one scene at a
+ * time. Returns the node.
+ */
+static int lui_drawSceneAdd(lua_State *L)
+{
+	lui_scene *scene = (lui_scene*) lui_checkDrawScene(L, 1)->object;
+	lui_sceneNode *node = lui_checkDrawNode(L, 2);
+	lua_settop(L, 2);
+	if (node->scene == scene) {
+		return 1;
+	} else if (node->scene) {
+		return luaL_error(L, "node is already part of another scene!");
+	}
+	if (scene->numnodes == scene->maxnodes) {
+		int max = scene->maxnodes ? scene->maxnodes * 2 : 16;
+		lui_sceneNode **nodes = realloc(scene->nodes, max * sizeof(lui_sceneNode*));
+		if (!nodes) {
+			return luaL_error(L, "out of memory!");
+		}
+		scene->nodes = nodes;
+		scene->maxnodes = max;
+	}
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, 2);
+	lua_pushboolean(L, 1);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+	node->scene = scene;
+	node->seq = scene->seq++;
+	scene->nodes[scene->numnodes++] = node;
+	if (scene->numnodes > 1 && lui_scene_compareNodes(&scene->nodes[scene->numnodes - 2], &node) > 0) {
+		scene->unsorted = 1;
+	}
+	lui_scenenode_dirty(node);
+	return 1;
+}
+
+/*** Method
+ * Object: draw.scene
+ * Name: remove
+ * Signature: scene:remove(node)
+ * remove a draw.node from the scene.
+ */
+static int lui_drawSceneRemove(lua_State *L)
+{
+	lui_scene *scene = (lui_scene*) lui_checkDrawScene(L, 1)->object;
+	lui_sceneNode *node = lui_checkDrawNode(L, 2);
+	if (node->scene != scene) {
+		return 0;
+	}
+	lui_scene_remove(scene, node);
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, 2);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	return 0;
+}
+
+/*** Method
+ * Object: draw.scene
+ * Name: clear
+ * Signature: scene:clear()
+ * remove all nodes from the scene.
+ */
+static int lui_drawSceneClear(lua_State *L)
+{
+	lui_scene *scene = (lui_scene*) lui_checkDrawScene(L, 1)->object;
+	for (int i = 0; i < scene->numnodes; ++i) {
+		scene->nodes[i]->scene = NULL;
+	}
+	scene->numnodes = 0;
+	lua_newtable(L);
+	lua_setuservalue(L, 1);
+	if (scene->area) {
+		lui_areaQueueRedrawAll(scene->area);
+	}
+	return 0;
+}
+
+/*** Method
+ * Object: draw.scene
+ * Name: draw
+ * Signature: scene:draw(context)
+ * draw the scene to a draw.context, for example to draw it in the ondraw
+ * handler of an area it is not attached to.
+ */
+static int lui_drawSceneDraw(lua_State *L)
+{
+	lui_scene *scene = (lui_scene*) lui_checkDrawScene(L, 1)->object;
+	lui_drawContextObject *ctx = lui_checkDrawContext(L, 2);
+	lui_scene_draw(scene, ctx);
+	return 0;
+}
+
+/*** Constructor
+ * Object: draw.scene
+ * Name: draw.scene
+ * Signature: scene = lui.draw.scene()
+ * create a new, empty draw.scene object.
+ */
+static int lui_newDrawScene(lua_State *L)
+{
+	lui_object *lobj = lui_pushDrawScene(L);
+	lobj->object = calloc(1, sizeof(lui_scene));
+	if (!lobj->object) {
+		return luaL_error(L, "out of memory!");
+	}
+	lui_registerObject(L, lua_gettop(L));
+	return 1;
+}
+
+/* metamethods for draw.scene */
+static const luaL_Reg lui_drawscene_meta[] = {
+	{"__gc", lui_drawscene__gc},
+	{"__len", lui_drawscene__len},
+	{0, 0}
+};
+
+/* methods for draw.scene */
+static const luaL_Reg lui_drawscene_methods[] = {
+	{"add", lui_drawSceneAdd},
+	{"remove", lui_drawSceneRemove},
+	{"clear", lui_drawSceneClear},
+	{"draw", lui_drawSceneDraw},
+	{0, 0}
+};
+
+static const struct luaL_Reg lui_scene_funcs [] ={
+	{"node", lui_newDrawNode},
+	{"scene", lui_newDrawScene},
+	{0, 0}
+};
+
+static int lui_init_scene(lua_State *L)
+{
+	/* the constructors go into lui.draw */
+	lua_getfield(L, -1, "draw");
+	luaL_setfuncs(L, lui_scene_funcs, 0);
+	lua_pop(L, 1);
+
+	lui_add_utility_type(L, LUI_DRAWNODE, lui_drawnode_methods, lui_drawnode_meta);
+	lui_add_utility_type(L, LUI_DRAWSCENE, lui_drawscene_methods, lui_drawscene_meta);
+
+	return 1;
+}
@@ -26,6 +26,7 @@ static int lui_tablemodel__gc(lua_State *L)
 	lui_object *lobj = lui_checkTableModel(L, 1);
 	if (lobj->object) {
 		DEBUGMSG("lui_tablemodel__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_imagesource_forgetModel(uiTableModel(lobj->object));
 		uiFreeTableModel(uiTableModel(lobj->object));
 		lobj->object = 0;
 	}
@@ -85,14 +86,6 @@ static int lui_tablemodel_row_deleted(lua_State *L)
 	return 0;
 }
 
-/* methods for tablemodel */
-static const luaL_Reg lui_tablemodel_methods[] = {
-	{"row_inserted", lui_tablemodel_row_inserted},
-	{"row_changed", lui_tablemodel_row_changed},
-	{"row_deleted", lui_tablemodel_row_deleted},
-	{0, 0}
-};
-
 /* lui control registry handling
  */
 static int lui_registerTableModel(lua_State *L, int pos)
@@ -164,11 +157,9 @@ typedef enum {
 	lui_TableValueTypeColor,
 } lui_TableValueType;
 
-static lui_TableValueType lui_tablemodelhandler_rawcolumntype(uiTableModelHandler *tmh, uiTableModel *tm, int col)
+static lui_TableValueType lui_tablemodel_rawcolumntype(lua_State *L, uiTableModel *tm, int col)
 {
-	DEBUGMSG("lui_tablemodelhandler_rawcolumntype called for col %d", col);
-	uiTableValueType res = lui_TableValueTypeNull;
-	lua_State *L = ((struct myUiTableModelHandler*)tmh)->L;
+	lui_TableValueType res = lui_TableValueTypeNull;
 	if (lui_findTableModel(L, tm) != LUA_TNIL) {
 		if (lui_aux_getUservalue(L, -1, "columntype") != LUA_TTABLE) {
 			lua_pop(L, 1);
@@ -210,10 +201,15 @@ static lui_TableValueType lui_tablemodelhandler_rawcolumntype(uiTableModelHandle
 	return res;
 }
 
-static uiTableValueType lui_tablemodelhandler_columntype(uiTableModelHandler *tmh, uiTableModel *tm, int col)
+static lui_TableValueType lui_tablemodelhandler_rawcolumntype(uiTableModelHandler *tmh, uiTableModel *tm, int col)
+{
+	DEBUGMSG("lui_tablemodelhandler_rawcolumntype called for col %d", col);
+	lua_State *L = ((struct myUiTableModelHandler*)tmh)->L;
+	return lui_tablemodel_rawcolumntype(L, tm, col);
+}
+
+static uiTableValueType lui_tablemodel_uitype(lui_TableValueType raw)
 {
-	DEBUGMSG("lui_tablemodelhandler_columntype called for col %d", col);
-	lui_TableValueType raw = lui_tablemodelhandler_rawcolumntype(tmh, tm, col);
 	uiTableValueType res = uiTableValueTypeString;
 	switch (raw) {
 		case lui_TableValueTypeNull:
@@ -234,6 +230,12 @@ static uiTableValueType lui_tablemodelhandler_columntype(uiTableModelHandler *tm
 	return res;
 }
 
+static uiTableValueType lui_tablemodelhandler_columntype(uiTableModelHandler *tmh, uiTableModel *tm, int col)
+{
+	DEBUGMSG("lui_tablemodelhandler_columntype called for col %d", col);
+	return lui_tablemodel_uitype(lui_tablemodelhandler_rawcolumntype(tmh, tm, col));
+}
+
 static uiTableValue *lui_tablemodel_totablevaluestring(lua_State *L, int pos)
 {
 	if (pos < 0) {
@@ -247,6 +249,17 @@ static uiTableValue *lui_tablemodel_totablevaluestring(lua_State *L, int pos)
 	return res;
 }
 
+static lui_imageSource *lui_tablemodel_imagesource(lua_State *L, uiTableModel *tm)
+{
+	lui_imageSource *src = NULL;
+	lui_findTableModel(L, tm);
+	if (lui_aux_getUservalue(L, -1, "imagesource") == LUA_TUSERDATA) {
+		src = (lui_imageSource*) lui_checkImageSource(L, -1)->object;
+	}
+	lua_pop(L, 2);
+	return src;
+}
+
 static uiTableValue *lui_tablemodelhandler_cellvalue(uiTableModelHandler *tmh, uiTableModel *tm, int row, int col)
 {
 	DEBUGMSG("lui_tablemodelhandler_cellvalue called for row %d col %d", row, col);
@@ -274,6 +287,10 @@ static uiTableValue *lui_tablemodelhandler_cellvalue(uiTableModelHandler *tmh, u
 					res = uiNewTableValueInt(lua_tointeger(L, -1));
 				} else if (vtype == uiTableValueTypeString) {
 					res = uiNewTableValueString(lua_tostring(L, -1));
+				} else if (vtype == uiTableValueTypeColor) {
+					double r, g, b, a;
+					lui_aux_rgbaFromValue(L, -1, &r, &g, &b, &a);
+					res = uiNewTableValueColor(r, g, b, a);
 				} else {
 					puts("Error!\n");// TODO error
 				}
@@ -300,6 +317,20 @@ static uiTableValue *lui_tablemodelhandler_cellvalue(uiTableModelHandler *tmh, u
 				}
 				break;
 			case LUA_TSTRING:
+				if (vtype == uiTableValueTypeImage) {
+					lui_imageSource *src = lui_tablemodel_imagesource(L, tm);
+					if (!src) {
+						luaL_error(L, "cellvalue returned an image name for column %d, but the tablemodel has no imagesource!", col);
+					}
+					res = uiNewTableValueImage(lui_imagesource_get(src, lua_tostring(L, -1), tmh, tm, row));
+					break;
+				} else if (vtype == uiTableValueTypeColor) {
+					double r, g, b, a;
+					lui_aux_rgbaFromValue(L, -1, &r, &g, &b, &a);
+					res = uiNewTableValueColor(r, g, b, a);
+					break;
+				}
+				/* fallthrough */
 			default:
 				if (vtype == uiTableValueTypeString) {
 					res = lui_tablemodel_totablevaluestring(L, -1);
@@ -408,7 +439,10 @@ static int lui_checkHandlerTable(lua_State *L, int pos)
  *		must return the data in row, col. The data must correspond to the
  *		type returned by columntype for this column, except in the case of
  *		string. Anything will be converted to it's string representation
- *		for string type columns.
+ *		for string type columns. If the model has an image source, see
+ *		setimagesource(), image columns may also return file names, which
+ *		is an error without one. Color columns may return any color value,
+ *		see lui.colorformat().
  *	setcellvalue(row, col, val)
  *		must set the data in row, col to value val.
  */
@@ -438,6 +472,762 @@ static int lui_newTableModel(lua_State *L)
 	return  1;
 }
 
+/* tablemodel snapshots *****************************************************/
+
+/* A snapshot file has this layout, all integers in native byte order and all
+ * blocks aligned to 8 bytes, so that a mapped file can be used in place:
+ *
+ *	header
+ *	column directory, one lui_snapshotColumnHeader per column
+ *	column blocks
+ *	string dictionary
+ *
+ * A raw column block is an array of numrows values. A run length encoded
+ * block is a uint64_t run count n, followed by n uint64_t run ends (the
+ * index of the first row after the run) and n values. The string dictionary
+ * is a uint64_t string count n, followed by n + 1 uint64_t offsets into the
+ * string bytes and the 0-terminated strings themselves. String cells are
+ * stored as uint32_t dictionary indices, integer cells as int32_t, boolean
+ * cells as uint8_t and colors as 4 floats r, g, b, a.
+ */
+#define LUI_SNAPSHOT_MAGIC "LUISNAP"
+#define LUI_SNAPSHOT_VERSION 1
+#define LUI_SNAPSHOT_BYTEORDER 0x01020304
+#define LUI_TABLESNAPSHOT "lui_tablesnapshot"
+#define LUI_SNAPSHOTWRITER "lui_snapshotwriter"
+
+#define lui_snapshotAlign(n) (((n) + 7) & ~((uint64_t)7))
+
+typedef enum {
+	lui_SnapshotEncodingRaw,
+	lui_SnapshotEncodingRle,
+} lui_SnapshotEncoding;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint64_t numrows;
+	uint32_t numcolumns;
+	uint32_t reserved;
+	uint64_t dictoffset;
+	uint64_t dictsize;
+} lui_snapshotHeader;
+
+typedef struct {
+	uint32_t type;
+	uint32_t encoding;
+	uint64_t offset;
+	uint64_t size;
+} lui_snapshotColumnHeader;
+
+typedef struct {
+	lui_TableValueType type;
+	lui_SnapshotEncoding encoding;
+	const unsigned char *values;
+	uint64_t numruns;
+	const uint64_t *runends;
+	uint64_t lastrun;
+} lui_snapshotColumn;
+
+/* handler must be the first member, the model handler callbacks cast their
+ * uiTableModelHandler* back to the snapshot.
+ */
+typedef struct {
+	struct uiTableModelHandler handler;
+	unsigned char *map;
+	size_t mapsize;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+	uint64_t numrows;
+	uint32_t numcolumns;
+	lui_snapshotColumn *columns;
+	uint64_t numstrings;
+	const uint64_t *stroffsets;
+	const char *strbytes;
+	uint64_t strsize;
+} lui_tablesnapshot;
+
+static size_t lui_snapshotValueSize(lui_TableValueType type)
+{
+	switch (type) {
+		case lui_TableValueTypeString:
+			return sizeof(uint32_t);
+		case lui_TableValueTypeInt:
+			return sizeof(int32_t);
+		case lui_TableValueTypeBool:
+			return sizeof(uint8_t);
+		case lui_TableValueTypeColor:
+			return 4 * sizeof(float);
+		default:
+			return 0;
+	}
+}
+
+static const unsigned char *lui_tablesnapshot_value(lui_snapshotColumn *col, uint64_t row)
+{
+	size_t vsize = lui_snapshotValueSize(col->type);
+	if (col->encoding == lui_SnapshotEncodingRaw) {
+		return col->values + row * vsize;
+	}
+	/* runs are mostly visited in order, so try the last one first */
+	uint64_t run = col->lastrun;
+	if (run >= col->numruns || row >= col->runends[run] || (run > 0 && row < col->runends[run - 1])) {
+		uint64_t lo = 0, hi = col->numruns;
+		while (lo < hi) {
+			uint64_t mid = lo + (hi - lo) / 2;
+			if (col->runends[mid] <= row) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		run = lo < col->numruns ? lo : col->numruns - 1;
+		col->lastrun = run;
+	}
+	return col->values + run * vsize;
+}
+
+static const char *lui_tablesnapshot_string(lui_tablesnapshot *snap, uint32_t idx)
+{
+	if (idx >= snap->numstrings) {
+		return "";
+	}
+	uint64_t start = snap->stroffsets[idx];
+	uint64_t end = snap->stroffsets[idx + 1];
+	/* the file may not be trusted, so check the string before handing it out */
+	if (start >= end || end > snap->strsize || snap->strbytes[end - 1] != 0) {
+		return "";
+	}
+	return snap->strbytes + start;
+}
+
+static int lui_tablesnapshot_numcolumns(uiTableModelHandler *tmh, uiTableModel *tm)
+{
+	return ((lui_tablesnapshot*)tmh)->numcolumns;
+}
+
+static int lui_tablesnapshot_numrows(uiTableModelHandler *tmh, uiTableModel *tm)
+{
+	return ((lui_tablesnapshot*)tmh)->numrows;
+}
+
+static uiTableValueType lui_tablesnapshot_columntype(uiTableModelHandler *tmh, uiTableModel *tm, int col)
+{
+	lui_tablesnapshot *snap = (lui_tablesnapshot*)tmh;
+	if (col < 0 || col >= snap->numcolumns) {
+		return uiTableValueTypeString;
+	}
+	return lui_tablemodel_uitype(snap->columns[col].type);
+}
+
+static uiTableValue *lui_tablesnapshot_cellvalue(uiTableModelHandler *tmh, uiTableModel *tm, int row, int col)
+{
+	lui_tablesnapshot *snap = (lui_tablesnapshot*)tmh;
+	if (col < 0 || col >= snap->numcolumns || row < 0 || row >= snap->numrows) {
+		return uiNewTableValueString("");
+	}
+	lui_snapshotColumn *column = &snap->columns[col];
+	const unsigned char *v = lui_tablesnapshot_value(column, row);
+	switch (column->type) {
+		case lui_TableValueTypeInt:
+			return uiNewTableValueInt(*(const int32_t*)v);
+		case lui_TableValueTypeBool:
+			return uiNewTableValueInt(*v != 0);
+		case lui_TableValueTypeColor:
+			{
+				const float *c = (const float*)v;
+				return uiNewTableValueColor(c[0], c[1], c[2], c[3]);
+			}
+		default:
+			return uiNewTableValueString(lui_tablesnapshot_string(snap, *(const uint32_t*)v));
+	}
+}
+
+static void lui_tablesnapshot_setcellvalue(uiTableModelHandler *tmh, uiTableModel *tm, int row, int col, const uiTableValue *tv)
+{
+	/* snapshots are read only */
+}
+
+static void lui_tablesnapshot_unmap(lui_tablesnapshot *snap)
+{
+	if (!snap->map) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(snap->map);
+	CloseHandle(snap->mapping);
+	CloseHandle(snap->file);
+#else
+	munmap(snap->map, snap->mapsize);
+#endif
+	snap->map = 0;
+}
+
+static int lui_tablesnapshot_map(lui_tablesnapshot *snap, const char *filename)
+{
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	snap->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (snap->file == INVALID_HANDLE_VALUE) {
+		return 0;
+	}
+	if (!GetFileSizeEx(snap->file, &size) || size.QuadPart == 0) {
+		CloseHandle(snap->file);
+		return 0;
+	}
+	snap->mapping = CreateFileMappingA(snap->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!snap->mapping) {
+		CloseHandle(snap->file);
+		return 0;
+	}
+	snap->map = MapViewOfFile(snap->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!snap->map) {
+		CloseHandle(snap->mapping);
+		CloseHandle(snap->file);
+		return 0;
+	}
+	snap->mapsize = size.QuadPart;
+#else
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+	snap->map = map;
+	snap->mapsize = st.st_size;
+#endif
+	return 1;
+}
+
+/* checks that size bytes starting at offset lie within the mapped file */
+#define lui_snapshotInFile(snap, offset, size) ((offset) <= (snap)->mapsize && (size) <= (snap)->mapsize - (offset))
+
+static const char *lui_tablesnapshot_setup(lui_tablesnapshot *snap)
+{
+	const lui_snapshotHeader *hdr = (const lui_snapshotHeader*)snap->map;
+	if (snap->mapsize < sizeof(lui_snapshotHeader) || memcmp(hdr->magic, LUI_SNAPSHOT_MAGIC, sizeof(LUI_SNAPSHOT_MAGIC)) != 0) {
+		return "not a table snapshot";
+	}
+	if (hdr->version != LUI_SNAPSHOT_VERSION) {
+		return "unsupported snapshot version";
+	}
+	if (hdr->byteorder != LUI_SNAPSHOT_BYTEORDER) {
+		return "snapshot was written on a machine with a different byte order";
+	}
+	if (hdr->numrows > INT_MAX || hdr->numcolumns > INT_MAX / sizeof(lui_snapshotColumnHeader)) {
+		return "snapshot is too large";
+	}
+	snap->numrows = hdr->numrows;
+	snap->numcolumns = hdr->numcolumns;
+
+	if (!lui_snapshotInFile(snap, hdr->dictoffset, hdr->dictsize) || hdr->dictsize < 2 * sizeof(uint64_t) || (hdr->dictoffset & 7)) {
+		return "invalid string dictionary";
+	}
+	const uint64_t *dict = (const uint64_t*)(snap->map + hdr->dictoffset);
+	snap->numstrings = dict[0];
+	if (snap->numstrings > (hdr->dictsize / sizeof(uint64_t)) - 2) {
+		return "invalid string dictionary";
+	}
+	snap->stroffsets = dict + 1;
+	snap->strbytes = (const char*)(snap->stroffsets + snap->numstrings + 1);
+	snap->strsize = hdr->dictsize - (snap->numstrings + 2) * sizeof(uint64_t);
+
+	const lui_snapshotColumnHeader *chdr = (const lui_snapshotColumnHeader*)(hdr + 1);
+	if (!lui_snapshotInFile(snap, sizeof(lui_snapshotHeader), snap->numcolumns * sizeof(lui_snapshotColumnHeader))) {
+		return "invalid column directory";
+	}
+	snap->columns = calloc(snap->numcolumns ? snap->numcolumns : 1, sizeof(lui_snapshotColumn));
+	if (!snap->columns) {
+		return "out of memory";
+	}
+	for (uint32_t i = 0; i < snap->numcolumns; ++i) {
+		lui_snapshotColumn *col = &snap->columns[i];
+		col->type = chdr[i].type;
+		col->encoding = chdr[i].encoding;
+		size_t vsize = lui_snapshotValueSize(col->type);
+		if (vsize == 0 || !lui_snapshotInFile(snap, chdr[i].offset, chdr[i].size) || (chdr[i].offset & 7)) {
+			return "invalid column block";
+		}
+		const unsigned char *block = snap->map + chdr[i].offset;
+		if (col->encoding == lui_SnapshotEncodingRaw) {
+			if (chdr[i].size < snap->numrows * vsize) {
+				return "invalid column block";
+			}
+			col->values = block;
+		} else if (col->encoding == lui_SnapshotEncodingRle) {
+			if (chdr[i].size < sizeof(uint64_t)) {
+				return "invalid column block";
+			}
+			col->numruns = *(const uint64_t*)block;
+			if (col->numruns > (chdr[i].size - sizeof(uint64_t)) / (sizeof(uint64_t) + vsize)) {
+				return "invalid column block";
+			}
+			if (snap->numrows > 0 && (col->numruns == 0 || ((const uint64_t*)block)[col->numruns] < snap->numrows)) {
+				return "invalid column block";
+			}
+			col->runends = (const uint64_t*)block + 1;
+			col->values = (const unsigned char*)(col->runends + col->numruns);
+		} else {
+			return "unsupported column encoding";
+		}
+	}
+	return NULL;
+}
+
+static int lui_tablesnapshot__gc(lua_State *L)
+{
+	lui_object *lobj = (lui_object*)luaL_checkudata(L, 1, LUI_TABLESNAPSHOT);
+	if (lobj->object) {
+		DEBUGMSG("lui_tablesnapshot__gc (%s)", lui_debug_controlTostring(L, 1));
+		lui_tablesnapshot *snap = (lui_tablesnapshot*)lobj->object;
+		lui_tablesnapshot_unmap(snap);
+		free(snap->columns);
+		free(snap);
+		lobj->object = 0;
+	}
+	return 0;
+}
+
+/* metamethods for tablesnapshot */
+static const luaL_Reg lui_tablesnapshot_meta[] = {
+	{"__gc", lui_tablesnapshot__gc},
+	{0, 0}
+};
+
+/* snapshot writer. This is a userdata so that the buffers get freed if a
+ * cellvalue() handler throws an error while the data is collected.
+ */
+typedef struct {
+	char *bytes;
+	size_t numbytes;
+	size_t bytescap;
+	uint64_t *offsets;
+	size_t numstrings;
+	size_t offsetscap;
+	uint32_t *slots;
+	size_t numslots;
+} lui_snapshotWriter;
+
+static void lui_snapshotwriter_free(lui_snapshotWriter *w)
+{
+	free(w->bytes);
+	free(w->offsets);
+	free(w->slots);
+	memset(w, 0, sizeof(lui_snapshotWriter));
+}
+
+static int lui_snapshotwriter__gc(lua_State *L)
+{
+	lui_snapshotwriter_free((lui_snapshotWriter*)luaL_checkudata(L, 1, LUI_SNAPSHOTWRITER));
+	return 0;
+}
+
+static uint32_t lui_snapshotHash(const char *str, size_t len)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; ++i) {
+		h = (h ^ (unsigned char)str[i]) * 16777619u;
+	}
+	return h;
+}
+
+static int lui_snapshotwriter_rehash(lui_snapshotWriter *w, size_t numslots)
+{
+	uint32_t *slots = calloc(numslots, sizeof(uint32_t));
+	if (!slots) {
+		return 0;
+	}
+	for (size_t i = 0; i < w->numstrings; ++i) {
+		const char *s = w->bytes + w->offsets[i];
+		size_t len = w->offsets[i + 1] - w->offsets[i] - 1;
+		size_t slot = lui_snapshotHash(s, len) & (numslots - 1);
+		while (slots[slot]) {
+			slot = (slot + 1) & (numslots - 1);
+		}
+		slots[slot] = i + 1;
+	}
+	free(w->slots);
+	w->slots = slots;
+	w->numslots = numslots;
+	return 1;
+}
+
+static uint32_t lui_snapshotwriter_intern(lua_State *L, lui_snapshotWriter *w, const char *str, size_t len)
+{
+	if (w->numstrings * 2 >= w->numslots) {
+		if (!lui_snapshotwriter_rehash(w, w->numslots ? w->numslots * 2 : 1024)) {
+			luaL_error(L, "out of memory!");
+		}
+	}
+	size_t slot = lui_snapshotHash(str, len) & (w->numslots - 1);
+	while (w->slots[slot]) {
+		uint32_t idx = w->slots[slot] - 1;
+		size_t ilen = w->offsets[idx + 1] - w->offsets[idx] - 1;
+		if (ilen == len && memcmp(w->bytes + w->offsets[idx], str, len) == 0) {
+			return idx;
+		}
+		slot = (slot + 1) & (w->numslots - 1);
+	}
+	if (w->numstrings + 2 > w->offsetscap) {
+		size_t cap = w->offsetscap ? w->offsetscap * 2 : 1024;
+		uint64_t *offsets = realloc(w->offsets, cap * sizeof(uint64_t));
+		if (!offsets) {
+			luaL_error(L, "out of memory!");
+		}
+		w->offsets = offsets;
+		w->offsetscap = cap;
+	}
+	if (w->numbytes + len + 1 > w->bytescap) {
+		size_t cap = w->bytescap ? w->bytescap : 4096;
+		while (cap < w->numbytes + len + 1) {
+			cap *= 2;
+		}
+		char *bytes = realloc(w->bytes, cap);
+		if (!bytes) {
+			luaL_error(L, "out of memory!");
+		}
+		w->bytes = bytes;
+		w->bytescap = cap;
+	}
+	memcpy(w->bytes + w->numbytes, str, len);
+	w->bytes[w->numbytes + len] = 0;
+	w->offsets[w->numstrings] = w->numbytes;
+	w->numbytes += len + 1;
+	w->offsets[w->numstrings + 1] = w->numbytes;
+	w->slots[slot] = w->numstrings + 1;
+	return w->numstrings++;
+}
+
+/* fetch one cell of a lua backed model, the cellvalue handler is on top of
+ * the stack and stays there.
+ */
+static void lui_snapshotwriter_fetchlua(lua_State *L, lui_snapshotWriter *w, lui_TableValueType type, int row, int col, unsigned char *dst)
+{
+	lua_pushvalue(L, -1);
+	lua_pushinteger(L, row + 1);
+	lua_pushinteger(L, col);
+	lua_call(L, 2, 1);
+	switch (type) {
+		case lui_TableValueTypeInt:
+			*(int32_t*)dst = lua_tointeger(L, -1);
+			break;
+		case lui_TableValueTypeBool:
+			*dst = lua_toboolean(L, -1);
+			break;
+		case lui_TableValueTypeColor:
+			{
+				double r = 0, g = 0, b = 0, a = 0;
+				if (!lua_isnil(L, -1)) {
+					lui_aux_rgbaFromValue(L, -1, &r, &g, &b, &a);
+				}
+				float *c = (float*)dst;
+				c[0] = r; c[1] = g; c[2] = b; c[3] = a;
+			}
+			break;
+		default:
+			{
+				size_t len;
+				const char *str = luaL_tolstring(L, -1, &len);
+				*(uint32_t*)dst = lui_snapshotwriter_intern(L, w, str, len);
+				lua_pop(L, 1);
+			}
+			break;
+	}
+	lua_pop(L, 1);
+}
+
+static void lui_snapshotwriter_fetchsnapshot(lua_State *L, lui_snapshotWriter *w, lui_tablesnapshot *snap, int row, int col, unsigned char *dst)
+{
+	lui_snapshotColumn *column = &snap->columns[col];
+	const unsigned char *v = lui_tablesnapshot_value(column, row);
+	if (column->type == lui_TableValueTypeString) {
+		const char *str = lui_tablesnapshot_string(snap, *(const uint32_t*)v);
+		*(uint32_t*)dst = lui_snapshotwriter_intern(L, w, str, strlen(str));
+	} else {
+		memcpy(dst, v, lui_snapshotValueSize(column->type));
+	}
+}
+
+static uint64_t lui_snapshotCountRuns(const unsigned char *values, uint64_t numrows, size_t vsize)
+{
+	uint64_t runs = numrows > 0;
+	for (uint64_t i = 1; i < numrows; ++i) {
+		if (memcmp(values + (i - 1) * vsize, values + i * vsize, vsize) != 0) {
+			++runs;
+		}
+	}
+	return runs;
+}
+
+static int lui_snapshotWritePadded(FILE *f, const void *data, size_t size)
+{
+	static const char zeros[8] = { 0 };
+	if (size > 0 && fwrite(data, 1, size, f) != size) {
+		return 0;
+	}
+	size_t pad = lui_snapshotAlign(size) - size;
+	return pad == 0 || fwrite(zeros, 1, pad, f) == pad;
+}
+
+static int lui_snapshotWriteRle(FILE *f, const unsigned char *values, uint64_t numrows, size_t vsize, uint64_t numruns)
+{
+	uint64_t *runends = malloc((numruns + 1) * sizeof(uint64_t));
+	unsigned char *runvalues = malloc(numruns * vsize + 1);
+	if (!runends || !runvalues) {
+		free(runends);
+		free(runvalues);
+		return 0;
+	}
+	uint64_t run = 0;
+	runends[0] = numruns;
+	for (uint64_t i = 0; i < numrows; ++i) {
+		if (i == 0 || memcmp(values + (i - 1) * vsize, values + i * vsize, vsize) != 0) {
+			memcpy(runvalues + run * vsize, values + i * vsize, vsize);
+			++run;
+		}
+		runends[run] = i + 1;
+	}
+	int ok = fwrite(runends, sizeof(uint64_t), numruns + 1, f) == numruns + 1 &&
+		lui_snapshotWritePadded(f, runvalues, numruns * vsize);
+	free(runends);
+	free(runvalues);
+	return ok;
+}
+
+/*** Method
+ * Object: tablemodel
+ * Name: save
+ * Signature: ok, err = mdl:save(filename, compress = true)
+ * write all data of the table model to a binary snapshot file, from where
+ * it can be loaded with lui.loadmodel(). Strings are stored once in a
+ * dictionary. If compress is true, columns with many repeated values are
+ * stored run length encoded, which does not hurt loading speed. Image
+ * columns can not be saved. Returns true on success, or nil and an error
+ * message if the file could not be written.
+ */
+static int lui_tablemodel_save(lua_State *L)
+{
+	lui_object *lobj = lui_checkTableModel(L, 1);
+	const char *filename = luaL_checkstring(L, 2);
+	int compress = lua_isnoneornil(L, 3) ? 1 : lua_toboolean(L, 3);
+	uiTableModel *tm = uiTableModel(lobj->object);
+	lua_settop(L, 3);
+
+	lui_tablesnapshot *snap = NULL;
+	if (lui_aux_getUservalue(L, 1, "snapshot") != LUA_TNIL) {
+		snap = (lui_tablesnapshot*)lui_toObject(L, -1)->object;
+	}
+	lua_pop(L, 1);
+
+	int numrows = 0, numcols = 0;
+	if (snap) {
+		numrows = snap->numrows;
+		numcols = snap->numcolumns;
+	} else {
+		if (lui_findhandler(L, tm, "numrows")) {
+			lua_call(L, 0, 1);
+			numrows = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+		}
+		if (lui_findhandler(L, tm, "numcolumns")) {
+			lua_call(L, 0, 1);
+			numcols = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+		}
+	}
+	if (numrows < 0 || numcols < 0) {
+		return luaL_error(L, "invalid table model size");
+	}
+
+	lui_snapshotWriter *w = (lui_snapshotWriter*)lua_newuserdata(L, sizeof(lui_snapshotWriter));
+	memset(w, 0, sizeof(lui_snapshotWriter));
+	luaL_setmetatable(L, LUI_SNAPSHOTWRITER);
+
+	/* collect the data, one buffer per column */
+	luaL_checkstack(L, numcols + 2, "too many columns");
+	lui_TableValueType *types = (lui_TableValueType*)lua_newuserdata(L, (numcols + 1) * sizeof(lui_TableValueType));
+	int bufpos = lua_gettop(L) + 1;
+	for (int col = 0; col < numcols; ++col) {
+		types[col] = snap ? snap->columns[col].type : lui_tablemodel_rawcolumntype(L, tm, col);
+		if (types[col] == lui_TableValueTypeNull) {
+			types[col] = lui_TableValueTypeString;
+		}
+		if (types[col] == lui_TableValueTypeImage) {
+			return luaL_error(L, "image columns can not be saved (column %d)", col);
+		}
+		size_t vsize = lui_snapshotValueSize(types[col]);
+		unsigned char *values = (unsigned char*)lua_newuserdata(L, (size_t)numrows * vsize + 1);
+		if (snap) {
+			for (int row = 0; row < numrows; ++row) {
+				lui_snapshotwriter_fetchsnapshot(L, w, snap, row, col, values + row * vsize);
+			}
+		} else {
+			if (!lui_findhandler(L, tm, "cellvalue")) {
+				return luaL_error(L, "table model has no cellvalue handler");
+			}
+			for (int row = 0; row < numrows; ++row) {
+				lui_snapshotwriter_fetchlua(L, w, types[col], row, col, values + row * vsize);
+			}
+			lua_pop(L, 1);
+		}
+	}
+
+	/* now write the file, no more lua calls from here */
+	FILE *f = fopen(filename, "wb");
+	if (!f) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "could not open %s for writing", filename);
+		return 2;
+	}
+	lui_snapshotHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, LUI_SNAPSHOT_MAGIC, sizeof(LUI_SNAPSHOT_MAGIC));
+	hdr.version = LUI_SNAPSHOT_VERSION;
+	hdr.byteorder = LUI_SNAPSHOT_BYTEORDER;
+	hdr.numrows = numrows;
+	hdr.numcolumns = numcols;
+
+	lui_snapshotColumnHeader *chdr = (lui_snapshotColumnHeader*)lua_newuserdata(L, (numcols + 1) * sizeof(lui_snapshotColumnHeader));
+	memset(chdr, 0, (numcols + 1) * sizeof(lui_snapshotColumnHeader));
+	uint64_t offset = sizeof(hdr) + numcols * sizeof(lui_snapshotColumnHeader);
+	int ok = fseek(f, offset, SEEK_SET) == 0;
+	for (int col = 0; ok && col < numcols; ++col) {
+		const unsigned char *values = (const unsigned char*)lua_touserdata(L, bufpos + col);
+		size_t vsize = lui_snapshotValueSize(types[col]);
+		uint64_t rawsize = lui_snapshotAlign((uint64_t)numrows * vsize);
+		chdr[col].type = types[col];
+		chdr[col].offset = offset;
+		uint64_t numruns = compress ? lui_snapshotCountRuns(values, numrows, vsize) : 0;
+		uint64_t rlesize = (numruns + 1) * sizeof(uint64_t) + lui_snapshotAlign(numruns * vsize);
+		if (compress && rlesize < rawsize) {
+			chdr[col].encoding = lui_SnapshotEncodingRle;
+			chdr[col].size = rlesize;
+			ok = lui_snapshotWriteRle(f, values, numrows, vsize, numruns);
+		} else {
+			chdr[col].encoding = lui_SnapshotEncodingRaw;
+			chdr[col].size = rawsize;
+			ok = lui_snapshotWritePadded(f, values, (size_t)numrows * vsize);
+		}
+		offset += chdr[col].size;
+	}
+	if (ok) {
+		uint64_t numstrings = w->numstrings;
+		uint64_t nooffset = 0;
+		hdr.dictoffset = offset;
+		hdr.dictsize = (numstrings + 2) * sizeof(uint64_t) + lui_snapshotAlign(w->numbytes);
+		ok = fwrite(&numstrings, sizeof(uint64_t), 1, f) == 1 &&
+			(numstrings > 0 ? fwrite(w->offsets, sizeof(uint64_t), numstrings + 1, f) == numstrings + 1 : fwrite(&nooffset, sizeof(uint64_t), 1, f) == 1) &&
+			lui_snapshotWritePadded(f, w->bytes, w->numbytes);
+	}
+	if (ok) {
+		ok = fseek(f, 0, SEEK_SET) == 0 &&
+			fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+			(numcols == 0 || fwrite(chdr, sizeof(lui_snapshotColumnHeader), numcols, f) == (size_t)numcols);
+	}
+	ok = (fclose(f) == 0) && ok;
+	lui_snapshotwriter_free(w);
+
+	if (!ok) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "error writing %s", filename);
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*** Constructor
+ * Object: tablemodel
+ * Name: loadmodel
+ * Signature: mdl = lui.loadmodel(filename)
+ * create a new, read only table model from a snapshot file written by
+ * tablemodel:save(). The file is mapped into memory and the cells are read
+ * from there when the table asks for them, so even huge snapshots are
+ * usable right away. Returns the model, or nil and an error message if the
+ * file could not be loaded.
+ */
+static int lui_loadTableModel(lua_State *L)
+{
+	const char *filename = luaL_checkstring(L, 1);
+
+	lui_object *sobj = (lui_object*)lua_newuserdata(L, sizeof(lui_object));
+	sobj->object = 0;
+	luaL_setmetatable(L, LUI_TABLESNAPSHOT);
+	int spos = lua_gettop(L);
+
+	lui_tablesnapshot *snap = calloc(1, sizeof(lui_tablesnapshot));
+	if (!snap) {
+		return luaL_error(L, "out of memory!");
+	}
+	sobj->object = snap;
+	if (!lui_tablesnapshot_map(snap, filename)) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "could not open %s", filename);
+		return 2;
+	}
+	const char *err = lui_tablesnapshot_setup(snap);
+	if (err) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", filename, err);
+		return 2;
+	}
+	snap->handler.NumColumns = lui_tablesnapshot_numcolumns;
+	snap->handler.ColumnType = lui_tablesnapshot_columntype;
+	snap->handler.NumRows = lui_tablesnapshot_numrows;
+	snap->handler.CellValue = lui_tablesnapshot_cellvalue;
+	snap->handler.SetCellValue = lui_tablesnapshot_setcellvalue;
+
+	lui_object *lobj = lui_pushTableModel(L);
+	lobj->object = uiNewTableModel(&snap->handler);
+	lui_aux_setUservalue(L, -1, "snapshot", spos);
+	lui_registerTableModel(L, lua_gettop(L));
+
+	return 1;
+}
+
+/*** Method
+ * Object: tablemodel
+ * Name: setimagesource
+ * Signature: mdl:setimagesource(src)
+ * set the imagesource for a tablemodel. With an image source set, the
+ * cellvalue handler may return file names for image columns, the images
+ * are then loaded in the background and provided by the image source. src
+ * may be nil to remove the image source.
+ */
+static int lui_tablemodel_setimagesource(lua_State *L)
+{
+	lui_checkTableModel(L, 1);
+	if (lua_isnoneornil(L, 2)) {
+		lui_aux_clearUservalue(L, 1, "imagesource");
+	} else {
+		lui_checkImageSource(L, 2);
+		lui_aux_setUservalue(L, 1, "imagesource", 2);
+	}
+	return 0;
+}
+
+/* methods for tablemodel */
+static const luaL_Reg lui_tablemodel_methods[] = {
+	{"row_inserted", lui_tablemodel_row_inserted},
+	{"row_changed", lui_tablemodel_row_changed},
+	{"row_deleted", lui_tablemodel_row_deleted},
+	{"save", lui_tablemodel_save},
+	{"setimagesource", lui_tablemodel_setimagesource},
+	{0, 0}
+};
+
 /* uiTable ******************************************************************/
 
 /*** Object
@@ -633,6 +1423,7 @@ static const struct luaL_Reg lui_table_funcs [] ={
 	/* utility constructors */
 	{"tablemodel", lui_newTableModel},
 	{"table", lui_newTable},
+	{"loadmodel", lui_loadTableModel},
 	{0, 0}
 };
 
@@ -641,6 +1432,12 @@ static int lui_init_table(lua_State *L)
 	luaL_setfuncs(L, lui_table_funcs, 0);
 
 	lui_add_utility_type(L, LUI_TABLEMODEL, lui_tablemodel_methods, lui_tablemodel_meta);
+	lui_add_utility_type(L, LUI_TABLESNAPSHOT, 0, lui_tablesnapshot_meta);
+
+	luaL_newmetatable(L, LUI_SNAPSHOTWRITER);
+	lua_pushcfunction(L, lui_snapshotwriter__gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
 	lui_add_control_type(L, LUI_TABLE, lui_table_methods, NULL);
 
 	/* create tablemodel registry */
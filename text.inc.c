@@ -434,19 +434,21 @@ static int lui_attributedStringSetAttributesFromTable(lua_State *L)
 			attr = uiNewStretchAttribute(value);
 		} else if (strcmp(key, "color") == 0) {
 			double r, g, b, a;
-			lui_aux_rgbaFromTable(L, -1, &r, &g, &b, &a);
+			lui_aux_rgbaFromValue(L, -1, &r, &g, &b, &a);
 			attr = uiNewColorAttribute(r, g, b, a);
 		} else if (strcmp(key, "bgcolor") == 0) {
 			double r, g, b, a;
-			lui_aux_rgbaFromTable(L, -1, &r, &g, &b, &a);
+			lui_aux_rgbaFromValue(L, -1, &r, &g, &b, &a);
 			attr = uiNewBackgroundAttribute(r, g, b, a);
 		} else if (strcmp(key, "underline") == 0) {
 			int value = lui_aux_getNumberOrValue(L, -1, "lui_enumtextunderline");
 			attr = uiNewUnderlineAttribute(value);
 		} else if (strcmp(key, "ulcolor") == 0) {
-			if (lua_type(L, -1) == LUA_TTABLE) {
+			/* small integers are enum values, larger ones packed colors */
+			int type = lua_type(L, -1);
+			if (type == LUA_TTABLE || (type == LUA_TSTRING && *lua_tostring(L, -1) == '#') || (lua_isinteger(L, -1) && lua_tointeger(L, -1) > uiUnderlineColorAuxiliary)) {
 				double r, g, b, a;
-				lui_aux_rgbaFromTable(L, -1, &r, &g, &b, &a);
+				lui_aux_rgbaFromValue(L, -1, &r, &g, &b, &a);
 				attr = uiNewUnderlineColorAttribute(uiUnderlineColorCustom, r, g, b, a);
 			} else {
 				int value = lui_aux_getNumberOrValue(L, -1, "lui_enumtextulcolor");
@@ -512,12 +514,14 @@ static int lui_attributedStringSetAttributesFromFont(lua_State *L)
  *   "expanded", "extraexpanded", "ultraexpanded", or
  *   lui.enum.stretch.ultracondensed, ...
  * - color: foreground color, a table { r = red, g = green, b = blue,
- *   a = alpha }, where the values range from 0.0 to 1.0
+ *   a = alpha }, where the values range from 0.0 to 1.0, or a packed integer
+ *   0xRRGGBBAA, or a string "#rrggbb" or "#rrggbbaa".
  * - bgcolor: background color, value as for color.
  * - underline: underline style, any of he strings "none", "single", "double",
  *   "suggestion", 
  * - ulcolor: underline color, any of the strings "spelling", "grammar",
- *   "auxiliary", or a rgba table as for color.
+ *   "auxiliary", or a color value as for color. Integers up to
+ *   lui.text.enum.ulcolor.auxiliary are taken as enum values.
  */
 static int lui_attributedStringSetAttributes(lua_State *L)
 {
@@ -558,7 +562,7 @@ static int lui_pushAttributeNameAndValue(lua_State *L, uiAttribute *attr)
 				double r, g, b, a;
 				lua_pushstring(L, "color");
 				uiAttributeColor(attr, &r, &g, &b, &a);
-				lui_aux_pushRgbaAsTable(L, r, g, b, a);
+				lui_aux_pushRgba(L, r, g, b, a);
 			}
 			break;
 		case uiAttributeTypeBackground:
@@ -566,7 +570,7 @@ static int lui_pushAttributeNameAndValue(lua_State *L, uiAttribute *attr)
 				double r, g, b, a;
 				lua_pushstring(L, "bgcolor");
 				uiAttributeColor(attr, &r, &g, &b, &a);
-				lui_aux_pushRgbaAsTable(L, r, g, b, a);
+				lui_aux_pushRgba(L, r, g, b, a);
 			}
 			break;
 		case uiAttributeTypeUnderline:
@@ -582,7 +586,7 @@ static int lui_pushAttributeNameAndValue(lua_State *L, uiAttribute *attr)
 				if (u != uiUnderlineColorCustom) {
 					lui_aux_pushNameOrValue(L, u, "lui_enumtextulcolor");
 				} else {
-					lui_aux_pushRgbaAsTable(L, r, g, b, a);
+					lui_aux_pushRgba(L, r, g, b, a);
 				}
 			}
 			break;
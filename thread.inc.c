@@ -0,0 +1,338 @@
+/* lui.c
+ *
+ * lua binding to libui (https://github.com/andlabs/libui)
+ *
+ * Gunnar Zötl <gz@tset.de>, 2016
+ * Released under MIT/X11 license. See file LICENSE for details.
+ *
+ * This file is included by lui.c
+ */
+
+/* threads  ****************************************************************/
+
+/* minimal portable wrappers for the few threading primitives lui needs. */
+#ifdef _WIN32
+
+typedef CRITICAL_SECTION lui_mutex;
+typedef CONDITION_VARIABLE lui_cond;
+typedef HANDLE lui_thread;
+
+#define lui_mutexInit(m) InitializeCriticalSection(m)
+#define lui_mutexDestroy(m) DeleteCriticalSection(m)
+#define lui_mutexLock(m) EnterCriticalSection(m)
+#define lui_mutexUnlock(m) LeaveCriticalSection(m)
+#define lui_condInit(c) InitializeConditionVariable(c)
+#define lui_condDestroy(c) ((void)(c))
+#define lui_condWait(c, m) SleepConditionVariableCS((c), (m), INFINITE)
+#define lui_condSignal(c) WakeConditionVariable(c)
+#define lui_condBroadcast(c) WakeAllConditionVariable(c)
+
+typedef struct {
+	void (*func)(void*);
+	void *arg;
+} lui_threadStart;
+
+static DWORD WINAPI lui_threadTrampoline(LPVOID data)
+{
+	lui_threadStart start = *(lui_threadStart*)data;
+	free(data);
+	start.func(start.arg);
+	return 0;
+}
+
+static int lui_threadCreate(lui_thread *t, void (*func)(void*), void *arg)
+{
+	lui_threadStart *start = malloc(sizeof(lui_threadStart));
+	if (!start) {
+		return 0;
+	}
+	start->func = func;
+	start->arg = arg;
+	*t = CreateThread(NULL, 0, lui_threadTrampoline, start, 0, NULL);
+	if (!*t) {
+		free(start);
+		return 0;
+	}
+	return 1;
+}
+
+static void lui_threadJoin(lui_thread t)
+{
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+}
+
+static int lui_numCpus(void)
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+typedef pthread_mutex_t lui_mutex;
+typedef pthread_cond_t lui_cond;
+typedef pthread_t lui_thread;
+
+#define lui_mutexInit(m) pthread_mutex_init((m), NULL)
+#define lui_mutexDestroy(m) pthread_mutex_destroy(m)
+#define lui_mutexLock(m) pthread_mutex_lock(m)
+#define lui_mutexUnlock(m) pthread_mutex_unlock(m)
+#define lui_condInit(c) pthread_cond_init((c), NULL)
+#define lui_condDestroy(c) pthread_cond_destroy(c)
+#define lui_condWait(c, m) pthread_cond_wait((c), (m))
+#define lui_condSignal(c) pthread_cond_signal(c)
+#define lui_condBroadcast(c) pthread_cond_broadcast(c)
+
+typedef struct {
+	void (*func)(void*);
+	void *arg;
+} lui_threadStart;
+
+static void *lui_threadTrampoline(void *data)
+{
+	lui_threadStart start = *(lui_threadStart*)data;
+	free(data);
+	start.func(start.arg);
+	return NULL;
+}
+
+static int lui_threadCreate(lui_thread *t, void (*func)(void*), void *arg)
+{
+	lui_threadStart *start = malloc(sizeof(lui_threadStart));
+	if (!start) {
+		return 0;
+	}
+	start->func = func;
+	start->arg = arg;
+	if (pthread_create(t, NULL, lui_threadTrampoline, start) != 0) {
+		free(start);
+		return 0;
+	}
+	return 1;
+}
+
+static void lui_threadJoin(lui_thread t)
+{
+	pthread_join(t, NULL);
+}
+
+static int lui_numCpus(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+#endif
+
+/* worker pools  ***********************************************************/
+
+/* A pool runs jobs on a fixed number of worker threads. A job is a struct
+ * that has a lui_poolJob as its first member. run() is called on a worker
+ * thread, with the data threadinit() returned for that thread. When run()
+ * has returned, done() is called on the ui thread. Finished jobs are
+ * collected and handed to the ui thread in batches, with only one
+ * uiQueueMain() call outstanding at any time. If done() raises a lua error,
+ * the rest of its batch is delivered with the next one.
+ */
+typedef struct lui_poolJob {
+	void (*run)(struct lui_poolJob *job, void *threaddata);
+	void (*done)(struct lui_poolJob *job);
+	struct lui_poolJob *next;
+} lui_poolJob;
+
+typedef struct {
+	lui_mutex lock;
+	lui_cond wake;
+	lui_poolJob *head, *tail;
+	lui_poolJob *donehead, *donetail;
+	lui_poolJob *batchhead, *batchtail;	/* being delivered, ui thread only */
+	int delivering;
+	int stopping;
+	int numthreads;
+	lui_thread *threads;
+	void *(*threadinit)(void);
+	void (*threadexit)(void *threaddata);
+} lui_pool;
+
+static void lui_poolDeliver(void *data);
+
+/* make sure a delivery is queued. The pool must be locked. */
+static void lui_poolQueueDelivery(lui_pool *pool)
+{
+	if (!pool->delivering && !pool->stopping) {
+		pool->delivering = 1;
+		uiQueueMain(lui_poolDeliver, pool);
+	}
+}
+
+/* call done() for the finished jobs. Jobs left over from a batch where
+ * done() raised an error are delivered first. */
+static void lui_poolDeliver(void *data)
+{
+	lui_pool *pool = (lui_pool*) data;
+	lui_mutexLock(&pool->lock);
+	if (pool->donehead) {
+		if (pool->batchtail) {
+			pool->batchtail->next = pool->donehead;
+		} else {
+			pool->batchhead = pool->donehead;
+		}
+		pool->batchtail = pool->donetail;
+	}
+	pool->donehead = pool->donetail = NULL;
+	pool->delivering = 0;
+	lui_mutexUnlock(&pool->lock);
+	lui_poolJob *job;
+	while ((job = pool->batchhead)) {
+		pool->batchhead = job->next;
+		if (!pool->batchhead) {
+			pool->batchtail = NULL;
+		} else {
+			/* queue the next delivery first, so that the rest of the batch
+			 * is not lost if done() raises an error */
+			lui_mutexLock(&pool->lock);
+			lui_poolQueueDelivery(pool);
+			lui_mutexUnlock(&pool->lock);
+		}
+		job->done(job);
+	}
+}
+
+static void lui_poolWorker(void *data)
+{
+	lui_pool *pool = (lui_pool*) data;
+	void *threaddata = pool->threadinit ? pool->threadinit() : NULL;
+	lui_mutexLock(&pool->lock);
+	for (;;) {
+		while (!pool->head && !pool->stopping) {
+			lui_condWait(&pool->wake, &pool->lock);
+		}
+		if (pool->stopping) {
+			break;
+		}
+		lui_poolJob *job = pool->head;
+		pool->head = job->next;
+		if (!pool->head) {
+			pool->tail = NULL;
+		}
+		lui_mutexUnlock(&pool->lock);
+
+		job->run(job, threaddata);
+
+		lui_mutexLock(&pool->lock);
+		job->next = NULL;
+		if (pool->donetail) {
+			pool->donetail->next = job;
+		} else {
+			pool->donehead = job;
+		}
+		pool->donetail = job;
+		lui_poolQueueDelivery(pool);
+	}
+	lui_mutexUnlock(&pool->lock);
+	if (pool->threadexit) {
+		pool->threadexit(threaddata);
+	}
+}
+
+/* lui_poolNew
+ *
+ * create a pool with numthreads worker threads, or one per cpu if
+ * numthreads is <= 0. threadinit and threadexit may be NULL.
+ */
+static lui_pool *lui_poolNew(int numthreads, void *(*threadinit)(void), void (*threadexit)(void*))
+{
+	if (numthreads <= 0) {
+		numthreads = lui_numCpus();
+	}
+	lui_pool *pool = calloc(1, sizeof(lui_pool));
+	if (!pool) {
+		return NULL;
+	}
+	pool->threads = calloc(numthreads, sizeof(lui_thread));
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+	lui_mutexInit(&pool->lock);
+	lui_condInit(&pool->wake);
+	pool->threadinit = threadinit;
+	pool->threadexit = threadexit;
+	for (int i = 0; i < numthreads; ++i) {
+		if (!lui_threadCreate(&pool->threads[i], lui_poolWorker, pool)) {
+			break;
+		}
+		pool->numthreads += 1;
+	}
+	return pool;
+}
+
+/* lui_poolSubmit
+ *
+ * queue a job. If urgent is true, the job is put in front of all other
+ * queued jobs, which is useful when the most recent request is the most
+ * relevant one.
+ */
+static void lui_poolSubmit(lui_pool *pool, lui_poolJob *job, int urgent)
+{
+	lui_mutexLock(&pool->lock);
+	if (urgent) {
+		job->next = pool->head;
+		pool->head = job;
+		if (!pool->tail) {
+			pool->tail = job;
+		}
+	} else {
+		job->next = NULL;
+		if (pool->tail) {
+			pool->tail->next = job;
+		} else {
+			pool->head = job;
+		}
+		pool->tail = job;
+	}
+	lui_condSignal(&pool->wake);
+	lui_mutexUnlock(&pool->lock);
+}
+
+/* lui_poolFree
+ *
+ * stop and join all worker threads. Jobs that have not been started yet
+ * are not run, but like all other finished jobs get their done() called
+ * before this returns, so done() must cope with a job that was never run.
+ */
+static void lui_poolFree(lui_pool *pool)
+{
+	if (!pool) {
+		return;
+	}
+	lui_mutexLock(&pool->lock);
+	pool->stopping = 1;
+	if (pool->head) {
+		if (pool->donetail) {
+			pool->donetail->next = pool->head;
+		} else {
+			pool->donehead = pool->head;
+		}
+		pool->donetail = pool->tail;
+		pool->head = pool->tail = NULL;
+	}
+	int delivering = pool->delivering;
+	lui_condBroadcast(&pool->wake);
+	lui_mutexUnlock(&pool->lock);
+	for (int i = 0; i < pool->numthreads; ++i) {
+		lui_threadJoin(pool->threads[i]);
+	}
+	lui_poolDeliver(pool);
+	/* a queued delivery can not be taken back, so in that case the pool
+	 * must stay around for it to run on. */
+	if (delivering) {
+		return;
+	}
+	lui_condDestroy(&pool->wake);
+	lui_mutexDestroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
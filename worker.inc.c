@@ -0,0 +1,540 @@
+/* lui.c
+ *
+ * lua binding to libui (https://github.com/andlabs/libui)
+ *
+ * Gunnar Zötl <gz@tset.de>, 2016
+ * Released under MIT/X11 license. See file LICENSE for details.
+ *
+ * This file is included by lui.c
+ */
+
+/* workers  ****************************************************************/
+
+/* Jobs are run on a pool of worker threads, each of which has its own lua
+ * state that lives as long as the thread, so modules a job requires are
+ * loaded only once per thread. Arguments and results are copied between
+ * the states with lui_pack() and lui_unpack().
+ */
+#define LUI_FUTURE "lui_future"
+#define LUI_WORKER_REGISTRY "lui_workers"
+#define lui_pushFuture(L) ((lui_futureObject*)lui_pushObjectSized(L, LUI_FUTURE, 1, sizeof(lui_futureObject)))
+#define lui_checkFuture(L, pos) ((lui_futureObject*)luaL_checkudata(L, pos, LUI_FUTURE))
+
+enum {
+	LUI_WORKER_MODULE,
+	LUI_WORKER_SOURCE,
+	LUI_WORKER_BINARY
+};
+
+typedef struct {
+	void *object;
+	int done;
+	int ok;
+} lui_futureObject;
+
+typedef struct {
+	lui_poolJob job;
+	lui_futureObject *future;
+	int kind;
+	char *code;
+	size_t codelen;
+	char *args;
+	size_t argslen;
+	char *result;			/* packed results, or the error message */
+	size_t resultlen;
+	int ran;
+	int ok;
+} lui_workerJob;
+
+static struct {
+	lui_pool *pool;
+	lua_State *L;			/* the ui state, NULL when lui is shutting down */
+	char *path, *cpath;		/* package.path and package.cpath for workers */
+} lui_workers;
+
+static int lui_worker_preloadPost(lua_State *L)
+{
+	return luaopen_lui_post(L);
+}
+
+/* create the lua state for a worker thread */
+static void *lui_worker_threadinit(void)
+{
+	lua_State *L = luaL_newstate();
+	if (!L) {
+		return NULL;
+	}
+	luaL_openlibs(L);
+	lua_getglobal(L, "package");
+	if (lui_workers.path) {
+		lua_pushstring(L, lui_workers.path);
+		lua_setfield(L, -2, "path");
+	}
+	if (lui_workers.cpath) {
+		lua_pushstring(L, lui_workers.cpath);
+		lua_setfield(L, -2, "cpath");
+	}
+	lua_getfield(L, -1, "preload");
+	lua_pushcfunction(L, lui_worker_preloadPost);
+	lua_setfield(L, -2, "lui.post");
+	lua_pop(L, 2);
+	return L;
+}
+
+static void lui_worker_threadexit(void *data)
+{
+	if (data) {
+		lua_close((lua_State*) data);
+	}
+}
+
+/* runs protected on the worker state, with the job as a light userdata */
+static int lui_worker_call(lua_State *L)
+{
+	lui_workerJob *job = (lui_workerJob*) lua_touserdata(L, 1);
+	lua_settop(L, 0);
+	if (job->kind == LUI_WORKER_MODULE) {
+		lua_getglobal(L, "require");
+		lua_pushlstring(L, job->code, job->codelen);
+		lua_call(L, 1, 1);
+		if (!lui_aux_iscallable(L, -1)) {
+			return luaL_error(L, "module '%s' did not return a function!", job->code);
+		}
+	} else if (luaL_loadbufferx(L, job->code, job->codelen, "=worker", job->kind == LUI_WORKER_BINARY ? "b" : "t") != LUA_OK) {
+		return lua_error(L);
+	}
+	lui_unpack(L, job->args, job->argslen);
+	lua_call(L, 1, LUA_MULTRET);
+
+	/* pack all results as an array with a field n */
+	int nres = lua_gettop(L);
+	lua_createtable(L, nres, 1);
+	lua_insert(L, 1);
+	for (int i = nres; i > 0; --i) {
+		lua_rawseti(L, 1, i);
+	}
+	lua_pushinteger(L, nres);
+	lua_setfield(L, 1, "n");
+	job->result = lui_pack(L, 1, 0, &job->resultlen);
+	return 0;
+}
+
+static void lui_worker_run(lui_poolJob *pjob, void *data)
+{
+	lui_workerJob *job = (lui_workerJob*) pjob;
+	lua_State *L = (lua_State*) data;
+	job->ran = 1;
+	if (!L) {
+		return;
+	}
+	lua_pushcfunction(L, lui_worker_call);
+	lua_pushlightuserdata(L, job);
+	if (lua_pcall(L, 1, 0, 0) == LUA_OK) {
+		job->ok = 1;
+	} else {
+		size_t len;
+		const char *msg = lua_tolstring(L, -1, &len);
+		if (!msg) {
+			msg = "error object is not a string";
+			len = strlen(msg);
+		}
+		job->result = malloc(len);
+		if (job->result) {
+			memcpy(job->result, msg, len);
+			job->resultlen = len;
+		}
+	}
+	lua_settop(L, 0);
+	lua_gc(L, LUA_GCSTEP, 0);
+}
+
+static void lui_worker_free(lui_workerJob *job)
+{
+	free(job->code);
+	free(job->args);
+	free(job->result);
+	free(job);
+}
+
+static void lui_worker_done(lui_poolJob *pjob)
+{
+	lui_workerJob *job = (lui_workerJob*) pjob;
+	lua_State *L = lui_workers.L;
+	if (!L) {
+		lui_worker_free(job);
+		return;
+	}
+	int top = lua_gettop(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_WORKER_REGISTRY);
+	lua_pushlightuserdata(L, job->future);
+	lua_rawget(L, -2);
+	lua_pushlightuserdata(L, job->future);
+	lua_pushnil(L);
+	lua_rawset(L, -4);
+	int fpos = lua_gettop(L);
+
+	lui_futureObject *f = job->future;
+	f->done = 1;
+	f->ok = job->ran && job->ok && job->result;
+	if (f->ok) {
+		lui_unpack(L, job->result, job->resultlen);
+		lui_aux_setUservalue(L, fpos, "results", lua_gettop(L));
+	} else {
+		if (!job->ran) {
+			lua_pushstring(L, "job was cancelled");
+		} else if (job->result) {
+			lua_pushlstring(L, job->result, job->resultlen);
+		} else {
+			lua_pushstring(L, "out of memory");
+		}
+		lui_aux_setUservalue(L, fpos, "error", lua_gettop(L));
+	}
+	lui_worker_free(job);
+	lua_settop(L, fpos);
+
+	/* wake the async functions waiting in lui.await(), from the idle queue
+	 * like any other yield, so that an error in ondone can not lose them */
+	if (lui_aux_getUservalue(L, fpos, "waiters") == LUA_TTABLE) {
+		lui_aux_clearUservalue(L, fpos, "waiters");
+		int n = lua_rawlen(L, -1);
+		for (int i = 1; i <= n; ++i) {
+			lua_rawgeti(L, -1, i);
+			lui_idle_push(L, -1, 0);
+			lua_pop(L, 1);
+		}
+	}
+	lua_settop(L, fpos);
+
+	lui_objectHandlerCallback(L, (uiControl*) f->object, "ondone", fpos + 1, 0, 0);
+	lua_settop(L, top);
+}
+
+/*** Object
+ * Name: future
+ * the pending result of a job started with lui.worker.spawn(). While the
+ * job runs, the future is kept alive by lui, so it need not be referenced
+ * for its ondone handler to be called.
+ */
+
+static int lui_future__gc(lua_State *L)
+{
+	lui_futureObject *f = lui_checkFuture(L, 1);
+	if (f->object) {
+		DEBUGMSG("lui_future__gc (%s)", lui_debug_controlTostring(L, 1));
+		f->object = 0;
+	}
+	return 0;
+}
+
+/*** Property
+ * Object: future
+ * Name: done
+ * true if the job has finished, successfully or not. Read only.
+ *** Property
+ * Object: future
+ * Name: ok
+ * true if the job has finished successfully, false if it failed, nil if
+ * it has not finished yet. Read only.
+ *** Property
+ * Object: future
+ * Name: error
+ * the error message if the job failed, else nil. Read only.
+ *** Property
+ * Object: future
+ * Name: ondone
+ * a function <code>ondone(future)</code> that is called on the ui thread
+ * when the job has finished. If the job has already finished when this is
+ * set, the function is called right away.
+ */
+static int lui_future__index(lua_State *L)
+{
+	lui_futureObject *f = lui_checkFuture(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "done") == 0) {
+		lua_pushboolean(L, f->done);
+	} else if (strcmp(what, "ok") == 0) {
+		if (f->done) {
+			lua_pushboolean(L, f->ok);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strcmp(what, "error") == 0) {
+		lui_aux_getUservalue(L, 1, "error");
+	} else if (strcmp(what, "ondone") == 0) {
+		lui_objectGetHandler(L, "ondone");
+	} else {
+		return lui_utility__index(L);
+	}
+	return 1;
+}
+
+static int lui_future__newindex(lua_State *L)
+{
+	lui_futureObject *f = lui_checkFuture(L, 1);
+	const char *what = luaL_checkstring(L, 2);
+
+	if (strcmp(what, "ondone") == 0) {
+		lui_objectSetHandler(L, "ondone", 3);
+		if (f->done) {
+			lua_settop(L, 1);
+			lui_objectHandlerCallback(L, (uiControl*) f->object, "ondone", 2, 0, 0);
+		}
+	} else {
+		return lui_utility__newindex(L);
+	}
+	return 0;
+}
+
+/*** Method
+ * Object: future
+ * Name: result
+ * Signature: ... = future:result()
+ * returns the values the job returned. Raises an error if the job failed
+ * or has not finished yet.
+ */
+static int lui_futureResult(lua_State *L)
+{
+	lui_futureObject *f = lui_checkFuture(L, 1);
+	if (!f->done) {
+		return luaL_error(L, "job has not finished yet!");
+	}
+	if (!f->ok) {
+		lui_aux_getUservalue(L, 1, "error");
+		return lua_error(L);
+	}
+	lua_settop(L, 1);
+	lui_aux_getUservalue(L, 1, "results");
+	lua_getfield(L, 2, "n");
+	int n = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	luaL_checkstack(L, n, "too many results");
+	for (int i = 1; i <= n; ++i) {
+		lua_rawgeti(L, 2, i);
+	}
+	return n;
+}
+
+/* continuation of lui.await(), ctx is the stack position of the future,
+ * which is kept in the frame while waiting */
+static int lui_future_awaitDone(lua_State *L, int status, lua_KContext ctx)
+{
+	lua_settop(L, (int) ctx);
+	return lui_futureResult(L);
+}
+
+/*** Function
+ * Name: await
+ * Signature: ... = lui.await(future)
+ * suspend the calling async function until the job of future has finished,
+ * while the main loop keeps running, then return the values the job
+ * returned, or raise its error. May only be called from functions run by
+ * lui.async(), unless the job has already finished.
+ */
+static int lui_asyncAwait(lua_State *L)
+{
+	lui_futureObject *f = lui_checkFuture(L, 1);
+	lua_settop(L, 1);
+	if (f->done) {
+		return lui_futureResult(L);
+	}
+	if (!lui_async_isAsync(L)) {
+		return luaL_error(L, "lui.await can only be called from async functions!");
+	}
+	if (lui_aux_getUservalue(L, 1, "waiters") != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lui_aux_setUservalue(L, 1, "waiters", 2);
+	}
+	lui_async_pushWake(L, L);
+	lua_rawseti(L, 2, lua_rawlen(L, 2) + 1);
+	lua_settop(L, 1);
+	lua_pushlightuserdata(L, &lui_asyncWaiting);
+	return lua_yieldk(L, 1, 1, lui_future_awaitDone);
+}
+
+/* remember package.path and package.cpath of the ui state for workers */
+static void lui_worker_copyPaths(lua_State *L)
+{
+	lua_getglobal(L, "package");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, "path");
+		lua_getfield(L, -2, "cpath");
+		if (lua_isstring(L, -2)) {
+			lui_workers.path = strdup(lua_tostring(L, -2));
+		}
+		if (lua_isstring(L, -1)) {
+			lui_workers.cpath = strdup(lua_tostring(L, -1));
+		}
+		lua_pop(L, 2);
+	}
+	lua_pop(L, 1);
+}
+
+static int lui_worker_dumpWriter(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	luaL_addlstring((luaL_Buffer*) ud, (const char*) p, sz);
+	return 0;
+}
+
+/* runs protected, with the arguments for the job and the job */
+static int lui_worker_packArgs(lua_State *L)
+{
+	lui_workerJob *job = (lui_workerJob*) lua_touserdata(L, 2);
+	job->args = lui_pack(L, 1, 0, &job->argslen);
+	return 0;
+}
+
+/*** Function
+ * Name: worker.spawn
+ * Signature: future = lui.worker.spawn(job, args = nil, ondone = nil)
+ * run job on a worker thread. There is one worker thread per cpu, each
+ * with its own lua state, in which job is called with args. job may be
+ * the name of a module that returns a function, the source of a lua chunk,
+ * or a lua function without upvalues. args and the values the job returns
+ * are copied between the states, so they may only be nil, booleans,
+ * numbers, strings and tables of those. The worker states have the
+ * standard libraries and the module "lui.post", so jobs can report
+ * progress with lui.post(). Returns a future, with ondone set to the
+ * ondone argument.
+ */
+static int lui_workerSpawn(lua_State *L)
+{
+	int kind;
+	size_t len;
+	const char *code;
+	luaL_Buffer b;
+	lua_settop(L, 3);
+	if (lua_type(L, 1) == LUA_TFUNCTION) {
+		luaL_argcheck(L, !lua_iscfunction(L, 1), 1, "can not run C functions");
+		const char *name;
+		for (int i = 1; (name = lua_getupvalue(L, 1, i)) != NULL; ++i) {
+			lua_pop(L, 1);
+			luaL_argcheck(L, strcmp(name, "_ENV") == 0, 1, "function must not have upvalues");
+		}
+		lua_pushvalue(L, 1);
+		luaL_buffinit(L, &b);
+#if LUA_VERSION_NUM >= 503
+		int err = lua_dump(L, lui_worker_dumpWriter, &b, 0);
+#else
+		int err = lua_dump(L, lui_worker_dumpWriter, &b);
+#endif
+		if (err != 0) {
+			return luaL_error(L, "unable to dump function!");
+		}
+		luaL_pushresult(&b);
+		lua_replace(L, 1);
+		lua_settop(L, 3);
+		kind = LUI_WORKER_BINARY;
+	} else {
+		code = luaL_checkstring(L, 1);
+		kind = strspn(code, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.") == lua_rawlen(L, 1) ? LUI_WORKER_MODULE : LUI_WORKER_SOURCE;
+	}
+	code = lua_tolstring(L, 1, &len);
+	if (!lua_isnoneornil(L, 3)) {
+		luaL_argcheck(L, lui_aux_iscallable(L, 3), 3, "expected callable");
+	}
+
+	if (!lui_workers.pool) {
+		lui_worker_copyPaths(L);
+		lui_workers.pool = lui_poolNew(0, lui_worker_threadinit, lui_worker_threadexit);
+		if (lui_workers.pool && lui_workers.pool->numthreads == 0) {
+			lui_poolFree(lui_workers.pool);
+			lui_workers.pool = NULL;
+		}
+		if (!lui_workers.pool) {
+			return luaL_error(L, "could not start worker threads!");
+		}
+	}
+	lui_workers.L = lui_mainState(L);
+
+	lui_workerJob *job = calloc(1, sizeof(lui_workerJob));
+	if (!job) {
+		return luaL_error(L, "out of memory!");
+	}
+	job->code = malloc(len + 1);
+	if (!job->code) {
+		free(job);
+		return luaL_error(L, "out of memory!");
+	}
+	memcpy(job->code, code, len + 1);
+	job->codelen = len;
+	job->kind = kind;
+	lua_pushvalue(L, 2);
+	lua_pushcfunction(L, lui_worker_packArgs);
+	lua_insert(L, -2);
+	lua_pushlightuserdata(L, job);
+	if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+		free(job->code);
+		free(job);
+		return lua_error(L);
+	}
+
+	lui_futureObject *f = lui_pushFuture(L);
+	f->object = f;
+	job->future = f;
+	job->job.run = lui_worker_run;
+	job->job.done = lui_worker_done;
+	if (!lua_isnoneornil(L, 3)) {
+		lui_aux_setUservalue(L, -1, "ondone", 3);
+	}
+	lui_registerObject(L, lua_gettop(L));
+	lua_getfield(L, LUA_REGISTRYINDEX, LUI_WORKER_REGISTRY);
+	lua_pushlightuserdata(L, f);
+	lua_pushvalue(L, -3);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	lui_poolSubmit(lui_workers.pool, &job->job, 0);
+	return 1;
+}
+
+/* stop the worker threads, called when lui is shut down */
+static void lui_worker_close(void)
+{
+	lui_workers.L = NULL;
+	lui_poolFree(lui_workers.pool);
+	lui_workers.pool = NULL;
+	free(lui_workers.path);
+	free(lui_workers.cpath);
+	lui_workers.path = lui_workers.cpath = NULL;
+}
+
+/* metamethods for futures */
+static const luaL_Reg lui_future_meta[] = {
+	{"__gc", lui_future__gc},
+	{"__index", lui_future__index},
+	{"__newindex", lui_future__newindex},
+	{0, 0}
+};
+
+/* methods for futures */
+static const luaL_Reg lui_future_methods[] = {
+	{"result", lui_futureResult},
+	{0, 0}
+};
+
+static const struct luaL_Reg lui_worker_funcs [] ={
+	{"spawn", lui_workerSpawn},
+	{0, 0}
+};
+
+static const struct luaL_Reg lui_await_funcs [] ={
+	{"await", lui_asyncAwait},
+	{0, 0}
+};
+
+static int lui_init_worker(lua_State *L)
+{
+	lua_newtable(L);
+	luaL_setfuncs(L, lui_worker_funcs, 0);
+	lua_setfield(L, -2, "worker");
+	luaL_setfuncs(L, lui_await_funcs, 0);
+
+	lui_add_utility_type(L, LUI_FUTURE, lui_future_methods, lui_future_meta);
+
+	lua_newtable(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, LUI_WORKER_REGISTRY);
+
+	return 1;
+}